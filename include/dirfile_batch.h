@@ -0,0 +1,37 @@
+#ifndef DIRFILE_BATCH_H
+#define DIRFILE_BATCH_H
+
+//Reading many dirfile channels at once, with slim/zip decoding spread over threads.  These live
+//in getdata.c and dirfile.c here; libactpol's own getdata.h and dirfile.h don't have them.
+
+#include "actpol/dirfile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct FormatType;
+
+/***************************************************************************/
+/*                                                                         */
+/*  GetDataMany: GetData for nfield fields at once, decoding raw fields    */
+/*    in parallel.  num_frames, num_samp, data_out, n_read and error_codes */
+/*    are per-field arrays.  Returns the number of fields with errors.     */
+/*                                                                         */
+/***************************************************************************/
+int GetDataMany(const struct FormatType *F, const char **field_codes, int nfield,
+    int first_frame, int first_samp,
+    const int *num_frames, const int *num_samp,
+    char return_type, void **data_out,
+    int *n_read, int *error_codes);
+
+// Read nchan channels in one go through GetDataMany.  data[i] is malloced, or NULL with
+// nsamples_out[i]=0 if channel i couldn't be read.  Returns the number of channels that failed.
+int ACTpolDirfile_read_channels( char typechar, const ACTpolDirfile *dirfile,
+        const char **channelnames, int nchan, void **data, int *nsamples_out );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,6 +26,8 @@
 
 #define MB_NOISE_DEFAULT_NP_COMMON 2  ///< 
 #define MB_NOISE_DEFAULT_NP_POLY 3    ///< 
+#define MB_COMMON_TILE 64             ///< Samples per tile when computing the median common mode.
+#define MB_COMMON_NETWORK_MAX 64      ///< Use a sorting network for the median with up to this many detectors.
 
 /// Structure to hold common-mode info.
 
@@ -41,6 +43,7 @@ typedef struct {
   bool apply_common;      ///< Whether to apply the common-mode fit to TODs.
   bool common_is_applied; ///< Whether common-mode fit has been applied to the TOD.
   bool keep_vecs;         ///< Not currently useful.
+  bool approx_median;     ///< Use a one-pass approximate median for the common mode instead of the exact one.
 
   actData **vecs;         ///< Precomputed vectors of time and powers thereof for Common-mode fitting.
   bool have_vecs;         ///< Whether vecs are computed.
@@ -90,6 +93,7 @@ extern void sgemv_(const char *trans, const int *m, const int *n, const float *a
 mbNoiseCommonMode *mbAllocateCommonMode(const mbTOD *tod, int np_common, int np_poly);
 void mbCleanUpCommonMode(mbNoiseCommonMode *data);
 void mbCalculateCommonMode(mbNoiseCommonMode *fit);
+void mbCalculateCommonModeSlow(mbNoiseCommonMode *fit);
 void mbCalculateMeanCommonMode(mbNoiseCommonMode *fit, const mbTOD *tod, const mbCuts *cuts);
 int mbGetNoCutInds(const mbCuts *cuts, int ndata, int row, int col, int **istart_out, int **istop_out);
 void mbRescaleArray(const mbTOD *tod, mbNoiseCommonMode *fit);
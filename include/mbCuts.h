@@ -3,6 +3,7 @@
 
 #include <ps_stuff.h>
 #include <omp.h>
+#include <stdint.h>
 
 //#define HAVE_MBTOD
 
@@ -16,26 +17,25 @@
 /// single detectors or the entire array.
 
 
-/// Represents a single range of data indices to be cut.
-/// Stored as a linked list of cuts.
+/// A single range of data indices to be cut, both ends inclusive.
 
-typedef struct mbSingleCut {
-  struct mbSingleCut *next;///< Pointer to next mbCut in the list.
+typedef struct {
   int indexFirst;        ///< First index to be cut.
   int indexLast;         ///< Last index to be cut.
-} mbSingleCut;
-
+} mbCutRange;
 
 
-/// Represents a full set of cuts for a detector (or array), with 0 or more ranges of cut data.
-/// The cuts are stored as a linked list.  
-/// This object contains the head and length of the list.
-/// Having no cuts at all is represented by head==NULL.
+/// Cut ranges live in chunks of this many, handed out to detectors as they need room.
+/// A detector that outgrows its slot moves to fresh space; old space is only reclaimed
+/// when the whole mbCuts is freed, so readers never see memory disappear underneath them.
+#define MB_CUTS_CHUNK 65536
 
-typedef struct {
-  mbSingleCut *head;     ///< Pointer to linked list of cuts (or NULL if no cuts).
-  int ncuts;             ///< Number of cuts in the list.
-} mbCutList;
+typedef struct mbCutChunk {
+  struct mbCutChunk *next;
+  long used;
+  long size;
+  mbCutRange ranges[];
+} mbCutChunk;
 
 
 typedef struct
@@ -58,23 +58,29 @@ mbCutFitParams;
 /// Represents all cuts for a time-ordered-data set.
 /// All cuts includes both global and detector-specific cuts.
 /// To be useful, it should be associated with a TOD.
+/// Each detector's cuts are a sorted array of merged ranges, indexed by row*ncol+col,
+/// with the global cuts stored in slot nrow*ncol.  No ranges means never cut.
 
 typedef struct {
   int nrow;              ///< Number of detector rows.
   int ncol;              ///< Number of detector columns.
-  mbCutList ***detCuts;  ///< Ptr to 2D array of per-detector cutLists.
-  mbCutList *globalCuts; ///< The global cutList.
+  mbCutRange **ranges;   ///< ranges[slot] points into chunks; NULL if the slot has never been cut.
+  int *ncut;             ///< Number of ranges in use for each slot.
+  int *cap;              ///< Room for each slot before it has to move.
+  mbCutChunk *chunks;    ///< Storage for all the ranges, usually a single contiguous chunk.
+
+  uint64_t *bitmap;      ///< Optional cut bitmaps from mbCutsBuildBitmaps, bit set == sample cut.
+  int bitmap_ndata;      ///< Samples covered by each detector's bitmap.
+  int bitmap_nword;      ///< 64-bit words per detector in the bitmap.
 
   omp_lock_t cutlock;
 } mbCuts;
 
-
+#define MB_CUTS_GLOBAL_SLOT(cuts) ((cuts)->nrow*(cuts)->ncol)
 
 
 // Allocators and other setup methods (deallocators are private)
 // Note: perhaps we want these first two to be private?
-mbSingleCut *mbSingleCutAlloc(int first, int last);
-mbCutList *mbCutListAlloc();
 mbCuts *mbCutsAlloc(int nrow, int ncol);
 mbCuts *mbCutsAllocFromFile( const char *filename );
 mbCuts *mbCutsAllocFromCuts( const mbCuts **cutsList, int ncuts );
@@ -107,7 +113,24 @@ int mbCutsListAlwaysCut(const mbCuts *cuts, int **rowlist, int **collist);
 int mbCutsGoodSampleList(const mbCuts *cuts, char **goodlist, int row, int col, mbTOD *tod);
 #endif
 int mbCutsGetNCut(const mbCuts *cuts, int row, int col );
-mbCutList *mbGetCutList( mbCuts *cuts, int row, int col );
+int mbCutsGetRanges(const mbCuts *cuts, int row, int col, mbCutRange *out);
+
+// Set algebra on sorted range lists.  Nothing is allocated; out must have room for na+nb
+// ranges (na+1 for the inversion).  All return the number of ranges written.
+int mbCutRangesOr(const mbCutRange *a, int na, const mbCutRange *b, int nb, mbCutRange *out);
+int mbCutRangesAnd(const mbCutRange *a, int na, const mbCutRange *b, int nb, mbCutRange *out);
+int mbCutRangesInvert(const mbCutRange *a, int na, int ndata, mbCutRange *out);
+
+// Packed per-detector bitmaps, for masked loops that want to test samples without branching
+// on range boundaries.  They must be rebuilt after the cuts change.
+void mbCutsBuildBitmaps(mbCuts *cuts, int ndata);
+const uint64_t *mbCutsGetBitmap(const mbCuts *cuts, int row, int col);
+void mbCutsFreeBitmaps(mbCuts *cuts);
+
+static inline bool mbCutsBitmapIsCut(const uint64_t *bits, int index)
+{
+  return (bits[index>>6]>>(index&63))&1;
+}
 
 mbUncut *
 mbCutsGetUncut( const mbCuts *cuts, int row, int col, int min, int max );
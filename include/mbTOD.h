@@ -140,6 +140,40 @@ typedef struct {
 
 } BadTimestreams;
 
+/*--------------------------------------------------------------------------------*/
+//Run-length/delta packed map pixelization.  Consecutive samples mostly land in the same
+//pixel, and when they move it's usually by a small step, so each run is one byte of length
+//plus two bytes of pixel step, ~5x smaller than the int-per-sample pixelization_saved.
+//Steps that don't fit in a short are flagged with NK_PIX_ESCAPE and the absolute pixel
+//goes in escape[].
+#define NK_PIX_ESCAPE (-32768)
+#define NK_PIX_MAXRUN 255
+
+typedef struct {
+  int ndet;
+  int ndata;
+  int *nrun;                //# of runs for each detector, 0 for cut detectors
+  unsigned char **runlen;   //runlen[det][run]
+  short **delta;            //pixel step from the previous run
+  int **escape;             //absolute pixels for the runs whose step didn't fit
+  long nbyte;               //total packed size, for bookkeeping
+} PackedPixelization;
+
+/*--------------------------------------------------------------------------------*/
+//Cached (cos 2gamma, sin 2gamma) pairs for the polarized projections, interleaved so one
+//sample's pair sits together.  Stored either as floats or, if half is set, as Q15 shorts
+//(value*NK_POLANGLE_SCALE), which is half the memory and good to ~3e-5.
+#define NK_POLANGLE_SCALE 32767.0
+
+typedef struct {
+  int ndet;
+  int ndata;
+  bool half;
+  float **cs;          //cs[det][2*j] is cos, cs[det][2*j+1] is sin; NULL if half
+  short **cs_half;     //same layout in Q15; NULL unless half
+  long nbyte;
+} PackedPolAngles;
+
 /*--------------------------------------------------------------------------------*/
 
 typedef struct {
@@ -258,6 +292,7 @@ typedef struct {
   mbNoiseVectorStruct *noise;
   mbNoiseVectorStructBands *band_noise;
   mbNoiseStructBandsVecs *band_vecs_noise;
+  mbNoiseBandsVecsOp *band_vecs_op;  //band_vecs_noise factored for applying, see prepare_banded_projvec_noise
   int *paired_detectors; //if we have a matched detector, put it here.
 
 
@@ -273,11 +308,13 @@ typedef struct {
   ACTpolPointingFit *actpol_pointing;
   actData *hwp;
   actData **twogamma_saved;
+  PackedPolAngles *polangle_packed;  //if set, the pol projections read cos/sin 2gamma from here
   DemodData *demod;
 #endif
 
   PointingFit *pointing_fit;  //pointing fit, turn alt/az into ra/dec
   int **pixelization_saved;  //save a map pixelization in here.  Will break if there are multiple classes of maps with different pixelizations.
+  PackedPixelization *pixelization_packed;  //compressed version of the same, used if pixelization_saved isn't there.
   actData **ra_saved;
   actData **dec_saved;
   actData **data_saved;
@@ -133,12 +133,24 @@ void act_fftw_execute_dft_r2c(act_fftw_plan p, actData *r, act_fftw_complex *c);
 void act_fftw_execute_dft_c2r(act_fftw_plan p,  act_fftw_complex *c, actData *r);
 act_fftw_plan act_fftw_plan_dft_r2c_1d(int n, actData *vec, act_fftw_complex *vec2,unsigned flags);
 act_fftw_plan act_fftw_plan_dft_c2r_1d(int n, act_fftw_complex *vec2,actData *vec, unsigned flags);
+void act_fftw_execute_dft(act_fftw_plan p, act_fftw_complex *in, act_fftw_complex *out);
+void act_fftw_set_planner_flags(unsigned flags);
+unsigned act_fftw_get_planner_flags( void );
+act_fftw_plan act_fftw_cached_plan_r2c(int n, int howmany, actData *in, act_fftw_complex *out, int nthread);
+act_fftw_plan act_fftw_cached_plan_c2r(int n, int howmany, act_fftw_complex *in, actData *out, int nthread);
+act_fftw_plan act_fftw_cached_plan_c2c(int n, int howmany, act_fftw_complex *in, act_fftw_complex *out, int sign, int nthread);
+int act_fftw_plan_cache_size( void );
+void act_fftw_clear_plan_cache( void );
+void act_fftw_init_threads( void );
+int act_fftw_import_wisdom(const char *fname);
+int act_fftw_export_wisdom(const char *fname);
 
 
 void createFFTWplans1TOD(mbTOD *mytod);
+void copy_map2map(MAP *map2, MAP *map);
 void copy_mapset2mapset(MAPvec *map2, MAPvec *map);
-actData mapset_times_mapset(MAPvec *x, MAPvec *y);
-void remove_common_mode(mbTOD *tod);
+double mapset_times_mapset(MAPvec *x, MAPvec *y);
+void remove_common_mode(mbTOD *tod, const PARAMS *params);
 void readwrite_simple_map(MAP *map, char *filename, int dowrite);
 void detrend_data(mbTOD *tod);
 void array_detrend(mbTOD *tod, int nsamp);
@@ -157,8 +169,10 @@ void get_pointing_vec(const mbTOD *tod, const MAP *map, int det, int *ind);
 void get_pointing_vec_new(const mbTOD *tod, const MAP *map, int det, int *ind, PointingFitScratch *scratch);
 void write_tod_pointing_to_disk(const mbTOD *tod, char *fname);
 void mapset2det(const MAPvec *maps, mbTOD *tod, const PARAMS *params, actData *vec, int *ind, int det, PointingFitScratch *scratch);
+void save_tod_projection(const MAP *map, mbTOD *tod,const PARAMS *params);
 void map2tod(const MAP *map, mbTOD *tod,const PARAMS *params);
 void polmap2tod(MAP *map, mbTOD *tod);
+void polmap2tod_slow(MAP *map, mbTOD *tod);
 
 void clear_map(MAP *map);
 void clear_tod(mbTOD *tod);
@@ -177,10 +191,34 @@ double *dvector(long n);
 actComplex *cvector(long n);
 int how_many_tods(char *froot, PARAMS *params);
 int find_my_tods(TODvec *tods, PARAMS *params);
+void log_tod_load_balance(const TODvec *tods, double my_time);
+void write_tod_costs(const TODvec *tods, const PARAMS *params);
 int read_all_tod_headers(TODvec *tods,PARAMS *params);
 void set_global_radec_lims(TODvec *tods);
 actData tocksilent(pca_time *tt);
 void tick(pca_time *tt);
+
+//stages the hot-path profiler keeps time for.
+#define NK_PROF_READ 0
+#define NK_PROF_MAP2TOD 1
+#define NK_PROF_NOISE 2
+#define NK_PROF_TOD2MAP 3
+#define NK_PROF_REDUCE 4
+#define NK_PROF_POINTING 5
+#define NK_PROF_NSTAGE 6
+extern bool nk_profile_on;
+void nk_profile_add(int stage, double dt);
+void nk_profile_reset(bool on);
+void nk_profile_report(PARAMS *params, double wall);
+static inline double nk_profile_tick(void)
+{
+  return (nk_profile_on ? omp_get_wtime() : 0);
+}
+static inline void nk_profile_tock(int stage, double t0)
+{
+  if (nk_profile_on)
+    nk_profile_add(stage,omp_get_wtime()-t0);
+}
 void pca_pause(actData pauselen);
 void mprintf(FILE *stream, char *format, ...);
 
@@ -192,11 +230,29 @@ bool is_det_used(mbTOD *tod, int det);
 
 
 int get_parameters(int argc, char *argv[], PARAMS *params);
+void setup_fft_planner(PARAMS *params);
+void save_fft_wisdom(PARAMS *params);
 void print_options(PARAMS *params);
 int setup_maps(MAPvec *maps, PARAMS *params);
+MapFootprint *allocate_map_footprint();
+void setup_map_footprint(MAPvec *maps, TODvec *tods, PARAMS *params);
 void clear_mapset(MAPvec *maps);
 void createFFTWplans(TODvec *tod);
 void run_PCG(MAPvec *maps, TODvec *tods, PARAMS *params);
+MAPvec *make_mapset_copy(MAPvec *maps);
+void destroy_mapset(MAPvec *maps);
+void mapset2tod(MAPvec *maps, mbTOD *tod,PARAMS *params);
+int get_weights(MAPvec *maps, TODvec *tods, PARAMS *params);
+int make_initial_mapset(MAPvec *maps, TODvec *tods,PARAMS *params);
+double PCGstep(MAPvec *r, MAPvec *p, MAPvec *x, TODvec *tods, MAPvec *wts, PARAMS *params, PCGWorkspace *ws);
+void mapset2mapset(MAPvec *maps, TODvec *tods, PARAMS *params);
+void mapset2mapset_out(MAPvec *maps, MAPvec *maps_out, TODvec *tods, PARAMS *params);
+void mapset2mapset_pipelined(MAPvec *maps, MAPvec *maps_out, TODvec *tods, PARAMS *params);
+PCGWorkspace *allocate_pcg_workspace(MAPvec *maps);
+CoarseSpace *setup_coarse_space(MAPvec *maps, MAPvec *weights, PARAMS *params);
+void destroy_coarse_space(CoarseSpace *cs);
+void benchmark_coarse_preconditioner(MAPvec *b, MAPvec *weights, TODvec *tods, PARAMS *params);
+void destroy_pcg_workspace(PCGWorkspace *ws);
 
 void allocate_tod_storage(mbTOD *tod);
 void tod2mapset(MAPvec *maps, mbTOD *tod, PARAMS *params);
@@ -214,8 +270,19 @@ int is_map_polarized(MAP *map);
 
 
 void tod2map(MAP *map, mbTOD *tod, PARAMS *params);
+MapTiles *allocate_map_tiles(const MAP *map);
+actData *map_tiles_new_tile(MapTiles *tiles, int myid, long itile);
+void reduce_map_tiles(MAP *map, MapTiles *tiles);
+void destroy_map_tiles(MapTiles *tiles);
 void tod2polmap(MAP *map,mbTOD *tod);
 void tod2polmap_copy(MAP *map,mbTOD *tod);
+void tod2polmap_copy_slow(MAP *map,mbTOD *tod);
+short polangle_to_q15(actData x);
+PackedPolAngles *pack_tod_polangles(const mbTOD *tod, bool half);
+void destroy_packed_polangles(PackedPolAngles *pk);
+void free_tod_polangles(mbTOD *tod);
+void setup_tod_polangles(mbTOD *tod, const PARAMS *params);
+void benchmark_polmap_kernels(MAP *map, mbTOD *tod, int nrep);
 int *tod2map_actpol(MAP *map, mbTOD *tod, int *ipiv_proc);
 
 void ground2tod(MAP *map, mbTOD *tod);
@@ -224,11 +291,12 @@ void tod2ground(MAP *map, mbTOD *tod);
 actData tod_times_map(const MAP *map, const mbTOD *tod, PARAMS *params);
 
 int read_tod_data(mbTOD *tod);
+void filter_data(mbTOD *tod);
 MAP *make_map_copy(MAP *map);
 MAP *deres_map(MAP *map);
 MAP *upres_map(MAP *map);
 
-actData map_times_map(MAP *x, MAP *y);
+double map_times_map(MAP *x, MAP *y);
 void map_axpy(MAP *y, MAP *x, actData a);
 bool is_det_listed(const mbTOD *tod, const PARAMS *params, int det);
 void purge_matrix(mbTOD *tod, actData **vec, int nelem, int ngood);
@@ -51,6 +51,7 @@ void set_tod_starting_altaz_ctime(mbTOD *tod, actData alt, actData az, double ct
 void get_radec_from_altaz_fit_tiled(const TiledPointingFit *tile, actData *alt, actData *az, actData *ctime, actData *ra, actData *dec, int npoint);
 void get_radec_from_altaz_exact_1det(const mbTOD *tod,int det,    PointingFitScratch *scratch);
 void get_radec_from_altaz_fit_1det(const mbTOD *tod,int det, PointingFitScratch *scratch);
+void get_radec_coarse_1det(const mbTOD *tod, int det, PointingFitScratch *scratch);
 void get_radec_from_altaz_fit_1det_coarse(const mbTOD *tod, int det, PointingFitScratch *scratch);
 void get_radec_from_altaz_fit_1det_coarse_exact(const mbTOD *tod, int det, PointingFitScratch *scratch);
 actData find_max_pointing_err(const mbTOD *tod);
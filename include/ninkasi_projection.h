@@ -61,8 +61,15 @@ int set_map_projection_healpix_nest(MAP *map, int nside);
 nkProjection *deres_projection(nkProjection *proj);
 nkProjection *upres_projection(nkProjection *proj);
 
+bool fused_projection_ok(const mbTOD *tod, const MAP *map);
+void get_map_projection_fused_range(const mbTOD *tod, const MAP *map, const PointingFitScratch *scratch, int i0, int i1, int *ind);
 void convert_radec_to_map_pixel(const actData *ra, const actData *dec, int *ind, long ndata, const MAP *map);
 void convert_saved_pointing_to_pixellization(mbTOD *tod, MAP *map);
+PackedPixelization *pack_tod_pixelization(mbTOD *tod, const MAP *map);
+void unpack_pixelization_1det(const PackedPixelization *pk, int det, int *ind);
+const int *get_saved_pixelization_1det(const mbTOD *tod, int det, int *buf);
+void destroy_packed_pixelization(PackedPixelization *pk);
+void free_tod_pixelization_saved(mbTOD *tod);
 
 
 #endif
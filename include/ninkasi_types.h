@@ -18,6 +18,7 @@ struct params_struct_s {
   bool remove_common;
   bool remove_mean;  //use this to remove the common mode from the data, but not
                     //during mapmaking.
+  bool approx_median;  //take the common mode from a one-pass median-of-3 instead of the exact median
   bool no_noise;
   long seed;
   bool add_noise;
@@ -31,6 +32,34 @@ struct params_struct_s {
 
   bool write_pointing;
 
+  int pipeline_depth;  //# of TODs in flight per process in mapset2mapset.  <=1 means one at a time.
+  int pipeline_threads[3];  //threads for the project/noise/accumulate stages.  0 means pick automatically.
+
+  unsigned fft_planner_flags;  //FFTW_ESTIMATE/MEASURE/PATIENT, used for plans that go into the plan cache
+  char fft_wisdom[MAXLEN];  //if set, read fftw wisdom from here at startup and write it back after mapping
+
+  bool pack_pointing;  //keep the saved pixelization run-length packed instead of one int per sample
+  int pack_polangles;  //cache cos/sin 2gamma per sample for the pol projections: 0 off, 1 as floats, 2 as Q15 shorts
+
+  int prefetch_depth;  //# of TODs to read ahead in the background in make_initial_mapset.  0 turns it off.
+  double prefetch_mem;  //max GB of read-ahead TOD data held at once
+
+  bool balance_tods;  //hand out TODs by estimated cost (LPT) instead of round-robin
+  char tod_cost_file[MAXLEN];  //per-TOD timings from a previous run, read when balancing and rewritten after the first iteration
+
+  bool distribute_maps;  //each process only keeps the map tiles its TODs hit, instead of whole maps
+
+  int mg_levels;  //coarse-grid correction in PCG on blocks of 2^mg_levels x 2^mg_levels pixels.  0 turns it off.
+  int mg_iter;  //CG iterations on the coarse problem per application of the preconditioner
+  bool mg_benchmark;  //solve with and without the coarse correction, report, and quit
+
+  char checkpoint_name[MAXLEN];  //if set, PCG state goes to <checkpoint_name>_<rank> in the background
+  int checkpoint_every;  //checkpoint every this many iterations
+  bool resume;  //pick the solve back up from the checkpoint, if there is a usable one
+  int temp_every;  //write the temporary map every this many iterations.  0 turns it off.
+  char warm_start[MAXLEN];  //start from this map, and take weights from <warm_start>.weights if it's there
+
+  char profile_file[MAXLEN];  //if set, time the hot path and write a report here at the end of run_PCG (.json for JSON, else CSV)
   
   int n_use_rows;
   int n_use_cols;
@@ -46,6 +75,8 @@ struct todvec_struct_s {
   int total_tod;  //total number of tod's
   mbTOD *tods;
   char **my_fnames;
+  int *my_inds;  //index of each of my TODs in params->datanames
+  double *tod_time;  //seconds spent on each of my TODs in the last mapset2mapset
   //char *froot;
   char froot[MAXLEN];
   
@@ -66,6 +97,26 @@ typedef struct todvec_struct_s TODvec;
 
 
 
+//Which tiles of the map a process keeps when maps are spread over processes (@distribute_maps).
+//Tiles are NK_MAP_TILE_LEN pixels, so npol*NK_MAP_TILE_LEN elements of a polarized map.  A
+//process holds every tile its TODs hit.  Of the processes holding a tile, one owns it, and is
+//the only one that counts it in dot products or writes it to disk.  Every map in a run shares
+//one footprint.  Until the TODs have been looked at it is pending (ready==false), and maps
+//behave as if held in full.
+struct map_footprint_struct_s {
+  bool ready;
+  int nref;  //# of maps using this footprint
+  int myid;
+  int nproc;
+  long ntile;  //pixel tiles in the whole map
+  int nword;  //unsigned longs per process in held
+  unsigned long *held;  //nproc bit masks of the tiles each process holds
+  int *owner;  //owner of each tile, -1 if nobody holds it
+  long nmine;  //# of tiles this process holds
+  long *mine;  //which ones, in order
+};
+typedef struct map_footprint_struct_s MapFootprint;
+
 struct map_struct_s {
   actData pixsize;
   actData ramin,ramax,decmin,decmax;
@@ -85,6 +136,7 @@ struct map_struct_s {
   int nlock;
 
   nkProjection *projection;
+  MapFootprint *footprint;  //NULL if this process holds the whole map
 } map_struct;
 typedef struct map_struct_s MAP;
 
@@ -96,6 +148,51 @@ struct mapvec_struct_s {
 } mapvec_struct;
 typedef struct mapvec_struct_s MAPvec;
 
+/*--------------------------------------------------------------------------------*/
+//Coarse space for the two-level preconditioner.  Fine pixels are lumped into square blocks
+//of 2^nlevel pixels on a side, P copies a coarse pixel out over its block, and the coarse
+//problem is the Galerkin P^T A P, applied by running P y through the TODs at full resolution.
+//Polarizations are kept separate.  The fine pixel index is islow*nfast+ifast.
+struct coarse_space_struct_s {
+  int nlevel;
+  int niter;  //CG iterations per coarse solve
+  long nfast,nslow;
+  long nfast_c,nslow_c;
+  long npix_c;
+  MAPvec *wt;  //weights summed over blocks, for Jacobi on the coarse problem
+  MAPvec *fine,*fine_out;  //full resolution scratch for P y and A P y
+  MAPvec *b,*y,*r,*z,*p,*q;  //coarse CG scratch
+};
+typedef struct coarse_space_struct_s CoarseSpace;
+
+/*--------------------------------------------------------------------------------*/
+//Scratch mapsets for the PCG solver, allocated once in run_PCG and reused every iteration.
+struct pcg_workspace_struct_s {
+  MAPvec *ap;   //A*p
+  MAPvec *z;    //preconditioned residual, M^-1 r.  Carried over between iterations.
+  double rz;    //r.z, so we don't recompute it at the start of each step
+  bool have_z;  //false until z/rz have been set from r
+  CoarseSpace *coarse;  //NULL for plain diagonal preconditioning
+};
+typedef struct pcg_workspace_struct_s PCGWorkspace;
+
+/*--------------------------------------------------------------------------------*/
+//Thread-private accumulation buffers for projecting into a map.  The map is split into
+//tiles of (1<<NK_MAP_TILE_SHIFT) elements, and a thread only gets a buffer for a tile once
+//it actually drops a sample there, so memory goes like threads x area scanned rather than
+//threads x npix.  Tiles are summed back into the map in parallel, with no locks.
+#define NK_MAP_TILE_SHIFT 14
+#define NK_MAP_TILE_LEN (1L<<NK_MAP_TILE_SHIFT)
+#define NK_MAP_TILE_MASK (NK_MAP_TILE_LEN-1)
+
+struct map_tiles_struct_s {
+  long nelem;  //total number of elements in the map, including polarizations
+  long ntile;
+  int nthread;
+  actData ***tiles;  //tiles[thread][tile], NULL if thread never touched that tile.
+  long *ntouched;  //how many tiles each thread has allocated
+};
+typedef struct map_tiles_struct_s MapTiles;
 
 /*--------------------------------------------------------------------------------*/
 struct modelvec_params_struct_s {
@@ -49,6 +49,7 @@ actComplex **fft_all_data_flag(mbTOD *tod, unsigned flags);
 actData **get_banded_correlation_matrix_from_fft(mbTOD *tod, actComplex **data_fft, actData nu_min, actData nu_max);
 void act_syrk(char uplo, char trans, int n, int m, actData alpha, actData *a, int lda, actData beta, actData *b, int ldb);
 void get_eigenvectors(actData **mat, int n);
+void set_banded_noise_eig_rank(mbTOD *tod, int rank, actData tol);
 void allocate_tod_noise_bands(mbTOD *tod,actData *bands, int nband);
 actComplex **apply_banded_rotations(mbTOD *tod, actComplex **mat_in, bool do_forward);
 void get_simple_banded_noise_model(mbTOD *tod, bool *do_rots, mbNoiseType *types);
@@ -70,6 +71,8 @@ void set_noise_powlaw(mbTOD *tod, actData *amps, actData *knees, actData *pows);
 
 void simple_test_diag_proj_noise_inv(actData **data_in, actData **data_out, actData *noise, actData **vecs, int ndata, int ndet, int nvecs);
 void apply_diag_proj_noise_inv_bands(actData **data_in, actData **data_out, actData *noise, actData **vecs, int ndata, int ndet, int nvecs, int imin, int imax);
+mbNoiseBandsVecsOp *prepare_banded_projvec_noise(mbTOD *tod, int ndet);
+void destroy_banded_projvec_noise_op(mbTOD *tod);
 
 void fill_sin_cos_mat(actData *theta, int ndata, int nterm, actData **mat);
 void fill_tod_sin_cos_vec(mbTOD *tod, int nterm, actData *vec);
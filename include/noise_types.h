@@ -89,6 +89,29 @@ typedef struct {
  *  noise in bands
  */
 
+/*!
+ *  One band of a prepared projected-vector noise operator.  With N the diagonal detector noise
+ *  and V the band's vectors, N^-1 - N^-1 V (1+V^T N^-1 V)^-1 V^T N^-1 is applied as two GEMMs
+ *  through ninv_vecs (N^-1 V, nvecs x ndet) and woodbury ((1+V^T N^-1 V)^-1 V^T N^-1, laid out
+ *  as ndet x nvecs so it's the right-hand factor of the second GEMM).
+ */
+typedef struct {
+  int nvecs;
+  int imin;  //band limits in actData elements of the interleaved spectrum
+  int imax;
+  actData *ninv;  //not owned, points at the model's noises for the band
+  actData **ninv_vecs;
+  actData **woodbury;
+} mbNoiseBandVecsFactor;
+
+typedef struct {
+  int ndet;  //the detector count this was prepared for, ndet*nchannel when demodulated
+  int nband;
+  mbNoiseBandVecsFactor *bands;
+  const void *model;  //the mbNoiseStructBandsVecs this came from...
+  unsigned long hash;  //...and a hash of its contents, so a refit in place gets noticed
+} mbNoiseBandsVecsOp;
+
 typedef struct {
   int ndet;
   int nband;
@@ -119,6 +142,9 @@ typedef struct {
 
   actData ***rot_mats;
   actData ***inv_rot_mats_transpose;
+
+  int eig_rank;  //if >0, only solve for this many top modes per rotated band
+  actData eig_tol;  //relative residual those modes get converged to
   
   mbNoiseParams1PixBand **noise_params;
   
@@ -139,6 +165,9 @@ typedef struct {
   actData *freqs;  //if you want multiple demodulated timestreams, this are the frequencies
   int nfreq;
   int nmode;  //number of frequencies to keep
+  actData **hwp_cos;  //cos/sin(freqs[ff]*hwp), nfreq x ntable, built on first use
+  actData **hwp_sin;
+  int ntable;
 } DemodData;
 
 
@@ -27,6 +27,7 @@ void *dirfile_read_channel_direct(char typechar, const char *filename, const cha
 
 void read_dirfile_tod_data (mbTOD *tod);
 actData **read_dirfile_tod_data_from_rowcol_list (mbTOD *tod, int *row, int *col, int ndet, actData **data, int *nout);
+size_t read_dirfile_channels_batched(const char *dirfile, char **channames, int nchan, int start_offset, int decimate, int ndata, actData **data, int *nout);
 
 mbTOD *
 read_dirfile_tod_header( const char *filename );
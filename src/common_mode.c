@@ -167,6 +167,7 @@ mbNoiseCommonMode *mbAllocateCommonMode(const mbTOD *tod, int np_common, int np_
 
   data->apply_common=false;
   data->common_is_applied=false;
+  data->approx_median=false;
 
   data->ata=NULL;
   data->have_ata=false;
@@ -423,14 +424,10 @@ int mbGetNoCutInds(const mbCuts *cuts, int ndata, int row, int col,
                    int **istart_out, int **istop_out)
 {
   int *istart, *istop;
-  bool cut_all=true;
-  if (cuts)
-    if (cuts->detCuts[row][col])
-      if (cuts->detCuts[row][col]->ncuts>0)
-	cut_all=false;
+  int ncut=mbCutsGetNCut(cuts,row,col);
 
   // Handle case where cut object is not able to specify real cuts by asserting that no data are good.
-  if (cut_all) {
+  if (ncut==0) {
     istart=(int *)psAlloc(sizeof(int));
     istop=(int *)psAlloc(sizeof(int));
     istart[0]=0;
@@ -440,34 +437,28 @@ int mbGetNoCutInds(const mbCuts *cuts, int ndata, int row, int col,
     return 1;
   } else {
 
-    mbCutList *mycuts=cuts->detCuts[row][col];
-    int nseg=mycuts->ncuts+1;
-    mbSingleCut *cur=mycuts->head;
-    istart=(int *)psAlloc(nseg*sizeof(int));
-    istop=(int *)psAlloc(nseg*sizeof(int));
-
-    // Handle boundary case where first value is cut.
-    if (cur->indexFirst==0) {
-      nseg--;
-      istart[0]=cur->indexLast;
-      istop[0]=ndata;  //make sure we're ok if we return because cur->next=0;
-      cur=cur->next;
-    } else
-      istart[0]=0;
-
-    int i=0;
-    while (cur) {
-      istop[i]=cur->indexFirst;
-      //fprintf(stderr,"det %2d %2d, segment %d of %d has limits %d %d.\n",row,col,i,nseg,istart[i],istop[i]);
-      istart[i+1]=cur->indexLast+1;
-      cur=cur->next;
-      i++;
+    mbCutRange *ranges=(mbCutRange *)psAlloc(ncut*sizeof(mbCutRange));
+    ncut=mbCutsGetRanges(cuts,row,col,ranges);
+    istart=(int *)psAlloc((ncut+1)*sizeof(int));
+    istop=(int *)psAlloc((ncut+1)*sizeof(int));
+
+    // The good stretches are the gaps between the cuts, plus whatever is left after the last one.
+    int nseg=0;
+    int first=0;
+    for (int i=0;i<ncut;i++) {
+      if (ranges[i].indexFirst>first) {
+        istart[nseg]=first;
+        istop[nseg]=ranges[i].indexFirst;
+        nseg++;
+      }
+      first=ranges[i].indexLast+1;
     }
-
-    // Handle boundary case where the last value in the set is cut.
-    istop[i]=ndata;
-    if (istop[i]<=istart[i])
-      nseg--;
+    if (first<ndata) {
+      istart[nseg]=first;
+      istop[nseg]=ndata;
+      nseg++;
+    }
+    psFree(ranges);
 
     // Set up the arrays to be returned.
     *istart_out=istart;
@@ -597,11 +588,11 @@ void mbRescaleArrayMean(const mbTOD *tod, mbNoiseCommonMode *fit, const mbCuts *
 
 
 /*---------------------------------------------------------------------------------------------------------*/
-/// Compute the "common mode" vector as the median over all detectors of the data at each time step.
-/// Note that here "the data" means data with a bias and rescaling to be zero-median, unit-"scatter".
+/// Compute the "common mode" vector as the median over all detectors of the data at each time step,
+/// one sample at a time.  This is the original implementation, kept as the reference for mbCalculateCommonMode.
 /// \param fit  The common mode object being used and updated.
 
-void mbCalculateCommonMode(mbNoiseCommonMode *fit)
+void mbCalculateCommonModeSlow(mbNoiseCommonMode *fit)
 {
   assert(fit->have_data);  /*check to make sure you pre-calculate the rescaled data.*/
   
@@ -624,6 +615,165 @@ void mbCalculateCommonMode(mbNoiseCommonMode *fit)
 
 
 
+/*---------------------------------------------------------------------------------------------------------*/
+/// Build a Batcher odd-even merge sorting network for n elements.  Comparators that would only touch
+/// the padding up to the next power of two are dropped, which is safe since the padding acts like +inf.
+/// \param n      Number of elements to sort.
+/// \param nstage Number of comparators in the network (output).
+/// \return       Array of 2*nstage indices, each pair (lo,hi) a compare-exchange putting the smaller value at lo.
+
+static int *mbSortingNetwork(int n, int *nstage)
+{
+  int nn=1;
+  while (nn<n)
+    nn*=2;
+  int nalloc=16,ncomp=0;
+  int *pairs=(int *)psAlloc(2*nalloc*sizeof(int));
+  for (int p=1;p<nn;p*=2)
+    for (int k=p;k>=1;k/=2)
+      for (int j=k%p;j<=nn-1-k;j+=2*k)
+        for (int i=0;(i<=k-1)&&(i<=nn-j-k-1);i++)
+          if ((i+j)/(p*2)==(i+j+k)/(p*2)) {
+            if (i+j+k>=n)
+              continue;
+            if (ncomp==nalloc) {
+              nalloc*=2;
+              pairs=(int *)realloc(pairs,2*nalloc*sizeof(int));
+            }
+            pairs[2*ncomp]=i+j;
+            pairs[2*ncomp+1]=i+j+k;
+            ncomp++;
+          }
+  *nstage=ncomp;
+  return pairs;
+}
+
+/*---------------------------------------------------------------------------------------------------------*/
+/// Elementwise median of three rows.  dest may be any of the inputs.
+
+static inline void mbMedian3Rows(const actData *a, const actData *b, const actData *c, actData *dest, int width)
+{
+  for (int j=0;j<width;j++) {
+    actData lo=(a[j]<b[j] ? a[j] : b[j]);
+    actData hi=(a[j]<b[j] ? b[j] : a[j]);
+    actData mid=(c[j]<hi ? c[j] : hi);
+    dest[j]=(lo>mid ? lo : mid);
+  }
+}
+
+/*---------------------------------------------------------------------------------------------------------*/
+/// Recursive median-of-3 across the rows of a detector-major tile, vectorized over the samples in each row.
+/// One pass through the data and no sorting, but only an approximation to the true median.
+/// \param tile  ndet rows of width samples each (row stride MB_COMMON_TILE).  Overwritten.
+/// \param ndet  Number of rows.
+/// \param width Number of samples in each row.
+/// \param out   Approximate median of each sample (output).
+
+static void mbApproxMedianTile(actData *tile, int ndet, int width, actData *out)
+{
+  int m=ndet;
+  while (m>=3) {
+    int ngroup=m/3;
+    //each group's output row is below any row still to be read, so this can go in place.
+    for (int g=0;g<ngroup;g++)
+      mbMedian3Rows(tile+(3*g)*MB_COMMON_TILE,tile+(3*g+1)*MB_COMMON_TILE,tile+(3*g+2)*MB_COMMON_TILE,tile+g*MB_COMMON_TILE,width);
+    //passing leftover rows straight through would let one raw detector carry up to half the
+    //weight at the end, so two leftovers get a median with a finished group and one is dropped.
+    if (m-3*ngroup==2) {
+      mbMedian3Rows(tile+(3*ngroup)*MB_COMMON_TILE,tile+(3*ngroup+1)*MB_COMMON_TILE,tile,tile+ngroup*MB_COMMON_TILE,width);
+      ngroup++;
+    }
+    m=ngroup;
+  }
+  if (m==2)
+    for (int j=0;j<width;j++)
+      out[j]=0.5*(tile[j]+tile[MB_COMMON_TILE+j]);
+  else
+    memcpy(out,tile,width*sizeof(actData));
+}
+
+/*---------------------------------------------------------------------------------------------------------*/
+/// Compute the "common mode" vector as the median over all detectors of the data at each time step.
+/// Note that here "the data" means data with a bias and rescaling to be zero-median, unit-"scatter".
+/// The data are worked through in tiles of MB_COMMON_TILE samples, read contiguously from each detector.
+/// For up to MB_COMMON_NETWORK_MAX detectors the tile is sorted in place by a sorting network that runs
+/// across all the samples in the tile at once; otherwise it's transposed to sample-major order and each
+/// sample gets its own selection.  Either way the answer is the same as mbCalculateCommonModeSlow.  If
+/// fit->approx_median is set, a one-pass recursive median-of-3 is used instead.
+/// \param fit  The common mode object being used and updated.
+
+void mbCalculateCommonMode(mbNoiseCommonMode *fit)
+{
+  assert(fit->have_data);  /*check to make sure you pre-calculate the rescaled data.*/
+  int ndet=fit->ndet;
+  int kmed=(ndet/2>0 ? ndet/2 : 1);  //same (1-offset) order statistic compute_median picks
+  int nstage=0;
+  int *network=NULL;
+  if ((!fit->approx_median)&&(ndet<=MB_COMMON_NETWORK_MAX))
+    network=mbSortingNetwork(ndet,&nstage);
+
+#pragma omp parallel shared(fit,network,nstage,ndet,kmed) default(none)
+  {
+    actData *tile=(actData *)psAlloc(ndet*MB_COMMON_TILE*sizeof(actData));
+#pragma omp for schedule(static)
+    for (int i0=0;i0<fit->ndata;i0+=MB_COMMON_TILE)  {
+      int width=fit->ndata-i0;
+      if (width>MB_COMMON_TILE)
+        width=MB_COMMON_TILE;
+      if (fit->approx_median||network) {
+        //detector-major tile, one row per detector
+        for (int j=0;j<ndet;j++)
+          memcpy(tile+j*MB_COMMON_TILE,fit->data[j]+i0,width*sizeof(actData));
+        if (fit->approx_median) {
+          mbApproxMedianTile(tile,ndet,width,fit->common_mode+i0);
+          continue;
+        }
+        for (int s=0;s<nstage;s++) {
+          actData *lo=tile+network[2*s]*MB_COMMON_TILE;
+          actData *hi=tile+network[2*s+1]*MB_COMMON_TILE;
+          for (int j=0;j<width;j++) {
+            actData a=lo[j];
+            actData b=hi[j];
+            lo[j]=(a<b ? a : b);
+            hi[j]=(a<b ? b : a);
+          }
+        }
+        memcpy(fit->common_mode+i0,tile+(kmed-1)*MB_COMMON_TILE,width*sizeof(actData));
+      }
+      else {
+        //sample-major tile, so each selection works on contiguous memory.
+        for (int j=0;j<ndet;j++) {
+          const actData *src=fit->data[j]+i0;
+          for (int k=0;k<width;k++)
+            tile[k*ndet+j]=src[k];
+        }
+        for (int k=0;k<width;k++)
+          fit->common_mode[i0+k]=sselect(kmed,ndet,tile+k*ndet-1);
+      }
+    }
+    psFree(tile);
+  }
+  if (network)
+    psFree(network);
+
+#ifdef MB_COMMON_CHECK
+  {
+    actData *cm=fit->common_mode;
+    fit->common_mode=(actData *)psAlloc(fit->ndata*sizeof(actData));
+    mbCalculateCommonModeSlow(fit);
+    actData maxdiff=0;
+    for (int i=0;i<fit->ndata;i++)
+      if (fabs(cm[i]-fit->common_mode[i])>maxdiff)
+        maxdiff=fabs(cm[i]-fit->common_mode[i]);
+    fprintf(stderr,"common mode max difference from per-sample median is %14.5e\n",maxdiff);
+    psFree(fit->common_mode);
+    fit->common_mode=cm;
+  }
+#endif
+}
+
+
+
 /*---------------------------------------------------------------------------------------------------------*/
 /// Compute the "common mode" vector as the mean over all not-cut detectors of the data at each time
 /// step.  Note that here "the data" means data with a bias and rescaling to be zero-mean,
@@ -655,14 +805,8 @@ void mbCalculateMeanCommonMode(mbNoiseCommonMode *fit, const mbTOD *tod, const m
       if (mbCutsIsAlwaysCut(cuts, tod->rows[j],tod->cols[j]))
         continue;
     
-    bool use_all_of_me=true;
-    if (cuts) {
-      mbCutList *mycuts=cuts->detCuts[tod->rows[j]][tod->cols[j]];
-      if (mycuts)
-        if (mycuts->ncuts>0)
-          use_all_of_me=false;
-    }
-    if (use_all_of_me) {  // Why not take all of me?
+    int ncut=mbCutsGetNCut(cuts,tod->rows[j],tod->cols[j]);
+    if (ncut==0) {  // Why not take all of me?
       for (int i=0;i<fit->ndata;i++) {
         weightsum[i]+=fit->weights[j];
         fit->common_mode[i]+=fit->data[j][i];
@@ -670,17 +814,17 @@ void mbCalculateMeanCommonMode(mbNoiseCommonMode *fit, const mbTOD *tod, const m
 
     } else {
       //fprintf(stderr,"Dealing with cuts on detector %d %d\n",tod->rows[j],tod->cols[j]);
-      mbCutList *mycuts=cuts->detCuts[tod->rows[j]][tod->cols[j]];
+      mbCutRange *ranges=(mbCutRange *)psAlloc(ncut*sizeof(mbCutRange));
+      ncut=mbCutsGetRanges(cuts,tod->rows[j],tod->cols[j],ranges);
       int istart=0;
-      mbSingleCut *cur=mycuts->head;
-      while (cur)	{
-        for (int i=istart; i<cur->indexFirst; i++) {
+      for (int c=0;c<ncut;c++) {
+        for (int i=istart; i<ranges[c].indexFirst && i<fit->ndata; i++) {
           weightsum[i]+=fit->weights[j];
           fit->common_mode[i]+=fit->data[j][i];		  
         }
-        istart=cur->indexLast+1;
-        cur=cur->next;
+        istart=ranges[c].indexLast+1;
       }
+      psFree(ranges);
       for (int i=istart;i<fit->ndata;i++) {
         weightsum[i]+=fit->weights[j];
         fit->common_mode[i]+=fit->data[j][i];		  
@@ -1300,37 +1444,19 @@ void mbApplyCutsToCommonMode(const mbTOD *tod, mbNoiseCommonMode *fit, const mbC
   }
 
   assert(tod->ndet==fit->ndet);  //and more checks
-#if 0
-  fprintf(stderr,"nrow and ncol are %d %d\n",cuts->nrow,cuts->ncol);
-  if (cuts->detCuts[15][15]) {
-    fprintf(stderr,"15,15 has cuts.\n");
-    mbCutList *mycuts=cuts->detCuts[15][15];
-    fprintf(stderr,"ncuts is %d\n",mycuts->ncuts);
-    mbSingleCut *cur=mycuts->head;
-    for (int i=0;i<mycuts->ncuts;i++) {
-      assert(cur!=NULL);
-      fprintf(stderr,"lims are %6d %6d\n",cur->indexFirst,cur->indexLast);
-      cur=cur->next;
-    }
-  } else
-    fprintf(stderr,"missing cuts on 15,15.\n");
-  for (int i=0;i<tod->ndet;i++) {
-    //fprintf(stderr,"row and col are %3d %3d\n",tod->rows[i],tod->cols[i]);
-  }
-#endif
-
   actData **myata=psAllocMatrix(fit->nparam,fit->nparam);
   actData *myatx=(actData *)psAlloc(fit->nparam*sizeof(actData));
   for (int i=0;i<tod->ndet;i++) {
-    mbCutList *mycuts=cuts->detCuts[tod->rows[i]][tod->cols[i]];
-    if (mycuts)  {//we have some cuts to do.
+    int ncut=mbCutsGetNCut(cuts,tod->rows[i],tod->cols[i]);
+    if (ncut>0)  {//we have some cuts to do.
       memcpy(myata[0],fit->ata[0],fit->nparam*fit->nparam*sizeof(actData));
       for (int j=0;j<fit->nparam;j++)
         myatx[j]=fit->atx[j][i];
-      mbSingleCut *cur=mycuts->head;
-      while (cur) {
-        int jmin=cur->indexFirst;
-        int jmax=cur->indexLast+1;
+      mbCutRange *ranges=(mbCutRange *)psAlloc(ncut*sizeof(mbCutRange));
+      ncut=mbCutsGetRanges(cuts,tod->rows[i],tod->cols[i],ranges);
+      for (int c=0;c<ncut;c++) {
+        int jmin=ranges[c].indexFirst;
+        int jmax=ranges[c].indexLast+1;
         //fprintf(stderr,"backing off %d %d\n",jmin,jmax);
 #if 1
         for (int j=jmin; j<jmax;j++)
@@ -1348,8 +1474,8 @@ void mbApplyCutsToCommonMode(const mbTOD *tod, mbNoiseCommonMode *fit, const mbC
 #else
         printf("hello!\n");
 #endif
-        cur=cur->next;
       }
+      psFree(ranges);
       mbInvertPosdefMat(myata,fit->nparam);
 #ifdef ACTDATA_DOUBLE
       cdgemv('n',fit->nparam,fit->nparam,fit->median_scats[i],myata[0],fit->nparam,
@@ -8,10 +8,11 @@
 
 #include "actpol/dirfile.h"
 #include "actpol/getdata.h"
+#include "dirfile_batch.h"
 
 #define dirfile_print_errstatus(STATUS) {\
     if ( STATUS != GD_E_OK ) \
-        fprintf(stderr, "line %d: *** dirfile error code: %d\n", __LINE__, status); \
+        fprintf(stderr, "line %d: *** dirfile error code: %d\n", __LINE__, STATUS); \
 }
 
 ACTpolDirfile *
@@ -129,6 +130,61 @@ ACTpolDirfile_read_channel( char typechar, const ACTpolDirfile *dirfile,
     return data;
 }
 
+// Read nchan channels in one go, with the decoding done in parallel by GetDataMany.
+int
+ACTpolDirfile_read_channels( char typechar, const ACTpolDirfile *dirfile,
+        const char **channelnames, int nchan, void **data, int *nsamples_out )
+{
+    const struct FormatType *F = dirfile->format;
+    // calloc so channels that fail below go to GetDataMany as zero-length reads.
+    int *nframes = calloc( nchan, sizeof(int) );
+    int *nextra = calloc( nchan, sizeof(int) );
+    int *status = calloc( nchan, sizeof(int) );
+    int nbad = 0;
+
+    for ( int i = 0; i < nchan; i++ )
+    {
+        int st = 0;
+        data[i] = NULL;
+        nsamples_out[i] = 0;
+        int n = GetNFrames( F, &st, channelnames[i] );
+        int samples_per_frame = 0;
+        if ( st == GD_E_OK )
+            samples_per_frame = GetSamplesPerFrame( F, channelnames[i], &st );
+        if ( st != GD_E_OK || n <= 0 || samples_per_frame <= 0 )
+        {
+            dirfile_print_errstatus( st );
+            continue;
+        }
+        // last frame may be partial
+        int nsamples = (n + 1) * samples_per_frame - 1;
+        nframes[i] = nsamples / samples_per_frame;
+        nextra[i] = nsamples % samples_per_frame;
+        data[i] = malloc( nsamples * bytes_per_sample(typechar) );
+    }
+
+    GetDataMany( F, channelnames, nchan, 0, 0, nframes, nextra,
+            typechar, data, nsamples_out, status );
+
+    for ( int i = 0; i < nchan; i++ )
+    {
+        if ( data[i] != NULL && (status[i] != GD_E_OK || nsamples_out[i] <= 0) )
+        {
+            dirfile_print_errstatus( status[i] );
+            free( data[i] );
+            data[i] = NULL;
+            nsamples_out[i] = 0;
+        }
+        if ( data[i] == NULL )
+            nbad++;
+    }
+
+    free( nframes );
+    free( nextra );
+    free( status );
+    return nbad;
+}
+
 int16_t *
 ACTpolDirfile_read_int16_channel(const ACTpolDirfile *dirfile,
         const char *channelname, int *nsamples )
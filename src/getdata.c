@@ -1222,6 +1222,14 @@ static inline ssize_t read_wrap(struct FileHandle *R, void *buf, size_t count) {
   return (ssize_t)-1;
 }
 
+/* true if data of type in_type can be handed back as out_type untouched */
+static inline bool SameType(char in_type, char out_type) {
+  if (in_type == out_type)
+    return(out_type != 'n');
+  return (((in_type == 'i') && (out_type == 'S')) ||
+          ((in_type == 'S') && (out_type == 'i')));
+}
+
 /***************************************************************************/
 /*                                                                         */
 /*   Look to see if the field code belongs to a raw.  If so, parse it.     */
@@ -1259,25 +1267,35 @@ static int DoIfRaw(const struct FormatType *F, const char *field_code,
     return(1);
   }
 
-  databuffer = (unsigned char *)malloc(ns*R->size);
-
   *n_read = 0;
-  if (s0 < 0) {
-    *n_read = FillZero((char *)databuffer, R->type, s0, ns);
-    ns -= *n_read;
-    s0 = 0;
-  }
+  if ((s0 >= 0) && SameType(R->type, return_type)) {
+    /* nothing to convert or zero-fill, so decode straight into the caller's buffer */
+    if (ns>0) {
+      seek_wrap(&FH, s0*R->size, SEEK_SET);
+      bytes_read = read_wrap(&FH, data_out, ns*R->size);
+      *n_read = bytes_read/R->size;
+    }
+    *error_code = GD_E_OK;
+  } else {
+    databuffer = (unsigned char *)malloc(ns*R->size);
 
-  if (ns>0) {
-    seek_wrap(&FH, s0*R->size, SEEK_SET);
-    bytes_read = read_wrap(&FH, databuffer + *n_read*R->size, ns*R->size);
-    *n_read += bytes_read/R->size;
-  }
+    if (s0 < 0) {
+      *n_read = FillZero((char *)databuffer, R->type, s0, ns);
+      ns -= *n_read;
+      s0 = 0;
+    }
+
+    if (ns>0) {
+      seek_wrap(&FH, s0*R->size, SEEK_SET);
+      bytes_read = read_wrap(&FH, databuffer + *n_read*R->size, ns*R->size);
+      *n_read += bytes_read/R->size;
+    }
 
-  *error_code =
-    ConvertType(databuffer, R->type, data_out, return_type, *n_read);
+    *error_code =
+      ConvertType(databuffer, R->type, data_out, return_type, *n_read);
 
-  free(databuffer);
+    free(databuffer);
+  }
 
   if (FH.fp >= 0)
     zzip_close(FH.fp);
@@ -2040,6 +2058,55 @@ int GetData(const struct FormatType *F, const char *field_code,
   return(n_read);
 }
 
+/***************************************************************************/
+/*                                                                         */
+/*  GetDataMany: GetData for a list of fields.  Raw fields each get their  */
+/*    own file handle and are decoded concurrently, which is where the     */
+/*    time goes for slim/zip compressed dirfiles.  Derived fields can      */
+/*    load linterp tables on first use, so they are done serially after.   */
+/*    num_frames, num_samp, data_out, n_read and error_codes are per       */
+/*    field.  Returns the number of fields that had errors.                */
+/*                                                                         */
+/***************************************************************************/
+int GetDataMany(const struct FormatType *F, const char **field_codes, int nfield,
+    int first_frame, int first_samp,
+    const int *num_frames, const int *num_samp,
+    char return_type, void **data_out,
+    int *n_read, int *error_codes) {
+
+  struct RawEntryType tR;
+  bool *is_raw = (bool *)malloc(nfield*sizeof(bool));
+  int nbad = 0;
+
+  for (int i=0;i<nfield;i++) {
+    strncpy(tR.field, field_codes[i], FIELD_LENGTH);
+    is_raw[i] = (bsearch(&tR, F->rawEntries, F->n_raw,
+          sizeof(struct RawEntryType), RawCmp) != NULL);
+  }
+
+#pragma omp parallel for schedule(dynamic,1) reduction(+:nbad) shared(F,field_codes,nfield,first_frame,first_samp,num_frames,num_samp,return_type,data_out,n_read,error_codes,is_raw) default(none)
+  for (int i=0;i<nfield;i++) {
+    if (is_raw[i]) {
+      n_read[i] = GetData(F, field_codes[i], first_frame, first_samp,
+          num_frames[i], num_samp[i], return_type, data_out[i], &error_codes[i]);
+      if (error_codes[i] != GD_E_OK)
+        nbad++;
+    }
+  }
+
+  for (int i=0;i<nfield;i++) {
+    if (!is_raw[i]) {
+      n_read[i] = GetData(F, field_codes[i], first_frame, first_samp,
+          num_frames[i], num_samp[i], return_type, data_out[i], &error_codes[i]);
+      if (error_codes[i] != GD_E_OK)
+        nbad++;
+    }
+  }
+
+  free(is_raw);
+  return(nbad);
+}
+
 /***************************************************************************/
 /*                                                                         */
 /*    Get the number of frames available                                   */
@@ -1,16 +1,20 @@
-
 /// \file mbCuts.c
 
 /// Contains methods for manipulating a set of time periods that are
 /// to be cut from further analysis.  Cuts can be array-wide (global)
 /// or detector-specific.
+/// Each detector's cuts are kept as a sorted array of merged, inclusive
+/// ranges, so lookups are a binary search and combining global and
+/// detector cuts is a merge of two sorted arrays with no allocation.
 
 
 //#include "act.h"
 #include <ninkasi.h>
 #include "mbCuts.h"
+#include <stdlib.h>
 #include <string.h>  // For memset()
 #include <assert.h>
+#include <limits.h>
 
 #include <omp.h>
 
@@ -18,47 +22,92 @@
 // Local (static) method declarations
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void CutListFree(mbCutList *list);
 void CutsFree(mbCuts *cuts);
-static inline int MAX(int a, int b);
-static void cutsCombine(mbCutList *list);
-static void cutListExtend(mbCutList *list, int first, int last);
-static bool isThisListAlwaysCut(const mbCutList *list);
-static bool isThisListNeverCut(const mbCutList *list);
+static void cutSlotExtend(mbCuts *cuts, int slot, int first, int last);
+static void cutSlotMerge(mbCuts *cuts, int slot);
+static bool isThisSlotAlwaysCut(const mbCuts *cuts, int slot);
+static bool isThisSlotNeverCut(const mbCuts *cuts, int slot);
+
+
 
-static mbCutList *cutListOr(const mbCutList *a, const mbCutList *b);
+/// Merges two sorted range lists on the fly, combining ranges that overlap or touch.
+/// This is what used to be done by building a new linked list for every query.
 
+typedef struct {
+  const mbCutRange *a;
+  const mbCutRange *b;
+  int na, nb;
+  int ia, ib;
+} cutMerge;
 
 
-static inline int MAX(int a, int b)
+static inline void cutMergeInit(cutMerge *m, const mbCutRange *a, int na, const mbCutRange *b, int nb)
 {
-  if (a>b)
-    return a;
-  else
-    return b;
+  m->a=a;
+  m->na=(a ? na : 0);
+  m->b=b;
+  m->nb=(b ? nb : 0);
+  m->ia=0;
+  m->ib=0;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Public functions on the structures mbCuts,  mbCutList and mbSingleCut.
-////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Pointer to the next unmerged range with the lowest indexFirst, or NULL if both lists are done.
+static inline const mbCutRange *cutMergePeek(const cutMerge *m)
+{
+  if (m->ia<m->na) {
+    if ((m->ib<m->nb)&&(m->b[m->ib].indexFirst<m->a[m->ia].indexFirst))
+      return &m->b[m->ib];
+    return &m->a[m->ia];
+  }
+  if (m->ib<m->nb)
+    return &m->b[m->ib];
+  return NULL;
+}
 
-/// Allocate a mbSingleCut structure.
-/// Also registers the deallocator.
-/// \param first  The first data index to be cut.
-/// \param last   The last data index to be cut.
+static inline void cutMergeAdvance(cutMerge *m, const mbCutRange *r)
+{
+  if ((m->ia<m->na)&&(r==&m->a[m->ia]))
+    m->ia++;
+  else
+    m->ib++;
+}
 
+/// Next merged range.  Returns false when both lists are exhausted.
+static inline bool cutMergeNext(cutMerge *m, mbCutRange *out)
+{
+  const mbCutRange *r=cutMergePeek(m);
+  if (r==NULL)
+    return false;
+  *out=*r;
+  cutMergeAdvance(m,r);
+  while ((r=cutMergePeek(m))!=NULL) {
+    if ((long)out->indexLast+1<r->indexFirst)
+      break;
+    if (r->indexLast>out->indexLast)
+      out->indexLast=r->indexLast;
+    cutMergeAdvance(m,r);
+  }
+  return true;
+}
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Public functions on the structure mbCuts.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
 void CutsFree(mbCuts *cuts)
 {
-  for (int r=0; r<cuts->nrow; r++)
-    for (int c=0; c<cuts->ncol; c++)
-      psFree(cuts->detCuts[r][c]);
-  psFree(cuts->detCuts[0]);
-  psFree(cuts->detCuts);
-  psFree(cuts->globalCuts);
-  //psFree(cuts->tod);
+  mbCutChunk *chunk=cuts->chunks;
+  while (chunk) {
+    mbCutChunk *next=chunk->next;
+    free(chunk);
+    chunk=next;
+  }
+  cuts->chunks=NULL;
+  mbCutsFreeBitmaps(cuts);
+  psFree(cuts->ranges);
+  psFree(cuts->ncut);
+  psFree(cuts->cap);
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -145,47 +194,47 @@ int mbCutsRead(mbCuts *c, const char *filename)
   return nread;
 }
 /*--------------------------------------------------------------------------------*/
-void mbCutsDecimateOneCut(mbCutList *cut)
+static void cutSlotMerge(mbCuts *cuts, int slot)
+//fold together any neighbouring ranges in a sorted slot that overlap or touch.
 {
-  if (cut==NULL)
-    return;
-  if (isThisListAlwaysCut(cut))
-    return;
-  int ncut=cut->ncuts;
-  if (ncut==0) {
-    //fprintf(stderr,"weirdness in mbCutsDecimateOneCut.\n");
+  mbCutRange *r=cuts->ranges[slot];
+  int n=cuts->ncut[slot];
+  if (n<2)
     return;
+  int nout=0;
+  for (int i=1;i<n;i++) {
+    if ((long)r[nout].indexLast+1>=r[i].indexFirst) {
+      if (r[i].indexLast>r[nout].indexLast)
+	r[nout].indexLast=r[i].indexLast;
+    }
+    else
+      r[++nout]=r[i];
   }
-  if (cut==NULL)
+  cuts->ncut[slot]=nout+1;
+}
+/*--------------------------------------------------------------------------------*/
+static void mbCutsDecimateSlot(mbCuts *cuts, int slot)
+//halving keeps the ranges in order, but ones that were apart can now meet.
+{
+  if (isThisSlotAlwaysCut(cuts,slot))
     return;
-
-  mbSingleCut *head=cut->head;
-  int ncur=0;
-  while (head!=NULL) {
-    ncur++;
-    head->indexFirst= (head->indexFirst)/2;
-    head->indexLast= (head->indexLast+1)/2;
-    head=head->next;
-    if (ncur==ncut)
-      if (head) {
-	fprintf(stderr,"Cuts have a problem.\n");
-	return;
-      }
+  mbCutRange *r=cuts->ranges[slot];
+  for (int i=0;i<cuts->ncut[slot];i++) {
+    r[i].indexFirst=r[i].indexFirst/2;
+    r[i].indexLast=((long)r[i].indexLast+1)/2;
   }
-  if (ncur!=ncut)
-    fprintf(stderr,"mismatch in mbCutsDecimateOneCut, %d vs %d\n",ncur,ncut);
+  cutSlotMerge(cuts,slot);
 }
 /*--------------------------------------------------------------------------------*/
 void mbCutsDecimate(mbCuts *cuts)
 {
-  //fprintf(stderr,"Doing globals.\n");
-  mbCutsDecimateOneCut(cuts->globalCuts);
+  mbCutsFreeBitmaps(cuts);
+  mbCutsDecimateSlot(cuts,MB_CUTS_GLOBAL_SLOT(cuts));
 
   for (int row=0;row<cuts->nrow;row++)
     for (int col=0;col<cuts->ncol;col++) {
       if (!mbCutsIsAlwaysCut(cuts,row,col)) {
-	//fprintf(stderr,"doing %d  %d with %d cuts.\n",row,col,cuts->detCuts[row][col]);
-	mbCutsDecimateOneCut(cuts->detCuts[row][col]);
+	mbCutsDecimateSlot(cuts,row*cuts->ncol+col);
       }
 
     }
@@ -207,7 +256,7 @@ void mbCutsExtendGlobal(mbCuts *cuts, int first, int last)
   if (last < first)
     return;
 
-  cutListExtend(cuts->globalCuts, first, last);
+  cutSlotExtend(cuts, MB_CUTS_GLOBAL_SLOT(cuts), first, last);
 }
 
 
@@ -231,140 +280,97 @@ void mbCutsExtend(mbCuts *cuts, int first, int last, int row, int col)
   if (last < first)
     return;
 
-  mbCutList *list = cuts->detCuts[row][col];
-  if (list == NULL) {
-    list = mbCutListAlloc();
-    cuts->detCuts[row][col] = list;
-  }
-  cutListExtend(list, first, last);
-}
-
-
-
-/// Extend any mbCutList by adding a new cut on index [first,last] both inclusive.
-/// Takes care of sorting the new cut into the appropriate place in the list.
-/// \param list   The mbCutList to be extended.
-/// \param first  The first data index to be cut.
-/// \param last   The last data index to be cut.
-
-static void cutListExtend(mbCutList *list, int first, int last)
-{
-  assert (first <= last);
-  mbSingleCut *newCut = mbSingleCutAlloc(first, last);
-
-  // There is no list yet.  This is going to be easy.
-  if (list->head == NULL) {
-    list->head = newCut;
-    list->ncuts = 1;
-    return;
-  }
-
-  // Add the current cut to an existing list, ensuring that it goes AFTER the
-  // last existing list element with the same or lower firstIndex.
-  // Do not worry if newCut overlaps any existing cuts: cutsCombine will fix that.
-  mbSingleCut *tail = list->head;
-  while (tail->next != NULL)
-    tail=tail->next;
-  int firstFirst = list->head->indexFirst;
-  int lastFirst = tail->indexFirst;
-
-  // Add the newCut at the tail of the list
-  if (first >= lastFirst) {       
-    tail->next = newCut;
-
-    // Add the newCut at the head of the list
-  } else if (first < firstFirst) { 
-    newCut->next = list->head;
-    list->head = newCut;
-
-    // Add the newCut somewhere in the list not at the head or tail.
-  } else { 
-    mbSingleCut *c = list->head;
-    while (first >= c->next->indexFirst)
-      c = c->next;
-    newCut->next = c->next;
-    c->next = newCut;
-  }
-
-  // Combine overlapping cuts into a single cut, where possible.
-  list->ncuts++;
-  cutsCombine(list);
-}
-
-
-
-/// Allocate a mbCutList structure.
-/// Also registers the deallocator.
-
-mbCutList *mbCutListAlloc()
-{
-  mbCutList *list = psAlloc(sizeof(mbCutList));
-  //psMemSetDeallocator(list, (psFreeFunc)CutListFree);
-    
-  list->head = NULL;
-  list->ncuts = 0;
-
-  return list;
+  cutSlotExtend(cuts, row*cuts->ncol+col, first, last);
 }
 
 
 
-
-/// If any consecutive cuts in a mbCutList are continguous,combine them into one.
-/// This assumes that the indexFirst values in the list are pre-sorted, and it 
-/// assures that they remain that way.
-/// \param list  The mbCutList to be fixed.
-
-static void cutsCombine(mbCutList *list)
+/// Find room for n ranges in the chunk storage.
+static mbCutRange *cutsGetRoom(mbCuts *cuts, int n)
 {
-  // No need to check empty lists.
-  if (list == NULL || list->head == 0)
-    return;
-
-  mbSingleCut *ca, *cb;
-  ca=list->head; 
-  cb=ca->next;
-  while (cb != NULL) {
-    // If 1st sample after 1st cut (ca) is included in the next cut (cb), then extend ca to end at
-    // the later of ca or cb.
-    if (ca->indexLast+1 >= cb->indexFirst ||
-        ca->indexLast == INT_MAX) {
-      ca->indexLast = MAX(ca->indexLast, cb->indexLast);
-      ca->next = cb->next;
-      psFree(cb);
-
-      cb = ca->next;
-      list->ncuts --;
-      continue;
-    }
-    ca = ca->next;
-    cb = ca->next;
+  mbCutChunk *chunk=cuts->chunks;
+  if ((chunk==NULL)||(chunk->used+n>chunk->size)) {
+    long size=(n>MB_CUTS_CHUNK ? n : MB_CUTS_CHUNK);
+    mbCutChunk *fresh=(mbCutChunk *)malloc(sizeof(mbCutChunk)+size*sizeof(mbCutRange));
+    assert(fresh);
+    fresh->next=chunk;
+    fresh->used=0;
+    fresh->size=size;
+    cuts->chunks=fresh;
+    chunk=fresh;
   }
+  mbCutRange *room=chunk->ranges+chunk->used;
+  chunk->used+=n;
+  return room;
 }
 
 
 
-/// Allocate a mbSingleCut structure.
-/// Also registers the deallocator.
+/// Add the cut [first,last], both inclusive, to a slot, keeping the ranges sorted and
+/// merging any that overlap or touch.  Binary search for the spot, then one memmove.
+/// \param cuts   The cuts object to be modified.
+/// \param slot   row*ncol+col, or MB_CUTS_GLOBAL_SLOT for the global cuts.
 /// \param first  The first data index to be cut.
 /// \param last   The last data index to be cut.
 
-mbSingleCut *mbSingleCutAlloc(int first, int last)
+static void cutSlotExtend(mbCuts *cuts, int slot, int first, int last)
 {
-  mbSingleCut *cut = psAlloc(sizeof(mbSingleCut));
+  assert (first <= last);
+  mbCutsFreeBitmaps(cuts);
+
+  int n=cuts->ncut[slot];
+  if (n==cuts->cap[slot]) {
+    int cap=(n ? 2*n : 4);
+    mbCutRange *room=cutsGetRoom(cuts,cap);
+    if (n)
+      memcpy(room,cuts->ranges[slot],n*sizeof(mbCutRange));
+    cuts->ranges[slot]=room;
+    cuts->cap[slot]=cap;
+  }
+  mbCutRange *r=cuts->ranges[slot];
+
+  // lo is the first range that starts after first, so the new cut goes at lo.  This puts it
+  // after any existing range with the same or lower indexFirst.
+  int lo=0;
+  int hi=n;
+  while (lo<hi) {
+    int mid=(lo+hi)/2;
+    if (r[mid].indexFirst<=first)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
 
-  cut->next = NULL;
-  cut->indexFirst = first;
-  cut->indexLast = last;
-    
-  return cut;
+  // Fold in the range before, if the new cut touches it.
+  int start=lo;
+  if ((start>0)&&((long)r[start-1].indexLast+1>=first)) {
+    start--;
+    if (r[start].indexFirst<first)
+      first=r[start].indexFirst;
+    if (r[start].indexLast>last)
+      last=r[start].indexLast;
+  }
+  // ...and every range after that it touches.
+  int stop=lo;
+  while ((stop<n)&&((long)last+1>=r[stop].indexFirst)) {
+    if (r[stop].indexLast>last)
+      last=r[stop].indexLast;
+    stop++;
+  }
+  // ranges [start,stop) get replaced by the single merged one.
+  int nremove=stop-start;
+  if (nremove!=1)
+    memmove(r+start+1,r+stop,(n-stop)*sizeof(mbCutRange));
+  r[start].indexFirst=first;
+  r[start].indexLast=last;
+  cuts->ncut[slot]=n+1-nremove;
+  cutSlotMerge(cuts,slot);
 }
 
 
 
 /// Allocate a mbCuts structure.
-/// Allocates the per-detector mbCutList objects but gives them empty cuts lists.
-/// Also registers the deallocator.
+/// Every detector starts out with no cuts; space for ranges is handed out as they arrive.
 
 mbCuts *mbCutsAlloc(int nrow,    ///< Number of rows
 		    int ncol)    ///< Number of columns
@@ -373,22 +379,23 @@ mbCuts *mbCutsAlloc(int nrow,    ///< Number of rows
   assert (ncol > 0);
 
   mbCuts *cuts = psAlloc(sizeof(mbCuts));
-  //psMemSetDeallocator(cuts, (psFreeFunc)CutsFree);
 
   cuts->nrow = nrow;
   cuts->ncol = ncol;
 
-  cuts->detCuts = psAlloc(nrow*sizeof(mbCutList **));
-  cuts->detCuts[0] = psAlloc(nrow*ncol*sizeof(mbCutList *));
-  for (int i=1; i<nrow; i++)
-    cuts->detCuts[i] = cuts->detCuts[0] + i*ncol;
-  for (int r=0; r<nrow; r++)
-    for (int c=0; c<ncol; c++)
-      cuts->detCuts[r][c] = NULL;
-
-  cuts->globalCuts = mbCutListAlloc();
-  cuts->globalCuts->head=NULL;
-  //cuts->tod = NULL;
+  int nslot=nrow*ncol+1;
+  cuts->ranges = psAlloc(nslot*sizeof(mbCutRange *));
+  cuts->ncut = psAlloc(nslot*sizeof(int));
+  cuts->cap = psAlloc(nslot*sizeof(int));
+  for (int i=0; i<nslot; i++) {
+    cuts->ranges[i] = NULL;
+    cuts->ncut[i] = 0;
+    cuts->cap[i] = 0;
+  }
+  cuts->chunks = NULL;
+  cuts->bitmap = NULL;
+  cuts->bitmap_ndata = 0;
+  cuts->bitmap_nword = 0;
   
   omp_init_lock(&(cuts->cutlock));
   return cuts;  
@@ -396,14 +403,11 @@ mbCuts *mbCutsAlloc(int nrow,    ///< Number of rows
 
 
 /// Return whether no data are cut.
-/// Recognize this state by having a cut list with no entries.
-/// \param list  The cut list to be checked.
+/// Recognize this state by having a slot with no ranges.
 
-static bool isThisListNeverCut(const mbCutList *list)
+static bool isThisSlotNeverCut(const mbCuts *cuts, int slot)
 {
-  if (list == NULL || list->head == NULL)
-    return true;
-  return false;
+  return (cuts->ncut[slot]==0);
 }
 	
 
@@ -422,29 +426,232 @@ bool mbCutsIsAlwaysCut(const mbCuts *cuts, int row, int col)
   if (col < 0 || col >= cuts->ncol) return true;
 
   // For valid arguments, find status.
-  if (isThisListAlwaysCut(cuts->globalCuts))
+  if (isThisSlotAlwaysCut(cuts, MB_CUTS_GLOBAL_SLOT(cuts)))
     return true;
-  if (isThisListNeverCut(cuts->detCuts[row][col]))
-    return false;
-  return (isThisListAlwaysCut(cuts->detCuts[row][col]));
+  return (isThisSlotAlwaysCut(cuts, row*cuts->ncol+col));
 }
 
 
 
 /// Return whether all data are cut.
 /// Recognize this state by having a cut encompassing all nonnegative integers.
-/// \param list  The cut list to be checked.
 
-static bool isThisListAlwaysCut(const mbCutList *list)
+static bool isThisSlotAlwaysCut(const mbCuts *cuts, int slot)
 {
-  if (list == NULL || list->head == NULL)
+  if (cuts->ncut[slot]==0)
     return false;
-  if (list->head->indexFirst <= 0 &&
-      list->head->indexLast == INT_MAX)
+  const mbCutRange *r=cuts->ranges[slot];
+  if (r[0].indexFirst <= 0 &&
+      r[0].indexLast == INT_MAX)
     return true;
   return false;
 }
-	
+
+
+
+/// Return whether a sample is cut, either globally or for this detector.  O(log ncuts).
+
+static bool isCutInSlot(const mbCuts *cuts, int slot, int index)
+{
+  const mbCutRange *r=cuts->ranges[slot];
+  int lo=0;
+  int hi=cuts->ncut[slot];
+  // find the last range starting at or before index.  Range ends are nondecreasing, so that's
+  // the only one that can contain it.
+  while (lo<hi) {
+    int mid=(lo+hi)/2;
+    if (r[mid].indexFirst<=index)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  return ((lo>0)&&(r[lo-1].indexLast>=index));
+}
+
+bool mbCutsIsCut(const mbCuts *cuts, int row, int col, int index)
+{
+  if (mbCutsIsAlwaysCut(cuts, row, col))
+    return true;
+  if (isCutInSlot(cuts, MB_CUTS_GLOBAL_SLOT(cuts), index))
+    return true;
+  return isCutInSlot(cuts, row*cuts->ncol+col, index);
+}
+
+
+
+/// Number of ranges in the combined global and detector cuts.
+
+int mbCutsGetNCut(const mbCuts *cuts, int row, int col)
+{
+  if (cuts == NULL ||
+      row < 0 || row >= cuts->nrow ||
+      col < 0 || col >= cuts->ncol)
+    return 0;
+  int gslot=MB_CUTS_GLOBAL_SLOT(cuts);
+  int slot=row*cuts->ncol+col;
+  cutMerge m;
+  cutMergeInit(&m, cuts->ranges[gslot], cuts->ncut[gslot], cuts->ranges[slot], cuts->ncut[slot]);
+  mbCutRange c;
+  int n=0;
+  while (cutMergeNext(&m, &c))
+    n++;
+  return n;
+}
+
+
+
+/// Write the combined global and detector cuts into out, which must have room for
+/// mbCutsGetNCut() ranges.  Returns the number written.
+
+int mbCutsGetRanges(const mbCuts *cuts, int row, int col, mbCutRange *out)
+{
+  if (cuts == NULL ||
+      row < 0 || row >= cuts->nrow ||
+      col < 0 || col >= cuts->ncol)
+    return 0;
+  int gslot=MB_CUTS_GLOBAL_SLOT(cuts);
+  int slot=row*cuts->ncol+col;
+  cutMerge m;
+  cutMergeInit(&m, cuts->ranges[gslot], cuts->ncut[gslot], cuts->ranges[slot], cuts->ncut[slot]);
+  int n=0;
+  while (cutMergeNext(&m, &out[n]))
+    n++;
+  return n;
+}
+
+
+
+/// Union of two sorted range lists.
+
+int mbCutRangesOr(const mbCutRange *a, int na, const mbCutRange *b, int nb, mbCutRange *out)
+{
+  cutMerge m;
+  cutMergeInit(&m, a, na, b, nb);
+  int n=0;
+  while (cutMergeNext(&m, &out[n]))
+    n++;
+  return n;
+}
+
+
+
+/// Intersection of two sorted, merged range lists.
+
+int mbCutRangesAnd(const mbCutRange *a, int na, const mbCutRange *b, int nb, mbCutRange *out)
+{
+  int n=0;
+  int ia=0;
+  int ib=0;
+  while ((ia<na)&&(ib<nb)) {
+    int first=(a[ia].indexFirst>b[ib].indexFirst ? a[ia].indexFirst : b[ib].indexFirst);
+    int last=(a[ia].indexLast<b[ib].indexLast ? a[ia].indexLast : b[ib].indexLast);
+    if (first<=last) {
+      out[n].indexFirst=first;
+      out[n].indexLast=last;
+      n++;
+    }
+    if (a[ia].indexLast<b[ib].indexLast)
+      ia++;
+    else
+      ib++;
+  }
+  return n;
+}
+
+
+
+/// Complement of a sorted, merged range list within [0,ndata-1].
+
+int mbCutRangesInvert(const mbCutRange *a, int na, int ndata, mbCutRange *out)
+{
+  int n=0;
+  long next=0;  //first sample not yet accounted for
+  for (int i=0;(i<na)&&(next<ndata);i++) {
+    if (a[i].indexFirst>next) {
+      out[n].indexFirst=next;
+      out[n].indexLast=(a[i].indexFirst<ndata ? a[i].indexFirst : ndata)-1;
+      n++;
+    }
+    if ((long)a[i].indexLast+1>next)
+      next=(long)a[i].indexLast+1;
+  }
+  if (next<ndata) {
+    out[n].indexFirst=next;
+    out[n].indexLast=ndata-1;
+    n++;
+  }
+  return n;
+}
+
+
+
+/// Build a packed bitmap for every detector, one bit per sample, set where the sample is cut
+/// (globally or for that detector).  All detectors share one allocation.
+
+void mbCutsBuildBitmaps(mbCuts *cuts, int ndata)
+{
+  mbCutsFreeBitmaps(cuts);
+  int nword=(ndata+63)/64;
+  int ndet=cuts->nrow*cuts->ncol;
+  uint64_t *bitmap=(uint64_t *)malloc(sizeof(uint64_t)*nword*(long)ndet);
+  assert(bitmap);
+  int gslot=MB_CUTS_GLOBAL_SLOT(cuts);
+#pragma omp parallel for shared(cuts,bitmap,ndata,nword,ndet,gslot) default(none) schedule(dynamic,16)
+  for (int slot=0;slot<ndet;slot++) {
+    uint64_t *bits=bitmap+slot*(long)nword;
+    memset(bits,0,sizeof(uint64_t)*nword);
+    cutMerge m;
+    cutMergeInit(&m, cuts->ranges[gslot], cuts->ncut[gslot], cuts->ranges[slot], cuts->ncut[slot]);
+    mbCutRange c;
+    while (cutMergeNext(&m, &c)) {
+      if (c.indexFirst>=ndata)
+	break;
+      int first=(c.indexFirst>0 ? c.indexFirst : 0);
+      int last=(c.indexLast<ndata ? c.indexLast : ndata-1);
+      int wfirst=first>>6;
+      int wlast=last>>6;
+      uint64_t lomask=~0ULL<<(first&63);
+      uint64_t himask=~0ULL>>(63-(last&63));
+      if (wfirst==wlast)
+	bits[wfirst]|=lomask&himask;
+      else {
+	bits[wfirst]|=lomask;
+	for (int w=wfirst+1;w<wlast;w++)
+	  bits[w]=~0ULL;
+	bits[wlast]|=himask;
+      }
+    }
+  }
+  cuts->bitmap=bitmap;
+  cuts->bitmap_ndata=ndata;
+  cuts->bitmap_nword=nword;
+}
+
+
+
+/// The bitmap for one detector, or NULL if mbCutsBuildBitmaps hasn't been called since the
+/// cuts last changed.
+
+const uint64_t *mbCutsGetBitmap(const mbCuts *cuts, int row, int col)
+{
+  if (cuts == NULL || cuts->bitmap == NULL ||
+      row < 0 || row >= cuts->nrow ||
+      col < 0 || col >= cuts->ncol)
+    return NULL;
+  return cuts->bitmap+(row*cuts->ncol+col)*(long)cuts->bitmap_nword;
+}
+
+
+
+void mbCutsFreeBitmaps(mbCuts *cuts)
+{
+  if (cuts->bitmap)
+    free(cuts->bitmap);
+  cuts->bitmap=NULL;
+  cuts->bitmap_ndata=0;
+  cuts->bitmap_nword=0;
+}
+
 
 
 static void
@@ -531,39 +738,44 @@ mbCutsGetUncut(
         return uncut;
     }
 
-    mbCutList *list = cutListOr(cuts->globalCuts, cuts->detCuts[row][col]);
-    assert (list->head != NULL);
+    // walk the global and detector cuts together rather than building a merged copy.
+    int gslot = MB_CUTS_GLOBAL_SLOT(cuts);
+    int slot = row*cuts->ncol+col;
+    int nmax = cuts->ncut[gslot] + cuts->ncut[slot];
+    assert (nmax > 0);
+    cutMerge m;
+    cutMergeInit(&m, cuts->ranges[gslot], cuts->ncut[gslot], cuts->ranges[slot], cuts->ncut[slot]);
 
-    uncut->indexFirst = psAlloc( (list->ncuts+1)*sizeof(int) );
-    uncut->indexLast = psAlloc( (list->ncuts+1)*sizeof(int) );
+    uncut->indexFirst = psAlloc( (nmax+1)*sizeof(int) );
+    uncut->indexLast = psAlloc( (nmax+1)*sizeof(int) );
     uncut->nregions = 1;
     uncut->indexFirst[0] = min;
     uncut->indexLast[0] = max;
 
-    for ( mbSingleCut *c = list->head; c != NULL; c=c->next )
+    mbCutRange c;
+    while ( cutMergeNext(&m, &c) )
     {
         // ignore cuts outside of [min,max]
-        if ( c->indexLast < min )
+        if ( c.indexLast < min )
             continue;
-        if ( c->indexFirst > max )
+        if ( c.indexFirst > max )
             break;
 
         int i = uncut->nregions - 1;
 
-        if ( c->indexFirst <= min ) // cut intersects min
-            uncut->indexFirst[i] = c->indexLast + 1;
-        else if ( c->indexLast >= max ) // cut intersects max
-            uncut->indexLast[i] = c->indexFirst - 1;
+        if ( c.indexFirst <= min ) // cut intersects min
+            uncut->indexFirst[i] = c.indexLast + 1;
+        else if ( c.indexLast >= max ) // cut intersects max
+            uncut->indexLast[i] = c.indexFirst - 1;
         else // cut contained in (min,max)
         {
             uncut->nregions++;
-            uncut->indexLast[i] = c->indexFirst - 1;
-            uncut->indexFirst[i+1] = c->indexLast + 1;
+            uncut->indexLast[i] = c.indexFirst - 1;
+            uncut->indexFirst[i+1] = c.indexLast + 1;
             uncut->indexLast[i+1] = max;
         }
     }
 
-    psFree(list);
     return uncut;
 }
 
@@ -582,28 +794,13 @@ bool mbCutsIsNeverCut(const mbCuts *cuts, int row, int col)
   if (col < 0 || col >= cuts->ncol) return false;
 
   // For valid arguments, find status.
-  if (isThisListNeverCut(cuts->globalCuts) &&
-      isThisListNeverCut(cuts->detCuts[row][col]))
+  if (isThisSlotNeverCut(cuts, MB_CUTS_GLOBAL_SLOT(cuts)) &&
+      isThisSlotNeverCut(cuts, row*cuts->ncol+col))
     return true;
   return false;
 }
 
 
-static mbCutList *cutListOr(const mbCutList *a, const mbCutList *b)
-{
-  mbCutList *or = mbCutListAlloc();
-  mbSingleCut *cut;
-  if (!isThisListNeverCut( a )){
-    for (cut = a->head; cut != NULL; cut=cut->next)
-      cutListExtend(or, cut->indexFirst, cut->indexLast);
-  }
-  if (!isThisListNeverCut( b )){
-    for (cut = b->head; cut != NULL; cut=cut->next)
-        cutListExtend(or, cut->indexFirst, cut->indexLast);
-  }
-  return or;
-}
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Methods to change cut status
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -642,8 +839,9 @@ int mbCutsWrite(const mbCuts *cuts, const char *filename)
 
   fprintf( f, "%d %d\n", cuts->nrow, cuts->ncol );
 
-  for ( mbSingleCut *ct = cuts->globalCuts->head; ct != NULL; ct = ct->next ){
-    fprintf( f, "(%d,%d) ", ct->indexFirst, ct->indexLast );
+  int gslot = MB_CUTS_GLOBAL_SLOT(cuts);
+  for ( int i = 0; i < cuts->ncut[gslot]; i++ ){
+    fprintf( f, "(%d,%d) ", cuts->ranges[gslot][i].indexFirst, cuts->ranges[gslot][i].indexLast );
   }
 
   nline += 2;
@@ -652,10 +850,11 @@ int mbCutsWrite(const mbCuts *cuts, const char *filename)
 
   for ( int c = 0; c < cuts->ncol; c++ ) {
     for ( int r = 0; r < cuts->nrow; r++) {
-      if ( isThisListNeverCut( cuts->detCuts[r][c] ) ) continue;
+      int slot = r*cuts->ncol+c;
+      if ( isThisSlotNeverCut( cuts, slot ) ) continue;
       fprintf( f, "r%2.2dc%2.2d: ", r, c );
-      for ( mbSingleCut *ct = cuts->detCuts[r][c]->head; ct != NULL; ct = ct->next ){
-        fprintf( f, "(%d,%d) ", ct->indexFirst, ct->indexLast );
+      for ( int i = 0; i < cuts->ncut[slot]; i++ ){
+        fprintf( f, "(%d,%d) ", cuts->ranges[slot][i].indexFirst, cuts->ranges[slot][i].indexLast );
       }
       fputc('\n', f);
       nline++;
@@ -682,26 +881,21 @@ mbCuts *mbCutsAllocFromCuts( const mbCuts **cutsList, int ncuts )
   uberCuts = mbCutsAlloc( cutsList[0]->nrow, cutsList[0]->ncol );
   for ( int i = 0; i < ncuts; i++ )
     {
-      mbSingleCut *sc;
       const mbCuts *cuts = cutsList[i];
 
       // First global cuts
-      if (cuts->globalCuts != NULL)
+      int gslot = MB_CUTS_GLOBAL_SLOT(cuts);
+      for ( int k = 0; k < cuts->ncut[gslot]; k++ )
 	{
-	  for ( sc = cuts->globalCuts->head; sc != NULL; sc = sc->next )
-	    {
-	      mbCutsExtendGlobal( uberCuts, sc->indexFirst, sc->indexLast );
-	    }
+	  mbCutsExtendGlobal( uberCuts, cuts->ranges[gslot][k].indexFirst, cuts->ranges[gslot][k].indexLast );
 	}
 
       // now cuts for individual detectors
       for ( int r = 0; r < cuts->nrow; r++ ) {
 	for ( int c = 0; c < cuts->ncol; c++ ) {
-	  if ( cuts->detCuts[r][c] != NULL ) {
-	    for ( sc = cuts->detCuts[r][c]->head; sc != NULL;
-		  sc = sc->next ) {
-	      mbCutsExtend( uberCuts, sc->indexFirst, sc->indexLast, r, c );
-	    }
+	  int slot = r*cuts->ncol+c;
+	  for ( int k = 0; k < cuts->ncut[slot]; k++ ) {
+	    mbCutsExtend( uberCuts, cuts->ranges[slot][k].indexFirst, cuts->ranges[slot][k].indexLast, r, c );
 	  }
 	}
       }
@@ -709,5 +903,3 @@ mbCuts *mbCutsAllocFromCuts( const mbCuts **cutsList, int ncuts )
 
   return uberCuts;
 }
-
-
@@ -3,18 +3,24 @@
 #endif
  
 #include <assert.h>
+#include <dirent.h>
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 #ifndef NO_FFTW
 #include <fftw3.h>
 #endif
 
 #include <getopt.h>
 #include <omp.h>
+#include <pthread.h>
 //#include <cpgplot.h>
 
 #include "ninkasi.h"
@@ -133,6 +139,143 @@ void mbStartTime(pca_time *tt)
 {
   tick(tt);
 }
+/*--------------------------------------------------------------------------------*/
+//Hot-path profiler.  Each thread that records anything gets its own slot the first time it
+//does, so there's no contention (the pipeline and prefetch threads live in nested teams, so
+//omp_get_thread_num isn't unique).  Slots are padded out so they don't share cache lines.
+//With profiling off, nk_profile_tick/tock are a test of nk_profile_on and nothing else.
+
+#define NK_PROFILE_MAX_SLOT 256
+
+typedef struct {
+  double time[NK_PROF_NSTAGE];
+  long ncall[NK_PROF_NSTAGE];
+  char pad[64];
+} nkProfileSlot;
+
+bool nk_profile_on=false;
+static nkProfileSlot nk_profile_slots[NK_PROFILE_MAX_SLOT];
+static int nk_profile_nslot=0;
+static __thread int nk_profile_myslot=-1;
+static const char *nk_profile_names[NK_PROF_NSTAGE]={"read_tod","map2tod","noise","tod2map","mpi_reduce","pointing"};
+
+/*--------------------------------------------------------------------------------*/
+void nk_profile_add(int stage, double dt)
+{
+  if (nk_profile_myslot<0) {
+    int slot;
+#pragma omp atomic capture
+    slot=nk_profile_nslot++;
+    if (slot>=NK_PROFILE_MAX_SLOT)
+      slot=NK_PROFILE_MAX_SLOT-1;  //everyone past the end shares the last one, hence the atomics
+    nk_profile_myslot=slot;
+  }
+  nkProfileSlot *me=nk_profile_slots+nk_profile_myslot;
+#pragma omp atomic
+  me->time[stage]+=dt;
+#pragma omp atomic
+  me->ncall[stage]++;
+}
+/*--------------------------------------------------------------------------------*/
+void nk_profile_reset(bool on)
+{
+  memset(nk_profile_slots,0,sizeof(nk_profile_slots));
+  nk_profile_on=on;
+}
+/*--------------------------------------------------------------------------------*/
+void nk_profile_report(PARAMS *params, double wall)
+//collect everybody's stage times and print the min/max/mean over processes.  If
+//params->profile_file is set, the master also writes the report there, as JSON if the name
+//ends in .json and CSV otherwise.  Times are summed over threads, so stages run inside
+//parallel regions can add up to more than the wall time, and pointing is also counted in
+//the projection stages that call it.
+{
+  if (!nk_profile_on)
+    return;
+  int nslot=(nk_profile_nslot<NK_PROFILE_MAX_SLOT ? nk_profile_nslot : NK_PROFILE_MAX_SLOT);
+  int nval=3*NK_PROF_NSTAGE+1;  //per stage thread-seconds, busiest thread, calls; then wall time
+  double *mine=dvector(nval);
+  memset(mine,0,sizeof(double)*nval);
+  for (int s=0;s<nslot;s++)
+    for (int i=0;i<NK_PROF_NSTAGE;i++) {
+      mine[i]+=nk_profile_slots[s].time[i];
+      if (nk_profile_slots[s].time[i]>mine[NK_PROF_NSTAGE+i])
+	mine[NK_PROF_NSTAGE+i]=nk_profile_slots[s].time[i];
+      mine[2*NK_PROF_NSTAGE+i]+=nk_profile_slots[s].ncall[i];
+    }
+  mine[3*NK_PROF_NSTAGE]=wall;
+
+  int myid=0,nproc=1;
+#ifdef HAVE_MPI
+  MPI_Comm_rank(MPI_COMM_WORLD,&myid);
+  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
+#endif
+  double *all=dvector(nval*nproc);
+#ifdef HAVE_MPI
+  MPI_Gather(mine,nval,MPI_DOUBLE,all,nval,MPI_DOUBLE,0,MPI_COMM_WORLD);
+#else
+  memcpy(all,mine,sizeof(double)*nval);
+#endif
+  if (myid==0) {
+    double tmin[NK_PROF_NSTAGE],tmax[NK_PROF_NSTAGE],tmean[NK_PROF_NSTAGE],thread_max[NK_PROF_NSTAGE],ncall[NK_PROF_NSTAGE];
+    for (int i=0;i<NK_PROF_NSTAGE;i++) {
+      tmin[i]=all[i];
+      tmax[i]=all[i];
+      tmean[i]=0;
+      thread_max[i]=0;
+      ncall[i]=0;
+      for (int j=0;j<nproc;j++) {
+	double t=all[j*nval+i];
+	if (t<tmin[i])
+	  tmin[i]=t;
+	if (t>tmax[i])
+	  tmax[i]=t;
+	tmean[i]+=t/nproc;
+	if (all[j*nval+NK_PROF_NSTAGE+i]>thread_max[i])
+	  thread_max[i]=all[j*nval+NK_PROF_NSTAGE+i];
+	ncall[i]+=all[j*nval+2*NK_PROF_NSTAGE+i];
+      }
+    }
+    printf("profile over %d processes, %8.3f seconds wall on the master (thread-seconds per process):\n",nproc,wall);
+    printf("%12s %12s %12s %12s %12s %12s\n","stage","calls","min","max","mean","max_thread");
+    for (int i=0;i<NK_PROF_NSTAGE;i++)
+      printf("%12s %12.0f %12.4f %12.4f %12.4f %12.4f\n",nk_profile_names[i],ncall[i],tmin[i],tmax[i],tmean[i],thread_max[i]);
+
+    if (strlen(params->profile_file)>0) {
+      FILE *outfile=fopen_safe(params->profile_file,"w");
+      if (!outfile)
+	fprintf(stderr,"Unable to open %s for writing the profile.\n",params->profile_file);
+      else {
+	const char *ext=strrchr(params->profile_file,'.');
+	if ((ext)&&(strcmp(ext,".json")==0)) {
+	  fprintf(outfile,"{\n  \"nproc\": %d,\n  \"nthread\": %d,\n  \"wall\": %.6f,\n  \"stages\": [\n",nproc,omp_get_max_threads(),wall);
+	  for (int i=0;i<NK_PROF_NSTAGE;i++) {
+	    fprintf(outfile,"    {\"name\": \"%s\", \"calls\": %.0f, \"min\": %.6f, \"max\": %.6f, \"mean\": %.6f, \"max_thread\": %.6f, \"per_rank\": [",nk_profile_names[i],ncall[i],tmin[i],tmax[i],tmean[i],thread_max[i]);
+	    for (int j=0;j<nproc;j++)
+	      fprintf(outfile,"%s%.6f",(j ? ", " : ""),all[j*nval+i]);
+	    fprintf(outfile,"]}%s\n",(i<NK_PROF_NSTAGE-1 ? "," : ""));
+	  }
+	  fprintf(outfile,"  ]\n}\n");
+	}
+	else {
+	  fprintf(outfile,"stage,calls,min,max,mean,max_thread");
+	  for (int j=0;j<nproc;j++)
+	    fprintf(outfile,",rank%d",j);
+	  fprintf(outfile,"\n");
+	  for (int i=0;i<NK_PROF_NSTAGE;i++) {
+	    fprintf(outfile,"%s,%.0f,%.6f,%.6f,%.6f,%.6f",nk_profile_names[i],ncall[i],tmin[i],tmax[i],tmean[i],thread_max[i]);
+	    for (int j=0;j<nproc;j++)
+	      fprintf(outfile,",%.6f",all[j*nval+i]);
+	    fprintf(outfile,"\n");
+	  }
+	}
+	fclose(outfile);
+      }
+    }
+  }
+  free(all);
+  free(mine);
+}
 
 /*--------------------------------------------------------------------------------*/
 void *malloc_retry(size_t n)
@@ -389,6 +532,283 @@ act_fftw_plan act_fftw_plan_dft_c2r_1d(int n, act_fftw_complex *vec2,actData *ve
 #endif
   return p;
 }
+/*--------------------------------------------------------------------------------*/
+void act_fftw_execute_dft(act_fftw_plan p, act_fftw_complex *in, act_fftw_complex *out)
+{
+#ifndef ACTDATA_DOUBLE
+  fftwf_execute_dft(p,in,out);
+#else
+  fftw_execute_dft(p,in,out);
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+//Plan cache for TOD-length transforms.  The planner runs once per distinct transform
+//(kind, length, batch, alignment, threads) for the life of the process, and everybody else
+//just executes with the new-array interface, so a PCG iteration never hits the planner.
+//Plans are made on scratch buffers that have the same SIMD alignment as the caller's arrays,
+//so FFTW_MEASURE/FFTW_PATIENT can't stomp on real data.
+
+#define NK_FFT_R2C 0
+#define NK_FFT_C2R 1
+#define NK_FFT_C2C_FORWARD 2
+#define NK_FFT_C2C_BACKWARD 3
+
+typedef struct {
+  int kind;
+  int n;
+  int howmany;
+  int nthread;  //0 means "whatever the planner was set to"
+  int ialign;
+  int oalign;
+  int inplace;
+  act_fftw_plan plan;
+} nkFFTPlanCacheEntry;
+
+static nkFFTPlanCacheEntry *fft_plan_cache=NULL;
+static int fft_plan_cache_n=0;
+static int fft_plan_cache_size=0;
+static unsigned fft_planner_flags=FFTW_ESTIMATE;
+static int fft_planner_nthread=0;  //what the fftw planner is set to, 0 until act_fftw_init_threads
+
+/*--------------------------------------------------------------------------------*/
+void act_fftw_set_planner_flags(unsigned flags)
+//only affects plans that aren't in the cache yet.
+{
+  fft_planner_flags=flags;
+}
+/*--------------------------------------------------------------------------------*/
+unsigned act_fftw_get_planner_flags( void )
+{
+  return fft_planner_flags;
+}
+/*--------------------------------------------------------------------------------*/
+static int act_fftw_alignment_of(void *ptr)
+{
+  if (ptr==NULL)
+    return 0;
+#ifndef ACTDATA_DOUBLE
+  return fftwf_alignment_of((float *)ptr);
+#else
+  return fftw_alignment_of((double *)ptr);
+#endif
+}
+/*--------------------------------------------------------------------------------*/
+void act_fftw_init_threads( void )
+//has to run before any other fftw call, or the first plan_with_nthreads throws away the wisdom and
+//any plans made so far.  Safe to call more than once.  The planner starts out with all our threads.
+{
+#pragma omp critical (nk_fft_plan_cache)
+  if (fft_planner_nthread==0) {
+#ifndef ACTDATA_DOUBLE
+    fftwf_init_threads();
+#else
+    fftw_init_threads();
+#endif
+    fft_planner_nthread=omp_get_max_threads();
+#ifndef ACTDATA_DOUBLE
+    fftwf_plan_with_nthreads(fft_planner_nthread);
+#else
+    fftw_plan_with_nthreads(fft_planner_nthread);
+#endif
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static int act_fftw_plan_with_nthreads(int nthread)
+//returns the thread count the planner had before, so it can be put back.  Does nothing until
+//act_fftw_init_threads has run, since fftw's threads aren't usable before that.
+{
+  int old=fft_planner_nthread;
+  if ((old==0)||(nthread==old))
+    return old;
+#ifndef ACTDATA_DOUBLE
+  fftwf_plan_with_nthreads(nthread);
+#else
+  fftw_plan_with_nthreads(nthread);
+#endif
+  fft_planner_nthread=nthread;
+  return old;
+}
+/*--------------------------------------------------------------------------------*/
+static act_fftw_plan make_cached_fft_plan(int kind, int n, int howmany, int ialign, int oalign, int inplace, int nthread)
+//must be called from inside the plan cache critical section, since the FFTW planner isn't thread safe.
+{
+  int nn=n;
+  if ((kind==NK_FFT_R2C)||(kind==NK_FFT_C2R))
+    nn=n/2+1;
+  //in-place real transforms work on rows padded out to 2*(n/2+1) reals.
+  int rdist=(inplace ? 2*nn : n);
+  size_t rbytes=sizeof(actData)*(size_t)rdist*howmany;
+  size_t cbytes=sizeof(act_fftw_complex)*(size_t)nn*howmany;
+  size_t ibytes=(kind==NK_FFT_R2C ? rbytes : cbytes);
+  size_t obytes=(kind==NK_FFT_C2R ? rbytes : cbytes);
+
+  char *ibuf=(char *)act_fftw_malloc(ibytes+ialign);
+  assert(ibuf!=NULL);
+  char *obuf=ibuf;
+  if (!inplace) {
+    obuf=(char *)act_fftw_malloc(obytes+oalign);
+    assert(obuf!=NULL);
+  }
+  void *in=ibuf+ialign;
+  void *out=obuf+oalign;
+  
+  int old_nthread=0;
+  if (nthread>0)
+    old_nthread=act_fftw_plan_with_nthreads(nthread);
+  
+  int dims[1];
+  dims[0]=n;
+  act_fftw_plan plan=NULL;
+#ifndef ACTDATA_DOUBLE
+  switch(kind) {
+  case NK_FFT_R2C:
+    plan=fftwf_plan_many_dft_r2c(1,dims,howmany,(float *)in,NULL,1,rdist,(fftwf_complex *)out,NULL,1,nn,fft_planner_flags);
+    break;
+  case NK_FFT_C2R:
+    plan=fftwf_plan_many_dft_c2r(1,dims,howmany,(fftwf_complex *)in,NULL,1,nn,(float *)out,NULL,1,rdist,fft_planner_flags);
+    break;
+  default:
+    plan=fftwf_plan_many_dft(1,dims,howmany,(fftwf_complex *)in,NULL,1,n,(fftwf_complex *)out,NULL,1,n,
+			     (kind==NK_FFT_C2C_FORWARD ? FFTW_FORWARD : FFTW_BACKWARD),fft_planner_flags);
+    break;
+  }
+#else
+  switch(kind) {
+  case NK_FFT_R2C:
+    plan=fftw_plan_many_dft_r2c(1,dims,howmany,(double *)in,NULL,1,rdist,(fftw_complex *)out,NULL,1,nn,fft_planner_flags);
+    break;
+  case NK_FFT_C2R:
+    plan=fftw_plan_many_dft_c2r(1,dims,howmany,(fftw_complex *)in,NULL,1,nn,(double *)out,NULL,1,rdist,fft_planner_flags);
+    break;
+  default:
+    plan=fftw_plan_many_dft(1,dims,howmany,(fftw_complex *)in,NULL,1,n,(fftw_complex *)out,NULL,1,n,
+			    (kind==NK_FFT_C2C_FORWARD ? FFTW_FORWARD : FFTW_BACKWARD),fft_planner_flags);
+    break;
+  }
+#endif
+
+  if (nthread>0)
+    act_fftw_plan_with_nthreads(old_nthread);
+  
+  if (!inplace)
+    act_fftw_free((act_fftw_complex *)obuf);
+  act_fftw_free((act_fftw_complex *)ibuf);
+  
+  if (plan==NULL) {
+    fprintf(stderr,"Had a problem getting an fft plan of kind %d, length %d, batch %d.\n",kind,n,howmany);
+    assert(1==0);
+  }
+  return plan;
+}
+/*--------------------------------------------------------------------------------*/
+static act_fftw_plan get_cached_fft_plan(int kind, int n, int howmany, void *in, void *out, int nthread)
+//in/out are only looked at for their alignment.  NULL means FFTW-aligned.
+{
+  int ialign=act_fftw_alignment_of(in);
+  int oalign=act_fftw_alignment_of(out);
+  int inplace=((in!=NULL)&&(in==out));
+  act_fftw_plan plan=NULL;
+
+#pragma omp critical (nk_fft_plan_cache)
+  {
+    for (int i=0;i<fft_plan_cache_n;i++) {
+      nkFFTPlanCacheEntry *entry=&(fft_plan_cache[i]);
+      if ((entry->kind==kind)&&(entry->n==n)&&(entry->howmany==howmany)&&(entry->nthread==nthread)&&
+	  (entry->ialign==ialign)&&(entry->oalign==oalign)&&(entry->inplace==inplace)) {
+	plan=entry->plan;
+	break;
+      }
+    }
+    if (plan==NULL) {
+      if (fft_plan_cache_n==fft_plan_cache_size) {
+	fft_plan_cache_size=(fft_plan_cache_size>0 ? 2*fft_plan_cache_size : 16);
+	fft_plan_cache=(nkFFTPlanCacheEntry *)realloc(fft_plan_cache,sizeof(nkFFTPlanCacheEntry)*fft_plan_cache_size);
+	assert(fft_plan_cache!=NULL);
+      }
+      plan=make_cached_fft_plan(kind,n,howmany,ialign,oalign,inplace,nthread);
+      nkFFTPlanCacheEntry *entry=&(fft_plan_cache[fft_plan_cache_n]);
+      entry->kind=kind;
+      entry->n=n;
+      entry->howmany=howmany;
+      entry->nthread=nthread;
+      entry->ialign=ialign;
+      entry->oalign=oalign;
+      entry->inplace=inplace;
+      entry->plan=plan;
+      fft_plan_cache_n++;
+    }
+  }
+  return plan;
+}
+/*--------------------------------------------------------------------------------*/
+act_fftw_plan act_fftw_cached_plan_r2c(int n, int howmany, actData *in, act_fftw_complex *out, int nthread)
+//batched plans assume contiguous rows, n reals in and n/2+1 complex out per transform.
+//In-place plans (in==out) take their real rows padded to 2*(n/2+1), as FFTW wants.
+//Cached plans belong to the cache - don't destroy them.
+{
+  return get_cached_fft_plan(NK_FFT_R2C,n,howmany,in,out,nthread);
+}
+/*--------------------------------------------------------------------------------*/
+act_fftw_plan act_fftw_cached_plan_c2r(int n, int howmany, act_fftw_complex *in, actData *out, int nthread)
+{
+  return get_cached_fft_plan(NK_FFT_C2R,n,howmany,in,out,nthread);
+}
+/*--------------------------------------------------------------------------------*/
+act_fftw_plan act_fftw_cached_plan_c2c(int n, int howmany, act_fftw_complex *in, act_fftw_complex *out, int sign, int nthread)
+{
+  return get_cached_fft_plan((sign==FFTW_FORWARD ? NK_FFT_C2C_FORWARD : NK_FFT_C2C_BACKWARD),n,howmany,in,out,nthread);
+}
+/*--------------------------------------------------------------------------------*/
+int act_fftw_plan_cache_size( void )
+{
+  return fft_plan_cache_n;
+}
+/*--------------------------------------------------------------------------------*/
+void act_fftw_clear_plan_cache( void )
+//only safe when nobody is holding on to a cached plan, e.g. tod->p_forward.
+{
+#pragma omp critical (nk_fft_plan_cache)
+  {
+    for (int i=0;i<fft_plan_cache_n;i++)
+      act_fftw_destroy_plan(fft_plan_cache[i].plan);
+    free(fft_plan_cache);
+    fft_plan_cache=NULL;
+    fft_plan_cache_n=0;
+    fft_plan_cache_size=0;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+int act_fftw_import_wisdom(const char *fname)
+//returns 1 if wisdom was read.  A missing file is fine, it just means nothing has been saved yet.
+{
+  int ok=0;
+#pragma omp critical (nk_fft_plan_cache)
+  {
+#ifndef ACTDATA_DOUBLE
+    ok=fftwf_import_wisdom_from_filename(fname);
+#else
+    ok=fftw_import_wisdom_from_filename(fname);
+#endif
+  }
+  return ok;
+}
+/*--------------------------------------------------------------------------------*/
+int act_fftw_export_wisdom(const char *fname)
+{
+  int ok=0;
+#pragma omp critical (nk_fft_plan_cache)
+  {
+#ifndef ACTDATA_DOUBLE
+    ok=fftwf_export_wisdom_to_filename(fname);
+#else
+    ok=fftw_export_wisdom_to_filename(fname);
+#endif
+  }
+  if (!ok)
+    fprintf(stderr,"Failed to write fftw wisdom to %s\n",fname);
+  return ok;
+}
 			
 /*--------------------------------------------------------------------------------*/
 FILE *fopen_safe(char *filename, char *mode)
@@ -434,8 +854,159 @@ int how_many_tods(char *froot, PARAMS *params)
   return params->ntod;
 }
 
+/*--------------------------------------------------------------------------------*/
+static double get_path_bytes(const char *path)
+//size of a file, or of all the regular files directly inside a directory (i.e. a dirfile).
+//On-disk size tracks ndet*ndata closely enough to balance on, and is cheap to get.
+{
+  struct stat st;
+  if (stat(path,&st)!=0)
+    return 0;
+  if (!S_ISDIR(st.st_mode))
+    return st.st_size;
+  DIR *dir=opendir(path);
+  if (!dir)
+    return 0;
+  double tot=0;
+  struct dirent *ent;
+  char fname[2*MAXLEN];
+  while ((ent=readdir(dir))!=NULL) {
+    if (ent->d_name[0]=='.')
+      continue;
+    snprintf(fname,sizeof(fname),"%s/%s",path,ent->d_name);
+    if ((stat(fname,&st)==0)&&(S_ISREG(st.st_mode)))
+      tot+=st.st_size;
+  }
+  closedir(dir);
+  return tot;
+}
+/*--------------------------------------------------------------------------------*/
+static int compare_doubles(const void *a, const void *b)
+{
+  double aa=*(const double *)a;
+  double bb=*(const double *)b;
+  return (aa>bb)-(aa<bb);
+}
+/*--------------------------------------------------------------------------------*/
+static void estimate_tod_costs(const PARAMS *params, int ntod, double *cost)
+//relative cost of each TOD.  Starts from the on-disk size, then swaps in measured times from
+//params->tod_cost_file where we have them.  TODs without a measurement get their size estimate
+//scaled by the median seconds/byte of those with one.
+{
+  for (int i=0;i<ntod;i++)
+    cost[i]=get_path_bytes(params->datanames[i]);
+
+  double *measured=(double *)malloc_retry(sizeof(double)*ntod);
+  for (int i=0;i<ntod;i++)
+    measured[i]=-1;
+  if (strlen(params->tod_cost_file)>0) {
+    FILE *test=fopen(params->tod_cost_file,"r");
+    if (test) {
+      fclose(test);
+      int myargc;
+      char *line_in=read_all_stdin(params->tod_cost_file);
+      char **myargv=create_argv_new(line_in,&myargc," \n");
+      int nfound=0;
+      for (int j=0;j+1<myargc;j+=2)
+	for (int i=0;i<ntod;i++)
+	  if ((measured[i]<0)&&(strcmp(myargv[j],params->datanames[i])==0)) {
+	    measured[i]=atof(myargv[j+1]);
+	    nfound++;
+	    break;
+	  }
+      free(line_in);
+      free_argv(myargc,myargv);
+      printf("found timings for %d of %d TODs in %s\n",nfound,ntod,params->tod_cost_file);
+    }
+    else
+      printf("no TOD timings in %s yet, balancing on size alone.\n",params->tod_cost_file);
+  }
+
+  double *ratios=(double *)malloc_retry(sizeof(double)*ntod);
+  int nratio=0;
+  for (int i=0;i<ntod;i++)
+    if ((measured[i]>0)&&(cost[i]>0))
+      ratios[nratio++]=measured[i]/cost[i];
+  if (nratio>0) {
+    qsort(ratios,nratio,sizeof(double),compare_doubles);
+    double scale=ratios[nratio/2];
+    for (int i=0;i<ntod;i++)
+      cost[i]=(measured[i]>0 ? measured[i] : cost[i]*scale);
+  }
+  //if we couldn't size something, call it average so it still gets a fair share.
+  double tot=0;
+  int nknown=0;
+  for (int i=0;i<ntod;i++)
+    if (cost[i]>0) {
+      tot+=cost[i];
+      nknown++;
+    }
+  for (int i=0;i<ntod;i++)
+    if (cost[i]<=0)
+      cost[i]=(nknown>0 ? tot/nknown : 1.0);
+  free(ratios);
+  free(measured);
+}
+/*--------------------------------------------------------------------------------*/
+typedef struct {
+  double cost;
+  int ind;
+} TODCost;
+
+static int compare_tod_costs(const void *a, const void *b)
+//biggest first, ties in file order so every process comes up with the same answer.
+{
+  const TODCost *aa=(const TODCost *)a;
+  const TODCost *bb=(const TODCost *)b;
+  if (aa->cost!=bb->cost)
+    return (aa->cost<bb->cost)-(aa->cost>bb->cost);
+  return aa->ind-bb->ind;
+}
+/*--------------------------------------------------------------------------------*/
+static void assign_tods_lpt(const double *cost, int ntod, int nproc, int *owner)
+//longest-processing-time first: hand out TODs from most to least expensive, each to the
+//currently least-loaded process.
+{
+  TODCost *order=(TODCost *)malloc_retry(sizeof(TODCost)*ntod);
+  for (int i=0;i<ntod;i++) {
+    order[i].cost=cost[i];
+    order[i].ind=i;
+  }
+  qsort(order,ntod,sizeof(TODCost),compare_tod_costs);
+  double *load=(double *)calloc(nproc,sizeof(double));
+  for (int i=0;i<ntod;i++) {
+    int best=0;
+    for (int j=1;j<nproc;j++)
+      if (load[j]<load[best])
+	best=j;
+    owner[order[i].ind]=best;
+    load[best]+=order[i].cost;
+  }
+  free(load);
+  free(order);
+}
+/*--------------------------------------------------------------------------------*/
+static double predicted_imbalance(const double *cost, const int *owner, int ntod, int nproc)
+//max/mean of the per-process load for an assignment.
+{
+  double *load=(double *)calloc(nproc,sizeof(double));
+  double tot=0;
+  for (int i=0;i<ntod;i++) {
+    load[owner[i]]+=cost[i];
+    tot+=cost[i];
+  }
+  double mymax=0;
+  for (int j=0;j<nproc;j++)
+    if (load[j]>mymax)
+      mymax=load[j];
+  free(load);
+  return (tot>0 ? mymax/(tot/nproc) : 1.0);
+}
 /*--------------------------------------------------------------------------------*/
 int find_my_tods(TODvec *tods, PARAMS *params)
+//decide which TODs this process owns.  Round-robin by default; with params->balance_tods,
+//TODs are costed on the master (see estimate_tod_costs), the costs are broadcast, and every
+//process runs the same LPT assignment.
 {
 #ifdef HAVE_MPI
   int ierr,myid,nproc;
@@ -448,25 +1019,107 @@ int find_my_tods(TODvec *tods, PARAMS *params)
   int nproc=1;
 #endif
 
-  tods->ntod=0;
-
-
-  //first, do a simple loop to figure out how many I own
-  for (int i=myid;i<tods->total_tod;i+=nproc) {
-    tods->ntod++;
+  int *owner=(int *)malloc_retry(sizeof(int)*(tods->total_tod+1));
+  for (int i=0;i<tods->total_tod;i++)
+    owner[i]=i%nproc;
+  if ((params->balance_tods)&&(nproc>1)&&(tods->total_tod>0)) {
+    double *cost=(double *)malloc_retry(sizeof(double)*tods->total_tod);
+    if (myid==0)
+      estimate_tod_costs(params,tods->total_tod,cost);
+#ifdef HAVE_MPI
+    MPI_Bcast(cost,tods->total_tod,MPI_DOUBLE,0,MPI_COMM_WORLD);
+#endif
+    double rr=predicted_imbalance(cost,owner,tods->total_tod,nproc);
+    assign_tods_lpt(cost,tods->total_tod,nproc,owner);
+    mprintf(stdout,"balanced TODs over %d processes, predicted max/mean load %6.3f vs %6.3f for round-robin.\n",nproc,predicted_imbalance(cost,owner,tods->total_tod,nproc),rr);
+    free(cost);
   }
-  tods->my_fnames=(char **)malloc_retry(sizeof(char *)*tods->ntod);
+
+  tods->ntod=0;
+  for (int i=0;i<tods->total_tod;i++)
+    if (owner[i]==myid)
+      tods->ntod++;
+  tods->my_fnames=(char **)malloc_retry(sizeof(char *)*(tods->ntod+1));
+  tods->my_inds=(int *)malloc_retry(sizeof(int)*(tods->ntod+1));
+  tods->tod_time=(double *)calloc(tods->ntod+1,sizeof(double));
   tods->tods=(mbTOD *)calloc(sizeof(mbTOD),tods->ntod);
   int ii=0;
-  for (int i=myid;i<tods->total_tod;i+=nproc) {
+  for (int i=0;i<tods->total_tod;i++) {
+    if (owner[i]!=myid)
+      continue;
     tods->tods[ii].seed=((1+fabs(params->seed))*MAXTOD+i)*MAXDET;
     tods->my_fnames[ii]=strdup(params->datanames[i]);
-    
+    tods->my_inds[ii]=i;
     ii++;
-
   }
+  free(owner);
   return 0;
   
+}
+/*--------------------------------------------------------------------------------*/
+void log_tod_load_balance(const TODvec *tods, double my_time)
+//report how evenly the last pass over the TODs was spread across processes.  The slowest
+//process sets the pace, since everyone waits for it in mpi_reduce_mapset.
+{
+  double tmax=my_time;
+  double tmin=my_time;
+  double tsum=my_time;
+  int nproc=1;
+#ifdef HAVE_MPI
+  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
+  MPI_Allreduce(&my_time,&tmax,1,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+  MPI_Allreduce(&my_time,&tmin,1,MPI_DOUBLE,MPI_MIN,MPI_COMM_WORLD);
+  MPI_Allreduce(&my_time,&tsum,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+#endif
+  double tmean=tsum/nproc;
+  mprintf(stdout,"TOD load over %d processes: min %8.3f mean %8.3f max %8.3f seconds, imbalance %6.1f%%\n",nproc,tmin,tmean,tmax,(tmean>0 ? 100.0*(tmax/tmean-1) : 0.0));
+}
+/*--------------------------------------------------------------------------------*/
+void write_tod_costs(const TODvec *tods, const PARAMS *params)
+//collect everyone's per-TOD times from the last mapset2mapset and have the master write them
+//to params->tod_cost_file as "dataname seconds" lines, for @balance_tods in the next run.
+{
+  if ((strlen(params->tod_cost_file)==0)||(tods->tod_time==NULL))
+    return;
+  int myid=0;
+  int nproc=1;
+  int total=tods->ntod;
+  int *inds=tods->my_inds;
+  double *times=tods->tod_time;
+#ifdef HAVE_MPI
+  MPI_Comm_rank(MPI_COMM_WORLD,&myid);
+  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
+  int *counts=(int *)malloc_retry(sizeof(int)*nproc);
+  int *displs=(int *)malloc_retry(sizeof(int)*nproc);
+  MPI_Gather(&(tods->ntod),1,MPI_INT,counts,1,MPI_INT,0,MPI_COMM_WORLD);
+  total=0;
+  if (myid==0)
+    for (int i=0;i<nproc;i++) {
+      displs[i]=total;
+      total+=counts[i];
+    }
+  inds=(int *)malloc_retry(sizeof(int)*(total+1));
+  times=(double *)malloc_retry(sizeof(double)*(total+1));
+  MPI_Gatherv(tods->my_inds,tods->ntod,MPI_INT,inds,counts,displs,MPI_INT,0,MPI_COMM_WORLD);
+  MPI_Gatherv(tods->tod_time,tods->ntod,MPI_DOUBLE,times,counts,displs,MPI_DOUBLE,0,MPI_COMM_WORLD);
+  free(counts);
+  free(displs);
+#endif
+  if (myid==0) {
+    FILE *outfile=fopen(params->tod_cost_file,"w");
+    if (outfile) {
+      for (int i=0;i<total;i++)
+	fprintf(outfile,"%s %12.5f\n",params->datanames[inds[i]],times[i]);
+      fclose(outfile);
+      printf("wrote timings for %d TODs to %s\n",total,params->tod_cost_file);
+    }
+    else
+      fprintf(stderr,"Unable to write TOD timings to %s\n",params->tod_cost_file);
+  }
+#ifdef HAVE_MPI
+  free(inds);
+  free(times);
+#endif
 }
 /*--------------------------------------------------------------------------------*/
 actData *read_1d_datafile(char *fname, int *n)
@@ -1180,20 +1833,13 @@ bool is_det_used(mbTOD *tod, int det)
 }
 
 /*--------------------------------------------------------------------------------*/
-int get_starting_altaz_from_file(char *fname, actData **az_out, actData **alt_out, double **ctime_out)
+int get_starting_altaz_from_file(char *fname, const TODvec *tods, actData **az_out, actData **alt_out, double **ctime_out)
+//pull the starting alt/az/ctime for each of my TODs out of the altaz file, which has one line per TOD.
 {
 
   actData *az=NULL, *alt=NULL;
   double *ctime=NULL;
   
-  int myid, nproc;      
-#ifdef HAVE_MPI
-  MPI_Comm_rank(MPI_COMM_WORLD,&myid);
-  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
-#else
-  myid=0;
-  nproc=1;
-#endif
   int myargc;
   char *line_in=read_all_stdin(fname);
   char **myargv=create_argv_new(line_in,&myargc," \n");
@@ -1202,7 +1848,7 @@ int get_starting_altaz_from_file(char *fname, actData **az_out, actData **alt_ou
   free(line_in);
   
   int my_nfiles=0;
-  for (int i=myid;i<nfiles;i+=nproc)
+  while ((my_nfiles<tods->ntod)&&(tods->my_inds[my_nfiles]<nfiles))
     my_nfiles++;
   
   if (my_nfiles==0) {
@@ -1213,7 +1859,7 @@ int get_starting_altaz_from_file(char *fname, actData **az_out, actData **alt_ou
   alt=vector(my_nfiles);
   ctime=dvector(my_nfiles);
   for (int i=0;i<my_nfiles;i++) {
-    int ind=myid+i*nproc;
+    int ind=tods->my_inds[i];
     alt[i]=atof(myargv[ind*ALTAZ_PER_LINE])*M_PI/180.0;
     az[i]=atof(myargv[ind*ALTAZ_PER_LINE+1])*M_PI/180.0;
     ctime[i]=atof(myargv[ind*ALTAZ_PER_LINE+2]);
@@ -1238,7 +1884,7 @@ int read_all_tod_headers(TODvec *tods,PARAMS *params)
   double *ctime=NULL;
   int my_naltaz=0;
   if (strlen(params->altaz_file)) {
-    my_naltaz=get_starting_altaz_from_file(params->altaz_file,&az,&alt,&ctime);
+    my_naltaz=get_starting_altaz_from_file(params->altaz_file,tods,&az,&alt,&ctime);
   }
   
   for (int i=0;i<tods->ntod;i++) {
@@ -1268,6 +1914,7 @@ int read_all_tod_headers(TODvec *tods,PARAMS *params)
     //currently not used - lives inside of read_tod_header_c.cpp
     find_pointing_pivots(mytod,0.5);
     printf("got pivots inside ninkasi .\n");
+    setup_tod_polangles(mytod,params);
     //printf("ra/dec are assigned.\n");
     find_tod_radec_lims(mytod);    
     int myid=0;
@@ -1326,42 +1973,264 @@ void set_global_radec_lims(TODvec *tods)
     
 }
 /*--------------------------------------------------------------------------------*/
-int setup_maps(MAPvec *maps, PARAMS *params)
+#define NK_MASK_BITS (8*sizeof(unsigned long))
+
+static inline bool tile_in_mask(const unsigned long *mask, long itile)
 {
-  assert(maps->nmap>0);
-  if (params) {
-    if (params->use_input_limits) {
-      MAP simmap;
-      readwrite_simple_map(&simmap,params->inname,DOREAD);
-      MAP *mymap=maps->maps[0];
-      mymap->ramin=simmap.ramin;
-      mymap->ramax=simmap.ramax;
-      mymap->decmin=simmap.decmin;
-      mymap->decmax=simmap.decmax;
-      mymap->pixsize=simmap.pixsize;
-      destroy_map(&simmap);
-    }
+  return (mask[itile/NK_MASK_BITS]>>(itile%NK_MASK_BITS))&1UL;
+}
+
+static inline long reduce_tile_len(long itile, long nelem, long tile_len)
+{
+  long len=nelem-itile*tile_len;
+  return (len<tile_len ? len : tile_len);
+}
+/*--------------------------------------------------------------------------------*/
+static void find_nonzero_tiles(const actData *map, long nelem, long ntile, unsigned long *mask, int nword)
+//flag the NK_MAP_TILE_LEN-element tiles of a map that have anything in them.  An all-zero tile
+//adds nothing to a sum, so this is exactly the set a process needs to send.
+{
+  memset(mask,0,sizeof(unsigned long)*nword);
+#pragma omp parallel for schedule(dynamic,16) shared(map,nelem,ntile,mask) default(none)
+  for (long itile=0;itile<ntile;itile++) {
+    const actData *tile=map+itile*NK_MAP_TILE_LEN;
+    long len=reduce_tile_len(itile,nelem,NK_MAP_TILE_LEN);
+    for (long i=0;i<len;i++)
+      if (tile[i]!=0) {
+#pragma omp atomic
+	mask[itile/NK_MASK_BITS]|=1UL<<(itile%NK_MASK_BITS);
+	break;
+      }
   }
-  for (int i=0;i<maps->nmap;i++) {
-    MAP *mymap=maps->maps[i];
-    assert(mymap->pixsize>0);
-    assert(mymap->ramax>mymap->ramin);
-    assert(mymap->decmax>mymap->decmin);
-    
-    mymap->nx=(mymap->ramax-mymap->ramin)/mymap->pixsize+1;
-    mymap->ny=(mymap->decmax-mymap->decmin)/mymap->pixsize+1;
-    mymap->npix=mymap->nx*mymap->ny;
-    mymap->map=vector(mymap->npix);
+}
+/*--------------------------------------------------------------------------------*/
+static actData *allocate_map_storage(long nelem, bool lazy)
+//lazy storage is an untouched anonymous mapping the size of the whole map.  Pages only get
+//real memory once something writes to them, and for a distributed map only the tiles this
+//process holds ever are.  Tiles are a multiple of the page size, so they don't share pages.
+{
+  if (!lazy)
+    return vector(nelem);
+  //the length goes in a page of its own ahead of the map, so the map stays page aligned.
+  long page=sysconf(_SC_PAGESIZE);
+  size_t len=page+sizeof(actData)*(nelem+1);
+  char *ptr=(char *)mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+  if (ptr==MAP_FAILED) {
+    fprintf(stderr,"Unable to map %ld map elements.\n",nelem);
+    assert(1==0);
   }
-    
-  return 0;
+  *(size_t *)ptr=len;
+  return (actData *)(ptr+page);
 }
-
 /*--------------------------------------------------------------------------------*/
-MAP *make_blank_map_copy(const MAP *map)
+static void free_map_storage(actData *vec, bool lazy)
+{
+  if (lazy) {
+    char *ptr=(char *)vec-sysconf(_SC_PAGESIZE);
+    munmap(ptr,*(size_t *)ptr);
+  }
+  else
+    free(vec);
+}
+/*--------------------------------------------------------------------------------*/
+MapFootprint *allocate_map_footprint()
+//a pending footprint, to be filled in by setup_map_footprint once the TODs have been read.
+{
+  MapFootprint *fp=(MapFootprint *)calloc(1,sizeof(MapFootprint));
+  fp->nproc=1;
+#ifdef HAVE_MPI
+  MPI_Comm_rank(MPI_COMM_WORLD,&fp->myid);
+  MPI_Comm_size(MPI_COMM_WORLD,&fp->nproc);
+#endif
+  return fp;
+}
+/*--------------------------------------------------------------------------------*/
+static void release_map_footprint(MapFootprint *fp)
+{
+  if (!fp)
+    return;
+  fp->nref--;
+  if (fp->nref>0)
+    return;
+  if (fp->held)
+    free(fp->held);
+  if (fp->owner)
+    free(fp->owner);
+  if (fp->mine)
+    free(fp->mine);
+  free(fp);
+}
+/*--------------------------------------------------------------------------------*/
+static inline bool map_is_distributed(const MAP *map)
+{
+  return (map->footprint)&&(map->footprint->ready);
+}
+/*--------------------------------------------------------------------------------*/
+static inline long map_nblock(const MAP *map)
+//maps are swept a tile at a time.  A distributed map only has the tiles this process holds.
+{
+  if (map_is_distributed(map))
+    return map->footprint->nmine;
+  return (map->npix+NK_MAP_TILE_LEN-1)/NK_MAP_TILE_LEN;
+}
+/*--------------------------------------------------------------------------------*/
+static inline void map_block_range(const MAP *map, long iblock, long *imin, long *imax)
+//elements [imin,imax) of the map that make up block iblock.
+{
+  long itile=(map_is_distributed(map) ? map->footprint->mine[iblock] : iblock);
+  long npol=get_npol_in_map(map);
+  *imin=itile*NK_MAP_TILE_LEN*npol;
+  *imax=(itile+1)*NK_MAP_TILE_LEN*npol;
+  if (*imax>map->npix*npol)
+    *imax=map->npix*npol;
+}
+/*--------------------------------------------------------------------------------*/
+static inline bool map_block_is_mine(const MAP *map, long iblock)
+//whether this process should count a block in sums over the whole map.  Every process has
+//the whole of an undistributed map, and for that it doesn't need to reduce the result.
+{
+  if (!map_is_distributed(map))
+    return true;
+  return map->footprint->owner[map->footprint->mine[iblock]]==map->footprint->myid;
+}
+/*--------------------------------------------------------------------------------*/
+static double sum_over_processes(const MAP *map, double tot)
+//finish off a dot product over a distributed map.
+{
+#ifdef HAVE_MPI
+  if (map_is_distributed(map)) {
+    double mytot=tot;
+    MPI_Allreduce(&mytot,&tot,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+  }
+#endif
+  return tot;
+}
+/*--------------------------------------------------------------------------------*/
+void setup_map_footprint(MAPvec *maps, TODvec *tods, PARAMS *params)
+//work out which tiles each process's TODs hit, and which process owns each tile, and switch
+//maps over to holding just those.  Hits come from projecting ones through every TOD into a
+//lazily allocated scratch map, like get_weights does.
+{
+  MAP *map=maps->maps[0];
+  MapFootprint *fp=map->footprint;
+  assert(fp);
+  assert(!fp->ready);
+  pca_time tt;
+  tick(&tt);
+
+  MAP *hits=(MAP *)calloc(1,sizeof(MAP));
+  hits->pixsize=map->pixsize;
+  hits->ramin=map->ramin;
+  hits->ramax=map->ramax;
+  hits->decmin=map->decmin;
+  hits->decmax=map->decmax;
+  hits->nx=map->nx;
+  hits->ny=map->ny;
+  hits->npix=map->npix;
+  hits->projection=map->projection;
+#ifdef ACTPOL
+  hits->pol_state[0]=1;
+#endif
+  hits->map=allocate_map_storage(hits->npix,true);
+  for (int i=0;i<tods->ntod;i++) {
+    mbTOD *mytod=&(tods->tods[i]);
+    allocate_tod_storage(mytod);
+    assign_tod_value(mytod,1.0);
+    tod2map(hits,mytod,params);
+    free_tod_storage(mytod);
+  }
+
+  fp->ntile=(map->npix+NK_MAP_TILE_LEN-1)/NK_MAP_TILE_LEN;
+  fp->nword=(fp->ntile+NK_MASK_BITS-1)/NK_MASK_BITS;
+  unsigned long *mymask=(unsigned long *)malloc_retry(sizeof(unsigned long)*(fp->nword+1));
+  find_nonzero_tiles(hits->map,hits->npix,fp->ntile,mymask,fp->nword);
+  free_map_storage(hits->map,true);
+  free(hits);
+
+  fp->held=(unsigned long *)malloc_retry(sizeof(unsigned long)*fp->nword*fp->nproc+1);
+#ifdef HAVE_MPI
+  MPI_Allgather(mymask,fp->nword,MPI_UNSIGNED_LONG,fp->held,fp->nword,MPI_UNSIGNED_LONG,MPI_COMM_WORLD);
+#else
+  memcpy(fp->held,mymask,sizeof(unsigned long)*fp->nword);
+#endif
+  free(mymask);
+
+  //hand each tile to whichever of its holders owns the least so far.
+  long *nowned=(long *)calloc(fp->nproc,sizeof(long));
+  fp->owner=(int *)malloc_retry(sizeof(int)*(fp->ntile+1));
+  fp->nmine=0;
+  long nused=0;
+  for (long itile=0;itile<fp->ntile;itile++) {
+    fp->owner[itile]=-1;
+    for (int r=0;r<fp->nproc;r++)
+      if (tile_in_mask(fp->held+r*fp->nword,itile))
+	if ((fp->owner[itile]<0)||(nowned[r]<nowned[fp->owner[itile]]))
+	  fp->owner[itile]=r;
+    if (fp->owner[itile]>=0) {
+      nowned[fp->owner[itile]]++;
+      nused++;
+    }
+    if (tile_in_mask(fp->held+fp->myid*fp->nword,itile))
+      fp->nmine++;
+  }
+  free(nowned);
+  fp->mine=(long *)malloc_retry(sizeof(long)*(fp->nmine+1));
+  fp->nmine=0;
+  for (long itile=0;itile<fp->ntile;itile++)
+    if (tile_in_mask(fp->held+fp->myid*fp->nword,itile))
+      fp->mine[fp->nmine++]=itile;
+
+  long maxmine=fp->nmine;
+#ifdef HAVE_MPI
+  MPI_Allreduce(&fp->nmine,&maxmine,1,MPI_LONG,MPI_MAX,MPI_COMM_WORLD);
+#endif
+  fp->ready=true;
+  mprintf(stdout,"distributed maps: %ld of %ld tiles in use, at most %ld (%.3f GB per I map) on one process, took %8.3f seconds.\n",nused,fp->ntile,maxmine,maxmine*NK_MAP_TILE_LEN*sizeof(actData)/1e9,tocksilent(&tt));
+}
+/*--------------------------------------------------------------------------------*/
+int setup_maps(MAPvec *maps, PARAMS *params)
+{
+  assert(maps->nmap>0);
+  if (params) {
+    if (params->use_input_limits) {
+      MAP simmap;
+      readwrite_simple_map(&simmap,params->inname,DOREAD);
+      MAP *mymap=maps->maps[0];
+      mymap->ramin=simmap.ramin;
+      mymap->ramax=simmap.ramax;
+      mymap->decmin=simmap.decmin;
+      mymap->decmax=simmap.decmax;
+      mymap->pixsize=simmap.pixsize;
+      destroy_map(&simmap);
+    }
+  }
+  MapFootprint *fp=NULL;
+  if ((params)&&(params->distribute_maps))
+    fp=allocate_map_footprint();  //filled in by make_initial_mapset
+  for (int i=0;i<maps->nmap;i++) {
+    MAP *mymap=maps->maps[i];
+    assert(mymap->pixsize>0);
+    assert(mymap->ramax>mymap->ramin);
+    assert(mymap->decmax>mymap->decmin);
+    
+    mymap->nx=(mymap->ramax-mymap->ramin)/mymap->pixsize+1;
+    mymap->ny=(mymap->decmax-mymap->decmin)/mymap->pixsize+1;
+    mymap->npix=mymap->nx*mymap->ny;
+    mymap->footprint=fp;
+    if (fp)
+      fp->nref++;
+    mymap->map=allocate_map_storage(mymap->npix,fp!=NULL);
+  }
+    
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+MAP *make_blank_map_copy(const MAP *map)
+//shares the footprint, so a distributed map's copy only ever has memory behind the tiles it holds.
 {
   MAP *map_copy;
-  map_copy=(MAP *)malloc_retry(sizeof(MAP));
+  map_copy=(MAP *)calloc(sizeof(MAP),1);
   
   map_copy->pixsize=map->pixsize;
   map_copy->ramin=map->ramin;
@@ -1371,11 +2240,16 @@ MAP *make_blank_map_copy(const MAP *map)
   map_copy->nx=map->nx;
   map_copy->ny=map->ny;
   map_copy->npix=map->npix;
+  map_copy->projection=(nkProjection *)malloc_retry(sizeof(nkProjection));
+  memcpy(map_copy->projection,map->projection,sizeof(nkProjection));
   map_copy->have_locks=0;  //don't recycle locks.  will create them as needed, if needed.
+  map_copy->footprint=map->footprint;
+  if (map_copy->footprint)
+    map_copy->footprint->nref++;
 #ifdef ACTPOL
   memcpy(map_copy->pol_state,map->pol_state,MAX_NPOL*sizeof(map->pol_state[0]));
 #endif
-  map_copy->map=(actData *)malloc_retry(sizeof(actData)*map_copy->npix*get_npol_in_map(map));
+  map_copy->map=allocate_map_storage(map_copy->npix*get_npol_in_map(map),map_copy->footprint!=NULL);
   //memcpy(map_copy->map,map->map,sizeof(actData)*map_copy->npix);
   clear_map(map_copy);
   return map_copy;
@@ -1401,6 +2275,7 @@ MAP *deres_map(MAP *map)
   //memcpy(map_copy->projection,map->projection,sizeof(nkProjection));
   map_copy->projection=deres_projection(map->projection);
   map_copy->have_locks=0;  //don't recycle locks.  will create them as needed, if needed.
+  map_copy->footprint=NULL;
   map_copy->map=(actData *)malloc_retry(sizeof(actData)*map_copy->npix);
   //memcpy(map_copy->map,map->map,sizeof(actData)*map_copy->npix);
   
@@ -1432,6 +2307,7 @@ MAP *upres_map(MAP *map)
   //memcpy(map_copy->projection,map->projection,sizeof(nkProjection));
   map_copy->projection=upres_projection(map->projection);
   map_copy->have_locks=0;  //don't recycle locks.  will create them as needed, if needed.
+  map_copy->footprint=NULL;
   map_copy->map=(actData *)malloc_retry(sizeof(actData)*map_copy->npix);
   //memcpy(map_copy->map,map->map,sizeof(actData)*map_copy->npix);
   for (int i=0;i<map_copy->ny;i++) 
@@ -1460,17 +2336,21 @@ MAP *make_map_copy(MAP *map)
   map_copy->projection=(nkProjection *)malloc_retry(sizeof(nkProjection));
   memcpy(map_copy->projection,map->projection,sizeof(nkProjection));
   map_copy->have_locks=0;  //don't recycle locks.  will create them as needed, if needed.
-  map_copy->map=(actData *)malloc_retry(sizeof(actData)*map_copy->npix*get_npol_in_map(map));
+  map_copy->footprint=map->footprint;
+  if (map_copy->footprint)
+    map_copy->footprint->nref++;
+  map_copy->map=allocate_map_storage(map_copy->npix*get_npol_in_map(map),map_copy->footprint!=NULL);
 #ifdef ACTPOL
   memcpy(map_copy->pol_state,map->pol_state,MAX_NPOL*sizeof(map->pol_state[0]));
 #endif
-  memcpy(map_copy->map,map->map,sizeof(actData)*map_copy->npix*get_npol_in_map(map));
+  copy_map2map(map_copy,map);
   return map_copy;
 }
 /*--------------------------------------------------------------------------------*/
 void destroy_map(MAP *map)
 {
-  free(map->map);
+  free_map_storage(map->map,map->footprint!=NULL);
+  release_map_footprint(map->footprint);
   if (map->have_locks)
     free(map->locks);
   //free(map->projection);
@@ -1490,7 +2370,7 @@ MAPvec *make_mapset_copy(MAPvec *maps)
   MAPvec *maps_copy;
   assert(maps->nmap>0);
   maps_copy=(MAPvec *)malloc_retry(sizeof(MAPvec));
-  maps_copy->maps=(MAP **)malloc_retry(sizeof(MAP *));
+  maps_copy->maps=(MAP **)malloc_retry(sizeof(MAP *)*maps->nmap);
   maps_copy->nmap=maps->nmap;
   for (int i=0;i<maps->nmap;i++)
     maps_copy->maps[i]=make_map_copy((maps->maps[i]));
@@ -1500,6 +2380,24 @@ MAPvec *make_mapset_copy(MAPvec *maps)
 /*--------------------------------------------------------------------------------*/
 void clear_map(MAP *map)
 {
+  if (map_is_distributed(map)) {
+    long nblock=map_nblock(map);
+#pragma omp parallel for shared(map,nblock) default(none)
+    for (long j=0;j<nblock;j++) {
+      long imin,imax;
+      map_block_range(map,j,&imin,&imax);
+      memset(map->map+imin,0,sizeof(actData)*(imax-imin));
+    }
+    return;
+  }
+#ifdef MADV_DONTNEED
+  if (map->footprint) {
+    //we don't know yet what we'll hold, so hand the pages back instead of writing zeros over
+    //the whole map.  They read as zero until something writes to them again.
+    madvise(map->map,sizeof(actData)*map->npix*get_npol_in_map(map),MADV_DONTNEED);
+    return;
+  }
+#endif
   memset(map->map,0,sizeof(actData)*map->npix*get_npol_in_map(map));
 }
 /*--------------------------------------------------------------------------------*/
@@ -1531,27 +2429,432 @@ bool is_mapset_blank(MAPvec *maps)
 
 
 #ifdef HAVE_MPI
-int mpi_reduce_map(MAP *map)
+int mpi_reduce_map_dense(MAP *map)
+//sum a map across processes with one MPI_Allreduce over every pixel.  mpi_reduce_map only
+//ships the parts of the map that are in use; this is kept around to check it against.
+//in single precision builds, sum across processes in double so big runs don't lose bits.
 {
 
   int ierr;
-  actData *vec=vector(map->npix);
-  memset(vec,0,sizeof(actData)*map->npix);
-  ierr=MPI_Allreduce(map->map,vec,map->npix,MPI_NType,MPI_SUM,MPI_COMM_WORLD);
-  memcpy(map->map,vec,sizeof(actData)*map->npix);
+  long nelem=map->npix*get_npol_in_map(map);
+#ifdef ACTDATA_DOUBLE
+  actData *vec=vector(nelem);
+  memset(vec,0,sizeof(actData)*nelem);
+  ierr=MPI_Allreduce(map->map,vec,nelem,MPI_NType,MPI_SUM,MPI_COMM_WORLD);
+  memcpy(map->map,vec,sizeof(actData)*nelem);
   free(vec);
+#else
+  double *vec=dvector(nelem);
+  double *vec_out=dvector(nelem);
+#pragma omp parallel for shared(nelem,vec,map) default(none)
+  for (long i=0;i<nelem;i++)
+    vec[i]=map->map[i];
+  ierr=MPI_Allreduce(vec,vec_out,nelem,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+#pragma omp parallel for shared(nelem,vec_out,map) default(none)
+  for (long i=0;i<nelem;i++)
+    map->map[i]=vec_out[i];
+  free(vec);
+  free(vec_out);
+#endif
   return ierr;
   
 }
 
+/*--------------------------------------------------------------------------------*/
+//running totals for the sparse reduction, reported and cleared by mpi_reduce_mapset.
+static double nk_reduce_time=0;
+static double nk_reduce_bytes=0;  //sent by this process
+static long nk_reduce_tiles=0;  //tiles someone had data in
+static long nk_reduce_tiles_total=0;
+
+/*--------------------------------------------------------------------------------*/
+typedef struct {
+  long itile;
+  long off;
+} TileSeg;
+
+static int mpi_reduce_map_distributed(MAP *map)
+//mpi_reduce_map for a map spread over processes.  Non-empty tiles go to their owners to be
+//summed like before, but the sums then only go back out to the processes holding each tile,
+//instead of to everyone.  Tiles nobody has anything in stay zero and never move.
+{
+  MapFootprint *fp=map->footprint;
+  int myid=fp->myid;
+  int nproc=fp->nproc;
+  int ierr;
+  double t0=MPI_Wtime();
+  long npol=get_npol_in_map(map);
+  long nelem=map->npix*npol;
+  long tile_len=NK_MAP_TILE_LEN*npol;
+  long ntile=fp->ntile;
+  int nword=fp->nword;
+
+  unsigned long *mymask=(unsigned long *)calloc(nword+1,sizeof(unsigned long));
+#pragma omp parallel for schedule(dynamic,16) shared(fp,map,mymask) default(none)
+  for (long j=0;j<fp->nmine;j++) {
+    long imin,imax;
+    map_block_range(map,j,&imin,&imax);
+    for (long i=imin;i<imax;i++)
+      if (map->map[i]!=0) {
+#pragma omp atomic
+	mymask[fp->mine[j]/NK_MASK_BITS]|=1UL<<(fp->mine[j]%NK_MASK_BITS);
+	break;
+      }
+  }
+  unsigned long *masks=(unsigned long *)malloc_retry(sizeof(unsigned long)*nword*nproc+1);
+  ierr=MPI_Allgather(mymask,nword,MPI_UNSIGNED_LONG,masks,nword,MPI_UNSIGNED_LONG,MPI_COMM_WORLD);
+  assert(ierr==0);
+  unsigned long *used=(unsigned long *)calloc(nword+1,sizeof(unsigned long));
+  for (int r=0;r<nproc;r++)
+    for (int i=0;i<nword;i++)
+      used[i]|=masks[r*nword+i];
+
+  long nowned=0;
+  for (long j=0;j<fp->nmine;j++)
+    if ((fp->owner[fp->mine[j]]==myid)&&(tile_in_mask(used,fp->mine[j])))
+      nowned++;
+  long *owned=(long *)malloc_retry(sizeof(long)*(nowned+1));
+  nowned=0;
+  for (long j=0;j<fp->nmine;j++)
+    if ((fp->owner[fp->mine[j]]==myid)&&(tile_in_mask(used,fp->mine[j])))
+      owned[nowned++]=fp->mine[j];
+
+  int *sendcounts=(int *)calloc(nproc,sizeof(int));
+  int *recvcounts=(int *)calloc(nproc,sizeof(int));
+  int *sdispls=(int *)calloc(nproc,sizeof(int));
+  int *rdispls=(int *)calloc(nproc,sizeof(int));
+  TileSeg *send=(TileSeg *)malloc_retry(sizeof(TileSeg)*(fp->nmine*(long)nproc+1));
+  long nseg=0;
+
+  //first my non-empty tiles go to their owners, grouped by owner and in tile order.
+  long nsend=0;
+  for (int o=0;o<nproc;o++) {
+    sdispls[o]=nsend;
+    for (long j=0;j<fp->nmine;j++) {
+      long itile=fp->mine[j];
+      if ((fp->owner[itile]==o)&&(tile_in_mask(mymask,itile))) {
+	send[nseg].itile=itile;
+	send[nseg].off=nsend;
+	nseg++;
+	nsend+=reduce_tile_len(itile,nelem,tile_len);
+      }
+    }
+    sendcounts[o]=nsend-sdispls[o];
+    assert(nsend<INT_MAX);
+  }
+  long nrecv=0;
+  long *recv_off=(long *)malloc_retry(sizeof(long)*(nowned*nproc+1));
+  for (int r=0;r<nproc;r++) {
+    rdispls[r]=nrecv;
+    for (long k=0;k<nowned;k++)
+      if (tile_in_mask(masks+r*nword,owned[k])) {
+	recv_off[r*nowned+k]=nrecv;
+	nrecv+=reduce_tile_len(owned[k],nelem,tile_len);
+      }
+      else
+	recv_off[r*nowned+k]=-1;
+    recvcounts[r]=nrecv-rdispls[r];
+    assert(nrecv<INT_MAX);
+  }
+  double *sendbuf=dvector(nsend+1);
+  double *recvbuf=dvector(nrecv+1);
+#pragma omp parallel for schedule(dynamic,4) shared(nseg,send,sendbuf,map,nelem,tile_len) default(none)
+  for (long j=0;j<nseg;j++) {
+    long len=reduce_tile_len(send[j].itile,nelem,tile_len);
+    const actData *tile=map->map+send[j].itile*tile_len;
+    double *dest=sendbuf+send[j].off;
+    for (long i=0;i<len;i++)
+      dest[i]=tile[i];
+  }
+  ierr=MPI_Alltoallv(sendbuf,sendcounts,sdispls,MPI_DOUBLE,recvbuf,recvcounts,rdispls,MPI_DOUBLE,MPI_COMM_WORLD);
+  assert(ierr==0);
+  nk_reduce_bytes+=sizeof(double)*(double)(nsend-sendcounts[myid]);
+  free(sendbuf);
+
+#pragma omp parallel for schedule(dynamic,4) shared(nowned,owned,nproc,recv_off,recvbuf,map,nelem,tile_len) default(none)
+  for (long k=0;k<nowned;k++) {
+    long len=reduce_tile_len(owned[k],nelem,tile_len);
+    actData *dest=map->map+owned[k]*tile_len;
+    for (long i=0;i<len;i++) {
+      double tot=0;
+      for (int r=0;r<nproc;r++)
+	if (recv_off[r*nowned+k]>=0)
+	  tot+=recvbuf[recv_off[r*nowned+k]+i];
+      dest[i]=tot;
+    }
+  }
+  free(recvbuf);
+  free(recv_off);
+
+  //then the sums go from owners to everyone else holding the tile.
+  nseg=0;
+  nsend=0;
+  for (int h=0;h<nproc;h++) {
+    sdispls[h]=nsend;
+    if (h!=myid)
+      for (long k=0;k<nowned;k++)
+	if (tile_in_mask(fp->held+h*nword,owned[k])) {
+	  send[nseg].itile=owned[k];
+	  send[nseg].off=nsend;
+	  nseg++;
+	  nsend+=reduce_tile_len(owned[k],nelem,tile_len);
+	}
+    sendcounts[h]=nsend-sdispls[h];
+    assert(nsend<INT_MAX);
+  }
+  TileSeg *recv=(TileSeg *)malloc_retry(sizeof(TileSeg)*(fp->nmine+1));
+  long nrseg=0;
+  nrecv=0;
+  for (int o=0;o<nproc;o++) {
+    rdispls[o]=nrecv;
+    if (o!=myid)
+      for (long j=0;j<fp->nmine;j++) {
+	long itile=fp->mine[j];
+	if ((fp->owner[itile]==o)&&(tile_in_mask(used,itile))) {
+	  recv[nrseg].itile=itile;
+	  recv[nrseg].off=nrecv;
+	  nrseg++;
+	  nrecv+=reduce_tile_len(itile,nelem,tile_len);
+	}
+      }
+    recvcounts[o]=nrecv-rdispls[o];
+    assert(nrecv<INT_MAX);
+  }
+  actData *sendback=vector(nsend+1);
+  actData *recvback=vector(nrecv+1);
+#pragma omp parallel for schedule(dynamic,4) shared(nseg,send,sendback,map,nelem,tile_len) default(none)
+  for (long j=0;j<nseg;j++)
+    memcpy(sendback+send[j].off,map->map+send[j].itile*tile_len,sizeof(actData)*reduce_tile_len(send[j].itile,nelem,tile_len));
+  ierr=MPI_Alltoallv(sendback,sendcounts,sdispls,MPI_NType,recvback,recvcounts,rdispls,MPI_NType,MPI_COMM_WORLD);
+  assert(ierr==0);
+#pragma omp parallel for schedule(dynamic,4) shared(nrseg,recv,recvback,map,nelem,tile_len) default(none)
+  for (long j=0;j<nrseg;j++)
+    memcpy(map->map+recv[j].itile*tile_len,recvback+recv[j].off,sizeof(actData)*reduce_tile_len(recv[j].itile,nelem,tile_len));
+
+  nk_reduce_bytes+=sizeof(unsigned long)*nword*(nproc-1);
+  nk_reduce_bytes+=sizeof(actData)*(double)nsend;
+  for (long itile=0;itile<ntile;itile++)
+    if (tile_in_mask(used,itile))
+      nk_reduce_tiles++;
+  nk_reduce_tiles_total+=ntile;
+
+  free(sendback);
+  free(recvback);
+  free(send);
+  free(recv);
+  free(sendcounts);
+  free(recvcounts);
+  free(sdispls);
+  free(rdispls);
+  free(owned);
+  free(used);
+  free(masks);
+  free(mymask);
+  nk_reduce_time+=MPI_Wtime()-t0;
+  return ierr;
+}
+/*--------------------------------------------------------------------------------*/
+int mpi_reduce_map(MAP *map)
+//sum a map across processes, only moving tiles that somebody has data in.  Everyone swaps
+//bitmasks of their non-empty tiles, and the tiles anyone uses are dealt round-robin to
+//owners.  Each process sends its non-empty tiles to their owners (a sparse reduce-scatter),
+//owners add them up, and the finished tiles are allgathered back out.  Tiles nobody touched
+//are already zero everywhere.  Sums are done in double, and the allgather is in actData.
+{
+  int myid,nproc,ierr;
+  MPI_Comm_rank(MPI_COMM_WORLD,&myid);
+  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
+  if (nproc==1)
+    return 0;
+  if (map_is_distributed(map))
+    return mpi_reduce_map_distributed(map);
+  double t0=MPI_Wtime();
+
+  long nelem=map->npix*get_npol_in_map(map);
+  long ntile=(nelem+NK_MAP_TILE_LEN-1)/NK_MAP_TILE_LEN;
+  int nword=(ntile+NK_MASK_BITS-1)/NK_MASK_BITS;
+  unsigned long *mymask=(unsigned long *)malloc_retry(sizeof(unsigned long)*(nword+1));
+  unsigned long *masks=(unsigned long *)malloc_retry(sizeof(unsigned long)*nword*nproc+1);
+  find_nonzero_tiles(map->map,nelem,ntile,mymask,nword);
+  ierr=MPI_Allgather(mymask,nword,MPI_UNSIGNED_LONG,masks,nword,MPI_UNSIGNED_LONG,MPI_COMM_WORLD);
+  assert(ierr==0);
+
+  //owner of each tile in use, -1 if nobody has it.  Also where my tiles go in the send
+  //buffer, and where tiles I own sit in my block of the final result.
+  int *owner=(int *)malloc_retry(sizeof(int)*(ntile+1));
+  long *send_off=(long *)malloc_retry(sizeof(long)*(ntile+1));
+  long *own_off=(long *)malloc_retry(sizeof(long)*(ntile+1));
+  int *sendcounts=(int *)calloc(nproc,sizeof(int));
+  int *recvcounts=(int *)calloc(nproc,sizeof(int));
+  int *owncounts=(int *)calloc(nproc,sizeof(int));
+  int *sdispls=(int *)calloc(nproc,sizeof(int));
+  int *rdispls=(int *)calloc(nproc,sizeof(int));
+  int *odispls=(int *)calloc(nproc,sizeof(int));
+  long nused=0;
+  for (long itile=0;itile<ntile;itile++) {
+    owner[itile]=-1;
+    for (int r=0;r<nproc;r++)
+      if (tile_in_mask(masks+r*nword,itile)) {
+	owner[itile]=(nused++)%nproc;
+	break;
+      }
+    if (owner[itile]<0)
+      continue;
+    long len=reduce_tile_len(itile,nelem,NK_MAP_TILE_LEN);
+    if (tile_in_mask(mymask,itile))
+      sendcounts[owner[itile]]+=len;
+    if (owner[itile]==myid)
+      for (int r=0;r<nproc;r++)
+	if (tile_in_mask(masks+r*nword,itile))
+	  recvcounts[r]+=len;
+    owncounts[owner[itile]]+=len;
+  }
+  long nsend=0,nrecv=0,nown=0;
+  for (int r=0;r<nproc;r++) {
+    assert(nsend+sendcounts[r]<INT_MAX);
+    assert(nrecv+recvcounts[r]<INT_MAX);
+    assert(nown+owncounts[r]<INT_MAX);
+    sdispls[r]=nsend;
+    rdispls[r]=nrecv;
+    odispls[r]=nown;
+    nsend+=sendcounts[r];
+    nrecv+=recvcounts[r];
+    nown+=owncounts[r];
+  }
+
+  //tiles headed to the same owner are packed in tile order, so the owner knows what's what.
+  int *fill=(int *)calloc(nproc,sizeof(int));
+  for (long itile=0;itile<ntile;itile++) {
+    send_off[itile]=-1;
+    own_off[itile]=-1;
+    if (owner[itile]<0)
+      continue;
+    long len=reduce_tile_len(itile,nelem,NK_MAP_TILE_LEN);
+    if (tile_in_mask(mymask,itile)) {
+      send_off[itile]=sdispls[owner[itile]]+fill[owner[itile]];
+      fill[owner[itile]]+=len;
+    }
+  }
+  long ilocal=0;
+  for (long itile=0;itile<ntile;itile++)
+    if (owner[itile]==myid) {
+      own_off[itile]=ilocal;
+      ilocal+=reduce_tile_len(itile,nelem,NK_MAP_TILE_LEN);
+    }
+
+  double *sendbuf=dvector(nsend+1);
+  double *recvbuf=dvector(nrecv+1);
+#pragma omp parallel for schedule(dynamic,4) shared(ntile,nelem,send_off,sendbuf,map) default(none)
+  for (long itile=0;itile<ntile;itile++)
+    if (send_off[itile]>=0) {
+      long len=reduce_tile_len(itile,nelem,NK_MAP_TILE_LEN);
+      const actData *tile=map->map+itile*NK_MAP_TILE_LEN;
+      double *dest=sendbuf+send_off[itile];
+      for (long i=0;i<len;i++)
+	dest[i]=tile[i];
+    }
+  ierr=MPI_Alltoallv(sendbuf,sendcounts,sdispls,MPI_DOUBLE,recvbuf,recvcounts,rdispls,MPI_DOUBLE,MPI_COMM_WORLD);
+  assert(ierr==0);
+  free(sendbuf);
+
+  //where each sender's copy of each of my tiles landed in recvbuf.
+  long nmine=0;
+  for (long itile=0;itile<ntile;itile++)
+    if (owner[itile]==myid)
+      nmine++;
+  long *mine=(long *)malloc_retry(sizeof(long)*(nmine+1));
+  long *recv_off=(long *)malloc_retry(sizeof(long)*(nproc*nmine+1));
+  nmine=0;
+  for (long itile=0;itile<ntile;itile++)
+    if (owner[itile]==myid)
+      mine[nmine++]=itile;
+  for (int r=0;r<nproc;r++) {
+    long off=rdispls[r];
+    for (long j=0;j<nmine;j++) {
+      if (tile_in_mask(masks+r*nword,mine[j])) {
+	recv_off[r*nmine+j]=off;
+	off+=reduce_tile_len(mine[j],nelem,NK_MAP_TILE_LEN);
+      }
+      else
+	recv_off[r*nmine+j]=-1;
+    }
+  }
+
+  actData *owned=vector(nown+1);
+  actData *mysums=owned+odispls[myid];
+#pragma omp parallel for schedule(dynamic,4) shared(nmine,mine,nelem,nproc,recv_off,recvbuf,own_off,mysums) default(none)
+  for (long j=0;j<nmine;j++) {
+    long len=reduce_tile_len(mine[j],nelem,NK_MAP_TILE_LEN);
+    actData *dest=mysums+own_off[mine[j]];
+    for (long i=0;i<len;i++) {
+      double tot=0;
+      for (int r=0;r<nproc;r++)
+	if (recv_off[r*nmine+j]>=0)
+	  tot+=recvbuf[recv_off[r*nmine+j]+i];
+      dest[i]=tot;
+    }
+  }
+  free(recvbuf);
+  free(recv_off);
+  free(mine);
+
+  ierr=MPI_Allgatherv(MPI_IN_PLACE,0,MPI_DATATYPE_NULL,owned,owncounts,odispls,MPI_NType,MPI_COMM_WORLD);
+  assert(ierr==0);
+
+  //unpack.  Owned tiles come back grouped by owner, each group in tile order.
+  memset(fill,0,sizeof(int)*nproc);
+  for (long itile=0;itile<ntile;itile++) {
+    if (owner[itile]<0)
+      continue;
+    own_off[itile]=odispls[owner[itile]]+fill[owner[itile]];
+    fill[owner[itile]]+=reduce_tile_len(itile,nelem,NK_MAP_TILE_LEN);
+  }
+#pragma omp parallel for schedule(dynamic,4) shared(ntile,nelem,owner,own_off,owned,map) default(none)
+  for (long itile=0;itile<ntile;itile++)
+    if (owner[itile]>=0)
+      memcpy(map->map+itile*NK_MAP_TILE_LEN,owned+own_off[itile],sizeof(actData)*reduce_tile_len(itile,nelem,NK_MAP_TILE_LEN));
+
+  nk_reduce_bytes+=sizeof(unsigned long)*nword*(nproc-1);
+  nk_reduce_bytes+=sizeof(double)*(nsend-sendcounts[myid]);
+  nk_reduce_bytes+=sizeof(actData)*(double)owncounts[myid]*(nproc-1);
+  nk_reduce_tiles+=nused;
+  nk_reduce_tiles_total+=ntile;
+
+  free(owned);
+  free(fill);
+  free(sendcounts);
+  free(recvcounts);
+  free(owncounts);
+  free(sdispls);
+  free(rdispls);
+  free(odispls);
+  free(owner);
+  free(send_off);
+  free(own_off);
+  free(masks);
+  free(mymask);
+  nk_reduce_time+=MPI_Wtime()-t0;
+  return ierr;
+}
+
 /*--------------------------------------------------------------------------------*/
 int  mpi_reduce_mapset(MAPvec *maps)
 {
   int ierr;
+  double t_prof=nk_profile_tick();
   for (int i=0;i<maps->nmap;i++) {
     ierr=mpi_reduce_map(maps->maps[i]);
     assert(ierr==0);
   }
+  nk_profile_tock(NK_PROF_REDUCE,t_prof);
+  double tot_bytes=0,max_time=0;
+  MPI_Reduce(&nk_reduce_bytes,&tot_bytes,1,MPI_DOUBLE,MPI_SUM,0,MPI_COMM_WORLD);
+  MPI_Reduce(&nk_reduce_time,&max_time,1,MPI_DOUBLE,MPI_MAX,0,MPI_COMM_WORLD);
+  mprintf(stdout,"reduced %d maps: %ld of %ld tiles in use, %.3f MB over the network, %8.4f seconds.\n",maps->nmap,nk_reduce_tiles,nk_reduce_tiles_total,tot_bytes/1e6,max_time);
+  nk_reduce_time=0;
+  nk_reduce_bytes=0;
+  nk_reduce_tiles=0;
+  nk_reduce_tiles_total=0;
   return ierr;
 }
 #endif
@@ -1579,7 +2882,7 @@ int mpi_broadcast_mapset(MAPvec *maps,int master)
 
 int read_tod_data(mbTOD *tod)
 {
-
+  double t_prof=nk_profile_tick();
   if (tod->have_data==0)
     tod->data=matrix(tod->ndet,tod->ndata);
   tod->have_data=1;  
@@ -1587,9 +2890,97 @@ int read_tod_data(mbTOD *tod)
   clear_tod(tod);
   //printf("reading tod.\n");
   read_dirfile_tod_data (tod);
+  nk_profile_tock(NK_PROF_READ,t_prof);
   return 0;
 }
 /*--------------------------------------------------------------------------------*/
+typedef struct {
+  int depth;  //read at most this many TODs ahead of the one being worked on
+  size_t budget;  //and don't hold more than this many bytes of read-ahead data
+  int nthread;  //threads used inside each background read
+  int nissued;  //TODs before this have either been read or had a read issued
+  int *ready;
+  size_t inflight;
+  double wait_time;
+  double read_time;
+} TODPrefetch;
+/*--------------------------------------------------------------------------------*/
+static size_t tod_data_bytes(mbTOD *tod)
+{
+  return (size_t)tod->ndet*tod->ndata*sizeof(actData);
+}
+/*--------------------------------------------------------------------------------*/
+static TODPrefetch *init_tod_prefetch(TODvec *tods, PARAMS *params, int nthread)
+{
+  TODPrefetch *pf=(TODPrefetch *)malloc_retry(sizeof(TODPrefetch));
+  pf->depth=params->prefetch_depth;
+  pf->budget=params->prefetch_mem*1e9;
+  pf->nthread=nthread/4;  //reads are mostly waiting on disk, so they don't need much CPU.
+  if (pf->nthread<1)
+    pf->nthread=1;
+  pf->nissued=0;
+  pf->ready=(int *)calloc(tods->ntod,sizeof(int));
+  pf->inflight=0;
+  pf->wait_time=0;
+  pf->read_time=0;
+  return pf;
+}
+/*--------------------------------------------------------------------------------*/
+static void issue_tod_prefetch(TODPrefetch *pf, TODvec *tods, int icur)
+//start background reads for the TODs after icur, as far as depth and the memory budget allow.
+//Must be called from inside a parallel region so there is a thread free to run the reads.
+{
+  if (pf->nissued<=icur)
+    pf->nissued=icur+1;  //icur itself wasn't prefetched, so it'll get read directly
+  while ((pf->nissued<tods->ntod)&&(pf->nissued<=icur+pf->depth)) {
+    int j=pf->nissued;
+    size_t nbyte=tod_data_bytes(&(tods->tods[j]));
+    if (pf->inflight+nbyte>pf->budget)
+      break;
+    pf->inflight+=nbyte;
+    pf->nissued++;
+#pragma omp task firstprivate(j) shared(pf,tods) default(none)
+    {
+      omp_set_num_threads(pf->nthread);
+      double t1=omp_get_wtime();
+      read_tod_data(&(tods->tods[j]));
+      double dt=omp_get_wtime()-t1;
+#pragma omp atomic
+      pf->read_time+=dt;
+#pragma omp flush
+#pragma omp atomic write
+      pf->ready[j]=1;
+    }
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void wait_tod_prefetch(TODPrefetch *pf, TODvec *tods, int icur)
+//make sure the data for TOD icur is in memory, either by waiting on its background read or by reading it now.
+{
+  double t1=omp_get_wtime();
+  if (icur>=pf->nissued)
+    read_tod_data(&(tods->tods[icur]));
+  else {
+    int done=0;
+    while (!done) {
+#pragma omp atomic read
+      done=pf->ready[icur];
+      if (!done)
+	usleep(200);
+    }
+#pragma omp flush
+    pf->inflight-=tod_data_bytes(&(tods->tods[icur]));
+  }
+  pf->wait_time+=omp_get_wtime()-t1;
+}
+/*--------------------------------------------------------------------------------*/
+static void destroy_tod_prefetch(TODPrefetch *pf, int ntod)
+{
+  mprintf(stdout,"prefetch: spent %8.3f seconds waiting on I/O for %d TODs, %8.3f seconds reading in the background.\n",pf->wait_time,ntod,pf->read_time);
+  free(pf->ready);
+  free(pf);
+}
+/*--------------------------------------------------------------------------------*/
 
 void reverse_tod_data(mbTOD *tod)
 //time-reverse all the data in a tod
@@ -1610,12 +3001,10 @@ void reverse_tod_data(mbTOD *tod)
 /*--------------------------------------------------------------------------------*/
 void createFFTWplans1TOD(mbTOD *mytod)
 {  
+  //plans come out of the cache, so TODs of the same length share them.  Don't destroy them.
   if (mytod->have_plans==false) {
-    actData *vec=vector(mytod->ndata);
-    act_fftw_complex *vec2=(act_fftw_complex *)act_fftw_malloc(sizeof(act_fftw_complex)*mytod->ndata);
-    mytod->p_forward=act_fftw_plan_dft_r2c_1d(mytod->ndata,vec,vec2,FFTW_ESTIMATE);
-    mytod->p_back=act_fftw_plan_dft_c2r_1d(mytod->ndata,vec2,vec,FFTW_ESTIMATE);
-    free(vec);
+    mytod->p_forward=act_fftw_cached_plan_r2c(mytod->ndata,1,NULL,NULL,0);
+    mytod->p_back=act_fftw_cached_plan_c2r(mytod->ndata,1,NULL,NULL,0);
     mytod->have_plans=true;
   }
   
@@ -1633,7 +3022,9 @@ void createFFTWplans(TODvec *tod)
 /*--------------------------------------------------------------------------------*/
 void filter_data(mbTOD *tod)
 {
+  double t_prof=nk_profile_tick();
   filter_data_wnoise(tod);
+  nk_profile_tock(NK_PROF_NOISE,t_prof);
 }
 
 
@@ -1785,6 +3176,79 @@ void omp_reduce_map(MAP *map,MAP *mymap)
   }
 
 }
+/*--------------------------------------------------------------------------------*/
+MapTiles *allocate_map_tiles(const MAP *map)
+//set up (empty) per-thread tile tables for accumulating into map.  No tile buffers are
+//allocated here - that happens the first time a thread touches a tile.
+{
+  MapTiles *tiles=(MapTiles *)malloc_retry(sizeof(MapTiles));
+  tiles->nelem=map->npix*get_npol_in_map(map);
+  tiles->ntile=(tiles->nelem+NK_MAP_TILE_LEN-1)>>NK_MAP_TILE_SHIFT;
+  tiles->nthread=omp_get_max_threads();
+  tiles->tiles=(actData ***)malloc_retry(sizeof(actData **)*tiles->nthread);
+  tiles->ntouched=(long *)calloc(tiles->nthread,sizeof(long));
+  for (int i=0;i<tiles->nthread;i++)
+    tiles->tiles[i]=(actData **)calloc(tiles->ntile,sizeof(actData *));
+  return tiles;
+}
+/*--------------------------------------------------------------------------------*/
+actData *map_tiles_new_tile(MapTiles *tiles, int myid, long itile)
+{
+  actData *tile=(actData *)malloc_retry(sizeof(actData)*NK_MAP_TILE_LEN);
+  assert(tile);
+  memset(tile,0,sizeof(actData)*NK_MAP_TILE_LEN);
+  tiles->tiles[myid][itile]=tile;
+  tiles->ntouched[myid]++;
+  return tile;
+}
+/*--------------------------------------------------------------------------------*/
+static inline void map_tiles_add(MapTiles *tiles, int myid, long ipix, actData val)
+{
+  long itile=ipix>>NK_MAP_TILE_SHIFT;
+  actData *tile=tiles->tiles[myid][itile];
+  if (!tile)
+    tile=map_tiles_new_tile(tiles,myid,itile);
+  tile[ipix&NK_MAP_TILE_MASK]+=val;
+}
+/*--------------------------------------------------------------------------------*/
+void reduce_map_tiles(MAP *map, MapTiles *tiles)
+//add every touched tile into the map.  Each tile of the map is owned by exactly one thread
+//during the sum, so no locks are needed.  Tile buffers are freed as we go.
+{
+  assert(tiles->nelem==map->npix*get_npol_in_map(map));
+#pragma omp parallel for shared(map,tiles) schedule(dynamic,16) default(none)
+  for (long itile=0;itile<tiles->ntile;itile++) {
+    long imin=itile<<NK_MAP_TILE_SHIFT;
+    long n=tiles->nelem-imin;
+    if (n>NK_MAP_TILE_LEN)
+      n=NK_MAP_TILE_LEN;
+    actData *mymap=map->map+imin;
+    for (int thread=0;thread<tiles->nthread;thread++) {
+      actData *tile=tiles->tiles[thread][itile];
+      if (tile) {
+	for (long j=0;j<n;j++)
+	  mymap[j]+=tile[j];
+	free(tile);
+	tiles->tiles[thread][itile]=NULL;
+      }
+    }
+  }
+  for (int thread=0;thread<tiles->nthread;thread++)
+    tiles->ntouched[thread]=0;
+}
+/*--------------------------------------------------------------------------------*/
+void destroy_map_tiles(MapTiles *tiles)
+{
+  for (int thread=0;thread<tiles->nthread;thread++) {
+    for (long itile=0;itile<tiles->ntile;itile++)
+      if (tiles->tiles[thread][itile])
+	free(tiles->tiles[thread][itile]);
+    free(tiles->tiles[thread]);
+  }
+  free(tiles->tiles);
+  free(tiles->ntouched);
+  free(tiles);
+}
 
 /*--------------------------------------------------------------------------------*/
 bool is_det_listed(const mbTOD *tod, const PARAMS *params, int det) 
@@ -2110,6 +3574,25 @@ int is_map_polarized(MAP *map)
 #endif
 }
 /*--------------------------------------------------------------------------------*/
+#define NK_FUSED_CHUNK 2048  //samples pixelized at a time when projection and accumulation are fused
+/*--------------------------------------------------------------------------------*/
+static mbUncut *get_det_kept_regions(const mbTOD *tod, int det)
+//the regions of a detector that go into maps, or NULL if all of it does.
+{
+  if (tod->kept_data)
+    return tod->kept_data[tod->rows[det]][tod->cols[det]];
+  if (tod->uncuts)
+    return tod->uncuts[tod->rows[det]][tod->cols[det]];
+  return NULL;
+}
+/*--------------------------------------------------------------------------------*/
+static bool use_fused_projection(const mbTOD *tod, const MAP *map)
+{
+  if ((tod->pixelization_saved)||(tod->pixelization_packed))
+    return false;
+  return fused_projection_ok(tod,map);
+}
+/*--------------------------------------------------------------------------------*/
 void tod2map(MAP *map, mbTOD *tod, PARAMS *params)
 {
 
@@ -2124,72 +3607,67 @@ void tod2map(MAP *map, mbTOD *tod, PARAMS *params)
 #endif
 
 
-  int nproc;
-  //printf("projecting TOD into map.\n");
-#pragma omp parallel shared(nproc) default(none)
-#pragma omp single
-  nproc=omp_get_num_threads();
-  
-  if (nproc*map->npix*sizeof(actData)>tod->ndata*tod->ndet*sizeof(int)) {
-    //printf("doing index-saving projection.\n");
-    tod2map_nocopy(map,tod,params);
-    return;
-  }
-  //else
-  //printf("doing old projection.\n");
-
-
-
-  if (!map->have_locks) {
-    //printf("setting up locks.\n");
-    setup_omp_locks(map);
-    //printf("set them up.\n");
-    
-  }
-#pragma omp parallel shared(tod,map,params) default(none)
+  //each thread accumulates into private tiles covering only the part of the map it hits,
+  //then the tiles get summed into the map.  This replaces both the full per-thread map
+  //copies + omp_reduce_map and the serial index-saving projection.
+  MapTiles *tiles=allocate_map_tiles(map);
+  bool use_fused=use_fused_projection(tod,map);
+#pragma omp parallel shared(tod,map,params,tiles,use_fused) default(none)
   { 
-    MAP *mymap=make_blank_map_copy(map);    
+    int myid=omp_get_thread_num();
     int *ind=(int *)malloc_retry(sizeof(int)*tod->ndata);
 
     PointingFitScratch *scratch=allocate_pointing_fit_scratch(tod);
-#pragma omp for nowait
+#pragma omp for schedule(dynamic,1) nowait
     for (int i=0;i<tod->ndet;i++) { 
       if ((!mbCutsIsAlwaysCut(tod->cuts,tod->rows[i],tod->cols[i]))&&(is_det_listed(tod,params,i))) {
-	//printf("doing first stuff.\n");
+	if (use_fused) {
+	  //pixelize a chunk at a time and accumulate it while it's still in cache.
+	  get_radec_coarse_1det(tod,i,scratch);
+	  mbUncut *uncut=get_det_kept_regions(tod,i);
+	  int nregion=(uncut ? uncut->nregions : 1);
+	  for (int region=0;region<nregion;region++) {
+	    int first=(uncut ? uncut->indexFirst[region] : 0);
+	    int last=(uncut ? uncut->indexLast[region] : tod->ndata);
+	    for (int j0=first;j0<last;j0+=NK_FUSED_CHUNK) {
+	      int j1=(j0+NK_FUSED_CHUNK<last ? j0+NK_FUSED_CHUNK : last);
+	      get_map_projection_fused_range(tod,map,scratch,j0,j1,ind);
+	      for (int j=j0;j<j1;j++)
+		map_tiles_add(tiles,myid,ind[j-j0],tod->data[i][j]);
+	    }
+	  }
+	  continue;
+	}
 	get_pointing_vec_new(tod,map,i,ind,scratch);
-	//printf("got pointing vec.\n");
 	if (tod->kept_data) {
 	  int row=tod->rows[i];
 	  int col=tod->cols[i];
 	  mbUncut *uncut=tod->kept_data[row][col];
 	  for (int region=0;region<uncut->nregions;region++) 
 	    for (int j=uncut->indexFirst[region];j<uncut->indexLast[region];j++)
-	      mymap->map[ind[j]]+=tod->data[i][j];	  
+	      map_tiles_add(tiles,myid,ind[j],tod->data[i][j]);
 	}
 	else {
 	  if (tod->uncuts) {
-	    //printf("doing uncuts.\n");
 	    int row=tod->rows[i];
 	    int col=tod->cols[i];
 	    mbUncut *uncut=tod->uncuts[row][col];
 	    for (int region=0;region<uncut->nregions;region++) 
 	      for (int j=uncut->indexFirst[region];j<uncut->indexLast[region];j++)
-		mymap->map[ind[j]]+=tod->data[i][j];
+		map_tiles_add(tiles,myid,ind[j],tod->data[i][j]);
 	  }
 	  else 
 	    for (int j=0;j<tod->ndata;j++) 
-	      mymap->map[ind[j]]+=tod->data[i][j];
+	      map_tiles_add(tiles,myid,ind[j],tod->data[i][j]);
 	}
       }
     }
     
-    //printf("ready to accumulate.\n");
-    
-    omp_reduce_map(map,mymap);
     free(ind);
     destroy_pointing_fit_scratch(scratch);
-    destroy_map(mymap);
   } 
+  reduce_map_tiles(map,tiles);
+  destroy_map_tiles(tiles);
 }
 /*--------------------------------------------------------------------------------*/
 void polmap2tod_old(MAP *map, mbTOD *tod)
@@ -2243,12 +3721,13 @@ void polmap2tod_old(MAP *map, mbTOD *tod)
 /*--------------------------------------------------------------------------------*/
 #define DO_HWP_POLMAP
 
-void polmap2tod(MAP *map, mbTOD *tod)
+void polmap2tod_slow(MAP *map, mbTOD *tod)
+//original per-sample polarized map->tod, kept as a reference for benchmark_polmap_kernels.
 {
 
   assert(tod);
   assert(tod->data);
-  assert(tod->pixelization_saved);
+  assert((tod->pixelization_saved)||(tod->pixelization_packed));
   assert(tod->uncuts);
 
 
@@ -2295,22 +3774,27 @@ void polmap2tod(MAP *map, mbTOD *tod)
 
 
     const actData *mymap=map->map;
+    int *pixbuf=NULL;
+    if (!tod->pixelization_saved)
+      pixbuf=(int *)malloc_retry(sizeof(int)*tod->ndata);
     switch(poltag){
     case POL_I:
 #pragma omp for
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 	int row=tod->rows[det];
 	int col=tod->cols[det];
 	mbUncut *uncut=tod->uncuts[row][col];
 	for (int region=0;region<uncut->nregions;region++) {
 	  for (int j=uncut->indexFirst[region];j<uncut->indexLast[region];j++)
-	    tod->data[det][j]+=mymap[tod->pixelization_saved[det][j]];
+	    tod->data[det][j]+=mymap[pixvec[j]];
 	}
       }
       break;
     case POL_IQU:
 #pragma omp for
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 #if 0
 	actData ctime_sin=pfit->gamma_ctime_sin_coeffs[det]*ninv;
 	actData ctime_cos=pfit->gamma_ctime_cos_coeffs[det]*ninv;
@@ -2355,7 +3839,7 @@ void polmap2tod(MAP *map, mbTOD *tod)
 	    mycos=mycos*hwp_cos[j]-mysin*hwp_sin[j];
 	    mysin=tmp;
 #endif
-	    int jj=tod->pixelization_saved[det][j]*npol;
+	    int jj=pixvec[j]*npol;
 	    //if (j<10) 
 	    //printf("map pixels are %12.4g %12.4g %12.4g, and sin/cos are %10.6f %10.6f %10.6f\n",mymap[jj],mymap[jj+1],mymap[jj+2],mycos,mysin,tod->twogamma_saved[det][j]);
 	    tod->data[det][j]+=mymap[jj];
@@ -2368,6 +3852,7 @@ void polmap2tod(MAP *map, mbTOD *tod)
     case POL_QU:
 #pragma omp for
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 	int row=tod->rows[det];
 	int col=tod->cols[det];
 	mbUncut *uncut=tod->uncuts[row][col];
@@ -2375,7 +3860,7 @@ void polmap2tod(MAP *map, mbTOD *tod)
 	  for (int j=uncut->indexFirst[region];j<uncut->indexLast[region];j++){
 	    actData mycos=cos7_pi(tod->twogamma_saved[det][j]);
 	    actData mysin=sin7_pi(tod->twogamma_saved[det][j]);
-	    int jj=tod->pixelization_saved[det][j]*npol;
+	    int jj=pixvec[j]*npol;
 	    tod->data[det][j]+=mymap[jj]*mycos;
 	    tod->data[det][j]+=mymap[jj+1]*mysin;
 	  }
@@ -2386,6 +3871,8 @@ void polmap2tod(MAP *map, mbTOD *tod)
       printf("Error - unsupported poltag in polmap2tod.\n");
       break;
     }
+    if (pixbuf)
+      free(pixbuf);
   }
 #ifdef DO_HWP_POLMAP
   free(hwp_sin_raw);
@@ -2509,12 +3996,13 @@ static inline void get_twogamma_sincos(actData *sinval, actData *cosval, const a
 }
 /*--------------------------------------------------------------------------------*/
 
-void tod2polmap_copy(MAP *map,mbTOD *tod) 
-//copy refers to each thread having a copy of the map.  
+void tod2polmap_copy_slow(MAP *map,mbTOD *tod) 
+//copy refers to each thread having a copy of the map.  Superseded by tod2polmap_copy,
+//kept as a reference for benchmark_polmap_kernels.
 {
   assert(tod);
   assert(tod->data);
-  assert(tod->pixelization_saved);
+  assert((tod->pixelization_saved)||(tod->pixelization_packed));
   assert(tod->uncuts);
 
   const int npol=get_npol_in_map(map);
@@ -2558,22 +4046,27 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
     actData *mymap=vector(npol*map->npix);
     actData ninv=1.0/tod->ndata;
     memset(mymap,0,npol*map->npix*sizeof(actData));
+    int *pixbuf=NULL;
+    if (!tod->pixelization_saved)
+      pixbuf=(int *)malloc_retry(sizeof(int)*tod->ndata);
     switch(poltag){
     case POL_I: 
 #pragma omp for
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 	int row=tod->rows[det];
 	int col=tod->cols[det];
 	mbUncut *uncut=tod->uncuts[row][col];
 	for (int region=0;region<uncut->nregions;region++) {
 	  for (int j=uncut->indexFirst[region];j<uncut->indexLast[region];j++)
-	    mymap[tod->pixelization_saved[det][j]]+=tod->data[det][j];	  
+	    mymap[pixvec[j]]+=tod->data[det][j];	  
 	}
       }
       break;
     case POL_IQU:
 #pragma omp for
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 
 	actData ctime_sin=0;
 	actData ctime_cos=0;
@@ -2609,7 +4102,7 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
 	    mycos=mycos*hwp_cos[j]-mysin*hwp_sin[j];
 	    mysin=tmp;
 #endif
-	    int jj=tod->pixelization_saved[det][j]*npol;
+	    int jj=pixvec[j]*npol;
 	    mymap[jj]+=tod->data[det][j];
 	    mymap[jj+1]+=tod->data[det][j]*mycos;
 	    mymap[jj+2]+=tod->data[det][j]*mysin;
@@ -2623,6 +4116,7 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
     case POL_QU:
 #pragma omp for
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 	int row=tod->rows[det];
 	int col=tod->cols[det];
 	mbUncut *uncut=tod->uncuts[row][col];
@@ -2631,13 +4125,13 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
 #if 1
 	    actData mycos=cos7_pi(tod->twogamma_saved[det][j]);
 	    actData mysin=sin7_pi(tod->twogamma_saved[det][j]);
-	    int jj=tod->pixelization_saved[det][j]*npol;
+	    int jj=pixvec[j]*npol;
 	    mymap[jj]+=tod->data[det][j]*mycos;
 	    mymap[jj+1]+=tod->data[det][j]*mysin;
 	    
 #else
-	    mymap[tod->pixelization_saved[det][j]]+=tod->data[det][j]*cos(tod->twogamma_saved[det][j]);
-	    mymap[tod->pixelization_saved[det][j]+npix]+=tod->data[det][j]*sin(tod->twogamma_saved[det][j]);
+	    mymap[pixvec[j]]+=tod->data[det][j]*cos(tod->twogamma_saved[det][j]);
+	    mymap[pixvec[j]+npix]+=tod->data[det][j]*sin(tod->twogamma_saved[det][j]);
 #endif
 	  }
 	}
@@ -2647,6 +4141,7 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
     case POL_IQU_PRECON:
 #pragma omp for
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 	actData ctime_sin=0;
 	actData ctime_cos=0;
 	actData *az_sin=NULL;
@@ -2685,7 +4180,7 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
 	    //actData mycos=cos7_pi(tod->twogamma_saved[det][j]);
 	    //actData mysin=sin7_pi(tod->twogamma_saved[det][j]);
 
-	    int jj=tod->pixelization_saved[det][j]*npol;
+	    int jj=pixvec[j]*npol;
 #if 0
 	    
 	    //mymap[jj]+=1;
@@ -2718,6 +4213,7 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
 #if 1
       //this is the c-bass branch
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 	int row=tod->rows[det];
 	int col=tod->cols[det];
 	mbUncut *uncut=tod->uncuts[row][col];
@@ -2726,20 +4222,21 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
 #if 1
 	    actData mycos=cos7_pi(tod->twogamma_saved[det][j]);
 	    actData mysin=sin7_pi(tod->twogamma_saved[det][j]);
-	    int jj=tod->pixelization_saved[det][j]*npol;
+	    int jj=pixvec[j]*npol;
 	    mymap[jj]+=tod->data[det][j]*mycos*mycos;
 	    mymap[jj+1]+=tod->data[det][j]*mycos*mysin;
 	    mymap[jj+2]+=tod->data[det][j]*mysin*mysin;
 	    
 #else
-	    mymap[tod->pixelization_saved[det][j]]+=tod->data[det][j]*cos(tod->twogamma_saved[det][j]);
-	    mymap[tod->pixelization_saved[det][j]+npix]+=tod->data[det][j]*sin(tod->twogamma_saved[det][j]);
+	    mymap[pixvec[j]]+=tod->data[det][j]*cos(tod->twogamma_saved[det][j]);
+	    mymap[pixvec[j]+npix]+=tod->data[det][j]*sin(tod->twogamma_saved[det][j]);
 #endif
 	  }
 	}
       }
 #else
       for (int det=0;det<tod->ndet;det++) {
+	const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
 	printf("working on detector %d\n",det);
 	actData ctime_sin=pfit->gamma_ctime_sin_coeffs[det]*ninv;
 	actData ctime_cos=pfit->gamma_ctime_cos_coeffs[det]*ninv;
@@ -2773,7 +4270,7 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
 	    //actData mycos=cos7_pi(tod->twogamma_saved[det][j]);
 	    //actData mysin=sin7_pi(tod->twogamma_saved[det][j]);
 
-	    int jj=tod->pixelization_saved[det][j]*npol;
+	    int jj=pixvec[j]*npol;
 	    
 	    mymap[jj]+=tod->data[det][j]*mycos*mycos;
 	    mymap[jj+1]+=tod->data[det][j]*mycos*mysin;
@@ -2789,6 +4286,8 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
       printf("Error - Don't know how to deal with map polarization in tod2polmap_copy.\n");
       break;
     }
+    if (pixbuf)
+      free(pixbuf);
 #pragma omp critical(reduce_first)
     for (int i=0;i<npix;i++) {
       map->map[i]+=mymap[i];
@@ -2828,29 +4327,527 @@ void tod2polmap_copy(MAP *map,mbTOD *tod)
 
 }
 /*--------------------------------------------------------------------------------*/
-
-actData tod_times_map(const MAP *map, const mbTOD *tod, PARAMS *params)
+static void eval_polangles_1det(const mbTOD *tod, int det, int first, int last, actData *mycos, actData *mysin)
+//cos/sin 2gamma for samples [first,last) of a detector, straight from twogamma_saved or the
+//pointing fit's gamma polynomials.  Loops are over contiguous samples so they vectorize.
 {
-
-
-  assert(map);
-  assert(map->projection);
-
-#if 0
-  int nproc;
-#pragma omp parallel shared(nproc) default(none)
-#pragma omp single
-  nproc=omp_get_num_threads();
-
-  if (nproc*map->npix*sizeof(actData)>tod->ndata*tod->ndet*sizeof(int)) {
-    //printf("doing index-saving projection.\n");
-    tod2map_nocopy(map,tod,params);
+  if (tod->twogamma_saved) {
+    const actData *gam=tod->twogamma_saved[det];
+#pragma omp simd
+    for (int j=first;j<last;j++) {
+      mycos[j]=cos7_pi(gam[j]);
+      mysin[j]=sin7_pi(gam[j]);
+    }
     return;
   }
-  //else
-  // printf("doing old projection.\n");
-
-
+  const ACTpolPointingFit *pfit=tod->actpol_pointing;
+  assert(pfit);
+  actData ninv=1.0/tod->ndata;
+  actData ctime_sin=pfit->gamma_ctime_sin_coeffs[det]*ninv;
+  actData ctime_cos=pfit->gamma_ctime_cos_coeffs[det]*ninv;
+  const actData *az_sin=pfit->gamma_az_sin_coeffs[det];
+  const actData *az_cos=pfit->gamma_az_cos_coeffs[det];
+  const actData *az=tod->az;
+  actData az_cent=pfit->az_cent;
+  actData az_std=pfit->az_std;
+#pragma omp simd
+  for (int j=first;j<last;j++) {
+    actData aa=(az[j]-az_cent)/az_std;
+    mysin[j]=az_sin[3]+aa*(az_sin[2]+aa*(az_sin[1]+aa*(az_sin[0])))+ctime_sin*j;
+    mycos[j]=az_cos[3]+aa*(az_cos[2]+aa*(az_cos[1]+aa*(az_cos[0])))+ctime_cos*j;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void get_polangles_1det(const mbTOD *tod, int det, int first, int last, actData *mycos, actData *mysin, const actData *hwp_sin, const actData *hwp_cos)
+//cos/sin 2gamma for samples [first,last), out of tod->polangle_packed if it's there.  If
+//hwp_sin/hwp_cos are non-NULL, the angles are rotated by them as well.
+{
+  const PackedPolAngles *pk=tod->polangle_packed;
+  if (pk&&pk->half&&pk->cs_half[det]) {
+    const short *cs=pk->cs_half[det];
+    const actData fac=1.0/NK_POLANGLE_SCALE;
+#pragma omp simd
+    for (int j=first;j<last;j++) {
+      mycos[j]=fac*cs[2*j];
+      mysin[j]=fac*cs[2*j+1];
+    }
+  }
+  else if (pk&&(!pk->half)&&pk->cs[det]) {
+    const float *cs=pk->cs[det];
+#pragma omp simd
+    for (int j=first;j<last;j++) {
+      mycos[j]=cs[2*j];
+      mysin[j]=cs[2*j+1];
+    }
+  }
+  else
+    eval_polangles_1det(tod,det,first,last,mycos,mysin);
+
+  if (hwp_sin) {
+#pragma omp simd
+    for (int j=first;j<last;j++) {
+      actData tmp=mysin[j]*hwp_cos[j]+mycos[j]*hwp_sin[j];
+      mycos[j]=mycos[j]*hwp_cos[j]-mysin[j]*hwp_sin[j];
+      mysin[j]=tmp;
+    }
+  }
+}
+/*--------------------------------------------------------------------------------*/
+short polangle_to_q15(actData x)
+//sin and cos from the separate polynomial fits on the actpol_pointing path can stray a little past
+//1 in magnitude, and those would wrap around in a short, so they get clamped to +-1.
+{
+  long val=lrint(x*NK_POLANGLE_SCALE);
+  if (val>32767)
+    return 32767;
+  if (val<-32767)
+    return -32767;
+  return (short)val;
+}
+/*--------------------------------------------------------------------------------*/
+PackedPolAngles *pack_tod_polangles(const mbTOD *tod, bool half)
+//evaluate cos/sin 2gamma once and keep them interleaved per sample, as floats or, if half,
+//as Q15 shorts.  Hang the result off tod->polangle_packed and the pol projections use it.
+{
+  assert((tod->twogamma_saved)||(tod->actpol_pointing));
+  PackedPolAngles *pk=(PackedPolAngles *)calloc(1,sizeof(PackedPolAngles));
+  pk->ndet=tod->ndet;
+  pk->ndata=tod->ndata;
+  pk->half=half;
+  if (half)
+    pk->cs_half=(short **)calloc(tod->ndet,sizeof(short *));
+  else
+    pk->cs=(float **)calloc(tod->ndet,sizeof(float *));
+
+  long nbyte=0;
+#pragma omp parallel shared(tod,pk,half) reduction(+:nbyte) default(none)
+  {
+    actData *mycos=vector(tod->ndata);
+    actData *mysin=vector(tod->ndata);
+#pragma omp for schedule(dynamic,1)
+    for (int det=0;det<tod->ndet;det++) {
+      if (mbCutsIsAlwaysCut(tod->cuts,tod->rows[det],tod->cols[det]))
+	continue;
+      eval_polangles_1det(tod,det,0,tod->ndata,mycos,mysin);
+      if (half) {
+	short *cs=(short *)malloc_retry(2*sizeof(short)*tod->ndata);
+	for (int j=0;j<tod->ndata;j++) {
+	  cs[2*j]=polangle_to_q15(mycos[j]);
+	  cs[2*j+1]=polangle_to_q15(mysin[j]);
+	}
+	pk->cs_half[det]=cs;
+	nbyte+=2*sizeof(short)*tod->ndata;
+      }
+      else {
+	float *cs=(float *)malloc_retry(2*sizeof(float)*tod->ndata);
+	for (int j=0;j<tod->ndata;j++) {
+	  cs[2*j]=mycos[j];
+	  cs[2*j+1]=mysin[j];
+	}
+	pk->cs[det]=cs;
+	nbyte+=2*sizeof(float)*tod->ndata;
+      }
+    }
+    free(mycos);
+    free(mysin);
+  }
+  pk->nbyte=nbyte;
+  return pk;
+}
+/*--------------------------------------------------------------------------------*/
+void destroy_packed_polangles(PackedPolAngles *pk)
+{
+  if (!pk)
+    return;
+  for (int i=0;i<pk->ndet;i++) {
+    if ((pk->cs)&&(pk->cs[i]))
+      free(pk->cs[i]);
+    if ((pk->cs_half)&&(pk->cs_half[i]))
+      free(pk->cs_half[i]);
+  }
+  if (pk->cs)
+    free(pk->cs);
+  if (pk->cs_half)
+    free(pk->cs_half);
+  free(pk);
+}
+/*--------------------------------------------------------------------------------*/
+void free_tod_polangles(mbTOD *tod)
+{
+  destroy_packed_polangles(tod->polangle_packed);
+  tod->polangle_packed=NULL;
+}
+/*--------------------------------------------------------------------------------*/
+void setup_tod_polangles(mbTOD *tod, const PARAMS *params)
+//build the angle cache params->pack_polangles asks for, if the TOD has angles and no cache yet.
+{
+#ifdef ACTPOL
+  if ((!params)||(params->pack_polangles<=0)||(tod->polangle_packed))
+    return;
+  if ((!tod->twogamma_saved)&&(!tod->actpol_pointing))
+    return;
+  tod->polangle_packed=pack_tod_polangles(tod,params->pack_polangles>1);
+#endif
+}
+/*--------------------------------------------------------------------------------*/
+#ifdef DO_HWP_POLMAP
+static void get_hwp_sincos(const mbTOD *tod, actData **hwp_sin, actData **hwp_cos)
+//cos/sin of 4x the HWP angle, or NULLs if there's no HWP, in which case no rotation is done.
+{
+  *hwp_sin=NULL;
+  *hwp_cos=NULL;
+  if (!tod->hwp)
+    return;
+  actData *mysin=(actData *)malloc_retry(sizeof(actData)*tod->ndata);
+  actData *mycos=(actData *)malloc_retry(sizeof(actData)*tod->ndata);
+#pragma omp parallel for shared(tod,mysin,mycos) default(none)
+  for (int i=0;i<tod->ndata;i++) {
+    mycos[i]=cos(tod->hwp[i]*4.0);
+    mysin[i]=sin(tod->hwp[i]*4.0);
+  }
+  *hwp_sin=mysin;
+  *hwp_cos=mycos;
+}
+#endif
+/*--------------------------------------------------------------------------------*/
+static inline void map_tiles_add_span(MapTiles *tiles, int myid, long ielem, const actData *val, int n)
+//add n consecutive map elements.  Usually they all sit in one tile and we only look it up once.
+{
+  long itile=ielem>>NK_MAP_TILE_SHIFT;
+  if (((ielem+n-1)>>NK_MAP_TILE_SHIFT)!=itile) {
+    for (int k=0;k<n;k++)
+      map_tiles_add(tiles,myid,ielem+k,val[k]);
+    return;
+  }
+  actData *tile=tiles->tiles[myid][itile];
+  if (!tile)
+    tile=map_tiles_new_tile(tiles,myid,itile);
+  tile+=ielem&NK_MAP_TILE_MASK;
+  for (int k=0;k<n;k++)
+    tile[k]+=val[k];
+}
+/*--------------------------------------------------------------------------------*/
+static void polmap_scatter_region(MapTiles *tiles, int myid, int poltag, int npol, const int *pixvec, const actData *dat,
+				  const actData *mycos, const actData *mysin, int first, int last)
+//accumulate samples [first,last) of one detector into the thread's map tiles.
+{
+  actData val[6];
+  switch(poltag) {
+  case POL_I:
+    for (int j=first;j<last;j++)
+      map_tiles_add(tiles,myid,pixvec[j],dat[j]);
+    break;
+  case POL_IQU:
+    for (int j=first;j<last;j++) {
+      val[0]=dat[j];
+      val[1]=dat[j]*mycos[j];
+      val[2]=dat[j]*mysin[j];
+      map_tiles_add_span(tiles,myid,(long)pixvec[j]*npol,val,3);
+    }
+    break;
+  case POL_QU:
+    for (int j=first;j<last;j++) {
+      val[0]=dat[j]*mycos[j];
+      val[1]=dat[j]*mysin[j];
+      map_tiles_add_span(tiles,myid,(long)pixvec[j]*npol,val,2);
+    }
+    break;
+  case POL_IQU_PRECON:
+    for (int j=first;j<last;j++) {
+      val[0]=dat[j];
+      val[1]=dat[j]*mycos[j];
+      val[2]=dat[j]*mysin[j];
+      val[3]=dat[j]*mycos[j]*mycos[j];
+      val[4]=dat[j]*mycos[j]*mysin[j];
+      val[5]=dat[j]*mysin[j]*mysin[j];
+      map_tiles_add_span(tiles,myid,(long)pixvec[j]*npol,val,6);
+    }
+    break;
+  case POL_QU_PRECON:
+    for (int j=first;j<last;j++) {
+      val[0]=dat[j]*mycos[j]*mycos[j];
+      val[1]=dat[j]*mycos[j]*mysin[j];
+      val[2]=dat[j]*mysin[j]*mysin[j];
+      map_tiles_add_span(tiles,myid,(long)pixvec[j]*npol,val,3);
+    }
+    break;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void polmap_gather_region(const actData *mymap, int poltag, int npol, const int *pixvec, actData *dat,
+				 const actData *mycos, const actData *mysin, int first, int last)
+//add the map into samples [first,last) of one detector.  Adds happen in the same order as
+//polmap2tod_slow, so results match it exactly.
+{
+  switch(poltag) {
+  case POL_I:
+#pragma omp simd
+    for (int j=first;j<last;j++)
+      dat[j]+=mymap[pixvec[j]];
+    break;
+  case POL_IQU:
+#pragma omp simd
+    for (int j=first;j<last;j++) {
+      long jj=(long)pixvec[j]*npol;
+      actData tmp=dat[j]+mymap[jj];
+      tmp+=mymap[jj+1]*mycos[j];
+      tmp+=mymap[jj+2]*mysin[j];
+      dat[j]=tmp;
+    }
+    break;
+  case POL_QU:
+#pragma omp simd
+    for (int j=first;j<last;j++) {
+      long jj=(long)pixvec[j]*npol;
+      actData tmp=dat[j]+mymap[jj]*mycos[j];
+      tmp+=mymap[jj+1]*mysin[j];
+      dat[j]=tmp;
+    }
+    break;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+void polmap2tod(MAP *map, mbTOD *tod)
+//polarized map->tod.  Angles are evaluated (or unpacked from tod->polangle_packed) a region
+//at a time into contiguous buffers, then a separate gather loop pulls from the map.
+{
+  assert(tod);
+  assert(tod->data);
+  assert((tod->pixelization_saved)||(tod->pixelization_packed));
+  assert(tod->uncuts);
+
+  int npol=get_npol_in_map(map);
+  int poltag=get_map_poltag(map);
+  if ((poltag!=POL_I)&&(poltag!=POL_IQU)&&(poltag!=POL_QU)) {
+    fprintf(stderr,"Error - unsupported poltag in polmap2tod.\n");
+    return;
+  }
+  actData *hwp_sin=NULL;
+  actData *hwp_cos=NULL;
+#ifdef DO_HWP_POLMAP
+  if (poltag==POL_IQU)  //QU never had the HWP rotation applied
+    get_hwp_sincos(tod,&hwp_sin,&hwp_cos);
+#endif
+
+#pragma omp parallel shared(map,tod,npol,poltag,hwp_sin,hwp_cos) default(none)
+  {
+    actData *mycos=NULL;
+    actData *mysin=NULL;
+    if (poltag!=POL_I) {
+      mycos=vector(tod->ndata);
+      mysin=vector(tod->ndata);
+    }
+    int *pixbuf=NULL;
+    if (!tod->pixelization_saved)
+      pixbuf=(int *)malloc_retry(sizeof(int)*tod->ndata);
+#pragma omp for schedule(dynamic,1)
+    for (int det=0;det<tod->ndet;det++) {
+      const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
+      mbUncut *uncut=tod->uncuts[tod->rows[det]][tod->cols[det]];
+      for (int region=0;region<uncut->nregions;region++) {
+	int first=uncut->indexFirst[region];
+	int last=uncut->indexLast[region];
+	if (poltag!=POL_I)
+	  get_polangles_1det(tod,det,first,last,mycos,mysin,hwp_sin,hwp_cos);
+	polmap_gather_region(map->map,poltag,npol,pixvec,tod->data[det],mycos,mysin,first,last);
+      }
+    }
+    if (mycos) {
+      free(mycos);
+      free(mysin);
+    }
+    if (pixbuf)
+      free(pixbuf);
+  }
+  if (hwp_sin) {
+    free(hwp_sin);
+    free(hwp_cos);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+void tod2polmap_copy(MAP *map,mbTOD *tod)
+//polarized tod->map.  Angles are evaluated a region at a time as in polmap2tod, and samples
+//go into per-thread map tiles, so a thread holds only the part of the npol x npix map it
+//touches instead of a full private copy.  The name is historical.
+{
+  assert(tod);
+  assert(tod->data);
+  assert((tod->pixelization_saved)||(tod->pixelization_packed));
+  assert(tod->uncuts);
+
+  int npol=get_npol_in_map(map);
+  int poltag=get_map_poltag(map);
+  if (poltag==POL_ERROR) {
+    fprintf(stderr,"Error - unrecognized combination in tod2polmap_copy.\n");
+    return;
+  }
+  actData *hwp_sin=NULL;
+  actData *hwp_cos=NULL;
+#ifdef DO_HWP_POLMAP
+  if ((poltag==POL_IQU)||(poltag==POL_IQU_PRECON))
+    get_hwp_sincos(tod,&hwp_sin,&hwp_cos);
+#endif
+
+  MapTiles *tiles=allocate_map_tiles(map);
+#pragma omp parallel shared(map,tod,tiles,npol,poltag,hwp_sin,hwp_cos) default(none)
+  {
+    int myid=omp_get_thread_num();
+    actData *mycos=NULL;
+    actData *mysin=NULL;
+    if (poltag!=POL_I) {
+      mycos=vector(tod->ndata);
+      mysin=vector(tod->ndata);
+    }
+    int *pixbuf=NULL;
+    if (!tod->pixelization_saved)
+      pixbuf=(int *)malloc_retry(sizeof(int)*tod->ndata);
+#pragma omp for schedule(dynamic,1)
+    for (int det=0;det<tod->ndet;det++) {
+      const int *pixvec=get_saved_pixelization_1det(tod,det,pixbuf);
+      mbUncut *uncut=tod->uncuts[tod->rows[det]][tod->cols[det]];
+      for (int region=0;region<uncut->nregions;region++) {
+	int first=uncut->indexFirst[region];
+	int last=uncut->indexLast[region];
+	if (poltag!=POL_I)
+	  get_polangles_1det(tod,det,first,last,mycos,mysin,hwp_sin,hwp_cos);
+	polmap_scatter_region(tiles,myid,poltag,npol,pixvec,tod->data[det],mycos,mysin,first,last);
+      }
+    }
+    if (mycos) {
+      free(mycos);
+      free(mysin);
+    }
+    if (pixbuf)
+      free(pixbuf);
+  }
+  reduce_map_tiles(map,tiles);
+  destroy_map_tiles(tiles);
+  if (hwp_sin) {
+    free(hwp_sin);
+    free(hwp_cos);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+void benchmark_polmap_kernels(MAP *map, mbTOD *tod, int nrep)
+//time tod2polmap_copy/polmap2tod against the _slow versions on this map and TOD, with the
+//angles computed on the fly and from float and Q15 packed caches.  Prints throughput in
+//samples/second and the largest difference from the old path.  Leaves map and TOD as they were.
+{
+  if (nrep<1)
+    nrep=1;
+  long nsamp=0;
+  for (int det=0;det<tod->ndet;det++) {
+    mbUncut *uncut=tod->uncuts[tod->rows[det]][tod->cols[det]];
+    for (int region=0;region<uncut->nregions;region++)
+      nsamp+=uncut->indexLast[region]-uncut->indexFirst[region];
+  }
+  long nelem=map->npix*get_npol_in_map(map);
+  actData *map_save=vector(nelem);
+  actData *map_ref=vector(nelem);
+  memcpy(map_save,map->map,sizeof(actData)*nelem);
+  actData **dat_save=matrix(tod->ndet,tod->ndata);
+  actData **dat_ref=matrix(tod->ndet,tod->ndata);
+  for (int det=0;det<tod->ndet;det++)
+    memcpy(dat_save[det],tod->data[det],sizeof(actData)*tod->ndata);
+  PackedPolAngles *pk_save=tod->polangle_packed;
+  tod->polangle_packed=NULL;
+
+  const char *names[3]={"on the fly","float cache","Q15 cache"};
+  for (int pass=-1;pass<3;pass++) {
+    if (pass==1)
+      tod->polangle_packed=pack_tod_polangles(tod,false);
+    if (pass==2) {
+      free_tod_polangles(tod);
+      tod->polangle_packed=pack_tod_polangles(tod,true);
+    }
+    //tod->map
+    memset(map->map,0,sizeof(actData)*nelem);
+    double t1=omp_get_wtime();
+    for (int i=0;i<nrep;i++) {
+      if (pass<0)
+	tod2polmap_copy_slow(map,tod);
+      else
+	tod2polmap_copy(map,tod);
+    }
+    double t_tod2map=(omp_get_wtime()-t1)/nrep;
+    actData maxdiff=0;
+    if (pass<0)
+      memcpy(map_ref,map->map,sizeof(actData)*nelem);
+    else
+      for (long i=0;i<nelem;i++)
+	if (fabs(map->map[i]-map_ref[i])>maxdiff)
+	  maxdiff=fabs(map->map[i]-map_ref[i]);
+
+    //map->tod, into zeroed data so the reps don't pile up differences.
+    memcpy(map->map,map_save,sizeof(actData)*nelem);
+    double t_map2tod=0;
+    actData maxdiff2=0;
+    int poltag=get_map_poltag(map);
+    if ((poltag==POL_I)||(poltag==POL_IQU)||(poltag==POL_QU)) {
+      for (int i=0;i<nrep;i++) {
+	for (int det=0;det<tod->ndet;det++)
+	  memset(tod->data[det],0,sizeof(actData)*tod->ndata);
+	t1=omp_get_wtime();
+	if (pass<0)
+	  polmap2tod_slow(map,tod);
+	else
+	  polmap2tod(map,tod);
+	t_map2tod+=omp_get_wtime()-t1;
+      }
+      t_map2tod/=nrep;
+      for (int det=0;det<tod->ndet;det++) {
+	if (pass<0)
+	  memcpy(dat_ref[det],tod->data[det],sizeof(actData)*tod->ndata);
+	else
+	  for (int j=0;j<tod->ndata;j++)
+	    if (fabs(tod->data[det][j]-dat_ref[det][j])>maxdiff2)
+	      maxdiff2=fabs(tod->data[det][j]-dat_ref[det][j]);
+      }
+    }
+    for (int det=0;det<tod->ndet;det++)
+      memcpy(tod->data[det],dat_save[det],sizeof(actData)*tod->ndata);
+
+    if (pass<0)
+      printf("old kernels:                 tod2polmap %8.2f Msamp/s, polmap2tod %8.2f Msamp/s\n",nsamp/t_tod2map/1e6,(t_map2tod>0 ? nsamp/t_map2tod/1e6 : 0));
+    else
+      printf("new kernels, %-12s:    tod2polmap %8.2f Msamp/s, polmap2tod %8.2f Msamp/s, max diffs %10.3e %10.3e\n",names[pass],nsamp/t_tod2map/1e6,(t_map2tod>0 ? nsamp/t_map2tod/1e6 : 0),maxdiff,maxdiff2);
+    if (pass==1)
+      printf("float cache is %.3f GB\n",tod->polangle_packed->nbyte/1e9);
+    if (pass==2)
+      printf("Q15 cache is %.3f GB\n",tod->polangle_packed->nbyte/1e9);
+  }
+  free_tod_polangles(tod);
+  tod->polangle_packed=pk_save;
+  memcpy(map->map,map_save,sizeof(actData)*nelem);
+  free(map_save);
+  free(map_ref);
+  free_matrix(dat_save);
+  free_matrix(dat_ref);
+}
+/*--------------------------------------------------------------------------------*/
+
+actData tod_times_map(const MAP *map, const mbTOD *tod, PARAMS *params)
+{
+
+
+  assert(map);
+  assert(map->projection);
+
+#if 0
+  int nproc;
+#pragma omp parallel shared(nproc) default(none)
+#pragma omp single
+  nproc=omp_get_num_threads();
+
+  if (nproc*map->npix*sizeof(actData)>tod->ndata*tod->ndet*sizeof(int)) {
+    //printf("doing index-saving projection.\n");
+    tod2map_nocopy(map,tod,params);
+    return;
+  }
+  //else
+  // printf("doing old projection.\n");
+
+
 
   if (!map->have_locks) {
     //printf("setting up locks.\n");
@@ -2860,7 +4857,8 @@ actData tod_times_map(const MAP *map, const mbTOD *tod, PARAMS *params)
   }
 #endif
   actData tot=0;
-#pragma omp parallel shared(tod,map,params) reduction(+:tot) default(none)
+  bool use_fused=use_fused_projection(tod,map);
+#pragma omp parallel shared(tod,map,params,use_fused) reduction(+:tot) default(none)
   { 
 
     //MAP *mymap=make_blank_map_copy(map);
@@ -2870,6 +4868,22 @@ actData tod_times_map(const MAP *map, const mbTOD *tod, PARAMS *params)
 #pragma omp for nowait
     for (int i=0;i<tod->ndet;i++) { 
       if ((!mbCutsIsAlwaysCut(tod->cuts,tod->rows[i],tod->cols[i]))&&(is_det_listed(tod,params,i))) {
+	if (use_fused) {
+	  get_radec_coarse_1det(tod,i,scratch);
+	  mbUncut *uncut=get_det_kept_regions(tod,i);
+	  int nregion=(uncut ? uncut->nregions : 1);
+	  for (int region=0;region<nregion;region++) {
+	    int first=(uncut ? uncut->indexFirst[region] : 0);
+	    int last=(uncut ? uncut->indexLast[region] : tod->ndata);
+	    for (int j0=first;j0<last;j0+=NK_FUSED_CHUNK) {
+	      int j1=(j0+NK_FUSED_CHUNK<last ? j0+NK_FUSED_CHUNK : last);
+	      get_map_projection_fused_range(tod,map,scratch,j0,j1,ind);
+	      for (int j=j0;j<j1;j++)
+		tot+=map->map[ind[j-j0]]*tod->data[i][j];
+	    }
+	  }
+	  continue;
+	}
 	get_pointing_vec_new(tod,map,i,ind,scratch);
 	if (tod->kept_data) {
 	  int row=tod->rows[i];
@@ -2904,8 +4918,10 @@ actData tod_times_map(const MAP *map, const mbTOD *tod, PARAMS *params)
 /*--------------------------------------------------------------------------------*/
 void tod2mapset(MAPvec *maps, mbTOD *tod, PARAMS *params)
 {
+  double t_prof=nk_profile_tick();
   for (int i=0;i<maps->nmap;i++)
     tod2map(maps->maps[i],tod,params);
+  nk_profile_tock(NK_PROF_TOD2MAP,t_prof);
 }
 
 
@@ -3259,8 +5275,22 @@ long is_tod_inbounds(const MAP *map, mbTOD *tod,const PARAMS *params)
 
 /*--------------------------------------------------------------------------------*/
 void save_tod_projection(const MAP *map, mbTOD *tod,const PARAMS *params)
-{
-  int **proj=imatrix(tod->ndet,tod->ndata);
+//if params->pack_pointing, keep the pixelization packed; it gets decoded per detector on the fly.
+//The polarization angle cache gets built here too, if it's wanted and not there yet.  Saving again
+//replaces whatever was saved before, reusing the unpacked buffer since it's always ndet by ndata.
+{
+  setup_tod_polangles(tod,params);
+  //take the old buffers off the TOD first, or the pointing would just get copied back out of them.
+  if ((params)&&(params->pack_pointing)) {
+    free_tod_pixelization_saved(tod);
+    tod->pixelization_packed=pack_tod_pixelization(tod,map);
+    return;
+  }
+  int **proj=tod->pixelization_saved;
+  tod->pixelization_saved=NULL;
+  free_tod_pixelization_saved(tod);
+  if (!proj)
+    proj=imatrix(tod->ndet,tod->ndata);
 #pragma omp parallel shared(tod,map,proj) default(none) 
   {
     PointingFitScratch *scratch=allocate_pointing_fit_scratch(tod);
@@ -3272,6 +5302,7 @@ void save_tod_projection(const MAP *map, mbTOD *tod,const PARAMS *params)
       }
       
     }
+    destroy_pointing_fit_scratch(scratch);
   }
   tod->pixelization_saved=proj;
 }
@@ -3641,12 +5672,13 @@ void clear_tod(mbTOD *tod)
 /*--------------------------------------------------------------------------------*/
 void mapset2tod(MAPvec *maps, mbTOD *tod,PARAMS *params)
 {
+  double t_prof=nk_profile_tick();
   clear_tod(tod);
   for (int i=0;i<maps->nmap;i++)
     map2tod(maps->maps[i],tod,params);
   if (params->remove_common)
-    remove_common_mode(tod);
-    
+    remove_common_mode(tod,params);
+  nk_profile_tock(NK_PROF_MAP2TOD,t_prof);
 }
 /*--------------------------------------------------------------------------------*/
 void allocate_tod_storage(mbTOD *tod)
@@ -3741,6 +5773,10 @@ void destroy_tod(mbTOD *tod)
     free(tod->hwp);
     tod->hwp=NULL;
   }
+  destroy_banded_projvec_noise_op(tod);
+#ifdef ACTPOL
+  free_tod_polangles(tod);
+#endif
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -3749,10 +5785,127 @@ void rotate_matrix(actData **mat1, actData **mat2, bool do_transpose)
   
 }
 /*--------------------------------------------------------------------------------*/
-void mapset2mapset(MAPvec *maps, TODvec *tods, PARAMS *params)
+#define NK_PIPE_PROJECT 0
+#define NK_PIPE_NOISE 1
+#define NK_PIPE_ACCUM 2
+#define NK_PIPE_NSTAGE 3
+
+static void run_pipeline_stage(int stage, MAPvec *maps, MAPvec *maps_out, mbTOD *mytod, PARAMS *params)
 {
-  MAPvec *maps_copy=make_mapset_copy(maps);
-  clear_mapset(maps_copy);
+  switch(stage) {
+  case NK_PIPE_PROJECT:
+    allocate_tod_storage(mytod);
+    mapset2tod(maps,mytod,params);
+    break;
+  case NK_PIPE_NOISE:
+    if (!params->no_noise)
+      filter_data(mytod);
+    break;
+  case NK_PIPE_ACCUM:
+    tod2mapset(maps_out,mytod,params);
+    free_tod_storage(mytod);
+    break;
+  default:
+    assert(1==0);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+void mapset2mapset_pipelined(MAPvec *maps, MAPvec *maps_out, TODvec *tods, PARAMS *params)
+//mapset2mapset with several TODs in flight.  The project/noise/accumulate stages are split
+//into params->pipeline_depth groups, and at each tick group g works on TOD tick-g, so with
+//a depth of 3 projecting TOD i+1 overlaps filtering TOD i and accumulating TOD i-1.  Each
+//group gets its own team of threads for the parallel regions inside it.  Only the noise
+//group plans FFTs and only the accumulate group writes to maps_out, so the groups don't
+//step on each other.  maps_out should already be cleared, and is not MPI-reduced here.
+{
+  int ngroup=params->pipeline_depth;
+  if (ngroup>NK_PIPE_NSTAGE)
+    ngroup=NK_PIPE_NSTAGE;
+  assert(ngroup>1);
+
+  //first stage in each group.  With two groups, projecting is cheap so it goes alone.
+  int group_start[NK_PIPE_NSTAGE+1];
+  if (ngroup==2) {
+    group_start[0]=NK_PIPE_PROJECT;
+    group_start[1]=NK_PIPE_NOISE;
+  }
+  else
+    for (int g=0;g<ngroup;g++)
+      group_start[g]=g;
+  group_start[ngroup]=NK_PIPE_NSTAGE;
+
+  //split threads between groups.  By default everyone gets an even share, with any leftovers
+  //going to the group doing the FFTs.
+  int nthread=omp_get_max_threads();
+  int group_threads[NK_PIPE_NSTAGE];
+  int nassigned=0;
+  for (int g=0;g<ngroup;g++) {
+    group_threads[g]=0;
+    for (int stage=group_start[g];stage<group_start[g+1];stage++)
+      group_threads[g]+=params->pipeline_threads[stage];
+    if (group_threads[g]<=0)
+      group_threads[g]=nthread/ngroup;
+    if (group_threads[g]<=0)
+      group_threads[g]=1;
+    nassigned+=group_threads[g];
+  }
+  if (nassigned<nthread)
+    for (int g=0;g<ngroup;g++)
+      if ((group_start[g]<=NK_PIPE_NOISE)&&(group_start[g+1]>NK_PIPE_NOISE))
+	group_threads[g]+=nthread-nassigned;
+
+  int old_levels=omp_get_max_active_levels();
+  if (old_levels<2)
+    omp_set_max_active_levels(2);
+
+  double stage_time[NK_PIPE_NSTAGE]={0,0,0};
+  double t_start=omp_get_wtime();
+  int ntick=tods->ntod+ngroup-1;
+  for (int tick=0;tick<ntick;tick++) {
+#pragma omp parallel for num_threads(ngroup) schedule(static,1) shared(tick,ngroup,group_start,group_threads,stage_time,tods,maps,maps_out,params) default(none)
+    for (int g=0;g<ngroup;g++) {
+      int itod=tick-g;
+      if ((itod>=0)&&(itod<tods->ntod)) {
+	omp_set_num_threads(group_threads[g]);
+	for (int stage=group_start[g];stage<group_start[g+1];stage++) {
+	  double t1=omp_get_wtime();
+	  run_pipeline_stage(stage,maps,maps_out,&(tods->tods[itod]),params);
+	  double dt=omp_get_wtime()-t1;
+	  stage_time[stage]+=dt;  //each stage only ever runs on one thread
+	  if (tods->tod_time)
+	    tods->tod_time[itod]+=dt;  //and no two groups have the same TOD at once
+	}
+      }
+    }
+  }
+  double t_wall=omp_get_wtime()-t_start;
+  omp_set_max_active_levels(old_levels);
+
+  mprintf(stdout,"pipeline (%d TODs in flight, threads",ngroup);
+  for (int g=0;g<ngroup;g++)
+    mprintf(stdout," %d",group_threads[g]);
+  mprintf(stdout,") project %8.3f noise %8.3f accumulate %8.3f wall %8.3f seconds.\n",stage_time[NK_PIPE_PROJECT],stage_time[NK_PIPE_NOISE],stage_time[NK_PIPE_ACCUM],t_wall);
+}
+/*--------------------------------------------------------------------------------*/
+void mapset2mapset_out(MAPvec *maps, MAPvec *maps_out, TODvec *tods, PARAMS *params)
+//project maps into the TODs, noise filter, and project back into maps_out (which gets
+//cleared first).  maps is untouched, and maps_out must be a different mapset.
+{
+  assert(maps!=maps_out);
+  clear_mapset(maps_out);
+  if (tods->tod_time)
+    memset(tods->tod_time,0,sizeof(double)*tods->ntod);
+  double t_start=omp_get_wtime();
+#ifndef MAPS_PREALLOC
+  if (params->pipeline_depth>1) {
+    mapset2mapset_pipelined(maps,maps_out,tods,params);
+    log_tod_load_balance(tods,omp_get_wtime()-t_start);
+#ifdef HAVE_MPI
+    mpi_reduce_mapset(maps_out);
+#endif
+    return;
+  }
+#endif
 #ifdef  MAPS_PREALLOC 
   int nproc;
   MAPvec **bigmaps;
@@ -3770,6 +5923,7 @@ void mapset2mapset(MAPvec *maps, TODvec *tods, PARAMS *params)
 #endif
   for (int i=0;i<tods->ntod;i++) {
     mbTOD *mytod=&(tods->tods[i]);
+    double t1=omp_get_wtime();
     allocate_tod_storage(mytod);
     mapset2tod(maps,mytod,params);
     if (!params->no_noise)
@@ -3777,28 +5931,37 @@ void mapset2mapset(MAPvec *maps, TODvec *tods, PARAMS *params)
 #ifdef MAPS_PREALLOC
     tod2mapset_prealloc(bigmaps,mytod,params);
 #else    
-    tod2mapset(maps_copy,mytod,params);
+    tod2mapset(maps_out,mytod,params);
 #endif
     free_tod_storage(mytod);    
+    if (tods->tod_time)
+      tods->tod_time[i]=omp_get_wtime()-t1;
   }
 #ifdef MAPS_PREALLOC
   for (int i=0;i<maps->nmap;i++)
-    setup_omp_locks(maps_copy->maps[i]);
-#pragma omp parallel shared(maps_copy,bigmaps,nproc) default(none)
+    setup_omp_locks(maps_out->maps[i]);
+#pragma omp parallel shared(maps_out,bigmaps,nproc) default(none)
   {
     int myid=omp_get_thread_num();
-    for (int i=0;i<maps_copy->nmap;i++)
-      omp_reduce_map(maps_copy->maps[i],bigmaps[myid]->maps[i]);
+    for (int i=0;i<maps_out->nmap;i++)
+      omp_reduce_map(maps_out->maps[i],bigmaps[myid]->maps[i]);
     destroy_mapset(bigmaps[myid]);
   }
   free(bigmaps);
 #endif
-  copy_mapset2mapset(maps,maps_copy);
-  destroy_mapset(maps_copy);
+  log_tod_load_balance(tods,omp_get_wtime()-t_start);
 #ifdef HAVE_MPI
-  mpi_reduce_mapset(maps);
+  mpi_reduce_mapset(maps_out);
 #endif
 }
+/*--------------------------------------------------------------------------------*/
+void mapset2mapset(MAPvec *maps, TODvec *tods, PARAMS *params)
+{
+  MAPvec *maps_copy=make_mapset_copy(maps);
+  mapset2mapset_out(maps,maps_copy,tods,params);
+  copy_mapset2mapset(maps,maps_copy);
+  destroy_mapset(maps_copy);
+}
 
 /*--------------------------------------------------------------------------------*/
 void array_detrend(mbTOD *tod, int nsamp)
@@ -3958,13 +6121,16 @@ void unwindow_data(mbTOD *tod)
   free(window2);
 }
 /*--------------------------------------------------------------------------------*/
-void remove_common_mode(mbTOD *tod)
+void remove_common_mode(mbTOD *tod, const PARAMS *params)
+//params may be NULL, in which case the exact median is used.
 {
   assert(tod->have_data);
   detrend_data(tod);
 
   mbNoiseCommonMode *common=mbAllocateCommonMode(tod,2,2); //eventually, these parameters need to actually get set.
   common->nsig=50;  //don't want to find a calbol for now...
+  if (params)
+    common->approx_median=params->approx_median;
   mbRescaleArray(tod,common);
   mbCalculateCommonMode(common);
   mbFindCalbols(common);
@@ -4052,6 +6218,21 @@ int make_initial_mapset(MAPvec *maps, TODvec *tods,PARAMS *params)
     mprintf(stdout,"maps are blank inside initial mapset.\n");
   else
     mprintf(stdout,"maps are not blank inside initial mapset.\n");
+  //with prefetching on, a second thread reads upcoming TODs while this one works through the
+  //current one.  The work itself still gets the full thread count in its nested regions.
+  bool do_prefetch=(params->prefetch_depth>0)&&(!params->do_sim)&&(!params->do_blank)&&(tods->ntod>1);
+  int nthread=omp_get_max_threads();
+  int old_levels=omp_get_max_active_levels();
+  TODPrefetch *prefetch=NULL;
+  if (do_prefetch) {
+    prefetch=init_tod_prefetch(tods,params,nthread);
+    if (old_levels<2)
+      omp_set_max_active_levels(2);
+  }
+#pragma omp parallel num_threads(do_prefetch ? 2 : 1)
+#pragma omp single
+  {
+  omp_set_num_threads(nthread);
   for (int i=0;i<tods->ntod;i++) {
     mbTOD *mytod=&(tods->tods[i]);
     mprintf(stdout,"working on %d %s\n",i,mytod->dirfile);
@@ -4085,6 +6266,10 @@ int make_initial_mapset(MAPvec *maps, TODvec *tods,PARAMS *params)
 	allocate_tod_storage(mytod);
 	assign_tod_value(mytod,0.0);
       }
+      else if (do_prefetch) {
+	issue_tod_prefetch(prefetch,tods,i);
+	wait_tod_prefetch(prefetch,tods,i);
+      }
       else
 	read_tod_data(mytod);
 
@@ -4106,7 +6291,7 @@ int make_initial_mapset(MAPvec *maps, TODvec *tods,PARAMS *params)
     
     if ((params->remove_common)||(params->remove_mean)) {
       mprintf(stdout,"removing common mode.\n");      
-      remove_common_mode(mytod);
+      remove_common_mode(mytod,params);
     }
 
 
@@ -4177,10 +6362,17 @@ int make_initial_mapset(MAPvec *maps, TODvec *tods,PARAMS *params)
     mprintf(stdout,"finished.\n");
     free_tod_storage(mytod);
   }
+  }
+  if (do_prefetch) {
+    omp_set_max_active_levels(old_levels);
+    destroy_tod_prefetch(prefetch,tods->ntod);
+  }
 
     
   if (params->do_sim)
     free(simmap.map);
+  if ((maps->maps[0]->footprint)&&(!maps->maps[0]->footprint->ready))
+    setup_map_footprint(maps,tods,params);
 #ifdef HAVE_MPI
   mpi_reduce_mapset(maps);
 #endif
@@ -4198,10 +6390,13 @@ int make_initial_mapset(MAPvec *maps, TODvec *tods,PARAMS *params)
 void map_axpy(MAP *y, MAP *x, actData a)
 {
   assert(x->npix==y->npix);
-  int npix=x->npix*get_npol_in_map(x);
-#pragma omp parallel for shared(x,y,a,npix) default(none)  
-  for (int i=0;i<npix;i++) {
-    y->map[i]=y->map[i]+x->map[i]*a;    
+  long nblock=map_nblock(y);
+#pragma omp parallel for shared(x,y,a,nblock) default(none)  
+  for (long j=0;j<nblock;j++) {
+    long imin,imax;
+    map_block_range(y,j,&imin,&imax);
+    for (long i=imin;i<imax;i++)
+      y->map[i]=y->map[i]+x->map[i]*a;    
   }
 }
 /*--------------------------------------------------------------------------------*/
@@ -4212,22 +6407,28 @@ void mapset_axpy(MAPvec *y, MAPvec *x, actData a)
     map_axpy(y->maps[i],x->maps[i],a);
 }
 /*--------------------------------------------------------------------------------*/
-actData map_times_map(MAP *x, MAP *y)
+double map_times_map(MAP *x, MAP *y)
+//always accumulate in double, even if the maps are float.
 {
   assert(x->npix==y->npix);
   double tot=0;
-  int npix=x->npix*get_npol_in_map(x);
-#pragma omp parallel for shared(x,y,npix) reduction(+:tot) default(none)
-  for (int i=0;i<npix;i++)
-    tot += x->map[i]*y->map[i];
+  long nblock=map_nblock(x);
+#pragma omp parallel for shared(x,y,nblock) reduction(+:tot) default(none)
+  for (long j=0;j<nblock;j++)
+    if (map_block_is_mine(x,j)) {
+      long imin,imax;
+      map_block_range(x,j,&imin,&imax);
+      for (long i=imin;i<imax;i++)
+	tot += (double)x->map[i]*y->map[i];
+    }
 
-  return (actData)tot;
+  return sum_over_processes(x,tot);
 }
 /*--------------------------------------------------------------------------------*/
-actData mapset_times_mapset(MAPvec *x, MAPvec *y)
+double mapset_times_mapset(MAPvec *x, MAPvec *y)
 {
   assert(x->nmap==y->nmap);
-  actData tot=0;
+  double tot=0;
   for (int i=0;i<x->nmap;i++)
     tot += map_times_map(x->maps[i],y->maps[i]);
   return tot;
@@ -4237,7 +6438,17 @@ void copy_map2map(MAP *map2, MAP *map)
 {
   assert(map->npix==map2->npix);
   assert(map->npix>0);
-  memcpy(map2->map,map->map,sizeof(actData)*map->npix*get_npol_in_map(map));
+  if (!map_is_distributed(map2)) {
+    memcpy(map2->map,map->map,sizeof(actData)*map->npix*get_npol_in_map(map));
+    return;
+  }
+  long nblock=map_nblock(map2);
+#pragma omp parallel for shared(map,map2,nblock) default(none)
+  for (long j=0;j<nblock;j++) {
+    long imin,imax;
+    map_block_range(map2,j,&imin,&imax);
+    memcpy(map2->map+imin,map->map+imin,sizeof(actData)*(imax-imin));
+  }
 }
 /*--------------------------------------------------------------------------------*/
 void copy_mapset2mapset(MAPvec *map2, MAPvec *map)
@@ -4248,47 +6459,325 @@ void copy_mapset2mapset(MAPvec *map2, MAPvec *map)
   }
 }
 /*--------------------------------------------------------------------------------*/
-actData PCGstep(MAPvec *r, MAPvec *p, MAPvec *x, TODvec *tods, MAPvec *wts, PARAMS *params)
+PCGWorkspace *allocate_pcg_workspace(MAPvec *maps)
+{
+  PCGWorkspace *ws=(PCGWorkspace *)malloc_retry(sizeof(PCGWorkspace));
+  ws->ap=make_mapset_copy(maps);
+  ws->z=make_mapset_copy(maps);
+  ws->rz=0;
+  ws->have_z=false;
+  ws->coarse=NULL;
+  return ws;
+}
+/*--------------------------------------------------------------------------------*/
+void destroy_pcg_workspace(PCGWorkspace *ws)
+{
+  destroy_mapset(ws->ap);
+  destroy_mapset(ws->z);
+  destroy_coarse_space(ws->coarse);
+  free(ws);
+}
+/*--------------------------------------------------------------------------------*/
+static double pcg_update_resid(MAPvec *x, MAPvec *r, MAPvec *z, MAPvec *p, MAPvec *ap, MAPvec *wts, double alpha, PARAMS *params)
+//single pass over the maps doing x+=alpha*p, r-=alpha*ap, z=M^-1 r, and returning r.z.
+//Preconditioning matches apply_preconditioner.  Call with alpha=0 (x/p/ap may be NULL) to
+//just set up z from r.
+{
+  double tot=0;
+  for (int m=0;m<r->nmap;m++) {
+    MAP *rmap=r->maps[m];
+    long nblock=map_nblock(rmap);
+    actData *rr=rmap->map;
+    actData *zz=z->maps[m]->map;
+    actData *xx=NULL;
+    actData *pp=NULL;
+    actData *aa=NULL;
+    if (alpha!=0) {
+      xx=x->maps[m]->map;
+      pp=p->maps[m]->map;
+      aa=ap->maps[m]->map;
+    }
+    long nwt=0;
+    actData *wt=NULL;
+    if ((m==0)&&(params->precondition)) {
+      wt=wts->maps[0]->map;
+      nwt=r->maps[0]->npix;
+    }
+    double mytot=0;
+#pragma omp parallel for shared(rmap,nblock,rr,zz,xx,pp,aa,wt,nwt,alpha) reduction(+:mytot) default(none)
+    for (long j=0;j<nblock;j++) {
+      long imin,imax;
+      map_block_range(rmap,j,&imin,&imax);
+      bool mine=map_block_is_mine(rmap,j);
+      for (long i=imin;i<imax;i++) {
+	actData myr=rr[i];
+	if (xx) {
+	  xx[i]+=alpha*pp[i];
+	  myr-=alpha*aa[i];
+	  rr[i]=myr;
+	}
+	actData myz=myr;
+	if ((i<nwt)&&(wt[i]>0))
+	  myz/=wt[i];
+	zz[i]=myz;
+	if (mine)
+	  mytot+=(double)myr*myz;
+      }
+    }
+    tot+=mytot;
+  }
+  return sum_over_processes(r->maps[0],tot);
+}
+/*--------------------------------------------------------------------------------*/
+static void mapset_xpby(MAPvec *y, MAPvec *x, double b)
+//y=x+b*y in one pass
+{
+  assert(x->nmap==y->nmap);
+  for (int m=0;m<y->nmap;m++) {
+    MAP *ymap=y->maps[m];
+    long nblock=map_nblock(ymap);
+    actData *yy=ymap->map;
+    actData *xx=x->maps[m]->map;
+#pragma omp parallel for shared(ymap,nblock,yy,xx,b) default(none)
+    for (long j=0;j<nblock;j++) {
+      long imin,imax;
+      map_block_range(ymap,j,&imin,&imax);
+      for (long i=imin;i<imax;i++)
+	yy[i]=xx[i]+b*yy[i];
+    }
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static bool get_pixel_grid(const MAP *map, long *nfast, long *nslow)
+//lay the map out as nslow rows of nfast pixels, the way the projection indexes it.  Returns
+//false if pixels aren't on a 2-d grid.
+{
+  if ((map->projection==NULL)||(map->projection->proj_type==NK_HEALPIX_RING)||(map->projection->proj_type==NK_HEALPIX_NEST))
+    return false;
+  if (map->projection->proj_type==NK_RECT) {  //dec runs fastest
+    *nfast=map->ny;
+    *nslow=map->nx;
+  }
+  else {
+    *nfast=map->nx;
+    *nslow=map->ny;
+  }
+  return (*nfast)*(*nslow)==map->npix;
+}
+/*--------------------------------------------------------------------------------*/
+static inline long coarse_pixel(const CoarseSpace *cs, long ipix)
+{
+  long islow=ipix/cs->nfast;
+  long ifast=ipix-islow*cs->nfast;
+  return (islow>>cs->nlevel)*cs->nfast_c+(ifast>>cs->nlevel);
+}
+/*--------------------------------------------------------------------------------*/
+static MAPvec *make_coarse_mapset(const MAPvec *maps, const CoarseSpace *cs)
+{
+  MAPvec *coarse=(MAPvec *)malloc_retry(sizeof(MAPvec));
+  coarse->nmap=maps->nmap;
+  coarse->maps=(MAP **)malloc_retry(sizeof(MAP *)*maps->nmap);
+  for (int i=0;i<maps->nmap;i++) {
+    const MAP *map=maps->maps[i];
+    MAP *map_c=(MAP *)calloc(1,sizeof(MAP));
+    map_c->pixsize=map->pixsize*(1<<cs->nlevel);
+    map_c->ramin=map->ramin;
+    map_c->ramax=map->ramax;
+    map_c->decmin=map->decmin;
+    map_c->decmax=map->decmax;
+    if (map->projection->proj_type==NK_RECT) {
+      map_c->nx=cs->nslow_c;
+      map_c->ny=cs->nfast_c;
+    }
+    else {
+      map_c->nx=cs->nfast_c;
+      map_c->ny=cs->nslow_c;
+    }
+    map_c->npix=cs->npix_c;
+    map_c->projection=map->projection;  //only ever used through prolong/restrict, never projected
+#ifdef ACTPOL
+    memcpy(map_c->pol_state,map->pol_state,MAX_NPOL*sizeof(map->pol_state[0]));
+#endif
+    map_c->map=allocate_map_storage(map_c->npix*get_npol_in_map(map_c),false);
+    clear_map(map_c);
+    coarse->maps[i]=map_c;
+  }
+  return coarse;
+}
+/*--------------------------------------------------------------------------------*/
+static void restrict_mapset(const CoarseSpace *cs, const MAPvec *fine, MAPvec *coarse)
+//coarse=P^T fine, summing each block of fine pixels.  For a distributed map, everyone sums the
+//tiles they own and the coarse maps are then added up over processes.
+{
+  long bsize=1L<<cs->nlevel;
+  for (int m=0;m<fine->nmap;m++) {
+    const MAP *map=fine->maps[m];
+    MAP *map_c=coarse->maps[m];
+    int npol=get_npol_in_map(map);
+    const MapFootprint *fp=(map_is_distributed(map) ? map->footprint : NULL);
+#pragma omp parallel for schedule(dynamic,64) shared(cs,map,map_c,npol,fp,bsize) default(none)
+    for (long ic=0;ic<cs->npix_c;ic++) {
+      long islow_c=ic/cs->nfast_c;
+      long ifast_c=ic-islow_c*cs->nfast_c;
+      double tot[MAX_NPOL]={0,0,0,0,0,0};
+      for (long islow=islow_c*bsize;(islow<(islow_c+1)*bsize)&&(islow<cs->nslow);islow++)
+	for (long ifast=ifast_c*bsize;(ifast<(ifast_c+1)*bsize)&&(ifast<cs->nfast);ifast++) {
+	  long ipix=islow*cs->nfast+ifast;
+	  if ((fp)&&(fp->owner[ipix>>NK_MAP_TILE_SHIFT]!=fp->myid))
+	    continue;
+	  for (int ipol=0;ipol<npol;ipol++)
+	    tot[ipol]+=map->map[ipix*npol+ipol];
+	}
+      for (int ipol=0;ipol<npol;ipol++)
+	map_c->map[ic*npol+ipol]=tot[ipol];
+    }
+#ifdef HAVE_MPI
+    if (fp)
+      MPI_Allreduce(MPI_IN_PLACE,map_c->map,map_c->npix*npol,MPI_NType,MPI_SUM,MPI_COMM_WORLD);
+#endif
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void prolong_mapset(const CoarseSpace *cs, const MAPvec *coarse, MAPvec *fine, bool add)
+//fine=P coarse, or fine+=P coarse if add.
+{
+  for (int m=0;m<fine->nmap;m++) {
+    MAP *map=fine->maps[m];
+    const MAP *map_c=coarse->maps[m];
+    long npol=get_npol_in_map(map);
+    long nblock=map_nblock(map);
+#pragma omp parallel for shared(cs,map,map_c,npol,nblock,add) default(none)
+    for (long j=0;j<nblock;j++) {
+      long imin,imax;
+      map_block_range(map,j,&imin,&imax);
+      for (long i=imin;i<imax;i++) {
+	long ipix=i/npol;
+	actData val=map_c->map[coarse_pixel(cs,ipix)*npol+(i-ipix*npol)];
+	if (add)
+	  map->map[i]+=val;
+	else
+	  map->map[i]=val;
+      }
+    }
+  }
+}
+/*--------------------------------------------------------------------------------*/
+CoarseSpace *setup_coarse_space(MAPvec *maps, MAPvec *weights, PARAMS *params)
+//set up the two-level preconditioner on params->mg_levels.  Returns NULL if the maps can't
+//be coarsened.
+{
+  CoarseSpace *cs=(CoarseSpace *)calloc(1,sizeof(CoarseSpace));
+  cs->nlevel=params->mg_levels;
+  cs->niter=(params->mg_iter>0 ? params->mg_iter : 1);
+  for (int i=0;i<maps->nmap;i++) {
+    long nfast,nslow;
+    if ((!get_pixel_grid(maps->maps[i],&nfast,&nslow))||((i>0)&&((nfast!=cs->nfast)||(nslow!=cs->nslow)))) {
+      mprintf(stdout,"Can't coarsen these maps, so no coarse-grid preconditioning.\n");
+      free(cs);
+      return NULL;
+    }
+    cs->nfast=nfast;
+    cs->nslow=nslow;
+  }
+  long bsize=1L<<cs->nlevel;
+  cs->nfast_c=(cs->nfast+bsize-1)/bsize;
+  cs->nslow_c=(cs->nslow+bsize-1)/bsize;
+  cs->npix_c=cs->nfast_c*cs->nslow_c;
+
+  cs->wt=make_coarse_mapset(weights,cs);
+  restrict_mapset(cs,weights,cs->wt);
+  cs->fine=make_mapset_copy(maps);
+  cs->fine_out=make_mapset_copy(maps);
+  cs->b=make_coarse_mapset(maps,cs);
+  cs->y=make_coarse_mapset(maps,cs);
+  cs->r=make_coarse_mapset(maps,cs);
+  cs->z=make_coarse_mapset(maps,cs);
+  cs->p=make_coarse_mapset(maps,cs);
+  cs->q=make_coarse_mapset(maps,cs);
+  mprintf(stdout,"coarse-grid preconditioner on %ldx%ld pixel blocks, %ld x %ld coarse pixels, %d coarse iterations per step.\n",bsize,bsize,cs->nslow_c,cs->nfast_c,cs->niter);
+  return cs;
+}
+/*--------------------------------------------------------------------------------*/
+void destroy_coarse_space(CoarseSpace *cs)
+{
+  if (!cs)
+    return;
+  destroy_mapset(cs->wt);
+  destroy_mapset(cs->fine);
+  destroy_mapset(cs->fine_out);
+  destroy_mapset(cs->b);
+  destroy_mapset(cs->y);
+  destroy_mapset(cs->r);
+  destroy_mapset(cs->z);
+  destroy_mapset(cs->p);
+  destroy_mapset(cs->q);
+  free(cs);
+}
+/*--------------------------------------------------------------------------------*/
+static double add_coarse_correction(CoarseSpace *cs, MAPvec *r, MAPvec *z, TODvec *tods, PARAMS *params)
+//z+=P y, with y from cs->niter Jacobi-preconditioned CG iterations on (P^T A P) y = P^T r
+//starting from zero.  Each iteration is one pass through the TODs.  Returns the new r.z.
+{
+  restrict_mapset(cs,r,cs->b);
+  clear_mapset(cs->y);
+  copy_mapset2mapset(cs->r,cs->b);
+  copy_mapset2mapset(cs->z,cs->r);
+  apply_preconditioner(cs->z,cs->wt,params);
+  copy_mapset2mapset(cs->p,cs->z);
+  double rz=mapset_times_mapset(cs->r,cs->z);
+  for (int iter=0;(iter<cs->niter)&&(rz>0);iter++) {
+    prolong_mapset(cs,cs->p,cs->fine,false);
+    mapset2mapset_out(cs->fine,cs->fine_out,tods,params);
+    restrict_mapset(cs,cs->fine_out,cs->q);
+    double alpha=rz/mapset_times_mapset(cs->p,cs->q);
+    mapset_axpy(cs->y,cs->p,alpha);
+    if (iter==cs->niter-1)
+      break;
+    mapset_axpy(cs->r,cs->q,-alpha);
+    copy_mapset2mapset(cs->z,cs->r);
+    apply_preconditioner(cs->z,cs->wt,params);
+    double rz_new=mapset_times_mapset(cs->r,cs->z);
+    mapset_xpby(cs->p,cs->z,rz_new/rz);
+    rz=rz_new;
+  }
+  prolong_mapset(cs,cs->y,z,true);
+  return mapset_times_mapset(r,z);
+}
+/*--------------------------------------------------------------------------------*/
+double PCGstep(MAPvec *r, MAPvec *p, MAPvec *x, TODvec *tods, MAPvec *wts, PARAMS *params, PCGWorkspace *ws)
+//one PCG iteration.  No maps get allocated in here; everything lives in ws.  Besides the
+//projection through the TODs, this is three sweeps over map memory - p.Ap, the fused
+//x/r/z update + r.z, and the p update.  Dot products and the CG scalars are double even
+//when actData is float.  With a coarse space the preconditioner changes a little from step to
+//step (the coarse solve is inexact), so beta takes the flexible (Polak-Ribiere) form.
 {
   pca_time tt;
   tick(&tt);
-  MAPvec *ap=make_mapset_copy(p);
-  MAPvec *mr=make_mapset_copy(r);
-  mapset2mapset(ap,tods,params);
-  apply_preconditioner(mr,wts,params);
-
-  actData rsqr=mapset_times_mapset(r,mr);
-  destroy_mapset(mr);
-  actData pap=mapset_times_mapset(p,ap);
-  actData alpha_k=rsqr/pap;
-  mapset_axpy(x,p,alpha_k);
-  MAPvec *rk=make_mapset_copy(r);
-  mapset_axpy(rk,ap,-alpha_k);  
-  destroy_mapset(ap);
-
-  MAPvec *mrk=make_mapset_copy(rk);
-  apply_preconditioner(mrk,wts,params);
-
-  actData beta_k=mapset_times_mapset(rk,mrk)/rsqr;
-  MAPvec *pk=make_mapset_copy(mrk);
-  mapset_axpy(pk,p,beta_k);
 
-  //int mpi_broadcast_mapset(MAPvec *maps,master)
-  
-  copy_mapset2mapset(r,rk);
-  copy_mapset2mapset(p,pk);
-  //MPI_Barrier(MPI_COMM_WORLD);
-  //mpi_broadcast_mapset(r,0);
-  //mpi_broadcast_mapset(x,0);
-  //mpi_broadcast_mapset(p,0);
+  if (!ws->have_z) {
+    ws->rz=pcg_update_resid(NULL,r,ws->z,NULL,NULL,wts,0,params);
+    if (ws->coarse) {
+      ws->rz=add_coarse_correction(ws->coarse,r,ws->z,tods,params);
+      copy_mapset2mapset(p,ws->z);
+    }
+    ws->have_z=true;
+  }
+  double rsqr=ws->rz;
 
+  mapset2mapset_out(p,ws->ap,tods,params);
+  double pap=mapset_times_mapset(p,ws->ap);
+  double alpha_k=rsqr/pap;
 
+  double rz_new=pcg_update_resid(x,r,ws->z,p,ws->ap,wts,alpha_k,params);
+  double beta_k=rz_new/rsqr;
+  if (ws->coarse) {
+    rz_new=add_coarse_correction(ws->coarse,r,ws->z,tods,params);
+    //r_new.z_new-r_old.z_new=-alpha z_new.Ap
+    beta_k=-alpha_k*mapset_times_mapset(ws->z,ws->ap)/rsqr;
+  }
+  mapset_xpby(p,ws->z,beta_k);
+  ws->rz=rz_new;
 
-  destroy_mapset(rk);
-  destroy_mapset(pk);
-  destroy_mapset(mrk);
-  
-  //printf("Iteration took %8.3f seconds.\n",tocksilent(&tt));
   mprintf(stdout,"Iteration took %8.3f seconds.\n",tocksilent(&tt));
   
   return rsqr;
@@ -4348,10 +6837,16 @@ void apply_preconditioner( MAPvec *maps,MAPvec *weights,PARAMS *params)
   if (params->precondition) {
     MAP *map=maps->maps[0];
     MAP *wt=weights->maps[0];
-#pragma omp parallel for shared(map,wt,params) default(none)
-    for (int i=0;i<map->npix;i++) {
-      if (wt->map[i]>0)
-	map->map[i]/=wt->map[i];
+    long nblock=map_nblock(map);
+#pragma omp parallel for shared(map,wt,nblock) default(none)
+    for (long j=0;j<nblock;j++) {
+      long imin,imax;
+      map_block_range(map,j,&imin,&imax);
+      if (imax>map->npix)
+	imax=map->npix;
+      for (long i=imin;i<imax;i++)
+	if (wt->map[i]>0)
+	  map->map[i]/=wt->map[i];
     }    
   }
 }
@@ -4367,8 +6862,65 @@ void dump_data(mbTOD *tod, char *fname)
   fclose(outfile);
 }
 /*--------------------------------------------------------------------------------*/
+static void write_distributed_map(MAP *map, char *filename)
+//readwrite_simple_map's format, written by everybody at once with MPI-IO.  The master writes
+//the header and each process writes the tiles it owns.  The file is sized up front, so tiles
+//nobody holds read back as zero.
+{
+  MapFootprint *fp=map->footprint;
+  mprintf(stdout,"trying to write to %s in parallel\n",filename);
+#ifdef HAVE_MPI
+  MPI_File fh;
+  int ierr=MPI_File_open(MPI_COMM_WORLD,filename,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&fh);
+  if (ierr!=MPI_SUCCESS) {
+    fprintf(stderr,"Unable to open %s for writing.\n",filename);
+    return;
+  }
+  MPI_Offset header=2*sizeof(int)+5*sizeof(actData);
+  MPI_File_set_size(fh,0);  //clear out anything an old file had where we hold nothing
+  MPI_File_set_size(fh,header+sizeof(actData)*(MPI_Offset)map->npix);
+  if (fp->myid==0) {
+    char buf[2*sizeof(int)+5*sizeof(actData)];
+    memcpy(buf,&map->nx,sizeof(int));
+    memcpy(buf+sizeof(int),&map->ny,sizeof(int));
+    actData lims[5]={map->pixsize,map->ramin,map->ramax,map->decmin,map->decmax};
+    memcpy(buf+2*sizeof(int),lims,sizeof(lims));
+    MPI_File_write_at(fh,0,buf,header,MPI_BYTE,MPI_STATUS_IGNORE);
+  }
+  //like the serial version, the file holds the first npix elements of the map.
+  for (long j=0;j<fp->nmine;j++)
+    if (map_block_is_mine(map,j)) {
+      long imin,imax;
+      map_block_range(map,j,&imin,&imax);
+      if (imax>map->npix)
+	imax=map->npix;
+      if (imax>imin)
+	MPI_File_write_at(fh,header+sizeof(actData)*(MPI_Offset)imin,map->map+imin,imax-imin,MPI_NType,MPI_STATUS_IGNORE);
+    }
+  MPI_File_close(&fh);
+#else
+  //one process holds everything it owns, which is everything anyone hit.
+  FILE *outfile=fopen_safe(filename,"w");
+  assert(outfile);
+  fwrite(&map->nx,sizeof(int),1,outfile);
+  fwrite(&map->ny,sizeof(int),1,outfile);
+  fwrite(&map->pixsize,sizeof(actData),1,outfile);
+  fwrite(&map->ramin,sizeof(actData),1,outfile);
+  fwrite(&map->ramax,sizeof(actData),1,outfile);
+  fwrite(&map->decmin,sizeof(actData),1,outfile);
+  fwrite(&map->decmax,sizeof(actData),1,outfile);
+  fwrite(map->map,sizeof(actData),map->npix,outfile);
+  fclose(outfile);
+#endif
+}
+/*--------------------------------------------------------------------------------*/
 void readwrite_simple_map(MAP *map, char *filename, int dowrite)
+//if writing a distributed map, every process has to call this.
 {
+  if ((dowrite==DOWRITE)&&(map_is_distributed(map))) {
+    write_distributed_map(map,filename);
+    return;
+  }
 #ifdef HAVE_MPI
   int myid;
   MPI_Comm_rank(MPI_COMM_WORLD,&myid);
@@ -4408,8 +6960,10 @@ void readwrite_simple_map(MAP *map, char *filename, int dowrite)
       freadwrite(&map->decmin,sizeof(actData),1,iofile,dowrite);
       freadwrite(&map->decmax,sizeof(actData),1,iofile,dowrite);
       //mprintf(stdout,"limits on %s are %10.5f %10.5f %10.5f %10.5f %4d %4d %10.5f\n",filename,map->decmin,map->decmax,map->ramin,map->ramax,map->nx,map->ny,map->pixsize);
-      if (dowrite==DOREAD)
+      if (dowrite==DOREAD) {
 	map->map=vector(map->npix);
+	map->footprint=NULL;
+      }
       freadwrite(map->map,sizeof(actData),map->npix,iofile,dowrite);
       fclose(iofile);
       //printf("npix is %ld\n",map->npix);
@@ -4417,14 +6971,362 @@ void readwrite_simple_map(MAP *map, char *filename, int dowrite)
   
 }
 /*--------------------------------------------------------------------------------*/
+static bool read_map_data(MAP *map, char *filename)
+//fill an existing map from a readwrite_simple_map file without reallocating it, so the map
+//keeps its storage and footprint.  Geometry has to match.  Distributed maps only read the
+//tiles they hold.
+{
+  FILE *infile=fopen(filename,"r");
+  if (!infile) {
+    fprintf(stderr,"Unable to open %s for reading.\n",filename);
+    return false;
+  }
+  int nx,ny;
+  bool ok=(fread(&nx,sizeof(int),1,infile)==1)&&(fread(&ny,sizeof(int),1,infile)==1);
+  if ((!ok)||(nx!=map->nx)||(ny!=map->ny)) {
+    fprintf(stderr,"%s is %dx%d, but the map is %dx%d.\n",filename,nx,ny,map->nx,map->ny);
+    fclose(infile);
+    return false;
+  }
+  long header=2*sizeof(int)+5*sizeof(actData);
+  long nblock=map_nblock(map);
+  for (long j=0;(j<nblock)&&(ok);j++) {
+    long imin,imax;
+    map_block_range(map,j,&imin,&imax);
+    if (imax>map->npix)
+      imax=map->npix;
+    if (imax<=imin)
+      continue;
+    ok=(fseek(infile,header+sizeof(actData)*imin,SEEK_SET)==0)&&(fread(map->map+imin,sizeof(actData),imax-imin,infile)==(size_t)(imax-imin));
+  }
+  fclose(infile);
+  if (!ok)
+    fprintf(stderr,"%s is too short.\n",filename);
+  else
+    mprintf(stdout,"read map data from %s\n",filename);
+  return ok;
+}
+/*--------------------------------------------------------------------------------*/
+//Checkpointed PCG state.  The solver copies x, r, p and z into snapshot maps and goes on
+//iterating while a background thread writes them out, so the only time the loop spends on a
+//checkpoint is one memory copy (plus waiting, if the previous write hasn't finished).  The
+//writer thread does no MPI.  Each process writes <name>_<rank> with the tiles it holds if the
+//maps are distributed; otherwise the master writes <name>_0 for everyone.  Files are written
+//under a temporary name and renamed, so a job killed mid-write leaves the last good one.
+
+#define NK_CKPT_MAGIC "NKCKPT01"
+#define NK_CKPT_NSET 5  //x, r, p, z, weights
+
+typedef struct {
+  char fname[MAXLEN+32];
+  bool writer;  //whether this process writes a file at all
+  MAPvec *snap[NK_CKPT_NSET-1];
+  MAPvec *weights;  //doesn't change during the solve, so it's written straight from the solver's copy
+  int nproc;
+  int myid;
+  int iter;
+  double rz;
+  double first_residual;
+  bool busy;
+  pthread_t thread;
+  double copy_time;
+  double wait_time;
+  double write_time;  //only touched by the writer thread while busy
+  size_t nbytes;
+  int nwritten;
+} PCGCheckpoint;
+/*--------------------------------------------------------------------------------*/
+static void get_checkpoint_name(char *fname, const char *root, int myid)
+{
+  sprintf(fname,"%s_%d",root,myid);
+}
+/*--------------------------------------------------------------------------------*/
+static bool checkpoint_is_distributed(MAPvec *maps)
+{
+  return map_is_distributed(maps->maps[0]);
+}
+/*--------------------------------------------------------------------------------*/
+static PCGCheckpoint *init_pcg_checkpoint(MAPvec *x, MAPvec *weights, PARAMS *params)
+{
+  PCGCheckpoint *ck=(PCGCheckpoint *)calloc(1,sizeof(PCGCheckpoint));
+  ck->nproc=1;
+  ck->myid=0;
+#ifdef HAVE_MPI
+  MPI_Comm_size(MPI_COMM_WORLD,&ck->nproc);
+  MPI_Comm_rank(MPI_COMM_WORLD,&ck->myid);
+#endif
+  get_checkpoint_name(ck->fname,params->checkpoint_name,ck->myid);
+  ck->writer=(ck->myid==0)||(checkpoint_is_distributed(x));
+  ck->weights=weights;
+  if (ck->writer)
+    for (int i=0;i<NK_CKPT_NSET-1;i++)
+      ck->snap[i]=make_mapset_copy(x);
+  return ck;
+}
+/*--------------------------------------------------------------------------------*/
+static size_t fwrite_mapset_blocks(MAPvec *maps, FILE *outfile)
+//the blocks of each map this process holds, each as its element range and then the data.
+{
+  size_t nbytes=0;
+  for (int m=0;m<maps->nmap;m++) {
+    MAP *map=maps->maps[m];
+    long npol=get_npol_in_map(map);
+    long nblock=map_nblock(map);
+    fwrite(&map->npix,sizeof(long),1,outfile);
+    fwrite(&npol,sizeof(long),1,outfile);
+    fwrite(&nblock,sizeof(long),1,outfile);
+    for (long j=0;j<nblock;j++) {
+      long lims[2];
+      map_block_range(map,j,lims,lims+1);
+      fwrite(lims,sizeof(long),2,outfile);
+      nbytes+=sizeof(actData)*fwrite(map->map+lims[0],sizeof(actData),lims[1]-lims[0],outfile);
+    }
+  }
+  return nbytes;
+}
+/*--------------------------------------------------------------------------------*/
+static bool fread_mapset_blocks(MAPvec *maps, FILE *infile)
+//read back what fwrite_mapset_blocks wrote.  Returns false if the layout isn't the one these
+//maps have, e.g. if the job is resumed on a different number of processes.
+{
+  for (int m=0;m<maps->nmap;m++) {
+    MAP *map=maps->maps[m];
+    long hdr[3];
+    long nblock=map_nblock(map);
+    if (fread(hdr,sizeof(long),3,infile)!=3)
+      return false;
+    if ((hdr[0]!=map->npix)||(hdr[1]!=get_npol_in_map(map))||(hdr[2]!=nblock))
+      return false;
+    for (long j=0;j<nblock;j++) {
+      long lims[2],imin,imax;
+      map_block_range(map,j,&imin,&imax);
+      if (fread(lims,sizeof(long),2,infile)!=2)
+	return false;
+      if ((lims[0]!=imin)||(lims[1]!=imax))
+	return false;
+      if (fread(map->map+imin,sizeof(actData),imax-imin,infile)!=(size_t)(imax-imin))
+	return false;
+    }
+  }
+  return true;
+}
+/*--------------------------------------------------------------------------------*/
+static void *write_pcg_checkpoint_thread(void *arg)
+{
+  PCGCheckpoint *ck=(PCGCheckpoint *)arg;
+  pca_time tt;
+  tick(&tt);
+  char tmpname[MAXLEN+64];
+  sprintf(tmpname,"%s.tmp",ck->fname);
+  FILE *outfile=fopen(tmpname,"w");
+  if (!outfile) {
+    fprintf(stderr,"Unable to open %s for writing, skipping checkpoint.\n",tmpname);
+    return NULL;
+  }
+  int nset=NK_CKPT_NSET;
+  fwrite(NK_CKPT_MAGIC,1,8,outfile);
+  fwrite(&ck->nproc,sizeof(int),1,outfile);
+  fwrite(&ck->myid,sizeof(int),1,outfile);
+  fwrite(&ck->iter,sizeof(int),1,outfile);
+  fwrite(&nset,sizeof(int),1,outfile);
+  fwrite(&ck->rz,sizeof(double),1,outfile);
+  fwrite(&ck->first_residual,sizeof(double),1,outfile);
+  size_t nbytes=0;
+  for (int i=0;i<NK_CKPT_NSET-1;i++)
+    nbytes+=fwrite_mapset_blocks(ck->snap[i],outfile);
+  nbytes+=fwrite_mapset_blocks(ck->weights,outfile);
+  bool ok=(fflush(outfile)==0);
+  ok=(fsync(fileno(outfile))==0)&&ok;
+  ok=(fclose(outfile)==0)&&ok;
+  if ((ok)&&(rename(tmpname,ck->fname)==0)) {
+    ck->nbytes+=nbytes;
+    ck->nwritten++;
+  }
+  else
+    fprintf(stderr,"Failed writing checkpoint %s.\n",tmpname);
+  ck->write_time+=tocksilent(&tt);
+  return NULL;
+}
+/*--------------------------------------------------------------------------------*/
+static void wait_pcg_checkpoint(PCGCheckpoint *ck)
+{
+  if (!ck->busy)
+    return;
+  pca_time tt;
+  tick(&tt);
+  pthread_join(ck->thread,NULL);
+  ck->busy=false;
+  ck->wait_time+=tocksilent(&tt);
+}
+/*--------------------------------------------------------------------------------*/
+static void save_pcg_checkpoint(PCGCheckpoint *ck, MAPvec *x, MAPvec *r, MAPvec *p, PCGWorkspace *ws, int iter, double first_residual)
+//snapshot the solver state after iteration iter and hand it to the writer thread.
+{
+  if (!ck->writer)
+    return;
+  wait_pcg_checkpoint(ck);
+  pca_time tt;
+  tick(&tt);
+  copy_mapset2mapset(ck->snap[0],x);
+  copy_mapset2mapset(ck->snap[1],r);
+  copy_mapset2mapset(ck->snap[2],p);
+  copy_mapset2mapset(ck->snap[3],ws->z);
+  ck->iter=iter;
+  ck->rz=ws->rz;
+  ck->first_residual=first_residual;
+  ck->copy_time+=tocksilent(&tt);
+  if (pthread_create(&ck->thread,NULL,write_pcg_checkpoint_thread,ck)==0)
+    ck->busy=true;
+  else {
+    fprintf(stderr,"Unable to start checkpoint writer, writing in the foreground.\n");
+    write_pcg_checkpoint_thread(ck);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void destroy_pcg_checkpoint(PCGCheckpoint *ck)
+{
+  wait_pcg_checkpoint(ck);
+  if (ck->writer) {
+    mprintf(stdout,"checkpoints: wrote %d, %.3f GB, %8.3f seconds copying, %8.3f waiting, %8.3f writing in the background.\n",ck->nwritten,ck->nbytes/1e9,ck->copy_time,ck->wait_time,ck->write_time);
+    for (int i=0;i<NK_CKPT_NSET-1;i++)
+      destroy_mapset(ck->snap[i]);
+  }
+  free(ck);
+}
+/*--------------------------------------------------------------------------------*/
+static bool read_pcg_checkpoint(PARAMS *params, MAPvec *x, MAPvec *r, MAPvec *p, PCGWorkspace *ws, MAPvec *weights, int *iter, double *first_residual)
+//restore what save_pcg_checkpoint wrote.  Either every process gets its state back or nobody
+//does and the solve starts over.
+{
+  int myid=0;
+  int nproc=1;
+#ifdef HAVE_MPI
+  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
+  MPI_Comm_rank(MPI_COMM_WORLD,&myid);
+#endif
+  bool distributed=checkpoint_is_distributed(x);
+  int ok=1;
+  int hdr[4]={0,0,0,0};
+  double scalars[2]={0,0};
+  if ((distributed)||(myid==0)) {
+    char fname[MAXLEN+32];
+    get_checkpoint_name(fname,params->checkpoint_name,myid);
+    FILE *infile=fopen(fname,"r");
+    if (infile) {
+      char magic[8];
+      ok=(fread(magic,1,8,infile)==8)&&(memcmp(magic,NK_CKPT_MAGIC,8)==0);
+      ok=ok&&(fread(hdr,sizeof(int),4,infile)==4)&&(fread(scalars,sizeof(double),2,infile)==2);
+      ok=ok&&(hdr[0]==nproc||!distributed)&&(hdr[1]==myid)&&(hdr[3]==NK_CKPT_NSET);
+      ok=ok&&fread_mapset_blocks(x,infile)&&fread_mapset_blocks(r,infile)&&fread_mapset_blocks(p,infile);
+      ok=ok&&fread_mapset_blocks(ws->z,infile)&&fread_mapset_blocks(weights,infile);
+      fclose(infile);
+      if (!ok)
+	fprintf(stderr,"Checkpoint %s doesn't match this run.\n",fname);
+    }
+    else {
+      fprintf(stderr,"Unable to open checkpoint %s.\n",fname);
+      ok=0;
+    }
+  }
+#ifdef HAVE_MPI
+  int myok=ok;
+  MPI_Allreduce(&myok,&ok,1,MPI_INT,MPI_MIN,MPI_COMM_WORLD);
+  if ((ok)&&(!distributed)) {
+    MPI_Bcast(hdr,4,MPI_INT,0,MPI_COMM_WORLD);
+    MPI_Bcast(scalars,2,MPI_DOUBLE,0,MPI_COMM_WORLD);
+    MAPvec *sets[NK_CKPT_NSET]={x,r,p,ws->z,weights};
+    for (int i=0;i<NK_CKPT_NSET;i++)
+      for (int m=0;m<sets[i]->nmap;m++) {
+	MAP *map=sets[i]->maps[m];
+	MPI_Bcast(map->map,map->npix*get_npol_in_map(map),MPI_NType,0,MPI_COMM_WORLD);
+      }
+  }
+#endif
+  if (!ok) {
+    mprintf(stdout,"Not resuming; starting the solve over.\n");
+    return false;
+  }
+  *iter=hdr[2];
+  ws->rz=scalars[0];
+  ws->have_z=true;
+  *first_residual=scalars[1];
+  mprintf(stdout,"Resuming PCG after iteration %d.\n",*iter);
+  return true;
+}
+/*--------------------------------------------------------------------------------*/
+void benchmark_coarse_preconditioner(MAPvec *b, MAPvec *weights, TODvec *tods, PARAMS *params)
+//solve A x=b from zero with the plain diagonal preconditioner, then with the coarse-grid
+//correction, until |r|^2 drops by params->tol, and report iterations, passes through the
+//TODs, and time for each.  A two-level step costs 1+mg_iter passes, so fewer iterations
+//is only a win if it beats that.
+{
+  int mg_levels=params->mg_levels;
+  if (mg_levels<=0)
+    mg_levels=3;
+  double r0=mapset_times_mapset(b,b);
+  for (int twolevel=0;twolevel<2;twolevel++) {
+    MAPvec *r=make_mapset_copy(b);
+    MAPvec *p=make_mapset_copy(b);
+    MAPvec *x=make_mapset_copy(b);
+    apply_preconditioner(p,weights,params);
+    clear_mapset(x);
+    PCGWorkspace *ws=allocate_pcg_workspace(b);
+    if (twolevel) {
+      int nlev_save=params->mg_levels;
+      params->mg_levels=mg_levels;
+      ws->coarse=setup_coarse_space(b,weights,params);
+      params->mg_levels=nlev_save;
+    }
+    if ((twolevel)&&(!ws->coarse)) {
+      destroy_pcg_workspace(ws);
+      destroy_mapset(x);
+      destroy_mapset(p);
+      destroy_mapset(r);
+      break;
+    }
+    pca_time tt;
+    tick(&tt);
+    int iter=0;
+    double rr=r0;
+    while ((iter<params->maxiter)&&(rr>params->tol*r0)) {
+      PCGstep(r,p,x,tods,weights,params,ws);
+      iter++;
+      rr=mapset_times_mapset(r,r);
+    }
+    double dt=tocksilent(&tt);
+    long npass=iter;
+    if (ws->coarse)
+      npass+=(long)(iter+1)*ws->coarse->niter;
+    mprintf(stdout,"%s preconditioner: %d iterations, %ld passes through the TODs, %8.3f seconds to |r|^2/|b|^2=%12.4e\n",(twolevel ? "two-level" : "diagonal"),iter,npass,dt,rr/r0);
+    destroy_pcg_workspace(ws);
+    destroy_mapset(x);
+    destroy_mapset(p);
+    destroy_mapset(r);
+  }
+}
+/*--------------------------------------------------------------------------------*/
 void run_PCG(MAPvec *maps, TODvec *tods, PARAMS *params)
 {
 
   //createFFTWplans(tod);
+  double t_run=omp_get_wtime();
+  nk_profile_reset(strlen(params->profile_file)>0);
 
   bool had_maps;
   MAPvec *maps_in;
-  had_maps=!(is_mapset_blank(maps));
+  bool warm=(strlen(params->warm_start)>0)&&(is_mapset_blank(maps));
+  if (warm) {
+    //start from a previous solution; the solve below finds the correction to it.  Distributed
+    //maps need their footprint first, so they only read (and pay for) the tiles they hold.
+    if ((maps->maps[0]->footprint)&&(!maps->maps[0]->footprint->ready))
+      setup_map_footprint(maps,tods,params);
+    if (!read_map_data(maps->maps[0],params->warm_start)) {
+      clear_mapset(maps);
+      warm=false;
+    }
+  }
+  //the warm start gets read back in at the end rather than copied, so it isn't held through the solve.
+  had_maps=(!warm)&&(!is_mapset_blank(maps));
   if (had_maps) 
     maps_in=make_mapset_copy(maps);  //save 'em, since the incoming mapset gets wiped over in make_initial_mapset
 
@@ -4449,50 +7351,77 @@ void run_PCG(MAPvec *maps, TODvec *tods, PARAMS *params)
   }
 
   MAPvec *weights=make_mapset_copy(maps);
-  get_weights(weights,tods,params);
-  char wtname[MAXLEN];
-  sprintf(wtname,"%s.weights",params->outname);
-  readwrite_simple_map(weights->maps[0],wtname,DOWRITE);
-  if (params->rawonly) 
-    exit(EXIT_SUCCESS);
-
-
-  //readwrite_simple_map(weights->maps[0],"weights.dat",DOWRITE);
-  //apply_preconditioner(maps,weights,params);
-
 
   mprintf(stdout,"making r,p, and x\n");
   MAPvec *r=make_mapset_copy(maps);
   MAPvec *p=make_mapset_copy(maps); 
-
-  apply_preconditioner(p,weights,params);
   MAPvec *x=make_mapset_copy(maps);
-  //clear_mapset(r);
-  //clear_mapset(p);
-  clear_mapset(x);
-  //pca_time tt;
-  
-  actData residual=1e20;
+  PCGWorkspace *ws=allocate_pcg_workspace(maps);
+  double residual=1e20;
   int iter=0;
   int converged=0;
-  actData first_residual=0;
+  double first_residual=0;
+
+  bool resumed=false;
+  if ((params->resume)&&(strlen(params->checkpoint_name)>0))
+    resumed=read_pcg_checkpoint(params,x,r,p,ws,weights,&iter,&first_residual);
+
+  if (!resumed) {
+    //a failed resume may have left partial state behind.
+    copy_mapset2mapset(r,maps);
+    copy_mapset2mapset(p,maps);
+    clear_mapset(x);
+
+    bool have_weights=false;
+    char wtname[MAXLEN+16];
+    if (strlen(params->warm_start)>0) {
+      //the previous run's weights are the same as these would be, so don't pay for another pass.
+      clear_mapset(weights);
+      sprintf(wtname,"%s.weights",params->warm_start);
+      have_weights=read_map_data(weights->maps[0],wtname);
+    }
+    if (!have_weights)
+      get_weights(weights,tods,params);
+    sprintf(wtname,"%s.weights",params->outname);
+    readwrite_simple_map(weights->maps[0],wtname,DOWRITE);
+    if (params->rawonly) 
+      exit(EXIT_SUCCESS);
+    if (params->mg_benchmark) {
+      benchmark_coarse_preconditioner(maps,weights,tods,params);
+      exit(EXIT_SUCCESS);
+    }
+    apply_preconditioner(p,weights,params);
+  }
+
+  //readwrite_simple_map(weights->maps[0],"weights.dat",DOWRITE);
+  //apply_preconditioner(maps,weights,params);
+  //pca_time tt;
+  
+  if (params->mg_levels>0)
+    ws->coarse=setup_coarse_space(maps,weights,params);
+  PCGCheckpoint *ckpt=NULL;
+  if ((strlen(params->checkpoint_name)>0)&&(params->checkpoint_every>0))
+    ckpt=init_pcg_checkpoint(x,weights,params);
   while ((iter<params->maxiter)&&(converged==0))
     {
       iter++;
       //tick(&tt);
-      residual=PCGstep(r,p,x,tods,weights,params);
-      if (iter==1) 
+      residual=PCGstep(r,p,x,tods,weights,params,ws);
+      if (iter==1) {
 	first_residual=residual;
+	write_tod_costs(tods,params);  //first full pass is representative; feed it to the next run's balancing
+      }
 
       if (residual<params->tol*first_residual)
 	converged=1;
       mprintf(stderr,"residual is %14.5e at iteration %d.\n",residual,iter);
       //fprintf(stderr,"residual is %14.5e at iteration %d.\n",residual,iter);
       //fprintf(stderr,"residual is %14.5e at iteration %d.  Step took %8.3f seconds.\n",residual,iter,tocksilent(&tt));            
+      if ((ckpt)&&(iter%params->checkpoint_every==0))
+	save_pcg_checkpoint(ckpt,x,r,p,ws,iter,first_residual);
 #ifdef HAVE_MPI
-      int ierr,myid;
-      ierr=MPI_Comm_rank(MPI_COMM_WORLD,&myid);
-      if (myid==0) {
+      if ((params->temp_every>0)&&(iter%params->temp_every==0)) {
+	//everyone calls this; only the master writes unless the map is distributed.
 	char outname[512];
 	sprintf(outname,"%s_%d.out",params->tempname,iter);
 	//sprintf(outname,"temporary_map_commonsub_%d.out",iter);
@@ -4503,7 +7432,18 @@ void run_PCG(MAPvec *maps, TODvec *tods, PARAMS *params)
       //displayMap(x->maps[0]);
 #endif
     }
+  if (ckpt)
+    destroy_pcg_checkpoint(ckpt);
+  nk_profile_report(params,omp_get_wtime()-t_run);
+  destroy_pcg_workspace(ws);
+  save_fft_wisdom(params);
   copy_mapset2mapset(maps,x);
+  if (warm) {
+    //x is free now, so the starting point goes back in through it.
+    clear_mapset(x);
+    if (read_map_data(x->maps[0],params->warm_start))
+      mapset_axpy(maps,x,1.0);
+  }
   destroy_mapset(x);
   destroy_mapset(r);
   destroy_mapset(p);
@@ -4551,6 +7491,8 @@ void print_options(PARAMS *params)
     printf("Going to use same shape as input map for output map.\n");
   if (params->remove_mean)
     printf("going to remove the common mode from the input data.\n");
+  if (params->approx_median)
+    printf("going to use the approximate median for the common mode.\n");
   if (params->deglitch)
     printf("going to deglitch data.\n");
   else
@@ -4567,6 +7509,39 @@ void print_options(PARAMS *params)
   else
     printf("Not going to write ra/dec solutions to disk.\n");
   
+  if (params->pipeline_depth>1)
+    printf("Going to pipeline mapping with %d TODs in flight.\n",params->pipeline_depth);
+  if (params->fft_planner_flags==FFTW_PATIENT)
+    printf("Going to plan FFTs with FFTW_PATIENT.\n");
+  if (params->fft_planner_flags==FFTW_MEASURE)
+    printf("Going to plan FFTs with FFTW_MEASURE.\n");
+  if (strlen(params->fft_wisdom)>0)
+    printf("fftw wisdom file is %s\n",params->fft_wisdom);
+  if (params->pack_pointing)
+    printf("Going to keep saved pointing packed.\n");
+  if (params->pack_polangles==1)
+    printf("Going to cache polarization angles as floats.\n");
+  if (params->pack_polangles==2)
+    printf("Going to cache polarization angles as Q15 shorts.\n");
+  if (params->prefetch_depth>0)
+    printf("Going to prefetch up to %d TODs ahead, using at most %.2f GB.\n",params->prefetch_depth,params->prefetch_mem);
+  if (params->balance_tods)
+    printf("Going to balance TODs across processes by estimated cost.\n");
+  if (params->distribute_maps)
+    printf("Going to keep only the map tiles each process's TODs hit.\n");
+  if (params->mg_levels>0)
+    printf("Going to add a coarse-grid correction on %dx%d pixel blocks with %d coarse iterations.\n",1<<params->mg_levels,1<<params->mg_levels,params->mg_iter);
+  if (params->mg_benchmark)
+    printf("Going to benchmark the coarse-grid preconditioner and quit.\n");
+  if (strlen(params->checkpoint_name)>0)
+    printf("Going to checkpoint to %s every %d iterations%s.\n",params->checkpoint_name,params->checkpoint_every,(params->resume ? ", resuming from there if possible" : ""));
+  if (strlen(params->warm_start)>0)
+    printf("Going to start from %s.\n",params->warm_start);
+  if (strlen(params->profile_file)>0)
+    printf("Going to profile the hot path and write the report to %s\n",params->profile_file);
+  if (strlen(params->tod_cost_file)>0)
+    printf("TOD timings go in %s\n",params->tod_cost_file);
+
   printf("Going to run to a fractional tolerance of %14.5g or %d iterations, whichever comes first.\n",params->tol,params->maxiter);
   
 }
@@ -4649,6 +7624,11 @@ void parse_params(int argc, char **argv, PARAMS *params)
     params->remove_mean=true;
   }
 
+  if (exists_in_command_line(argc,argv,"@approx_median",found_list)) {
+    printf("Going to take the common mode from an approximate median.\n");
+    params->approx_median=true;
+  }
+
   if (tok=find_argument(argc,argv,"@pixsize",found_list)) {
     params->pixsize=atof(tok);
     printf("Output map pixel size is %12.4e\n",params->pixsize);
@@ -4710,6 +7690,105 @@ void parse_params(int argc, char **argv, PARAMS *params)
     printf("going to write pointing solutions to disk.\n");
   }
 
+  if (tok=find_argument(argc,argv,"@pipeline_depth",found_list)) {
+    params->pipeline_depth=atoi(tok);
+    printf("going to keep %d TODs in flight in the mapping pipeline.\n",params->pipeline_depth);
+  }
+
+  {
+    int nthreads;
+    int *pipeline_threads;
+    if (pipeline_threads=get_int_list_from_argv(argc,argv,"@pipeline_threads",&nthreads,found_list)) {
+      printf("pipeline stage threads: ");
+      for (int i=0;(i<nthreads)&&(i<3);i++) {
+	params->pipeline_threads[i]=pipeline_threads[i];
+	printf(" %d ",params->pipeline_threads[i]);
+      }
+      printf("\n");
+      free(pipeline_threads);
+    }
+  }
+
+  if (tok=find_argument(argc,argv,"@fft_planner",found_list)) {
+    if (strcmp(tok,"patient")==0)
+      params->fft_planner_flags=FFTW_PATIENT;
+    else if (strcmp(tok,"measure")==0)
+      params->fft_planner_flags=FFTW_MEASURE;
+    else if (strcmp(tok,"estimate")==0)
+      params->fft_planner_flags=FFTW_ESTIMATE;
+    else
+      printf("Unrecognized fft planner %s, should be one of estimate/measure/patient.\n",tok);
+    printf("fft planner is %s\n",tok);
+  }
+  if (tok=find_argument(argc,argv,"@prefetch_depth",found_list)) {
+    params->prefetch_depth=atoi(tok);
+    printf("going to read up to %d TODs ahead.\n",params->prefetch_depth);
+  }
+  if (tok=find_argument(argc,argv,"@prefetch_mem",found_list)) {
+    params->prefetch_mem=atof(tok);
+    printf("going to hold at most %.2f GB of read-ahead TOD data.\n",params->prefetch_mem);
+  }
+  if (exists_in_command_line(argc,argv,"@distribute_maps",found_list)) {
+    params->distribute_maps=true;
+    printf("going to spread maps over processes.\n");
+  }
+  if (tok=find_argument(argc,argv,"@mg_levels",found_list)) {
+    params->mg_levels=atoi(tok);
+    printf("going to coarsen the preconditioner by %d levels.\n",params->mg_levels);
+  }
+  if (tok=find_argument(argc,argv,"@mg_iter",found_list)) {
+    params->mg_iter=atoi(tok);
+    printf("going to do %d coarse iterations per step.\n",params->mg_iter);
+  }
+  if (exists_in_command_line(argc,argv,"@mg_benchmark",found_list)) {
+    params->mg_benchmark=true;
+    printf("going to benchmark the coarse-grid preconditioner.\n");
+  }
+  if (tok=find_argument(argc,argv,"@checkpoint_name",found_list)) {
+    strncpy(params->checkpoint_name,tok,MAXLEN-1);
+    printf("PCG checkpoints are %s\n",params->checkpoint_name);
+  }
+  if (tok=find_argument(argc,argv,"@checkpoint_every",found_list)) {
+    params->checkpoint_every=atoi(tok);
+    printf("going to checkpoint every %d iterations.\n",params->checkpoint_every);
+  }
+  if (exists_in_command_line(argc,argv,"@resume",found_list)) {
+    params->resume=true;
+    printf("going to resume from the last checkpoint.\n");
+  }
+  if (tok=find_argument(argc,argv,"@save_temp_every",found_list)) {
+    params->temp_every=atoi(tok);
+    printf("going to write temporary maps every %d iterations.\n",params->temp_every);
+  }
+  if (tok=find_argument(argc,argv,"@warm_start",found_list)) {
+    strncpy(params->warm_start,tok,MAXLEN-1);
+    printf("going to start from %s\n",params->warm_start);
+  }
+  if (tok=find_argument(argc,argv,"@profile",found_list)) {
+    strncpy(params->profile_file,tok,MAXLEN-1);
+    printf("profile report goes to %s\n",params->profile_file);
+  }
+  if (exists_in_command_line(argc,argv,"@balance_tods",found_list)) {
+    params->balance_tods=true;
+    printf("going to balance TODs across processes by cost.\n");
+  }
+  if (tok=find_argument(argc,argv,"@tod_cost_file",found_list)) {
+    strncpy(params->tod_cost_file,tok,MAXLEN-1);
+    printf("TOD timings file is %s\n",params->tod_cost_file);
+  }
+  if (exists_in_command_line(argc,argv,"@pack_pointing",found_list)) {
+    params->pack_pointing=true;
+    printf("going to keep saved pointing packed.\n");
+  }
+  if (tok=find_argument(argc,argv,"@pack_polangles",found_list)) {
+    params->pack_polangles=atoi(tok);
+    printf("going to cache polarization angles, mode %d.\n",params->pack_polangles);
+  }
+  if (tok=find_argument(argc,argv,"@fft_wisdom",found_list)) {
+    strncpy(params->fft_wisdom,tok,MAXLEN-1);
+    printf("fftw wisdom file is %s\n",params->fft_wisdom);
+  }
+
 
 
   
@@ -4720,6 +7799,33 @@ void parse_params(int argc, char **argv, PARAMS *params)
   free(found_list);
   
 
+}
+/*--------------------------------------------------------------------------------*/
+void setup_fft_planner(PARAMS *params)
+//every process reads the wisdom file itself, it's small.
+{
+  act_fftw_init_threads();
+  act_fftw_set_planner_flags(params->fft_planner_flags);
+  if (strlen(params->fft_wisdom)>0) {
+    if (act_fftw_import_wisdom(params->fft_wisdom))
+      mprintf(stdout,"read fftw wisdom from %s\n",params->fft_wisdom);
+    else
+      mprintf(stdout,"no fftw wisdom in %s yet, will plan from scratch.\n",params->fft_wisdom);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+void save_fft_wisdom(PARAMS *params)
+//only the master writes, everyone has planned the same transforms anyways.
+{
+  if (strlen(params->fft_wisdom)==0)
+    return;
+#ifdef HAVE_MPI
+  int myid;
+  MPI_Comm_rank(MPI_COMM_WORLD,&myid);
+  if (myid!=0)
+    return;
+#endif
+  act_fftw_export_wisdom(params->fft_wisdom);
 }
 /*--------------------------------------------------------------------------------*/
 int get_parameters(int argc, char *argv[], PARAMS *params)
@@ -4749,9 +7855,29 @@ int get_parameters(int argc, char *argv[], PARAMS *params)
 	params->use_input_limits=false;
 	params->seed=1;
 	params->remove_mean=false;
+	params->approx_median=false;
 	params->maxtod=0;  //0 for unlimited.
 	params->deglitch=false;
 	params->rawonly=false;
+	params->pipeline_depth=1;
+	params->fft_planner_flags=FFTW_ESTIMATE;
+	params->fft_wisdom[0]='\0';
+	params->pack_pointing=false;
+	params->pack_polangles=0;
+	params->prefetch_depth=0;
+	params->prefetch_mem=2.0;
+	params->balance_tods=false;
+	params->distribute_maps=false;
+	params->tod_cost_file[0]='\0';
+	params->mg_levels=0;
+	params->mg_iter=2;
+	params->mg_benchmark=false;
+	params->checkpoint_name[0]='\0';
+	params->checkpoint_every=10;
+	params->resume=false;
+	params->temp_every=1;
+	params->warm_start[0]='\0';
+	params->profile_file[0]='\0';
 
 	int myargc;
 	char **myargv;
@@ -4784,6 +7910,7 @@ int get_parameters(int argc, char *argv[], PARAMS *params)
 #ifdef HAVE_MPI
   MPI_Bcast(params,sizeof(PARAMS),MPI_CHAR,0,MPI_COMM_WORLD);
 #endif
+  setup_fft_planner(params);
   return 0;
   
 }
@@ -4891,7 +8018,7 @@ void invert_pol_precon(MAP *map)
     switch(poltag){
     case POL_QU_PRECON: {
       printf("inverting precon with %d %d pixels.\n",map->npix,get_npol_in_map(map));
-      actData **mymat=matrix(2,2);
+      double **mymat=dmatrix(2,2);
 #pragma omp for
       for (int i=0;i<map->npix;i++) {
 	int ii=i*3;
@@ -4914,7 +8041,7 @@ void invert_pol_precon(MAP *map)
       
       break;      
     case POL_IQU_PRECON:  {
-      actData **mymat=matrix(3,3);
+      double **mymat=dmatrix(3,3);
 #pragma omp for 
       for (int i=0;i<map->npix;i++)  {
 	int ii=i*6; //6 polarization in this map
@@ -169,6 +169,7 @@
       mapvec[i].projection=(nkProjection *)malloc(sizeof(nkProjection));
       mapvec[i].projection->proj_type=NK_RECT;
       mapvec[i].have_locks=0;
+      mapvec[i].footprint=NULL;
     }
     maps.maps=&mapvec;
   }
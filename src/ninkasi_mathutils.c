@@ -736,7 +736,17 @@ actData *legendre_fit(actData *data, int ndata, int ord)
       vecs[j+1][i]=((2*j+1)*x*vecs[j][i]-j*vecs[j-1][i])/(1+(actData)j);
   }
 #endif
+#ifdef ACTDATA_DOUBLE
   actData *fitp=linfit(data,vecs,NULL,ndata,ord);
+#else
+  //linfit wants double basis vectors
+  double **dvecs=dmatrix(ord,ndata);
+  for (long i=0;i<(long)ord*ndata;i++)
+    dvecs[0][i]=vecs[0][i];
+  actData *fitp=linfit(data,dvecs,NULL,ndata,ord);
+  free(dvecs[0]);
+  free(dvecs);
+#endif
   free(vecs[0]);
   free(vecs);
   return fitp;
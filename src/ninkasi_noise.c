@@ -111,7 +111,7 @@ void set_tod_noise(mbTOD *tod, actData white, actData knee, actData powlaw)
 }
 
 /*--------------------------------------------------------------------------------*/
-
+static void fit_tod_noise_powlaw_batched(mbTOD *tod, mbNoiseVectorStruct *noises);
 
 mbNoiseVectorStruct *nkFitTODNoise(mbTOD *tod, mbNoiseType noise_type, actData minFreq, actData maxFreq, actData powlaw)
 {
@@ -130,6 +130,10 @@ mbNoiseVectorStruct *nkFitTODNoise(mbTOD *tod, mbNoiseType noise_type, actData m
     SetMinFreq(&(noises->noises[i]),minFreq);
     SetPowlaw(&(noises->noises[i]),powlaw);    
   }
+  if (noise_type==MBNOISE_LINEAR_POWLAW) {
+    fit_tod_noise_powlaw_batched(tod,noises);
+    return noises;
+  }
 #pragma omp parallel for shared(noises,tod) default(none) schedule(dynamic,1)
   for (int i=0;i<noises->ndet;i++) {
     if (!mbCutsIsAlwaysCut(tod->cuts,tod->rows[i],tod->cols[i])) 
@@ -1346,6 +1350,8 @@ void allocate_tod_noise_bands(mbTOD *tod,actData *bands, int nband)
 /*--------------------------------------------------------------------------------*/
 
 actComplex **fft_all_data_flag(mbTOD *tod, unsigned flags) 
+//plans come out of the fft plan cache now, so flags only matter if the cache
+//doesn't already have this transform.  Set planning rigor with act_fftw_set_planner_flags.
 {
   assert(tod);
   assert(tod->have_data);
@@ -1355,34 +1361,24 @@ actComplex **fft_all_data_flag(mbTOD *tod, unsigned flags)
   //printf("inside, nn is %d\n",nn);
   actComplex **data_fft=cmatrix(tod->ndet,nn);
 
-  int *n=ivector(tod->ndet);
-  for (int i=0;i<tod->ndet;i++)
-    n[i]=tod->ndata;
-
 #ifdef MAX_DET_FFT //if FFT's are touch, cap the # that can be run at once.
   for (int i=0;i<tod->ndet;i+=MAX_DET_FFT) {
     int ndet=MAX_DET_FFT;
     if (ndet>tod->ndet-i)
       ndet=tod->ndet-i;
     //fprintf(stderr,"Ndet is %d, i is %d of %d\n",ndet,i,tod->ndet);
-    fftw_plan plan=fftw_plan_many_dft_r2c(1,n+i,ndet,tod->data[i],NULL,1,tod->ndata,data_fft[i],NULL,1,nn,flags);
-    fftw_execute(plan);
+    act_fftw_plan plan=act_fftw_cached_plan_r2c(tod->ndata,ndet,tod->data[i],data_fft[i],0);
+    act_fftw_execute_dft_r2c(plan,tod->data[i],data_fft[i]);
     //fprintf(stderr,"Plan is executed.\n");
-    fftw_destroy_plan(plan);
   }
   //fprintf(stderr,"Finished FFT's.\n");
 #else  
   //fprintf(stderr,"Preparing plan with %d %d %d.\n",tod->ndet,tod->ndata,nn);
-  fftw_plan plan=fftw_plan_many_dft_r2c(1,n,tod->ndet,tod->data[0],NULL,1,tod->ndata,data_fft[0],NULL,1,nn,flags);
-  if (plan==NULL)
-    printf("Had a problem getting the fft plan.\n");
+  act_fftw_plan plan=act_fftw_cached_plan_r2c(tod->ndata,tod->ndet,tod->data[0],data_fft[0],0);
   //fprintf(stderr,"Executing plan.\n");
-  fftw_execute(plan);
+  act_fftw_execute_dft_r2c(plan,tod->data[0],data_fft[0]);
   //fprintf(stderr,"Executed plan.\n");
-  fftw_destroy_plan(plan);
-  //fprintf(stderr,"Destroyed plan.\n");
 #endif
-  free(n);
 
   return data_fft;
   
@@ -1391,24 +1387,19 @@ actComplex **fft_all_data_flag(mbTOD *tod, unsigned flags)
 
 actComplex **fft_all_data(mbTOD *tod) 
 {
-  actComplex **data_fft=fft_all_data_flag(tod,FFTW_ESTIMATE);
+  actComplex **data_fft=fft_all_data_flag(tod,act_fftw_get_planner_flags());
   return data_fft;
   
 }
 /*--------------------------------------------------------------------------------*/
 
 void ifft_all_data_flag(mbTOD *tod,actComplex **data_fft,unsigned flag) 
+//as with fft_all_data_flag, the plan is cached and flag only matters the first time through.
 {
   assert(tod);
   assert(tod->have_data);
   assert(tod->ndet>0);
   
-  int nn=get_nn(tod->ndata);
-
-  int *n=ivector(tod->ndet);
-  for (int i=0;i<tod->ndet;i++)
-    n[i]=tod->ndata;
-
   
 #if 0
 #pragma omp parallel
@@ -1416,9 +1407,8 @@ void ifft_all_data_flag(mbTOD *tod,actComplex **data_fft,unsigned flag)
   fftw_plan_with_nthreads(omp_get_num_procs());
 #endif
   
-  fftw_plan plan=fftw_plan_many_dft_c2r(1,n,tod->ndet,data_fft[0],NULL,1,nn,tod->data[0],NULL,1,tod->ndata,flag);
-  fftw_execute(plan);  
-  fftw_destroy_plan(plan);
+  act_fftw_plan plan=act_fftw_cached_plan_c2r(tod->ndata,tod->ndet,data_fft[0],tod->data[0],0);
+  act_fftw_execute_dft_c2r(plan,data_fft[0],tod->data[0]);
   
 
   actData fn=tod->ndata;
@@ -1427,9 +1417,6 @@ void ifft_all_data_flag(mbTOD *tod,actComplex **data_fft,unsigned flag)
     for (int j=0;j<tod->ndata;j++)
       tod->data[i][j]/=fn;
 
-  
-  
-  free(n);
   return;
   
 }
@@ -1439,7 +1426,7 @@ void ifft_all_data_flag(mbTOD *tod,actComplex **data_fft,unsigned flag)
 void ifft_all_data(mbTOD *tod,actComplex **data_fft) 
 {
 #if 1
-  ifft_all_data_flag(tod,data_fft,FFTW_ESTIMATE);
+  ifft_all_data_flag(tod,data_fft,act_fftw_get_planner_flags());
 #else
   assert(tod);
   assert(tod->have_data);
@@ -1503,7 +1490,7 @@ actData **get_banded_correlation_matrix_from_fft(mbTOD *tod, actComplex **data_f
       imax=i;
   }
   
-  act_syrk('u','t',tod->ndet,2*(imax-imin+1),1.0,(double *)(&data_fft[0][imin]),2*nn,0.0,mat[0],tod->ndet);
+  act_syrk('u','t',tod->ndet,2*(imax-imin+1),1.0,(actData *)(&data_fft[0][imin]),2*nn,0.0,mat[0],tod->ndet);
   for (int i=0;i<tod->ndet;i++)
     for (int j=0;j<i;j++)
       mat[j][i]=mat[i][j];
@@ -1525,7 +1512,7 @@ actData **get_banded_correlation_matrix_from_fft_int(mbTOD *tod, actComplex **da
 
   memset(mat[0],0,sizeof(actData)*tod->ndet*tod->ndet);
   
-  act_syrk('u','t',tod->ndet,2*(imax-imin),1.0,(double *)(&data_fft[0][imin]),2*nn,0.0,mat[0],tod->ndet);
+  act_syrk('u','t',tod->ndet,2*(imax-imin),1.0,(actData *)(&data_fft[0][imin]),2*nn,0.0,mat[0],tod->ndet);
   for (int i=0;i<tod->ndet;i++)
     for (int j=0;j<i;j++)
       mat[j][i]=mat[i][j];
@@ -1535,8 +1522,8 @@ actData **get_banded_correlation_matrix_from_fft_int(mbTOD *tod, actComplex **da
 
 
 /*--------------------------------------------------------------------------------*/
-void get_eigenvectors(actData **mat, int n) 
-//transform mat into its eigenvectors.
+static void get_eigensystem(actData **mat, actData *w, int n)
+//transform mat into its eigenvectors, eigenvalues (ascending) go into w.
 {
   
   actData fwork;
@@ -1546,14 +1533,12 @@ void get_eigenvectors(actData **mat, int n)
   
   int info;
 
-  actData *w=vector(n);
-  
   lwork=-1;
   liwork=-1;
 #ifdef ACTDATA_DOUBLE
   dsyevd_(&jobz,&uplo,&n,mat[0],&n,w,&fwork,&lwork,&iiwork,&liwork,&info);
 #else
-  ssyevd_(&jobz,&uplo,&n,mat[0],&n,w,&fwork,&lwork,&iiwork,&liwork,&info);
+  ssyevd_(&jobz,&uplo,&n,mat[0],&n,w,&fwork,&lwork,&iiwork,&liwork,&info,1,1);
 #endif
   lwork=fwork;
   liwork=iiwork;
@@ -1566,15 +1551,219 @@ void get_eigenvectors(actData **mat, int n)
 #ifdef ACTDATA_DOUBLE
   dsyevd_(&jobz,&uplo,&n,mat[0],&n,w,work,&lwork,iwork,&liwork,&info);
 #else
-  ssyevd_(&jobz,&uplo,&n,mat[0],&n,w,work,&lwork,iwork,&liwork,&info);
+  ssyevd_(&jobz,&uplo,&n,mat[0],&n,w,work,&lwork,iwork,&liwork,&info,1,1);
 #endif
   
-  free(w);
   free(work);
   free(iwork);
   
   return;
 }
+/*--------------------------------------------------------------------------------*/
+void get_eigenvectors(actData **mat, int n) 
+//transform mat into its eigenvectors.
+{
+  actData *w=vector(n);
+  get_eigensystem(mat,w,n);
+  free(w);
+}
+
+/*--------------------------------------------------------------------------------*/
+void set_banded_noise_eig_rank(mbTOD *tod, int rank, actData tol)
+//have get_simple_banded_noise_model solve for only the top rank modes of each rotated band,
+//until their residuals |Cv-lambda v| are below tol times the largest eigenvalue (tol<=0 gets
+//the default).  rank<=0 goes back to the full eigen-decomposition.
+{
+  assert(tod);
+  assert(tod->band_noise);
+  tod->band_noise->eig_rank=rank;
+  tod->band_noise->eig_tol=tol;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+#define NK_EIG_OVERSAMPLE 10  //extra vectors carried along in the subspace iteration
+#define NK_EIG_MAXITER 50
+#define NK_EIG_TOL 1e-3
+
+static void orthonormalize_rows(actData **q, int nvec, int n, unsigned *seed)
+//Gram-Schmidt, twice, on the rows of q.  Rows that turn out to be dependent on the ones
+//before them get replaced by random ones so the subspace doesn't shrink.
+{
+  for (int i=0;i<nvec;i++) {
+    while (1) {
+      actData norm0=0;
+      for (int k=0;k<n;k++)
+	norm0+=q[i][k]*q[i][k];
+      for (int pass=0;pass<2;pass++)
+	for (int j=0;j<i;j++) {
+	  actData dot=0;
+	  for (int k=0;k<n;k++)
+	    dot+=q[i][k]*q[j][k];
+	  for (int k=0;k<n;k++)
+	    q[i][k]-=dot*q[j][k];
+	}
+      actData norm=0;
+      for (int k=0;k<n;k++)
+	norm+=q[i][k]*q[i][k];
+      if (norm>1e-6*norm0) {
+	norm=1.0/sqrt(norm);
+	for (int k=0;k<n;k++)
+	  q[i][k]*=norm;
+	break;
+      }
+      for (int k=0;k<n;k++)
+	q[i][k]=mygasdev(seed);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+static void complete_rotation(actData **rot, actData **top, int rank, int ndet)
+//fill the ndet x ndet rot with the rank orthonormal rows of top at the end and an orthonormal
+//basis for their complement before them.  The complement is the rest of the Q from a
+//Householder QR of top, so it costs rank*ndet^2 and stays close to the detector basis.
+{
+  actData **house=matrix(rank,ndet);
+  memcpy(house[0],top[0],sizeof(actData)*rank*ndet);
+  for (int c=0;c<rank;c++) {
+    actData *v=house[c];
+    for (int i=0;i<c;i++)
+      v[i]=0;
+    actData norm=0;
+    for (int i=c;i<ndet;i++)
+      norm+=v[i]*v[i];
+    norm=sqrt(norm);
+    v[c]+=(v[c]>0 ? norm : -norm);
+    norm=0;
+    for (int i=c;i<ndet;i++)
+      norm+=v[i]*v[i];
+    assert(norm>0);
+    norm=1.0/sqrt(norm);
+    for (int i=c;i<ndet;i++)
+      v[i]*=norm;
+    for (int cc=c+1;cc<rank;cc++) {
+      actData dot=0;
+      for (int i=c;i<ndet;i++)
+	dot+=v[i]*house[cc][i];
+      for (int i=c;i<ndet;i++)
+	house[cc][i]-=2*dot*v[i];
+    }
+  }
+
+#pragma omp parallel for shared(rot,house,rank,ndet) default(none) schedule(static)
+  for (int j=rank;j<ndet;j++) {
+    actData *row=rot[j-rank];
+    memset(row,0,sizeof(actData)*ndet);
+    row[j]=1;
+    for (int c=rank-1;c>=0;c--) {
+      actData dot=0;
+      for (int i=c;i<ndet;i++)
+	dot+=house[c][i]*row[i];
+      for (int i=c;i<ndet;i++)
+	row[i]-=2*dot*house[c][i];
+    }
+  }
+  memcpy(rot[ndet-rank],top[0],sizeof(actData)*rank*ndet);
+  free_matrix(house);
+}
+
+/*--------------------------------------------------------------------------------*/
+static actData **get_band_rotation_topk(mbTOD *tod, actComplex **data_fft, int imin, int imax, int rank, actData tol)
+//top rank eigenvectors of the band's correlation matrix from subspace iteration with
+//Rayleigh-Ritz on the transformed data, so the matrix is only ever applied as A^T(AQ) and never
+//formed.  Comes back laid out the way get_eigenvectors leaves the full matrix (modes ascending,
+//so the top ones are the last rank rows), completed to a rotation by complete_rotation.
+{
+  int ndet=tod->ndet;
+  int nn=get_nn(tod->ndata);
+  int m=2*(imax-imin);
+  int nvec=rank+NK_EIG_OVERSAMPLE;
+  assert(nvec<=ndet);
+  assert(nvec<=m);
+  if (tol<=0)
+    tol=NK_EIG_TOL;
+  actData *a=(actData *)(&data_fft[0][imin]);
+
+  actData **q=matrix(nvec,ndet);
+  actData **aq=matrix(nvec,m);
+  actData **z=matrix(nvec,ndet);
+  actData **t=matrix(nvec,nvec);
+  actData **v=matrix(nvec,ndet);
+  actData **cv=matrix(nvec,ndet);
+  actData *w=vector(nvec);
+  unsigned seed=imin+1;
+  for (int i=0;i<nvec;i++)
+    for (int j=0;j<ndet;j++)
+      q[i][j]=mygasdev(&seed);
+
+  actData resid=0;
+  int iter;
+  for (iter=0;iter<NK_EIG_MAXITER;iter++) {
+    orthonormalize_rows(q,nvec,ndet,&seed);
+    act_gemm('n','n',m,nvec,ndet,1.0,a,2*nn,q[0],ndet,0.0,aq[0],m);
+    act_gemm('t','n',ndet,nvec,m,1.0,a,2*nn,aq[0],m,0.0,z[0],ndet);
+    act_gemm('t','n',nvec,nvec,ndet,1.0,q[0],ndet,z[0],ndet,0.0,t[0],nvec);
+    for (int i=0;i<nvec;i++)
+      for (int j=0;j<i;j++) {
+	actData avg=0.5*(t[i][j]+t[j][i]);
+	t[i][j]=avg;
+	t[j][i]=avg;
+      }
+    get_eigensystem(t,w,nvec);
+    act_gemm('n','n',ndet,nvec,nvec,1.0,q[0],ndet,t[0],nvec,0.0,v[0],ndet);
+    act_gemm('n','n',ndet,nvec,nvec,1.0,z[0],ndet,t[0],nvec,0.0,cv[0],ndet);
+
+    resid=0;
+    for (int i=nvec-rank;i<nvec;i++) {
+      actData r=0;
+      for (int j=0;j<ndet;j++) {
+	actData d=cv[i][j]-w[i]*v[i][j];
+	r+=d*d;
+      }
+      if (r>resid)
+	resid=r;
+    }
+    if (w[nvec-1]<=0)
+      break;
+    resid=sqrt(resid)/w[nvec-1];
+    if (resid<tol)
+      break;
+    //the next iterate is C applied to the Ritz vectors, they come out sorted.
+    actData **tmp=q;
+    q=cv;
+    cv=tmp;
+  }
+  if (iter==NK_EIG_MAXITER)
+    fprintf(stderr,"top %d modes of band %d-%d only got to residual %12.4e in %d iterations.\n",rank,imin,imax,resid,iter);
+
+  actData **rot=matrix(ndet,ndet);
+  complete_rotation(rot,&(v[nvec-rank]),rank,ndet);
+
+  free_matrix(q);
+  free_matrix(aq);
+  free_matrix(z);
+  free_matrix(t);
+  free_matrix(v);
+  free_matrix(cv);
+  free(w);
+  return rot;
+}
+
+/*--------------------------------------------------------------------------------*/
+static actData **get_band_rotation(mbTOD *tod, actComplex **data_fft, int imin, int imax)
+//the rotation for modes imin to imax: eigenvectors of their correlation matrix, all of them
+//unless band_noise asks for only the top few and that's actually a saving.
+{
+  int rank=tod->band_noise->eig_rank;
+  int nvec=rank+NK_EIG_OVERSAMPLE;
+  if ((rank>0)&&(nvec<tod->ndet)&&(nvec<=2*(imax-imin)))
+    return get_band_rotation_topk(tod,data_fft,imin,imax,rank,tod->band_noise->eig_tol);
+
+  actData **corrmat=get_banded_correlation_matrix_from_fft_int(tod,data_fft,imin,imax);
+  get_eigenvectors(corrmat,tod->ndet);
+  return corrmat;
+}
 
 /*--------------------------------------------------------------------------------*/
 bool do_I_have_rotations(mbTOD *tod)
@@ -1732,8 +1921,7 @@ void get_simple_banded_noise_model(mbTOD *tod, bool *do_rots, mbNoiseType *types
   for (int band=0;band<noise->nband;band++) {
     noise->do_rotations[band]=do_rots[band];
     if (do_rots[band]) {
-      actData **corrmat=get_banded_correlation_matrix_from_fft_int(tod,data_fft,noise->ibands[band],noise->ibands[band+1]);
-      get_eigenvectors(corrmat,tod->ndet);
+      actData **corrmat=get_band_rotation(tod,data_fft,noise->ibands[band],noise->ibands[band+1]);
       noise->rot_mats[band]=corrmat;
       noise->inv_rot_mats_transpose[band]=corrmat;
     }
@@ -1771,8 +1959,7 @@ void get_simple_banded_noise_model_onerotmat(mbTOD *tod, bool *do_rots, mbNoiseT
   actComplex **data_fft=fft_all_data(tod);
   
   //get total data covariance matrix.  Currently hardwired to skip first/last rows of data fft.
-  actData **corrmat=get_banded_correlation_matrix_from_fft_int(tod,data_fft,1,fft_real2complex_nelem(tod->ndata)-1);
-  get_eigenvectors(corrmat,tod->ndet);
+  actData **corrmat=get_band_rotation(tod,data_fft,1,fft_real2complex_nelem(tod->ndata)-1);
 
   for (int band=0;band<noise->nband;band++) {
     noise->do_rotations[band]=do_rots[band];
@@ -1805,16 +1992,17 @@ void get_simple_banded_noise_model_onerotmat(mbTOD *tod, bool *do_rots, mbNoiseT
 }
 /*--------------------------------------------------------------------------------*/
 
-void apply_banded_noise_1det_full(mbNoiseParams1PixBand *params,actComplex *dat)
+void apply_banded_noise_1det_full(mbNoiseParams1PixBand *params,actComplex *dat, actData scale)
+//scale multiplies the weights, so normalizations can ride along for free.
 {
   int n=params->i_high-params->i_low;
   for (int i=0;i<n;i++)
-    dat[i+params->i_low]*=params->noise_data[i];
+    dat[i+params->i_low]*=params->noise_data[i]*scale;
   
 }
 
 /*--------------------------------------------------------------------------------*/
-void apply_banded_noise_1det_interp(mbNoiseParams1PixBand *params_left, mbNoiseParams1PixBand *params, mbNoiseParams1PixBand *params_right, actComplex *dat)
+void apply_banded_noise_1det_interp(mbNoiseParams1PixBand *params_left, mbNoiseParams1PixBand *params, mbNoiseParams1PixBand *params_right, actComplex *dat, actData scale)
 {
 
   int n=params->i_high - params->i_low;
@@ -1823,64 +2011,688 @@ void apply_banded_noise_1det_interp(mbNoiseParams1PixBand *params_left, mbNoiseP
 
   for (int i=0;i<nn;i++) {
     actData fac=((actData)i)/((actData) nn);
-    dat[i+params->i_low]*=(1.0-fac)*params_left->noise_data[0]+fac*params->noise_data[0];
+    dat[i+params->i_low]*=((1.0-fac)*params_left->noise_data[0]+fac*params->noise_data[0])*scale;
   }
   for (int i=nn;i<n;i++) {
     actData fac=((actData)(i-nn))/((actData)( n-nn));
-    dat[i+params->i_low]*=fac*params_right->noise_data[0]+(1-fac)*params->noise_data[0];
+    dat[i+params->i_low]*=(fac*params_right->noise_data[0]+(1-fac)*params->noise_data[0])*scale;
   }
   
 }
 
 /*--------------------------------------------------------------------------------*/
-void apply_banded_noise_1det_constant(mbNoiseParams1PixBand *params,actComplex *dat)
+void apply_banded_noise_1det_constant(mbNoiseParams1PixBand *params,actComplex *dat, actData scale)
 {
   int n=params->i_high-params->i_low;
+  actData fac=params->noise_data[0]*scale;
   for (int i=0;i<n;i++)
-    dat[i+params->i_low]*=params->noise_data[0];
+    dat[i+params->i_low]*=fac;
 
 }
 /*--------------------------------------------------------------------------------*/
+static void apply_banded_noise_1det(const mbNoiseVectorStructBands *noise, int det, actComplex *dat, actData scale)
+{
+  for (int i=0;i<noise->nband;i++) 
+    switch(noise->noise_params[i][det].noise_type) {
+    case MBNOISE_INTERP: {
+      int ileft=i-1;
+      if (ileft<0)
+	ileft=0;
+      int iright=i+1;
+      if (iright>=noise->nband)
+	iright=noise->nband-1;
+      apply_banded_noise_1det_interp(&(noise->noise_params[ileft][det]),&(noise->noise_params[i][det]),&(noise->noise_params[iright][det]),dat,scale);
+      break;
+    }
+    case MBNOISE_FULL:
+      apply_banded_noise_1det_full(&(noise->noise_params[i][det]),dat,scale);
+      break;
+    case MBNOISE_CONSTANT:
+      apply_banded_noise_1det_constant(&(noise->noise_params[i][det]),dat,scale);
+      break;
+    default:
+      printf("Warning - unrecognized noise type in apply_banded_noise_complex.\n");
+      break;	
+    }
+}
+/*--------------------------------------------------------------------------------*/
 void apply_banded_noise_complex(mbTOD *tod, actComplex **dat)
 {
 
   mbNoiseVectorStructBands *noise=tod->band_noise;
 
 #pragma omp parallel for shared(tod,dat,noise) default(none)
-  for (int det=0;det<tod->ndet;det++) {
-    int fwee;      
-    for (int i=0;i<noise->nband;i++) 
-      
-      switch(noise->noise_params[i][det].noise_type) {
-      case MBNOISE_INTERP:
-	fwee=0;
-	int ileft=i-1;
-	if (ileft<0)
-	  ileft=0;
-	int iright=i+1;
-	if (iright>=noise->nband)
-	  iright=noise->nband-1;
-	apply_banded_noise_1det_interp(&(noise->noise_params[ileft][det]),&(noise->noise_params[i][det]),&(noise->noise_params[iright][det]),dat[det]);
-	break;
+  for (int det=0;det<tod->ndet;det++)
+    apply_banded_noise_1det(noise,det,dat[det],1.0);
+}
+/*--------------------------------------------------------------------------------*/
+//Blocked FFT engine for the noise models.  Detectors go through in groups of about
+//NK_NOISE_BLOCK_BYTES: a thread copies its group into a padded buffer of its own and transforms
+//it in place, then either finishes the group right there (detectors are independent) or parks
+//the spectra in one ndet x nn matrix for the steps that mix detectors.  Nobody divides by n
+//after the inverse transform; callers fold 1/n into the weights they apply.
+#define NK_NOISE_BLOCK_BYTES (1<<21)
 
-      case MBNOISE_FULL:
-	apply_banded_noise_1det_full(&(noise->noise_params[i][det]),dat[det]);
-	break;
-      case MBNOISE_CONSTANT:
-	apply_banded_noise_1det_constant(&(noise->noise_params[i][det]),dat[det]);
-	break;
-      default:
-	printf("Warning - unrecognized noise type in apply_banded_noise_complex.\n");
-	break;	
+typedef struct {
+  int ndata;
+  int nn;
+  int ldr;  //padded row length in actData, 2*nn
+  int ndet;
+  int nblock;  //detectors per group
+  int nthread;
+  actData **work;  //an nblock x ldr buffer per thread
+  act_fftw_plan fwd[2];  //[0] for full groups, [1] for a short last one
+  act_fftw_plan back[2];
+} NoiseFFTBlocks;
+
+/*--------------------------------------------------------------------------------*/
+static NoiseFFTBlocks *setup_noise_fft_blocks(const mbTOD *tod)
+//plans come out of the cache up here, since making one resets the FFTW thread count and that
+//shouldn't happen from inside a parallel region.
+{
+  NoiseFFTBlocks *b=(NoiseFFTBlocks *)calloc(1,sizeof(NoiseFFTBlocks));
+  b->ndata=tod->ndata;
+  b->nn=get_nn(tod->ndata);
+  b->ldr=2*b->nn;
+  b->ndet=tod->ndet;
+  b->nthread=omp_get_max_threads();
+  size_t rowbytes=sizeof(actData)*b->ldr;
+  b->nblock=NK_NOISE_BLOCK_BYTES/rowbytes;
+  int per_thread=(b->ndet+b->nthread-1)/b->nthread;  //small TODs shouldn't leave threads idle
+  if (b->nblock>per_thread)
+    b->nblock=per_thread;
+  if (b->nblock<1)
+    b->nblock=1;
+  b->work=(actData **)malloc(sizeof(actData *)*b->nthread);
+  for (int i=0;i<b->nthread;i++) {
+    b->work[i]=(actData *)act_fftw_malloc(rowbytes*b->nblock);
+    assert(b->work[i]!=NULL);
+  }
+  int ntail=b->ndet%b->nblock;
+  int sizes[2]={b->nblock,(ntail>0 ? ntail : b->nblock)};
+  for (int i=0;i<2;i++) {
+    b->fwd[i]=act_fftw_cached_plan_r2c(b->ndata,sizes[i],b->work[0],(act_fftw_complex *)b->work[0],1);
+    b->back[i]=act_fftw_cached_plan_c2r(b->ndata,sizes[i],(act_fftw_complex *)b->work[0],b->work[0],1);
+  }
+  return b;
+}
+/*--------------------------------------------------------------------------------*/
+static void destroy_noise_fft_blocks(NoiseFFTBlocks *b)
+//the plans belong to the cache.
+{
+  for (int i=0;i<b->nthread;i++)
+    act_fftw_free((act_fftw_complex *)b->work[i]);
+  free(b->work);
+  free(b);
+}
+/*--------------------------------------------------------------------------------*/
+static inline int noise_block_len(const NoiseFFTBlocks *b, int det0)
+{
+  return (det0+b->nblock<=b->ndet ? b->nblock : b->ndet-det0);
+}
+/*--------------------------------------------------------------------------------*/
+static void noise_block_forward(const NoiseFFTBlocks *b, const mbTOD *tod, int det0, actData *work)
+{
+  int nb=noise_block_len(b,det0);
+  for (int i=0;i<nb;i++)
+    memcpy(work+(long)i*b->ldr,tod->data[det0+i],sizeof(actData)*b->ndata);
+  act_fftw_execute_dft_r2c(b->fwd[nb!=b->nblock],work,(act_fftw_complex *)work);
+}
+/*--------------------------------------------------------------------------------*/
+static void noise_block_backward(const NoiseFFTBlocks *b, mbTOD *tod, int det0, actData *work)
+//unnormalized, like FFTW.
+{
+  int nb=noise_block_len(b,det0);
+  act_fftw_execute_dft_c2r(b->back[nb!=b->nblock],(act_fftw_complex *)work,work);
+  for (int i=0;i<nb;i++)
+    memcpy(tod->data[det0+i],work+(long)i*b->ldr,sizeof(actData)*b->ndata);
+}
+/*--------------------------------------------------------------------------------*/
+static void noise_blocks_to_spectra(const NoiseFFTBlocks *b, const mbTOD *tod, actData **spec)
+//forward transform every detector into spec, ndet rows of ldr.  Each row gets first touched
+//by the thread that transformed it.
+{
+#pragma omp parallel for schedule(dynamic,1) shared(b,tod,spec) default(none)
+  for (int det0=0;det0<b->ndet;det0+=b->nblock) {
+    actData *work=b->work[omp_get_thread_num()];
+    noise_block_forward(b,tod,det0,work);
+    int nb=noise_block_len(b,det0);
+    for (int i=0;i<nb;i++)
+      memcpy(spec[det0+i],work+(long)i*b->ldr,sizeof(actData)*b->ldr);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void noise_blocks_from_spectra(const NoiseFFTBlocks *b, mbTOD *tod, actData **spec)
+{
+#pragma omp parallel for schedule(dynamic,1) shared(b,tod,spec) default(none)
+  for (int det0=0;det0<b->ndet;det0+=b->nblock) {
+    actData *work=b->work[omp_get_thread_num()];
+    int nb=noise_block_len(b,det0);
+    for (int i=0;i<nb;i++)
+      memcpy(work+(long)i*b->ldr,spec[det0+i],sizeof(actData)*b->ldr);
+    noise_block_backward(b,tod,det0,work);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static int noise_chunk_len(int ndet, int minlen)
+//frequencies per chunk for the steps that mix detectors, so an ndet-wide chunk fits the block budget.
+{
+  int chunk=NK_NOISE_BLOCK_BYTES/(sizeof(actComplex)*ndet);
+  return (chunk<minlen ? minlen : chunk);
+}
+/*--------------------------------------------------------------------------------*/
+static void apply_banded_rotations_inplace(mbTOD *tod, actComplex **mat, bool do_forward)
+//apply_banded_rotations, but a chunk of frequencies at a time through a small buffer instead
+//of into a second full matrix.  Chunks are at least ndet long so each pass over the rotation
+//matrix does as much work as it costs to stream it.
+{
+  mbNoiseVectorStructBands *noise=tod->band_noise;
+  int ndet=tod->ndet;
+  int nn=get_nn(tod->ndata);
+  int chunk=noise_chunk_len(ndet,ndet);
+  actComplex *tmp=cvector((long)chunk*ndet);
+
+  for (int band=0;band<noise->nband;band++) {
+    if (!noise->do_rotations[band])
+      continue;
+    actData **rotmat;
+    char trans;
+    if (do_forward) {
+      trans='n';
+      rotmat=noise->rot_mats[band];
+    }
+    else {
+      trans='t';
+      rotmat=noise->inv_rot_mats_transpose[band];
+    }
+    for (int i0=noise->ibands[band];i0<noise->ibands[band+1];i0+=chunk) {
+      int len=noise->ibands[band+1]-i0;
+      if (len>chunk)
+	len=chunk;
+      act_gemm('n',trans,2*len,ndet,ndet,1.0,(actData *)(&(mat[0][i0])),2*nn,rotmat[0],ndet,0.0,(actData *)tmp,2*len);
+#pragma omp parallel for shared(ndet,mat,tmp,i0,len) default(none)
+      for (int det=0;det<ndet;det++)
+	memcpy(&(mat[det][i0]),tmp+(long)det*len,sizeof(actComplex)*len);
+    }
+  }
+  free(tmp);
+}
+/*--------------------------------------------------------------------------------*/
+static void scale_outside_bands(const mbNoiseVectorStructBands *noise, actComplex *dat, int nn, actData scale)
+//modes no band covers only pick up the normalization.
+{
+  for (int i=0;i<noise->ibands[0];i++)
+    dat[i]*=scale;
+  for (int i=noise->ibands[noise->nband];i<nn;i++)
+    dat[i]*=scale;
+}
+/*--------------------------------------------------------------------------------*/
+//Batched power-law fits for nkFitTODNoise.  Every detector has the same frequency range and
+//1/f basis, so spectra come out of the blocked FFT engine, get binned into periodograms once,
+//and the steps nkFitNoise_LinearPowlaw takes (starting guess, reweighted least squares, Newton
+//on the likelihood) run on the bins for a chunk of detectors in lockstep.  Bins are whole modes,
+//one mode wide at low frequency and NK_NOISE_FIT_BIN_FRAC of the frequency wide higher up, so
+//the model changes by about that fraction across a bin.
+#define NK_NOISE_FIT_BIN_FRAC 0.01
+#define NK_NOISE_FIT_CHUNK 32  //detectors fit together
+#define NK_NOISE_FIT_NSUM 10
+
+typedef struct {
+  int nbin;
+  int ndet;
+  actData *nreal;  //real degrees of freedom in each bin
+  actData *v0;  //white basis, averaged over the bin
+  actData *v1;  //1/f basis, averaged over the bin
+  actData **power;  //nbin x ndet, summed squares of the data in each bin
+} NoisePeriodograms;
+
+/*--------------------------------------------------------------------------------*/
+static void destroy_noise_periodograms(NoisePeriodograms *pg)
+{
+  free(pg->nreal);
+  free(pg->v0);
+  free(pg->v1);
+  free_matrix(pg->power);
+  free(pg);
+}
+/*--------------------------------------------------------------------------------*/
+static NoisePeriodograms *get_noise_periodograms(mbTOD *tod, NoiseParams1Pix *proto)
+//the first mode in range gets a bin for each of its two reals, since the basis differs between
+//them at DC and the Newton fit ignores that mode's data.
+{
+  int nn=get_nn(tod->ndata);
+  int nn_start,nn_stop;
+  actData delta;
+  nkSetNoiseFreqRange(tod,proto,&nn_start,&nn_stop,&delta);
+  if (nn_stop>nn)
+    nn_stop=nn;
+  int nmode=nn_stop-nn_start;
+  assert(nmode>1);
+  actData **vecs;
+  int nparam;
+  nkCalculateOneoverFVecs(tod,proto,&vecs,&nparam);
+  assert(nparam==2);
+
+  int *edge=ivector(2*nmode+1);
+  int nbin=0;
+  edge[nbin++]=0;
+  edge[nbin++]=1;
+  for (int i=1;i<nmode;) {
+    edge[nbin++]=2*i;
+    int width=NK_NOISE_FIT_BIN_FRAC*(i+nn_start);
+    i+=(width>1 ? width : 1);
+  }
+  edge[nbin]=2*nmode;
+
+  NoisePeriodograms *pg=(NoisePeriodograms *)calloc(1,sizeof(NoisePeriodograms));
+  pg->nbin=nbin;
+  pg->ndet=tod->ndet;
+  pg->nreal=vector(nbin);
+  pg->v0=vector(nbin);
+  pg->v1=vector(nbin);
+  for (int b=0;b<nbin;b++) {
+    pg->nreal[b]=edge[b+1]-edge[b];
+    pg->v0[b]=0;
+    pg->v1[b]=0;
+    for (int j=edge[b];j<edge[b+1];j++) {
+      pg->v0[b]+=vecs[0][j];
+      pg->v1[b]+=vecs[1][j];
+    }
+    pg->v0[b]/=pg->nreal[b];
+    pg->v1[b]/=pg->nreal[b];
+  }
+  free_matrix(vecs);
+
+  pg->power=matrix(nbin,tod->ndet);
+  memset(pg->power[0],0,sizeof(actData)*nbin*tod->ndet);
+  NoiseFFTBlocks *blk=setup_noise_fft_blocks(tod);
+#pragma omp parallel for schedule(dynamic,1) shared(tod,blk,pg,edge,nbin,nn_start) default(none)
+  for (int det0=0;det0<blk->ndet;det0+=blk->nblock) {
+    actData *work=blk->work[omp_get_thread_num()];
+    noise_block_forward(blk,tod,det0,work);
+    int nb=noise_block_len(blk,det0);
+    for (int i=0;i<nb;i++) {
+      int det=det0+i;
+      if (mbCutsIsAlwaysCut(tod->cuts,tod->rows[det],tod->cols[det]))
+	continue;
+      actData *spec=work+(long)i*blk->ldr+2*nn_start;
+      if (nn_start==0)  //the median subtraction only ever touched the constant mode
+	spec[0]-=tod->ndata*compute_median_inplace(tod->ndata,tod->data[det]);
+      for (int b=0;b<nbin;b++) {
+	actData tot=0;
+	for (int j=edge[b];j<edge[b+1];j++)
+	  tot+=spec[j]*spec[j];
+	pg->power[b][det]=tot;
       }
+    }
+  }
+  destroy_noise_fft_blocks(blk);
+  free(edge);
+  return pg;
+}
+/*--------------------------------------------------------------------------------*/
+static void get_powlaw_fit_sums(const NoisePeriodograms *pg, const actData *p0, const actData *p1, int nd, int det0, bool skip_first_mode, actData sums[NK_NOISE_FIT_NSUM][NK_NOISE_FIT_CHUNK], actData *cmin)
+//everything the fits need, for detectors det0..det0+nd with model C=p0*v0+p1*v1 and power P:
+//sum v_i P/C^2 (0,1), sum n v_i/C (2,3), sum n v_i v_j/C^2 (4-6) and sum v_i v_j P/C^3 (7-9),
+//plus the smallest C.  The inner loops run across detectors.
+{
+  for (int k=0;k<NK_NOISE_FIT_NSUM;k++)
+    for (int d=0;d<nd;d++)
+      sums[k][d]=0;
+  for (int d=0;d<nd;d++)
+    cmin[d]=p0[d]*pg->v0[0]+p1[d]*pg->v1[0];
+  for (int b=0;b<pg->nbin;b++) {
+    actData v0=pg->v0[b];
+    actData v1=pg->v1[b];
+    actData nr=pg->nreal[b];
+    actData pfac=((skip_first_mode)&&(b<2) ? 0 : 1);
+    const actData *power=pg->power[b]+det0;
+    for (int d=0;d<nd;d++) {
+      actData c=p0[d]*v0+p1[d]*v1;
+      if (c<cmin[d])
+	cmin[d]=c;
+      actData ci=1.0/c;
+      actData ci2=ci*ci;
+      actData pc2=pfac*power[d]*ci2;
+      actData pc3=pc2*ci;
+      sums[0][d]+=v0*pc2;
+      sums[1][d]+=v1*pc2;
+      sums[2][d]+=nr*v0*ci;
+      sums[3][d]+=nr*v1*ci;
+      sums[4][d]+=nr*v0*v0*ci2;
+      sums[5][d]+=nr*v0*v1*ci2;
+      sums[6][d]+=nr*v1*v1*ci2;
+      sums[7][d]+=v0*v0*pc3;
+      sums[8][d]+=v0*v1*pc3;
+      sums[9][d]+=v1*v1*pc3;
+    }
   }
 }
 /*--------------------------------------------------------------------------------*/
+static void fit_powlaw_chunk(const NoisePeriodograms *pg, mbTOD *tod, mbNoiseVectorStruct *noises, int det0, int nd)
+//the same three steps as nkFitNoise_LinearPowlaw, on a chunk of detectors at once.
+{
+  actData sums[NK_NOISE_FIT_NSUM][NK_NOISE_FIT_CHUNK];
+  actData p0[NK_NOISE_FIT_CHUNK],p1[NK_NOISE_FIT_CHUNK],cmin[NK_NOISE_FIT_CHUNK];
+  actData c00[NK_NOISE_FIT_CHUNK],c01[NK_NOISE_FIT_CHUNK],c11[NK_NOISE_FIT_CHUNK];
+  actData g0[NK_NOISE_FIT_CHUNK],g1[NK_NOISE_FIT_CHUNK];
+  bool live[NK_NOISE_FIT_CHUNK],quad_ok[NK_NOISE_FIT_CHUNK],finished[NK_NOISE_FIT_CHUNK],converged[NK_NOISE_FIT_CHUNK];
+  int nlive=0;
+  for (int d=0;d<nd;d++) {
+    int det=det0+d;
+    live[d]=!mbCutsIsAlwaysCut(tod->cuts,tod->rows[det],tod->cols[det]);
+    nlive+=live[d];
+    quad_ok[d]=true;
+    finished[d]=!live[d];
+    converged[d]=false;
+  }
+  if (nlive==0)
+    return;
+
+  //starting guess, a straight least-squares fit to the power.  A^T A is the same for everyone.
+  actData a00=0,a01=0,a11=0;
+  for (int b=0;b<pg->nbin;b++) {
+    a00+=pg->nreal[b]*pg->v0[b]*pg->v0[b];
+    a01+=pg->nreal[b]*pg->v0[b]*pg->v1[b];
+    a11+=pg->nreal[b]*pg->v1[b]*pg->v1[b];
+  }
+  actData adet=a00*a11-a01*a01;
+  if ((a00<=0)||(adet<=0)) {
+    fprintf(stderr,"Failure in inverting A^T A in fit_powlaw_chunk.\n");
+    return;
+  }
+  for (int d=0;d<nd;d++) {
+    actData ax0=0,ax1=0;
+    for (int b=0;b<pg->nbin;b++) {
+      ax0+=pg->v0[b]*pg->power[b][det0+d];
+      ax1+=pg->v1[b]*pg->power[b][det0+d];
+    }
+    p0[d]=(a11*ax0-a01*ax1)/adet;
+    p1[d]=(a00*ax1-a01*ax0)/adet;
+    if (live[d]) {
+      noises->noises[det0+d].params[0]=p0[d];
+      noises->noises[det0+d].params[1]=p1[d];
+    }
+  }
+
+  //the quadratic estimator: weights of C^-2, six rounds, as in nkFitSpecUncorrDataQuadratic.
+  for (int iter=0;iter<6;iter++) {
+    get_powlaw_fit_sums(pg,p0,p1,nd,det0,false,sums,cmin);
+    for (int d=0;d<nd;d++) {
+      if (!quad_ok[d])
+	continue;
+      actData m00=sums[4][d],m01=sums[5][d],m11=sums[6][d];
+      actData mdet=m00*m11-m01*m01;
+      if ((cmin[d]<0)||(m00<=0)||(mdet<=0)) {
+	quad_ok[d]=false;
+	continue;
+      }
+      p0[d]=(m11*sums[0][d]-m01*sums[1][d])/mdet;
+      p1[d]=(m00*sums[1][d]-m01*sums[0][d])/mdet;
+    }
+  }
+  for (int d=0;d<nd;d++)
+    if ((live[d])&&(quad_ok[d])) {
+      noises->noises[det0+d].params[0]=p0[d];
+      noises->noises[det0+d].params[1]=p1[d];
+    }
+
+  //Newton on the likelihood, as in nkFitNoiseUncorrData.  The first mode's data are left out
+  //there, so they are here too.
+  actData tol=1e-2;
+  int max_iter=MB_DEFAULT_MAX_ITER_NOISEFIT;
+  for (int iter=1;(iter<=max_iter)&&(nlive>0);iter++) {
+    get_powlaw_fit_sums(pg,p0,p1,nd,det0,true,sums,cmin);
+    for (int d=0;d<nd;d++) {
+      if (finished[d])
+	continue;
+      if (cmin[d]<=0) {
+	if (iter==1) {
+	  finished[d]=true;
+	  nlive--;
+	  continue;
+	}
+	//like mbGetCurveDerivUncorrData, a bad point leaves the last gradient and whatever
+	//mbGetShiftsUncorrData left in the curvature.
+      }
+      else {
+	g0[d]=0.5*sums[0][d]-0.5*sums[2][d];
+	g1[d]=0.5*sums[1][d]-0.5*sums[3][d];
+	c00[d]=0.5*sums[4][d]-sums[7][d];
+	c01[d]=0.5*sums[5][d]-sums[8][d];
+	c11[d]=0.5*sums[6][d]-sums[9][d];
+      }
+      actData cdet=c00[d]*c11[d]-c01[d]*c01[d];
+      actData i00=c11[d]/cdet;
+      actData i11=c00[d]/cdet;
+      actData i01=-c01[d]/cdet;
+      c00[d]=i00;
+      c11[d]=i11;
+      c01[d]=i01;
+      actData s0=i00*g0[d]+i01*g1[d];
+      actData s1=i01*g0[d]+i11*g1[d];
+      actData max_shift=fabs(s0/sqrt(fabs(i00)));
+      if (fabs(s1/sqrt(fabs(i11)))>max_shift)
+	max_shift=fabs(s1/sqrt(fabs(i11)));
+      actData step=(iter>10 ? 1.0 : 0.5);  //take it easy on the first few steps
+      p0[d]-=step*s0;
+      p1[d]-=step*s1;
+      if (max_shift<tol)
+	converged[d]=true;
+      if ((converged[d])||(iter>=max_iter)) {
+	finished[d]=true;
+	nlive--;
+      }
+    }
+  }
+
+  for (int d=0;d<nd;d++) {
+    if (!live[d])
+      continue;
+    NoiseParams1Pix *noise=&(noises->noises[det0+d]);
+    if ((converged[d])&&(isfinite(p0[d]))) {
+      noise->params[0]=p0[d];
+      noise->params[1]=p1[d];
+      noise->converged=1;
+      if (noise->params[0]<0)
+	noise->converged=0;  //we probably didn't do the right thing in this case.
+      else
+	noise->knee=pow(noise->params[0]/noise->params[1],1.0/noise->powlaw);
+    }
+    else
+      noise->converged=0;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void fit_tod_noise_powlaw_batched(mbTOD *tod, mbNoiseVectorStruct *noises)
+{
+  NoisePeriodograms *pg=get_noise_periodograms(tod,&(noises->noises[0]));
+#pragma omp parallel for schedule(dynamic,1) shared(pg,tod,noises) default(none)
+  for (int det0=0;det0<tod->ndet;det0+=NK_NOISE_FIT_CHUNK) {
+    int nd=tod->ndet-det0;
+    if (nd>NK_NOISE_FIT_CHUNK)
+      nd=NK_NOISE_FIT_CHUNK;
+    fit_powlaw_chunk(pg,tod,noises,det0,nd);
+  }
+  destroy_noise_periodograms(pg);
+}
+/*--------------------------------------------------------------------------------*/
+static void setup_band_vecs_factor(mbNoiseBandVecsFactor *f, actData *ninv, actData **vecs, int ndet, int nvecs, int imin, int imax)
+//everything in the band's Woodbury update that doesn't depend on the data.
+{
+  f->nvecs=nvecs;
+  f->imin=imin;
+  f->imax=imax;
+  f->ninv=ninv;
+  f->ninv_vecs=NULL;
+  f->woodbury=NULL;
+  if (nvecs==0)
+    return;
+
+  actData **ninv_vecs=matrix(nvecs,ndet);
+#pragma omp parallel for shared(nvecs,ninv_vecs,vecs,ninv,ndet) default(none)
+  for (int i=0;i<nvecs;i++) {
+    for (int j=0;j<ndet;j++)
+      ninv_vecs[i][j]=vecs[i][j]*ninv[j];
+  }
+  actData **inside=matrix(nvecs,nvecs);
+  act_gemm('t','n',nvecs,nvecs,ndet,1.0,vecs[0],ndet,ninv_vecs[0],ndet,0.0,inside[0],nvecs);
+  for (int i=0;i<nvecs;i++)
+    inside[i][i]+=1.0;
+  assert(mbInvertPosdefMat(inside,nvecs)==0);
+
+  //fold the inverse into N^-1 V now so applying is one GEMM shorter.
+  actData **woodbury=matrix(ndet,nvecs);
+  act_gemm('n','t',nvecs,ndet,nvecs,1.0,inside[0],nvecs,ninv_vecs[0],ndet,0.0,woodbury[0],nvecs);
+  free(inside[0]);
+  free(inside);
+
+  f->ninv_vecs=ninv_vecs;
+  f->woodbury=woodbury;
+}
+/*--------------------------------------------------------------------------------*/
+static void free_band_vecs_factor(mbNoiseBandVecsFactor *f)
+{
+  if (f->ninv_vecs) {
+    free(f->ninv_vecs[0]);
+    free(f->ninv_vecs);
+  }
+  if (f->woodbury) {
+    free(f->woodbury[0]);
+    free(f->woodbury);
+  }
+  f->ninv_vecs=NULL;
+  f->woodbury=NULL;
+}
+/*--------------------------------------------------------------------------------*/
+static void apply_band_vecs_factor_range(const mbNoiseBandVecsFactor *f, actData *work, const actData *in, int ldin, actData *out, int ldout, int ndet, int len, actData scale)
+//out=scale*(N^-1 in - N^-1 V (1+V^T N^-1 V)^-1 V^T N^-1 in) over len columns.  in and out
+//point at the first column of the range, rows are ldin/ldout apart.  work holds nvecs x len.
+{
+  actData *ninv=f->ninv;
+  if (len<=0)
+    return;
+
+  if (f->nvecs==0) {
+#pragma omp parallel for shared(ninv,ndet,len,ldin,ldout,out,in,scale) default(none)
+    for (int i=0;i<ndet;i++)
+      for (int j=0;j<len;j++)
+	out[i*(long)ldout+j]=in[i*(long)ldin+j]*ninv[i]*scale;
+    return;
+  }
+
+  act_gemm('n','n',len,f->nvecs,ndet,1.0,(actData *)in,ldin,f->ninv_vecs[0],ndet,0.0,work,len);
+  act_gemm('n','n',len,ndet,f->nvecs,scale,work,len,f->woodbury[0],f->nvecs,0.0,out,ldout);
+
+#pragma omp parallel for shared(ndet,ninv,len,ldin,ldout,out,in,scale) default(none)
+  for (int i=0;i<ndet;i++)
+    for (int j=0;j<len;j++)
+      out[i*(long)ldout+j]=in[i*(long)ldin+j]*ninv[i]*scale-out[i*(long)ldout+j];
+}
+/*--------------------------------------------------------------------------------*/
+static void apply_band_vecs_factor(const mbNoiseBandVecsFactor *f, actData *work, actData **data_in, actData **data_out, int ndata, int ndet)
+//the whole band [imin,imax) of ndata-long rows.
+{
+  apply_band_vecs_factor_range(f,work,data_in[0]+f->imin,ndata,data_out[0]+f->imin,ndata,ndet,f->imax-f->imin,1.0);
+}
+/*--------------------------------------------------------------------------------*/
+void apply_diag_proj_noise_inv_bands(actData **data_in, actData **data_out, actData *ninv, actData **vecs, int ndata, int ndet, int nvecs, int imin, int imax)
+//one-off version.  Models that get applied more than once should go through
+//prepare_banded_projvec_noise so the factors only get built once.
+{
+  mbNoiseBandVecsFactor f;
+  setup_band_vecs_factor(&f,ninv,vecs,ndet,nvecs,imin,imax);
+  actData *work=NULL;
+  if ((nvecs>0)&&(imax>imin))
+    work=vector((long)nvecs*(imax-imin));
+  apply_band_vecs_factor(&f,work,data_in,data_out,ndata,ndet);
+  if (work)
+    free(work);
+  free_band_vecs_factor(&f);
+}
+/*--------------------------------------------------------------------------------*/
+static unsigned long hash_bytes(unsigned long h, const void *ptr, size_t nbyte)
+//FNV-1a, continuing from h.
+{
+  const unsigned char *p=(const unsigned char *)ptr;
+  for (size_t i=0;i<nbyte;i++) {
+    h^=p[i];
+    h*=1099511628211UL;
+  }
+  return h;
+}
+/*--------------------------------------------------------------------------------*/
+static unsigned long hash_banded_projvec_noise(const mbNoiseStructBandsVecs *noise, int ndet)
+//everything the factors get built from.  Cheap next to the FFTs each application does anyways.
+{
+  unsigned long h=14695981039346656037UL;
+  h=hash_bytes(h,&ndet,sizeof(int));
+  h=hash_bytes(h,&(noise->nband),sizeof(int));
+  h=hash_bytes(h,noise->band_edges,sizeof(int)*(noise->nband+1));
+  h=hash_bytes(h,noise->nvecs,sizeof(int)*noise->nband);
+  for (int i=0;i<noise->nband;i++) {
+    h=hash_bytes(h,noise->noises[i],sizeof(actData)*ndet);
+    if (noise->nvecs[i]>0)
+      h=hash_bytes(h,noise->vecs[i][0],sizeof(actData)*ndet*noise->nvecs[i]);
+  }
+  return h;
+}
+/*--------------------------------------------------------------------------------*/
+mbNoiseBandsVecsOp *prepare_banded_projvec_noise(mbTOD *tod, int ndet)
+//factor tod->band_vecs_noise for repeated application on ndet (possibly demodulated) timestreams.
+//The result is kept in tod->band_vecs_op, and gets rebuilt if the model is swapped out, refit in
+//place, or applied with a different ndet.
+{
+  mbNoiseStructBandsVecs *noise=tod->band_vecs_noise;
+  assert(noise);
+  unsigned long hash=hash_banded_projvec_noise(noise,ndet);
+  mbNoiseBandsVecsOp *op=tod->band_vecs_op;
+  if (op) {
+    if ((op->model==noise)&&(op->ndet==ndet)&&(op->hash==hash))
+      return op;
+    destroy_banded_projvec_noise_op(tod);
+  }
+  op=(mbNoiseBandsVecsOp *)calloc(1,sizeof(mbNoiseBandsVecsOp));
+  op->ndet=ndet;
+  op->nband=noise->nband;
+  op->model=noise;
+  op->hash=hash;
+  op->bands=(mbNoiseBandVecsFactor *)calloc(noise->nband,sizeof(mbNoiseBandVecsFactor));
+  for (int i=0;i<noise->nband;i++) {
+    //band edges count complex modes, the data get handed over as interleaved re/im.
+    int imin=2*noise->band_edges[i];
+    int imax=2*noise->band_edges[i+1];
+    setup_band_vecs_factor(&(op->bands[i]),noise->noises[i],noise->vecs[i],ndet,noise->nvecs[i],imin,imax);
+  }
+  tod->band_vecs_op=op;
+  return op;
+}
+/*--------------------------------------------------------------------------------*/
+void destroy_banded_projvec_noise_op(mbTOD *tod)
+{
+  mbNoiseBandsVecsOp *op=tod->band_vecs_op;
+  if (!op)
+    return;
+  for (int i=0;i<op->nband;i++)
+    free_band_vecs_factor(&(op->bands[i]));
+  free(op->bands);
+  free(op);
+  tod->band_vecs_op=NULL;
+}
+/*--------------------------------------------------------------------------------*/
+static int max_band_vecs(const mbNoiseBandsVecsOp *op)
+{
+  int nvecs=0;
+  for (int i=0;i<op->nband;i++)
+    if (op->bands[i].nvecs>nvecs)
+      nvecs=op->bands[i].nvecs;
+  return nvecs;
+}
+/*--------------------------------------------------------------------------------*/
 void apply_banded_projvec_noise_model_demod(mbTOD *tod)
 {
   assert(tod);
   assert(tod->band_vecs_noise);
-  mbNoiseStructBandsVecs *noise=tod->band_vecs_noise;
   demodulate_data(tod,tod->demod);
   actComplex **data_ft=tod->demod->data;
   int ncol=get_demod_nchannel(tod->demod);
@@ -1889,8 +2701,22 @@ void apply_banded_projvec_noise_model_demod(mbTOD *tod)
   actComplex **data_filt=cmatrix(ndet_use,nn);
   for (int i=0;i<ndet_use;i++)
     data_filt[i][0]=0;
-  for (int i=0;i<noise->nband;i++)
-    apply_diag_proj_noise_inv_bands((double **)data_ft, (double **)data_filt, noise->noises[i],noise->vecs[i],2*nn,ndet_use,noise->nvecs[i],2*noise->band_edges[i],2*noise->band_edges[i+1]);
+  mbNoiseBandsVecsOp *op=prepare_banded_projvec_noise(tod,ndet_use);
+  //same chunking as the undemodulated case, so the scratch is only nvecs x chunk.
+  int chunk=2*noise_chunk_len(ndet_use,16);
+  int nvecs=max_band_vecs(op);
+  actData *work=(nvecs>0 ? vector((long)chunk*nvecs) : NULL);
+  for (int i=0;i<op->nband;i++) {
+    mbNoiseBandVecsFactor *f=&(op->bands[i]);
+    for (int j0=f->imin;j0<f->imax;j0+=chunk) {
+      int len=f->imax-j0;
+      if (len>chunk)
+	len=chunk;
+      apply_band_vecs_factor_range(f,work,((actData *)data_ft[0])+j0,2*nn,((actData *)data_filt[0])+j0,2*nn,ndet_use,len,1.0);
+    }
+  }
+  if (work)
+    free(work);
   memcpy(data_ft,data_filt,nn*ndet_use*sizeof(actComplex));
   memset(tod->data[0],0,tod->ndet*tod->ndata*sizeof(actData));
   remodulate_data(tod,tod->demod);
@@ -1902,6 +2728,8 @@ void apply_banded_projvec_noise_model_demod(mbTOD *tod)
 /*--------------------------------------------------------------------------------*/
 
 void apply_banded_projvec_noise_model(mbTOD *tod)
+//the Woodbury update mixes detectors, so spectra get parked in one ndet x nn matrix and each
+//band is worked through a chunk of frequencies at a time, writing back in place.
 {
   assert(tod);
   assert(tod->band_vecs_noise);
@@ -1909,53 +2737,91 @@ void apply_banded_projvec_noise_model(mbTOD *tod)
     apply_banded_projvec_noise_model_demod(tod);
     return;
   }
-  mbNoiseStructBandsVecs *noise=tod->band_vecs_noise;
-  actComplex **data_ft=fft_all_data(tod);
-  int nn=get_nn(tod->ndata);
-  actComplex **data_filt=cmatrix(tod->ndet,nn);
-  //explicitly zero out constant modes.
-  for (int i=0;i<tod->ndet;i++)
-    data_filt[i][0]=0;
-  for (int i=0;i<noise->nband;i++) {
-    apply_diag_proj_noise_inv_bands((double **)data_ft, (double **)data_filt, noise->noises[i],noise->vecs[i],2*nn,tod->ndet,noise->nvecs[i],2*noise->band_edges[i],2*noise->band_edges[i+1]);
+  mbNoiseBandsVecsOp *op=prepare_banded_projvec_noise(tod,tod->ndet);
+  NoiseFFTBlocks *b=setup_noise_fft_blocks(tod);
+  int ndet=tod->ndet;
+  int ldr=b->ldr;
+  actData scale=1.0/((actData)tod->ndata);
+  actData **data_ft=matrix(ndet,ldr);
+  noise_blocks_to_spectra(b,tod,data_ft);
+
+  int chunk=2*noise_chunk_len(ndet,16);
+  actData *tmp=vector((long)chunk*ndet);
+  int nvecs=max_band_vecs(op);
+  actData *work=(nvecs>0 ? vector((long)chunk*nvecs) : NULL);
+  for (int i=0;i<op->nband;i++) {
+    mbNoiseBandVecsFactor *f=&(op->bands[i]);
+    for (int j0=f->imin;j0<f->imax;j0+=chunk) {
+      int len=f->imax-j0;
+      if (len>chunk)
+	len=chunk;
+      apply_band_vecs_factor_range(f,work,data_ft[0]+j0,ldr,tmp,len,ndet,len,scale);
+#pragma omp parallel for shared(ndet,data_ft,tmp,j0,len) default(none)
+      for (int det=0;det<ndet;det++)
+	memcpy(data_ft[det]+j0,tmp+(long)det*len,sizeof(actData)*len);
+    }
   }
-  ifft_all_data(tod,data_filt);
-  free(data_filt[0]);
-  free(data_filt);
+  free(tmp);
+  if (work)
+    free(work);
+
+  //nothing outside the bands survives, the constant mode included.
+  int jlo=(op->nband>0 ? op->bands[0].imin : ldr);
+  int jhi=(op->nband>0 ? op->bands[op->nband-1].imax : ldr);
+#pragma omp parallel for shared(ndet,data_ft,jlo,jhi,ldr) default(none)
+  for (int det=0;det<ndet;det++) {
+    memset(data_ft[det],0,sizeof(actData)*jlo);
+    if (jhi<ldr)
+      memset(data_ft[det]+jhi,0,sizeof(actData)*(ldr-jhi));
+  }
+
+  noise_blocks_from_spectra(b,tod,data_ft);
   free(data_ft[0]);
   free(data_ft);
+  destroy_noise_fft_blocks(b);
 }
 /*--------------------------------------------------------------------------------*/
 
 void apply_banded_noise_model(mbTOD *tod)
+//detector-independent models go through a group at a time while it's in cache.  Rotations
+//mix detectors, so with any of those the spectra get parked in one ndet x nn matrix, which is
+//the only full-size copy made.
 {
 
   assert(tod->band_noise);
+  mbNoiseVectorStructBands *noise=tod->band_noise;
+  NoiseFFTBlocks *b=setup_noise_fft_blocks(tod);
+  actData scale=1.0/((actData)tod->ndata);
   
   if (do_I_have_rotations(tod)) {
-    
-    actComplex **data_ft=fft_all_data(tod);
-    actComplex **data_rot=apply_banded_rotations(tod,data_ft,true);
+    actComplex **data_ft=cmatrix(tod->ndet,b->nn);
+    noise_blocks_to_spectra(b,tod,(actData **)data_ft);
+    apply_banded_rotations_inplace(tod,data_ft,true);
+#pragma omp parallel for shared(tod,noise,data_ft,b,scale) default(none)
+    for (int det=0;det<tod->ndet;det++) {
+      apply_banded_noise_1det(noise,det,data_ft[det],scale);
+      scale_outside_bands(noise,data_ft[det],b->nn,scale);
+    }
+    apply_banded_rotations_inplace(tod,data_ft,false);
+    noise_blocks_from_spectra(b,tod,(actData **)data_ft);
     free(data_ft[0]);
     free(data_ft);
-    
-    apply_banded_noise_complex(tod,data_rot);
-    actComplex **data_back=apply_banded_rotations(tod,data_rot,false);
-    free(data_rot[0]);
-    free(data_rot);
-    
-    ifft_all_data(tod,data_back);
-    free(data_back[0]);
-    free(data_back);
   }
-  else
-    {
-      actComplex **data_ft=fft_all_data(tod);
-      apply_banded_noise_complex(tod,data_ft);
-      ifft_all_data(tod,data_ft);
-      free(data_ft[0]);
-      free(data_ft);
+  else {
+#pragma omp parallel for schedule(dynamic,1) shared(tod,noise,b,scale) default(none)
+    for (int det0=0;det0<b->ndet;det0+=b->nblock) {
+      actData *work=b->work[omp_get_thread_num()];
+      noise_block_forward(b,tod,det0,work);
+      int nb=noise_block_len(b,det0);
+      for (int i=0;i<nb;i++) {
+	actComplex *dat=(actComplex *)(work+(long)i*b->ldr);
+	apply_banded_noise_1det(noise,det0+i,dat,scale);
+	scale_outside_bands(noise,dat,b->nn,scale);
+      }
+      noise_block_backward(b,tod,det0,work);
     }
+  }
+  destroy_noise_fft_blocks(b);
   
 }
 
@@ -2075,7 +2941,7 @@ void simple_test_diag_proj_noise_inv(actData **data_in, actData **data_out, actD
 
   double tstart=omp_get_wtime();
 
-  double *ninv=vector(ndet);
+  actData *ninv=vector(ndet);
   for (int i=0;i<ndet;i++)
     ninv[i]=1.0/noise[i];
 #if 0
@@ -2103,10 +2969,10 @@ void simple_test_diag_proj_noise_inv(actData **data_in, actData **data_out, actD
   assert(mbInvertPosdefMat(inside,nvecs)==0);
 
 
-  double **tmp=matrix(nvecs,ndata);
+  actData **tmp=matrix(nvecs,ndata);
   act_gemm('n','n',ndata,nvecs,ndet,1.0,data_in[0],ndata,ninv_vecs[0],ndet,0.0,tmp[0],ndata);
 
-  double **tmp2=matrix(nvecs,ndata);
+  actData **tmp2=matrix(nvecs,ndata);
   act_gemm('n','n',ndata,nvecs,nvecs,1.0,tmp[0],ndata,inside[0],nvecs,0.0,tmp2[0],ndata);
 
   act_gemm('n','t',ndata,ndet,nvecs,1.0,tmp2[0],ndata,ninv_vecs[0],ndet,0.0,data_out[0],ndata);
@@ -2131,59 +2997,6 @@ void simple_test_diag_proj_noise_inv(actData **data_in, actData **data_out, actD
 
 }
 
-/*--------------------------------------------------------------------------------*/
-void apply_diag_proj_noise_inv_bands(actData **data_in, actData **data_out, actData *ninv, actData **vecs, int ndata, int ndet, int nvecs, int imin, int imax)
-{
-  if (nvecs==0) {
-
-#pragma omp parallel for shared(ninv,ndata,ndet,imin,imax,data_out,data_in) default(none)
-    for (int i=0;i<ndet;i++)
-      for (int j=imin;j<imax;j++)
-	data_out[i][j]=data_in[i][j]*ninv[i];
-
-    return;
-    
-  }
-
-  actData **ninv_vecs=matrix(nvecs,ndet);
-#pragma omp parallel for shared(nvecs,ninv_vecs,vecs,ninv,ndet) default(none)
-  for (int i=0;i<nvecs;i++) {
-    for (int j=0;j<ndet;j++)
-      ninv_vecs[i][j]=vecs[i][j]*ninv[j];
-  }
-  actData **inside=matrix(nvecs,nvecs);
-
-
-  act_gemm('t','n',nvecs,nvecs,ndet,1.0,vecs[0],ndet,ninv_vecs[0],ndet,0.0,inside[0],nvecs);
-  for (int i=0;i<nvecs;i++)
-    inside[i][i]+=1.0;
-
-  assert(mbInvertPosdefMat(inside,nvecs)==0);
-
-  double **tmp=matrix(nvecs,ndata);
-  act_gemm('n','n',(imax-imin),nvecs,ndet,1.0,data_in[0]+imin,ndata,ninv_vecs[0],ndet,0.0,tmp[0]+imin,ndata);
-  double **tmp2=matrix(nvecs,ndata);
-  act_gemm('n','n',(imax-imin),nvecs,nvecs,1.0,tmp[0]+imin,ndata,inside[0],nvecs,0.0,tmp2[0]+imin,ndata);
-
-
-  act_gemm('n','t',(imax-imin),ndet,nvecs,1.0,tmp2[0]+imin,ndata,ninv_vecs[0],ndet,0.0,data_out[0]+imin,ndata);
-  
-#pragma omp parallel for shared(ndata,ndet,ninv,data_out,data_in,imin,imax) default(none)
-  for (int i=0;i<ndet;i++)
-    for (int j=imin;j<imax;j++)
-      data_out[i][j]=data_in[i][j]*ninv[i]-data_out[i][j];
-
-   
-  free(tmp[0]);
-  free(tmp);
-  free(tmp2[0]);
-  free(tmp2);
-  free(inside[0]);
-  free(inside);
-  free(ninv_vecs[0]);
-  free(ninv_vecs);
-
-}
 /*--------------------------------------------------------------------------------*/
 void fill_sin_cos_mat(actData *theta, int ndata, int nterm, actData **mat) 
 //fill a matrix with sin/cos(n*hwp) and put in mat
@@ -2386,34 +3199,24 @@ int get_demodulated_hwp_data(mbTOD *tod, actData hwp_freq, actComplex **tdata,ac
   if ((tdata==NULL)||(poldata==NULL))
     return nmode;
 
-  fftw_plan_with_nthreads(1);
-
-
-
-  double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));
-  actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-  actComplex *ctmp2=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-  fftw_plan plan_r2c=fftw_plan_dft_r2c_1d(tod->ndata,tmp,ctmp,FFTW_ESTIMATE);
-  fftw_plan plan_c2r=fftw_plan_dft_c2r_1d(tod->ndata,ctmp,tmp,FFTW_ESTIMATE);
-  fftw_plan plan_c2c=fftw_plan_dft_1d(tod->ndata,ctmp,ctmp2,FFTW_FORWARD,FFTW_ESTIMATE);
-
-  fftw_free(tmp);
-  fftw_free(ctmp);
-  fftw_free(ctmp2);
+  //single-threaded plans from the cache, since we run one per thread.
+  act_fftw_plan plan_r2c=act_fftw_cached_plan_r2c(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_c2r=act_fftw_cached_plan_c2r(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_c2c=act_fftw_cached_plan_c2c(tod->ndata,1,NULL,NULL,FFTW_FORWARD,1);
 
 #pragma omp parallel shared(tod,hwp_freq,tdata,poldata,nmode,plan_r2c,plan_c2r,plan_c2c) default(none)
   {
-    double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));
-    actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-    actComplex *ctmp2=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
+    actData *tmp=(actData *)act_fftw_malloc(tod->ndata*sizeof(actData));
+    actComplex *ctmp=(actComplex *)act_fftw_malloc(tod->ndata*sizeof(actComplex));
+    actComplex *ctmp2=(actComplex *)act_fftw_malloc(tod->ndata*sizeof(actComplex));
     int nelem=fft_real2complex_nelem(tod->ndata);
 #pragma omp for
     for (int det=0;det<tod->ndet;det++) {
       //printf("det is %d\n",det);
-      fftw_execute_dft_r2c(plan_r2c,tod->data[det],ctmp);
+      act_fftw_execute_dft_r2c(plan_r2c,tod->data[det],ctmp);
       memcpy(tdata[det],ctmp,nmode*sizeof(actComplex));
       //memset(ctmp,0,nmode*sizeof(actComplex));  //do a highpass.  Could have a bandpass as well.
-      fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
+      act_fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
       //memcpy(tod->data[det],tmp,sizeof(actData)*tod->ndata);
       actData norm_fac=1.0/tod->ndata;
       if (tod->twogamma_saved) {
@@ -2434,7 +3237,7 @@ int get_demodulated_hwp_data(mbTOD *tod, actData hwp_freq, actComplex **tdata,ac
 	}
       }
       printf("demodulated second element on %2d is %15.7e %15.7e from %15.7e %12.5f\n",det,creal(ctmp[1])/tod->ndata,cimag(ctmp[1])/tod->ndata,tmp[1],tod->hwp[1]);
-      fftw_execute_dft(plan_c2c,ctmp,ctmp2);
+      act_fftw_execute_dft(plan_c2c,ctmp,ctmp2);
       //printf("demodulated second elements on %2d are %15.7e %15.7e, %15.7e %15.7e\n",det,creal(ctmp2[1])/tod->ndata,cimag(ctmp2[1])/tod->ndata,creal(ctmp2[tod->ndata-2])/tod->ndata,cimag(ctmp2[tod->ndata-2])/tod->ndata);
       if (det==-1) {
 	for (int i=0;i<10;i++) 
@@ -2451,20 +3254,13 @@ int get_demodulated_hwp_data(mbTOD *tod, actData hwp_freq, actComplex **tdata,ac
       memcpy(poldata[det]+nmode,ctmp2+tod->ndata-nmode+1,(nmode-1)*sizeof(actComplex));
       
     }
-    fftw_free(tmp);
-    fftw_free(ctmp);
-    fftw_free(ctmp2);
+    act_fftw_free((act_fftw_complex *)tmp);
+    act_fftw_free(ctmp);
+    act_fftw_free(ctmp2);
   }
   
   //printf("finished the FFTs.\n");
 
-  fftw_destroy_plan(plan_r2c);
-  fftw_destroy_plan(plan_c2r);
-  fftw_destroy_plan(plan_c2c);
-
-  //printf("destroyed plans.\n");
-
-  fftw_plan_with_nthreads(omp_get_max_threads());
   
   //actComplex **dataft=fft_all_data(tod);
   return 0;
@@ -2481,33 +3277,23 @@ int remodulate_hwp_data(mbTOD *tod, actData hwp_freq, actComplex **tdata,actComp
   if ((tdata==NULL)||(poldata==NULL))
     return nmode;
 
-  fftw_plan_with_nthreads(1);
-
-
-
-  double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));
-  actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-  actComplex *ctmp2=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-  fftw_plan plan_r2c=fftw_plan_dft_r2c_1d(tod->ndata,tmp,ctmp,FFTW_ESTIMATE);
-  fftw_plan plan_c2r=fftw_plan_dft_c2r_1d(tod->ndata,ctmp,tmp,FFTW_ESTIMATE);
-  fftw_plan plan_c2c=fftw_plan_dft_1d(tod->ndata,ctmp,ctmp2,FFTW_BACKWARD,FFTW_ESTIMATE);
-
-  fftw_free(tmp);
-  fftw_free(ctmp);
-  fftw_free(ctmp2);
+  //single-threaded plans from the cache, since we run one per thread.
+  act_fftw_plan plan_r2c=act_fftw_cached_plan_r2c(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_c2r=act_fftw_cached_plan_c2r(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_c2c=act_fftw_cached_plan_c2c(tod->ndata,1,NULL,NULL,FFTW_BACKWARD,1);
 
 #pragma omp parallel shared(tod,hwp_freq,tdata,poldata,nmode,plan_r2c,plan_c2r,plan_c2c) default(none)
   {
-    double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));
-    actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-    actComplex *ctmp2=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
+    actData *tmp=(actData *)act_fftw_malloc(tod->ndata*sizeof(actData));
+    actComplex *ctmp=(actComplex *)act_fftw_malloc(tod->ndata*sizeof(actComplex));
+    actComplex *ctmp2=(actComplex *)act_fftw_malloc(tod->ndata*sizeof(actComplex));
     int nelem=fft_real2complex_nelem(tod->ndata);
 #pragma omp for
     for (int det=0;det<tod->ndet;det++) {
       memset(ctmp2,0,sizeof(tod->ndata*sizeof(actComplex)));
       memcpy(ctmp2,poldata[det],nmode*sizeof(actComplex));
       memcpy(ctmp2+tod->ndata-nmode+1,poldata[det]+nmode,(nmode-1)*sizeof(actComplex));
-      fftw_execute_dft(plan_c2c,ctmp2,ctmp);
+      act_fftw_execute_dft(plan_c2c,ctmp2,ctmp);
       actData norm_fac=1.0/tod->ndata;      
 
       if (tod->twogamma_saved) {
@@ -2537,31 +3323,78 @@ int remodulate_hwp_data(mbTOD *tod, actData hwp_freq, actComplex **tdata,actComp
 	if (det==0)
 	  printf("real/imag tots are %14.4e %14.4e\n",real_tot,imag_tot);
       }
-      fftw_execute_dft_r2c(plan_r2c,tmp,ctmp);
+      act_fftw_execute_dft_r2c(plan_r2c,tmp,ctmp);
       memcpy(ctmp,tdata[det],nmode*sizeof(actComplex));   //copy the intensity data back in
-      fftw_execute_dft_c2r(plan_c2r,ctmp,tod->data[det]);
+      act_fftw_execute_dft_c2r(plan_c2r,ctmp,tod->data[det]);
       
     }
-    fftw_free(tmp);
-    fftw_free(ctmp);
-    fftw_free(ctmp2);
+    act_fftw_free((act_fftw_complex *)tmp);
+    act_fftw_free(ctmp);
+    act_fftw_free(ctmp2);
   }
   
   //printf("finished the FFTs.\n");
   
-  fftw_destroy_plan(plan_r2c);
-  fftw_destroy_plan(plan_c2r);
-  fftw_destroy_plan(plan_c2c);
-
-  //printf("destroyed plans.\n");
-
-  fftw_plan_with_nthreads(omp_get_max_threads());
   
   //actComplex **dataft=fft_all_data(tod);
   return 0;
   
 }
 /*--------------------------------------------------------------------------------*/
+static void free_demod_tables(DemodData *demod)
+{
+  if (demod->hwp_cos) {
+    free(demod->hwp_cos[0]);
+    free(demod->hwp_cos);
+  }
+  if (demod->hwp_sin) {
+    free(demod->hwp_sin[0]);
+    free(demod->hwp_sin);
+  }
+  demod->hwp_cos=NULL;
+  demod->hwp_sin=NULL;
+  demod->ntable=0;
+}
+/*--------------------------------------------------------------------------------*/
+static void setup_demod_tables(const mbTOD *tod, DemodData *demod)
+//cos/sin(freqs[ff]*hwp) for every demodulation frequency.  They only depend on the TOD, so
+//they're built once and shared by every detector, in both directions.
+{
+  if ((demod->hwp_cos)&&(demod->ntable==tod->ndata))
+    return;
+  free_demod_tables(demod);
+  if (demod->nfreq==0)
+    return;
+  assert(tod->hwp);
+  int nfreq=demod->nfreq;
+  actData **hwp_cos=matrix(nfreq,tod->ndata);
+  actData **hwp_sin=matrix(nfreq,tod->ndata);
+#pragma omp parallel for shared(tod,demod,hwp_cos,hwp_sin,nfreq) default(none)
+  for (int i=0;i<tod->ndata;i++)
+    for (int ff=0;ff<nfreq;ff++) {
+      hwp_cos[ff][i]=cos(tod->hwp[i]*demod->freqs[ff]);
+      hwp_sin[ff][i]=sin(tod->hwp[i]*demod->freqs[ff]);
+    }
+  demod->hwp_cos=hwp_cos;
+  demod->hwp_sin=hwp_sin;
+  demod->ntable=tod->ndata;
+}
+/*--------------------------------------------------------------------------------*/
+static void demod_bandpass(const DemodData *demod, actComplex *ctmp, int ndata, actData dnu)
+//keep the part of the spectrum the modulated signal lives in: above the nmode intensity modes,
+//and inside the high/lowpass if they're set.  ctmp is ndata long.
+{
+  memset(ctmp,0,demod->nmode*sizeof(actComplex));
+  if (demod->highpass_freq>0) {
+    int istart=demod->highpass_freq/dnu;
+    memset(ctmp+istart,0,(ndata-istart)*sizeof(actComplex));
+  }
+  if (demod->lowpass_freq>0) {
+    int istop=demod->lowpass_freq/dnu;
+    memset(ctmp,0,istop*sizeof(actComplex));
+  }
+}
+/*--------------------------------------------------------------------------------*/
 DemodData *init_demod_data(mbTOD *tod, actData hwp_freq, actData lowpass_freq, actData lowpass_taper, actData highpass_freq,actData highpass_taper)
 {
   DemodData *demod=(DemodData *)calloc(1,sizeof(DemodData));
@@ -2590,6 +3423,7 @@ void set_demod_freqs(DemodData *demod, actData *freqs, int nfreq)
   if (demod->freqs) {
     free(demod->freqs);
   }
+  free_demod_tables(demod);
   demod->freqs=vector(nfreq);
   demod->nfreq=nfreq;
   for (int i=0;i<nfreq;i++) {
@@ -2613,6 +3447,7 @@ void free_demod_data(DemodData *demod)
 void destroy_demod_data(DemodData *demod) 
 {
   free_demod_data(demod);
+  free_demod_tables(demod);
   free(demod);
 }
 /*--------------------------------------------------------------------------------*/
@@ -2642,90 +3477,93 @@ actData get_hwp_freq(mbTOD *tod)
 }
 /*--------------------------------------------------------------------------------*/
 void demodulate_data(mbTOD *tod, DemodData *demod) 
+//channel 0 is the detector's low modes as they are.  The rest of the spectrum gets bandpassed
+//once, multiplied by the shared cos/sin tables, and all 2*nfreq products go through one
+//batched FFT.
 {
   //printf("greetings from demodulate_data.\n");
   actData dnu=1.0/(tod->deltat*tod->ndata);
   int nchan=get_demod_nchannel(demod);
+  int ncomp=2*demod->nfreq;
+  int nn=get_nn(tod->ndata);
+  assert(demod->nmode<=nn);
 
   if (demod->data==NULL)  {
     printf("allocating storage in demodulate_data.\n");
     demod->data=cmatrix(tod->ndet*nchan,demod->nmode);
 
   }
+  setup_demod_tables(tod,demod);
 
-  //fftw_plan_with_nthreads(1);
-
-  double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));  
-  actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-  fftw_plan plan_r2c=fftw_plan_dft_r2c_1d(tod->ndata,tmp,ctmp,FFTW_ESTIMATE);
-  fftw_plan plan_c2r=fftw_plan_dft_c2r_1d(tod->ndata,ctmp,tmp,FFTW_ESTIMATE);
-  fftw_free(tmp);
-  fftw_free(ctmp);
-  //printf("plans are made.\n");
-  //#pragma omp parallel shared(tod,demod,plan_r2c,plan_c2r,nchan,dnu) default(none)
+  //threads each run their own transforms, so plans are single-threaded and come out of the
+  //cache before the parallel region.
+  act_fftw_plan plan_r2c=act_fftw_cached_plan_r2c(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_c2r=act_fftw_cached_plan_c2r(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_comps=NULL;
+  if (ncomp>0)
+    plan_comps=act_fftw_cached_plan_r2c(tod->ndata,ncomp,NULL,NULL,1);
+#pragma omp parallel shared(tod,demod,plan_r2c,plan_c2r,plan_comps,nchan,ncomp,nn,dnu) default(none)
   {
-    double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));  
-    double *tmp_demod=(double *)fftw_malloc(tod->ndata*sizeof(double));  
-    actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
+    actData *tmp=(actData *)act_fftw_malloc(tod->ndata*sizeof(actData));  
+    actComplex *ctmp=(actComplex *)act_fftw_malloc(tod->ndata*sizeof(actComplex));
+    actData *comps=NULL;
+    actComplex *comps_ft=NULL;
+    if (ncomp>0) {
+      comps=(actData *)act_fftw_malloc(sizeof(actData)*ncomp*tod->ndata);
+      comps_ft=(actComplex *)act_fftw_malloc(sizeof(actComplex)*ncomp*nn);
+    }
     actData normfac=1.0/tod->ndata;
 
-#pragma omp for
+#pragma omp for schedule(dynamic,1)
     for (int det=0;det<tod->ndet;det++) {
-      //printf("det is %d\n",det);
       int dd=det*nchan;
-      fftw_execute_dft_r2c(plan_r2c,tod->data[det],ctmp);
-      //printf("did first fft.\n");
+      //copy first so the transform always sees an aligned buffer.
+      memcpy(tmp,tod->data[det],tod->ndata*sizeof(actData));
+      act_fftw_execute_dft_r2c(plan_r2c,tmp,ctmp);
       memcpy(demod->data[dd],ctmp,demod->nmode*sizeof(actComplex));
-
-      memset(ctmp,0,demod->nmode*sizeof(actComplex));
-      if (demod->highpass_freq>0) {
-	int istart=demod->highpass_freq/dnu;
-	memset(ctmp+istart,0,(tod->ndata-istart)*sizeof(actComplex));
-      }
-      if (demod->lowpass_freq>0) {
-	int istop=demod->lowpass_freq/dnu;
-	memset(ctmp,0,istop*sizeof(actComplex));
-      }
-      
-      fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
-      //printf("detector %d has element 1000 %14.6g\n",det,tmp[1000]);
-      //printf("did second fft.\n");
+      if (ncomp==0)
+	continue;
+
+      demod_bandpass(demod,ctmp,tod->ndata,dnu);
+      //the FFT normalization goes in here once instead of into every component.
+      for (int i=0;i<nn;i++)
+	ctmp[i]*=normfac;
+      act_fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
       for (int ff=0;ff<demod->nfreq;ff++) {
-	//printf("ff is %d of %d\n",ff,demod->nfreq);
-	for (int i=0;i<tod->ndata;i++)
-	  tmp_demod[i]=tmp[i]*cos(tod->hwp[i]*demod->freqs[ff])*normfac;
-	fftw_execute_dft_r2c(plan_r2c,tmp_demod,ctmp);
-	//printf("detector %d has cos element 0 %14.6g %14.6g\n",det,ctmp[0][0],ctmp[0][1]);
-	memcpy(demod->data[dd+1+2*ff],ctmp,demod->nmode*sizeof(actComplex));
-
-	for (int i=0;i<tod->ndata;i++)
-	  tmp_demod[i]=tmp[i]*sin(tod->hwp[i]*demod->freqs[ff])*normfac;
-	fftw_execute_dft_r2c(plan_r2c,tmp_demod,ctmp);
-	//printf("detector %d has sin element 0 %14.6g \n",det,ctmp[0]);
-	memcpy(demod->data[dd+2+2*ff],ctmp,demod->nmode*sizeof(actComplex));	
+	actData *cc=comps+(long)2*ff*tod->ndata;
+	actData *ss=cc+tod->ndata;
+	const actData *hwp_cos=demod->hwp_cos[ff];
+	const actData *hwp_sin=demod->hwp_sin[ff];
+	for (int i=0;i<tod->ndata;i++) {
+	  cc[i]=tmp[i]*hwp_cos[i];
+	  ss[i]=tmp[i]*hwp_sin[i];
+	}
       }
+      act_fftw_execute_dft_r2c(plan_comps,comps,comps_ft);
+      for (int c=0;c<ncomp;c++)
+	memcpy(demod->data[dd+1+c],comps_ft+(long)c*nn,demod->nmode*sizeof(actComplex));
     }
-    //printf("freeing.\n");
    
-    fftw_free(tmp);
-    fftw_free(tmp_demod);
-    fftw_free(ctmp);
-    //printf("freed.\n");
+    act_fftw_free((act_fftw_complex *)tmp);
+    act_fftw_free(ctmp);
+    if (ncomp>0) {
+      act_fftw_free((act_fftw_complex *)comps);
+      act_fftw_free(comps_ft);
+    }
   }
   
-  fftw_destroy_plan(plan_c2r);
-  fftw_destroy_plan(plan_r2c);
-
-  //fftw_plan_with_nthreads(omp_get_max_threads());
-  //printf("replanned.\n");
   
 }
 
 /*--------------------------------------------------------------------------------*/
 void remodulate_data(mbTOD *tod, DemodData *demod)
+//the inverse of demodulate_data, added into tod->data.  A detector's 2*nfreq channels come back
+//through one batched FFT and get recombined with the shared tables.
 {
   actData dnu=1.0/(tod->deltat*tod->ndata);
   int nchan=get_demod_nchannel(demod);
+  int ncomp=2*demod->nfreq;
+  int nn=get_nn(tod->ndata);
   if (demod->data==NULL) {
     fprintf(stderr,"Must have data in remodulate_data.\n");
     return;
@@ -2733,73 +3571,66 @@ void remodulate_data(mbTOD *tod, DemodData *demod)
   if (tod->data==NULL) {
     assert(1==0);  //we should have storage here.
   }
+  setup_demod_tables(tod,demod);
 
-  fftw_plan_with_nthreads(1);
-  double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));
-  actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
-  fftw_plan plan_r2c=fftw_plan_dft_r2c_1d(tod->ndata,tmp,ctmp,FFTW_ESTIMATE);
-  fftw_plan plan_c2r=fftw_plan_dft_c2r_1d(tod->ndata,ctmp,tmp,FFTW_ESTIMATE);
-  fftw_free(tmp);
-  fftw_free(ctmp);
-#pragma omp parallel shared(tod,demod,plan_r2c,plan_c2r,nchan,dnu) default(none)
+  act_fftw_plan plan_r2c=act_fftw_cached_plan_r2c(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_c2r=act_fftw_cached_plan_c2r(tod->ndata,1,NULL,NULL,1);
+  act_fftw_plan plan_comps=NULL;
+  if (ncomp>0)
+    plan_comps=act_fftw_cached_plan_c2r(tod->ndata,ncomp,NULL,NULL,1);
+#pragma omp parallel shared(tod,demod,plan_r2c,plan_c2r,plan_comps,nchan,ncomp,nn,dnu) default(none)
   {
-    double *tmp=(double *)fftw_malloc(tod->ndata*sizeof(double));
-    //double *tmp_demod=(double *)fftw_malloc(tod->ndata*sizeof(double));
-    double *accum=(double *)fftw_malloc(tod->ndata*sizeof(double));
-    memset(accum,0,sizeof(double)*tod->ndata);
-    actComplex *ctmp=(actComplex *)fftw_malloc(tod->ndata*sizeof(actComplex));
+    actData *tmp=(actData *)act_fftw_malloc(tod->ndata*sizeof(actData));
+    actData *accum=(actData *)act_fftw_malloc(tod->ndata*sizeof(actData));
+    actComplex *ctmp=(actComplex *)act_fftw_malloc(tod->ndata*sizeof(actComplex));
+    actData *comps=NULL;
+    actComplex *comps_ft=NULL;
+    if (ncomp>0) {
+      comps=(actData *)act_fftw_malloc(sizeof(actData)*ncomp*tod->ndata);
+      comps_ft=(actComplex *)act_fftw_malloc(sizeof(actComplex)*ncomp*nn);
+    }
     
     actData normfac=1.0/tod->ndata;
-#pragma omp for
+#pragma omp for schedule(dynamic,1)
     for (int det=0;det<tod->ndet;det++) {
       int dd=det*nchan;
-      for (int ff=0;ff<demod->nfreq;ff++) {
-	memset(ctmp,0,sizeof(actComplex)*tod->ndata);
-	memcpy(ctmp,demod->data[dd+1+2*ff],demod->nmode*sizeof(actComplex));
-	fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
-	for (int i=0;i<tod->ndata;i++)
-	  accum[i]+=tmp[i]*cos(tod->hwp[i]*demod->freqs[ff]);
-	memcpy(ctmp,demod->data[dd+2+2*ff],demod->nmode*sizeof(actComplex));
-	fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
-	for (int i=0;i<tod->ndata;i++)
-	  accum[i]+=tmp[i]*sin(tod->hwp[i]*demod->freqs[ff]);
-      }
-      //now apply the bandpass
-      fftw_execute_dft_r2c(plan_r2c,accum,ctmp);
-      memset(ctmp,0,demod->nmode*sizeof(actComplex));
-      if (demod->highpass_freq>0) {
-        int istart=demod->highpass_freq/dnu;
-        memset(ctmp+istart,0,(tod->ndata-istart)*sizeof(actComplex));
-      }
-      if (demod->lowpass_freq>0) {
-        int istop=demod->lowpass_freq/dnu;
-        memset(ctmp,0,istop*sizeof(actComplex));
+      if (ncomp>0) {
+	memset(comps_ft,0,sizeof(actComplex)*ncomp*nn);
+	for (int c=0;c<ncomp;c++)
+	  memcpy(comps_ft+(long)c*nn,demod->data[dd+1+c],demod->nmode*sizeof(actComplex));
+	act_fftw_execute_dft_c2r(plan_comps,comps_ft,comps);
+	memset(accum,0,sizeof(actData)*tod->ndata);
+	for (int ff=0;ff<demod->nfreq;ff++) {
+	  const actData *cc=comps+(long)2*ff*tod->ndata;
+	  const actData *ss=cc+tod->ndata;
+	  const actData *hwp_cos=demod->hwp_cos[ff];
+	  const actData *hwp_sin=demod->hwp_sin[ff];
+	  for (int i=0;i<tod->ndata;i++)
+	    accum[i]+=cc[i]*hwp_cos[i]+ss[i]*hwp_sin[i];
+	}
+	//now apply the bandpass
+	act_fftw_execute_dft_r2c(plan_r2c,accum,ctmp);
+	demod_bandpass(demod,ctmp,tod->ndata,dnu);
+	//scale the data by FFT norm factor.  We've picked up one copy in the filter, will pick up
+	//another in the IFFT, so put in two here.
+	for (int i=0;i<nn;i++)
+	  ctmp[i]*=normfac*normfac;
       }
-      
-      //scale the data by FFT norm factor.  We've picked up one copy in the filter, will pick up another in the IFFT, so put in two here.
-      //to save time, don't apply normfac to data above the high frequency cutoff
-      int imax=tod->ndata;
-      if (demod->highpass_freq>0)
-	imax=demod->highpass_freq/dnu;
-      for (int i=0;i<imax;i++)
-	ctmp[i]*=normfac*normfac;
+      else
+	memset(ctmp,0,sizeof(actComplex)*nn);
       //now add in the I part of the demod data.  need one copy of normfac here.
       for (int i=0;i<demod->nmode;i++)
 	ctmp[i]+=normfac*demod->data[dd][i];
-      fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
+      act_fftw_execute_dft_c2r(plan_c2r,ctmp,tmp);
       for (int i=0;i<tod->ndata;i++)
 	tod->data[det][i]+=tmp[i];
     }
-    fftw_free(tmp);
-    fftw_free(ctmp);
-    fftw_free(accum);
-
-    
-    
+    act_fftw_free((act_fftw_complex *)tmp);
+    act_fftw_free(ctmp);
+    act_fftw_free((act_fftw_complex *)accum);
+    if (ncomp>0) {
+      act_fftw_free((act_fftw_complex *)comps);
+      act_fftw_free(comps_ft);
+    }
   }
-  fftw_destroy_plan(plan_c2r);
-  fftw_destroy_plan(plan_r2c);
-  fftw_plan_with_nthreads(omp_get_max_threads());
-
-
 }
@@ -740,6 +740,38 @@ void get_radec_from_altaz_fit_tiled(const TiledPointingFit *tile, actData *alt,
   }
 }
 /*--------------------------------------------------------------------------------*/
+void get_radec_coarse_1det(const mbTOD *tod, int det, PointingFitScratch *scratch)
+//evaluate the pointing fit for one detector at the pivots only, leaving ra/dec in scratch->ra_coarse/dec_coarse.
+//For non-tiled fits the clock-rate terms and the ra/dec offsets are not included.
+{
+  double t_prof=nk_profile_tick();
+  assert(tod->pointing_fit);
+  assert(tod->pointingOffset);
+  actData mydalt=get_alt_offset(tod,det);
+  actData mydaz=get_az_offset(tod,det);
+  int ncoarse=scratch->pointing_fit->ncoarse;
+  assert(ncoarse>0);
+  int *ind=scratch->pointing_fit->coarse_ind;
+
+  for (int i=0;i<ncoarse;i++) {
+#ifdef OLD_POINTING_OFFSET
+    scratch->alt_coarse[i]=scratch->tod_alt[ind[i]]+mydalt;
+    scratch->az_coarse[i]=scratch->tod_az[ind[i]]+mydaz/cos(scratch->alt_coarse[i]);
+#else
+    actData alt0=scratch->tod_alt[ind[i]];
+    scratch->alt_coarse[i]=alt0+mydalt;
+    scratch->az_coarse[i]=scratch->tod_az[ind[i]]+mydaz/cos(alt0);
+#endif
+    scratch->time_coarse[i]=tod->deltat*(ind[i]);
+  }
+
+  if (tod->pointing_fit->tiled_fit)
+    get_radec_from_altaz_fit_tiled(tod->pointing_fit->tiled_fit,scratch->alt_coarse, scratch->az_coarse, scratch->time_coarse,scratch->ra_coarse, scratch->dec_coarse, ncoarse);
+  else
+    eval_2d_poly_pair_inplace(scratch->alt_coarse,scratch->az_coarse,ncoarse,scratch->pointing_fit->ra_fit,scratch->ra_coarse,scratch->pointing_fit->dec_fit,scratch->dec_coarse);
+  nk_profile_tock(NK_PROF_POINTING,t_prof);
+}
+/*--------------------------------------------------------------------------------*/
 void get_radec_from_altaz_fit_1det_coarse(const mbTOD *tod, int det, PointingFitScratch *scratch)
 {
   //printf("in get_radec_from_altaz_fit_1det_coarse\n");
@@ -767,42 +799,12 @@ void get_radec_from_altaz_fit_1det_coarse(const mbTOD *tod, int det, PointingFit
     return;
   }
 
-  //printf("Don't think I should be here.\n");
-  assert(tod->pointing_fit);
-  assert(tod->pointingOffset);
-  actData mydalt=get_alt_offset(tod,det);
-  actData mydaz=get_az_offset(tod,det);
-  actData myalt=tod->alt[0];
-  actData myaz=tod->az[0];
-
-#ifdef OLD_POINTING_OFFSET
-  actData fac=mydaz/cos(scratch->tod_alt[0]+mydalt);
-#else
-  actData fac=mydaz/cos(scratch->tod_alt[0]);
-#endif
+  get_radec_coarse_1det(tod,det,scratch);
+  double t_prof=nk_profile_tick();  //the pivots time themselves
   int ncoarse=scratch->pointing_fit->ncoarse;
-  assert(ncoarse>0);
   int *ind=scratch->pointing_fit->coarse_ind;
 
-  for (int i=0;i<ncoarse;i++) {
-
-#ifdef OLD_POINTING_OFFSET
-    scratch->alt_coarse[i]=scratch->tod_alt[ind[i]]+mydalt;
-    scratch->az_coarse[i]=scratch->tod_az[ind[i]]+mydaz/cos(scratch->alt_coarse[i]);
-#else
-    actData alt0=scratch->tod_alt[ind[i]];
-    scratch->alt_coarse[i]=alt0+mydalt;
-    scratch->az_coarse[i]=scratch->tod_az[ind[i]]+mydaz/cos(alt0);
-#endif
-    scratch->time_coarse[i]=tod->deltat*(ind[i]);
-  }
-  
-
-
-
-
   if (tod->pointing_fit->tiled_fit) {
-    get_radec_from_altaz_fit_tiled(tod->pointing_fit->tiled_fit,scratch->alt_coarse, scratch->az_coarse, scratch->time_coarse,scratch->ra_coarse, scratch->dec_coarse, ncoarse);
     for (int i=0;i<ncoarse-1;i++) {
       scratch->ra[ind[i]]=scratch->ra_coarse[i];
       scratch->dec[ind[i]]=scratch->dec_coarse[i];     
@@ -816,8 +818,6 @@ void get_radec_from_altaz_fit_1det_coarse(const mbTOD *tod, int det, PointingFit
     }
   }
   else {
-    eval_2d_poly_pair_inplace(scratch->alt_coarse,scratch->az_coarse,ncoarse,scratch->pointing_fit->ra_fit,scratch->ra_coarse,scratch->pointing_fit->dec_fit,scratch->dec_coarse);
-    
     for (int i=0;i<ncoarse-1;i++) {
       scratch->ra[ind[i]]=scratch->ra_coarse[i] +((actData)ind[i])*tod->pointing_fit->ra_clock_rate;
       scratch->dec[ind[i]]=scratch->dec_coarse[i]+((actData)ind[i])*tod->pointing_fit->dec_clock_rate;
@@ -869,6 +869,7 @@ void get_radec_from_altaz_fit_1det_coarse(const mbTOD *tod, int det, PointingFit
 
 
   //apply_time_ramp_to_fit(tod,scratch);
+  nk_profile_tock(NK_PROF_POINTING,t_prof);
   return;  
 
 }
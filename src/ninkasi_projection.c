@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <limits.h>
 
 #ifdef USE_HEALPIX
 #include "chealpix.h"
@@ -146,6 +147,15 @@ void get_map_projection_wchecks(const mbTOD *tod, const MAP *map, int det, int *
     memcpy(ind,tod->pixelization_saved[det],sizeof(int)*tod->ndata);
     return;
   }
+  if (tod->pixelization_packed) {
+    unpack_pixelization_1det(tod->pixelization_packed,det,ind);
+    return;
+  }
+  if ((inbounds==NULL)&&(fused_projection_ok(tod,map))) {
+    get_radec_coarse_1det(tod,det,scratch);
+    get_map_projection_fused_range(tod,map,scratch,0,tod->ndata,ind);
+    return;
+  }
   get_radec_from_altaz_fit_1det_coarse(tod,det,scratch);
 #if 1
   convert_radec_to_map_pixel(scratch->ra,scratch->dec,ind,tod->ndata,map);
@@ -889,6 +899,120 @@ void convert_radec_to_map_pixel(const actData *ra, const actData *dec, int *ind,
   
 }
 
+/*--------------------------------------------------------------------------------*/
+bool fused_projection_ok(const mbTOD *tod, const MAP *map)
+//can get_map_projection_fused_range handle this tod/map?  It needs a pointing fit (not saved ra/dec) and a CEA/CAR/TAN map.
+{
+  if ((tod->ra_saved)||(tod->pointing_fit==NULL))
+    return false;
+  switch(map->projection->proj_type) {
+  case NK_CEA:
+  case NK_CAR:
+  case NK_TAN:
+    return true;
+  default:
+    return false;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static inline void project_pivot_segment(const MAP *map, int j0, int j1, int jref, actData len, 
+					 actData ra0, actData dra, actData dec0, actData ddec,
+					 actData ra_rate, actData dec_rate, actData ra_off, actData dec_off, int *ind)
+//interpolate ra/dec linearly from the pivot at jref over samples [j0,j1) and pixelize them on the spot.
+//The interpolation is written the same way as in get_radec_from_altaz_fit_1det_coarse so the pixels agree.
+{
+  const nkProjection *proj=map->projection;
+  const int nx=map->nx;
+  switch(proj->proj_type) {
+  case NK_CEA: {
+    double rafac=RAD2DEG/proj->radelt;
+    double decfac=RAD2DEG/proj->pv/proj->decdelt;
+    actData drapix=proj->rapix-1+0.5;
+    actData ddecpix=proj->decpix-1+0.5;
+    for (int j=j0;j<j1;j++) {
+      actData ra=ra0+((actData)(j-jref))/len*dra+((actData)j)*ra_rate+ra_off;
+      actData dec=dec0+((actData)(j-jref))/len*ddec+((actData)j)*dec_rate+dec_off;
+      int tmp_ra=ra*rafac+drapix;
+      int tmp_dec=sin5(dec)*decfac+ddecpix;
+      ind[j-j0]=nx*tmp_dec+tmp_ra;
+    }
+  }
+    break;
+  case NK_CAR: {
+    double rafac=RAD2DEG/proj->radelt;
+    double decfac=RAD2DEG/proj->decdelt;
+    actData drapix=proj->rapix-1+0.5;
+    actData ddecpix=proj->decpix-1+0.5;
+    for (int j=j0;j<j1;j++) {
+      actData ra=ra0+((actData)(j-jref))/len*dra+((actData)j)*ra_rate+ra_off;
+      actData dec=dec0+((actData)(j-jref))/len*ddec+((actData)j)*dec_rate+dec_off;
+      int tmp_ra=ra*rafac+drapix;
+      int tmp_dec=dec*decfac+ddecpix;
+      ind[j-j0]=nx*tmp_dec+tmp_ra;
+    }
+  }
+    break;
+  case NK_TAN:
+    for (int j=j0;j<j1;j++) {
+      actData ra=ra0+((actData)(j-jref))/len*dra+((actData)j)*ra_rate+ra_off;
+      actData dec=dec0+((actData)(j-jref))/len*ddec+((actData)j)*dec_rate+dec_off;
+      actData x,y;
+      radec2xy_tan(&x,&y,ra,dec,proj);
+      ind[j-j0]=(int)(x+0.5)+nx*((int)(y+0.5));
+    }
+    break;
+  default:
+    assert(1==0);  //fused_projection_ok should have kept us out of here.
+  }
+}
+/*--------------------------------------------------------------------------------*/
+void get_map_projection_fused_range(const mbTOD *tod, const MAP *map, const PointingFitScratch *scratch, int i0, int i1, int *ind)
+//pixelize samples [i0,i1) of the detector whose pivots get_radec_coarse_1det has put in scratch, writing ind[0..i1-i0).
+//Each pivot segment goes straight from interpolation to pixel, so the full-length ra/dec never get written.
+{
+  double t_prof=nk_profile_tick();
+  const PointingFit *fit=tod->pointing_fit;
+  const int ncoarse=scratch->pointing_fit->ncoarse;
+  const int *cind=scratch->pointing_fit->coarse_ind;
+  const actData *ra_c=scratch->ra_coarse;
+  const actData *dec_c=scratch->dec_coarse;
+  actData ra_rate=0,dec_rate=0;
+  if (!fit->tiled_fit) {
+    ra_rate=fit->ra_clock_rate;
+    dec_rate=fit->dec_clock_rate;
+  }
+
+  //find the segment holding i0.  Anything past the last pivot sits on the last pivot.
+  int seg=ncoarse-1;
+  if (i0<cind[ncoarse-1]) {
+    int lo=0,hi=ncoarse-1;
+    while (hi-lo>1) {
+      int mid=(lo+hi)/2;
+      if (cind[mid]<=i0)
+	lo=mid;
+      else
+	hi=mid;
+    }
+    seg=lo;
+  }
+
+  int j=i0;
+  while (j<i1) {
+    int jend=i1;
+    actData dra=0,ddec=0,len=1;
+    if (seg<ncoarse-1) {
+      if (cind[seg+1]<jend)
+	jend=cind[seg+1];
+      dra=ra_c[seg+1]-ra_c[seg];
+      ddec=dec_c[seg+1]-dec_c[seg];
+      len=cind[seg+1]-cind[seg];
+    }
+    project_pivot_segment(map,j,jend,cind[seg],len,ra_c[seg],dra,dec_c[seg],ddec,ra_rate,dec_rate,fit->ra_offset,fit->dec_offset,ind+(j-i0));
+    j=jend;
+    seg++;
+  }
+  nk_profile_tock(NK_PROF_POINTING,t_prof);
+}
 /*--------------------------------------------------------------------------------*/
 void convert_saved_pointing_to_pixellization(mbTOD *tod, MAP *map)
 //convert the ra/dec saved in a TOD to a map pixellization.  Free the RA/Dec.
@@ -907,7 +1031,6 @@ void convert_saved_pointing_to_pixellization(mbTOD *tod, MAP *map)
       #pragma omp for 
       for (int i=0;i<tod->ndet;i++) {
 	get_pointing_vec_new(tod,map,i,tod->pixelization_saved[i],scratch);
-	convert_radec_to_map_pixel(scratch->ra,scratch->dec,tod->pixelization_saved[i],tod->ndata,map);
       }
       destroy_pointing_fit_scratch(scratch);
       
@@ -929,3 +1052,167 @@ void convert_saved_pointing_to_pixellization(mbTOD *tod, MAP *map)
   }
   
 }
+/*--------------------------------------------------------------------------------*/
+static void pack_pixelization_1det(PackedPixelization *pk, int det, const int *ind)
+//two passes - count runs/escapes, then fill - so each detector gets exactly what it needs.
+{
+  int n=pk->ndata;
+  int nrun=0;
+  int nesc=0;
+  long prev=0;
+  for (int j=0;j<n;) {
+    int len=1;
+    while ((j+len<n)&&(ind[j+len]==ind[j])&&(len<NK_PIX_MAXRUN))
+      len++;
+    long step=(long)ind[j]-prev;
+    if ((step<=NK_PIX_ESCAPE)||(step>SHRT_MAX))
+      nesc++;
+    prev=ind[j];
+    nrun++;
+    j+=len;
+  }
+  
+  pk->nrun[det]=nrun;
+  pk->runlen[det]=(unsigned char *)malloc_retry(sizeof(unsigned char)*nrun);
+  pk->delta[det]=(short *)malloc_retry(sizeof(short)*nrun);
+  pk->escape[det]=NULL;
+  if (nesc>0)
+    pk->escape[det]=(int *)malloc_retry(sizeof(int)*nesc);
+  
+  unsigned char *runlen=pk->runlen[det];
+  short *delta=pk->delta[det];
+  int *escape=pk->escape[det];
+  int irun=0;
+  int iesc=0;
+  prev=0;
+  for (int j=0;j<n;) {
+    int len=1;
+    while ((j+len<n)&&(ind[j+len]==ind[j])&&(len<NK_PIX_MAXRUN))
+      len++;
+    long step=(long)ind[j]-prev;
+    if ((step<=NK_PIX_ESCAPE)||(step>SHRT_MAX)) {
+      delta[irun]=NK_PIX_ESCAPE;
+      escape[iesc++]=ind[j];
+    }
+    else
+      delta[irun]=step;
+    runlen[irun]=len;
+    prev=ind[j];
+    irun++;
+    j+=len;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+PackedPixelization *pack_tod_pixelization(mbTOD *tod, const MAP *map)
+//Evaluate the pointing once and keep it packed.  If the TOD already has a full
+//pixelization_saved, pack that instead of redoing the pointing.
+{
+  PackedPixelization *pk=(PackedPixelization *)calloc(1,sizeof(PackedPixelization));
+  pk->ndet=tod->ndet;
+  pk->ndata=tod->ndata;
+  pk->nrun=(int *)calloc(tod->ndet,sizeof(int));
+  pk->runlen=(unsigned char **)calloc(tod->ndet,sizeof(unsigned char *));
+  pk->delta=(short **)calloc(tod->ndet,sizeof(short *));
+  pk->escape=(int **)calloc(tod->ndet,sizeof(int *));
+
+  //make sure the pointing gets computed rather than read back out of an old cache.
+  PackedPixelization *old=tod->pixelization_packed;
+  tod->pixelization_packed=NULL;
+  
+  long nbyte=0;
+#pragma omp parallel shared(tod,map,pk) reduction(+:nbyte) default(none)
+  {
+    PointingFitScratch *scratch=NULL;
+    int *ind=NULL;
+    if (!tod->pixelization_saved) {
+      scratch=allocate_pointing_fit_scratch(tod);
+      ind=(int *)malloc_retry(sizeof(int)*tod->ndata);
+    }
+#pragma omp for schedule(dynamic,1)
+    for (int det=0;det<tod->ndet;det++) {
+      if (mbCutsIsAlwaysCut(tod->cuts,tod->rows[det],tod->cols[det]))
+	continue;
+      if (tod->pixelization_saved)
+	pack_pixelization_1det(pk,det,tod->pixelization_saved[det]);
+      else {
+	get_pointing_vec_new(tod,map,det,ind,scratch);
+	pack_pixelization_1det(pk,det,ind);
+      }
+      nbyte+=pk->nrun[det]*(sizeof(unsigned char)+sizeof(short));
+    }
+    if (scratch) {
+      destroy_pointing_fit_scratch(scratch);
+      free(ind);
+    }
+  }
+  pk->nbyte=nbyte;
+  tod->pixelization_packed=old;
+  return pk;
+}
+/*--------------------------------------------------------------------------------*/
+void unpack_pixelization_1det(const PackedPixelization *pk, int det, int *ind)
+//inner loop is a plain fill so the compiler can vectorize it.
+{
+  const unsigned char *runlen=pk->runlen[det];
+  const short *delta=pk->delta[det];
+  const int *escape=pk->escape[det];
+  int nrun=pk->nrun[det];
+  int pix=0;
+  int iesc=0;
+  int j=0;
+  for (int irun=0;irun<nrun;irun++) {
+    if (delta[irun]==NK_PIX_ESCAPE)
+      pix=escape[iesc++];
+    else
+      pix+=delta[irun];
+    int len=runlen[irun];
+    int *myind=ind+j;
+    for (int k=0;k<len;k++)
+      myind[k]=pix;
+    j+=len;
+  }
+}
+/*--------------------------------------------------------------------------------*/
+const int *get_saved_pixelization_1det(const mbTOD *tod, int det, int *buf)
+//pointer to a detector's saved pixelization.  Straight out of pixelization_saved if
+//we have it, otherwise decoded into buf, which must be of length ndata.
+{
+  if (tod->pixelization_saved)
+    return tod->pixelization_saved[det];
+  assert(tod->pixelization_packed);
+  assert(buf);
+  unpack_pixelization_1det(tod->pixelization_packed,det,buf);
+  return buf;
+}
+/*--------------------------------------------------------------------------------*/
+void destroy_packed_pixelization(PackedPixelization *pk)
+{
+  if (!pk)
+    return;
+  for (int i=0;i<pk->ndet;i++) {
+    if (pk->runlen[i])
+      free(pk->runlen[i]);
+    if (pk->delta[i])
+      free(pk->delta[i]);
+    if (pk->escape[i])
+      free(pk->escape[i]);
+  }
+  free(pk->runlen);
+  free(pk->delta);
+  free(pk->escape);
+  free(pk->nrun);
+  free(pk);
+}
+/*--------------------------------------------------------------------------------*/
+void free_tod_pixelization_saved(mbTOD *tod)
+{
+  if (tod->pixelization_saved) {
+    free(tod->pixelization_saved[0]);
+    free(tod->pixelization_saved);
+    tod->pixelization_saved=NULL;
+  }
+  if (tod->pixelization_packed) {
+    destroy_packed_pixelization(tod->pixelization_packed);
+    tod->pixelization_packed=NULL;
+  }
+}
@@ -154,23 +154,13 @@ void filter_whole_tod(mbTOD *tod, const actData *filt, actData **to_filt_in)
     memcpy(myfilt,filt,sizeof(actData)*n);
     actComplex *tmpfft=(actComplex *)act_fftw_malloc((n/2+1)*sizeof(actComplex));
     
-    act_fftw_plan p_forward;
-    act_fftw_plan p_back;
-#pragma omp critical
-    {
-      p_forward =act_fftw_plan_dft_r2c_1d(n,to_filt[0],tmpfft,FFTW_ESTIMATE);  
-      p_back    =act_fftw_plan_dft_c2r_1d(n,tmpfft,to_filt[0],FFTW_ESTIMATE);  
-    }
+    act_fftw_plan p_forward=act_fftw_cached_plan_r2c(n,1,to_filt[0],tmpfft,1);
+    act_fftw_plan p_back=act_fftw_cached_plan_c2r(n,1,tmpfft,to_filt[0],1);
     
 #pragma omp for
     for (int i=0; i<tod->ndet; i++) {
       filter_one_tod(to_filt[i],filt,tmpfft,p_forward,p_back,n);
     }
-#pragma omp critical
-    {
-      act_fftw_destroy_plan(p_forward);
-      act_fftw_destroy_plan(p_back);
-    }
     act_fftw_free(tmpfft);
     psFree(myfilt);
 #if 0
@@ -349,26 +339,12 @@ int *glitch_one_detector_simple(
   actData *filtvec=calculate_glitch_filterC(t_glitch,t_smooth,dt,n,1);
   int *cutvec=psAlloc(n*sizeof(int));
       
-  act_fftw_plan p_forward;
-  act_fftw_plan p_back;
-#if !defined(MB_SKIP_OMP)
-#pragma omp critical
-#endif
-  {
-    p_forward =act_fftw_plan_dft_r2c_1d(n,tmpvec,tmpfft,FFTW_ESTIMATE);  
-    p_back    =act_fftw_plan_dft_c2r_1d(n,tmpfft,tmpvec,FFTW_ESTIMATE);  
-  }
+  act_fftw_plan p_forward=act_fftw_cached_plan_r2c(n,1,tmpvec,tmpfft,1);
+  act_fftw_plan p_back=act_fftw_cached_plan_c2r(n,1,tmpfft,tmpvec,1);
   glitch_one_detector(mydat,filtvec, tmpfft,tmpvec,tmpclean,cutvec,n, p_forward,  p_back,do_smooth,
                       apply_glitch, do_cuts,nsig);
 
-      
-#if !defined(MB_SKIP_OMP)
-#pragma omp critical
-#endif
-  {
-    act_fftw_destroy_plan(p_forward);
-    act_fftw_destroy_plan(p_back);
-  }
+
   psFree(tmpvec);
   psFree(tmpclean);
   psFree(filtvec);
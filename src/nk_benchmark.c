@@ -0,0 +1,829 @@
+//Reproducible timings of the mapping hot path on synthetic data.  Writes a set of dirfiles with
+//a constant-speed azimuth scan, a detector grid, random sample cuts and 1/f noise (made with
+//set_tod_noise/add_noise_to_tod_new, so it's the same noise the simulations use), then times
+//the pieces of a PCG iteration on them and writes the results as JSON.  Data and seeds only
+//depend on the options, so runs on different commits can be compared stage by stage.
+//It's built next to ninkasi, against libninkasi with the same libraries (make nk_benchmark),
+//and run as
+//  OMP_NUM_THREADS=8 mpirun -np 2 ./nk_benchmark bench.par
+//bench.par takes any of the usual ninkasi options (@pixsize, @precon, @distribute_maps...) plus
+//  @bench_ndet 256 @bench_ndata 65536 @bench_ntod 4 @bench_nrep 3 @bench_srate 400
+//  @bench_throw 5 @bench_speed 1.5 @bench_elev 50 @bench_cut_frac 0.02 @bench_cut_len 400
+//  @bench_knee 1 @bench_alpha -1.5 @bench_white 1.2e-3 @bench_dir nk_bench_data
+//  @bench_hwp_freq 2 @bench_nharm 2 @bench_eig_rank 8 @bench_eig_tol 1e-3 @bench_polmap_nrep 3
+//  @bench_label mybranch @bench_json nk_benchmark.json
+//  @bench_pcg_niter 50 @bench_pcg_history nk_bench_pcg.txt @bench_pcg_reference nk_bench_pcg_double.txt
+//The demodulate/remodulate stages spin a synthetic HWP at hwp_freq and demodulate at 2,4,..2*nharm
+//times its angle; they only run in ACTPOL builds.  fit_noise_banded_topk refits the banded model
+//solving for only the top eig_rank modes per rotated band, next to the dense fit_noise_banded;
+//@bench_eig_rank 0 skips it.  In ACTPOL builds the first process also runs
+//benchmark_polmap_kernels on its first TOD against an IQU copy of the map, with synthetic
+//detector angles, and prints what it finds; @bench_polmap_nrep 0 skips that.
+//Each reported time is the slowest process's total over its TODs for one repetition; min and
+//median are over repetitions.  Reads after the first repetition come out of the page cache.
+//With @bench_pcg_niter N the solve is also run for N iterations from the start and its residual
+//history is written to the pcg_history file, headed by which actData (float or double) the build
+//uses.  Point @bench_pcg_reference at the history a double build wrote for the same options and
+//the two get printed side by side, to see whether a float build converges the same way.
+
+#ifndef MAKEFILE_HAND
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <omp.h>
+
+#include "ninkasi.h"
+
+#ifdef HAVE_MPI
+#  include <mpi.h>
+#endif
+
+#include "readtod.h"
+#include "mbCuts.h"
+#include "mbTOD.h"
+#include "noise.h"
+#include "parse_strings.h"
+
+typedef struct {
+  int ndet;
+  int ndata;
+  int ntod;
+  int nrep;
+  double srate;  //samples per second
+  double az_throw;  //peak-to-peak azimuth sweep, degrees
+  double az_speed;  //degrees/second
+  double elev;  //degrees
+  double cut_frac;  //fraction of samples cut, in chunks of cut_len
+  int cut_len;
+  double knee;
+  double alpha;
+  double white;  //noise per root second
+  double hwp_freq;  //Hz
+  int nharm;  //demodulate at 2,4,..2*nharm times the HWP angle
+  int eig_rank;  //top modes per band for the top-k banded fit, 0 to skip it
+  double eig_tol;
+  int polmap_nrep;  //repetitions for benchmark_polmap_kernels, 0 to skip it
+  int pcg_niter;  //iterations for the residual history, 0 to skip it
+  char pcg_history[MAXLEN];
+  char pcg_reference[MAXLEN];  //history from another build to compare against, if set
+  char dir[MAXLEN];
+  char label[MAXLEN];
+  char json[MAXLEN];
+} BenchConfig;
+
+enum {BENCH_READ, BENCH_COMMON, BENCH_FIT_POWLAW, BENCH_FILTER, BENCH_APPLY_POWLAW,
+      BENCH_FIT_BANDED, BENCH_FIT_BANDED_TOPK, BENCH_APPLY_BANDED, BENCH_DEMOD, BENCH_REMOD, BENCH_MAP2TOD, BENCH_TOD2MAP,
+      BENCH_INITIAL, BENCH_PCG, BENCH_NSTAGE};
+static const char *bench_stage_names[BENCH_NSTAGE]={"read_tod_data","remove_common_mode","fit_noise_powlaw",
+						   "filter_data","apply_noise_powlaw","fit_noise_banded",
+						   "fit_noise_banded_topk","apply_noise_banded","demodulate","remodulate",
+						   "mapset2tod","tod2mapset",
+						   "make_initial_mapset","pcg_step"};
+
+#define BENCH_NCOL_MAX 32
+#define BENCH_NROW_MAX 33
+#define BENCH_DET_SPACING (1.0/60*M_PI/180)  //one arcminute between neighbouring detectors
+#define BENCH_CTIME0 1223150033.0
+#ifdef ACTDATA_DOUBLE
+#define BENCH_ACTDATA_NAME "double"
+#else
+#define BENCH_ACTDATA_NAME "float"
+#endif
+
+/*--------------------------------------------------------------------------------*/
+static void set_bench_defaults(BenchConfig *cfg)
+{
+  memset(cfg,0,sizeof(BenchConfig));
+  cfg->ndet=256;
+  cfg->ndata=65536;
+  cfg->ntod=4;
+  cfg->nrep=3;
+  cfg->srate=400;
+  cfg->az_throw=5;
+  cfg->az_speed=1.5;
+  cfg->elev=50;
+  cfg->cut_frac=0.02;
+  cfg->cut_len=400;
+  cfg->knee=1;
+  cfg->alpha=-1.5;
+  cfg->white=1.2e-3;
+  cfg->hwp_freq=2.0;
+  cfg->nharm=2;
+  cfg->eig_rank=8;
+  cfg->eig_tol=1e-3;
+  cfg->polmap_nrep=3;
+  sprintf(cfg->dir,"nk_bench_data");
+  sprintf(cfg->json,"nk_benchmark.json");
+  sprintf(cfg->pcg_history,"nk_bench_pcg.txt");
+}
+/*--------------------------------------------------------------------------------*/
+static void parse_bench_params(const char *fname, BenchConfig *cfg)
+//the @bench_ options.  get_parameters reads the same file and will list these as ignored.
+{
+  char *line_in=read_all_stdin(fname);
+  assert(line_in);
+  int argc;
+  char **argv=create_argv_new(line_in,&argc," \n");
+  free(line_in);
+  int *found_list=(int *)calloc(argc,sizeof(int));
+  char *tok;
+
+  if ((tok=find_argument(argc,argv,"@bench_ndet",found_list)))
+    cfg->ndet=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_ndata",found_list)))
+    cfg->ndata=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_ntod",found_list)))
+    cfg->ntod=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_nrep",found_list)))
+    cfg->nrep=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_srate",found_list)))
+    cfg->srate=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_throw",found_list)))
+    cfg->az_throw=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_speed",found_list)))
+    cfg->az_speed=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_elev",found_list)))
+    cfg->elev=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_cut_frac",found_list)))
+    cfg->cut_frac=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_cut_len",found_list)))
+    cfg->cut_len=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_knee",found_list)))
+    cfg->knee=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_alpha",found_list)))
+    cfg->alpha=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_white",found_list)))
+    cfg->white=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_hwp_freq",found_list)))
+    cfg->hwp_freq=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_nharm",found_list)))
+    cfg->nharm=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_eig_rank",found_list)))
+    cfg->eig_rank=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_eig_tol",found_list)))
+    cfg->eig_tol=atof(tok);
+  if ((tok=find_argument(argc,argv,"@bench_polmap_nrep",found_list)))
+    cfg->polmap_nrep=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_dir",found_list)))
+    strncpy(cfg->dir,tok,MAXLEN-1);
+  if ((tok=find_argument(argc,argv,"@bench_label",found_list)))
+    strncpy(cfg->label,tok,MAXLEN-1);
+  if ((tok=find_argument(argc,argv,"@bench_json",found_list)))
+    strncpy(cfg->json,tok,MAXLEN-1);
+  if ((tok=find_argument(argc,argv,"@bench_pcg_niter",found_list)))
+    cfg->pcg_niter=atoi(tok);
+  if ((tok=find_argument(argc,argv,"@bench_pcg_history",found_list)))
+    strncpy(cfg->pcg_history,tok,MAXLEN-1);
+  if ((tok=find_argument(argc,argv,"@bench_pcg_reference",found_list)))
+    strncpy(cfg->pcg_reference,tok,MAXLEN-1);
+
+  free(found_list);
+  free_argv(argc,argv);
+
+  assert(cfg->ndet>0);
+  assert(cfg->ndet<=BENCH_NCOL_MAX*BENCH_NROW_MAX);
+  assert(cfg->ndata>1);
+  assert(cfg->ntod>0);
+  assert(cfg->ntod<=MAXTOD);
+  assert(cfg->nrep>0);
+  assert(cfg->cut_len>0);
+  assert(cfg->nharm>=0);
+  assert(cfg->eig_rank>=0);
+  assert(cfg->pcg_niter>=0);
+  printf("benchmarking %d TODs of %d detectors x %d samples, %d repetitions, data in %s\n",cfg->ntod,cfg->ndet,cfg->ndata,cfg->nrep,cfg->dir);
+  printf("actData is %s (%d bytes) in this build.\n",BENCH_ACTDATA_NAME,(int)sizeof(actData));
+}
+/*--------------------------------------------------------------------------------*/
+static inline uint32_t bench_rand(uint32_t *state)
+//xorshift, plenty for placing cuts and it's the same everywhere.
+{
+  uint32_t x=*state;
+  x^=x<<13;
+  x^=x>>17;
+  x^=x<<5;
+  *state=x;
+  return x;
+}
+/*--------------------------------------------------------------------------------*/
+static int bench_ncol(const BenchConfig *cfg)
+{
+  return (cfg->ndet<BENCH_NCOL_MAX ? cfg->ndet : BENCH_NCOL_MAX);
+}
+/*--------------------------------------------------------------------------------*/
+static void get_bench_todname(const BenchConfig *cfg, int itod, char *name)
+//name has MAXLEN bytes, like the datanames it goes into.
+{
+  int n=snprintf(name,MAXLEN,"%s/tod_%04d",cfg->dir,itod);
+  assert((n>0)&&(n<MAXLEN));
+}
+/*--------------------------------------------------------------------------------*/
+static void write_bench_channel(const char *todname, const char *field, const void *data, size_t nbytes)
+{
+  char fname[2*MAXLEN];
+  sprintf(fname,"%s/%s",todname,field);
+  FILE *outfile=fopen(fname,"w");
+  if (!outfile) {
+    fprintf(stderr,"Unable to open %s for writing.\n",fname);
+    assert(1==0);
+  }
+  size_t nwrite=fwrite(data,1,nbytes,outfile);
+  assert(nwrite==nbytes);
+  fclose(outfile);
+}
+/*--------------------------------------------------------------------------------*/
+static void write_bench_dirfile(const BenchConfig *cfg, int itod)
+//scan and timing fields plus all-zero detector channels; the noise gets filled in once the
+//TOD has been read back in.  TODs follow on from each other in time, so the sky drifts.
+{
+  char todname[MAXLEN];
+  get_bench_todname(cfg,itod,todname);
+  mkdir(todname,0755);
+
+  int n=cfg->ndata;
+  float *az=(float *)malloc(sizeof(float)*n);
+  float *el=(float *)malloc(sizeof(float)*n);
+  uint32_t *sec=(uint32_t *)malloc(sizeof(uint32_t)*n);
+  uint32_t *usec=(uint32_t *)malloc(sizeof(uint32_t)*n);
+  double period=2*cfg->az_throw/cfg->az_speed;
+  double t0=BENCH_CTIME0+(double)itod*n/cfg->srate;
+  for (int i=0;i<n;i++) {
+    double t=i/cfg->srate;
+    double phase=fmod(t/period,1.0);
+    double tri=(phase<0.5 ? 4*phase-1 : 3-4*phase);
+    az[i]=0.5*cfg->az_throw*tri-180.0;  //the reader adds 180 back on
+    el[i]=cfg->elev;
+    double ct=t0+t;
+    sec[i]=(uint32_t)floor(ct);
+    usec[i]=(uint32_t)((ct-floor(ct))*1e6);
+  }
+  write_bench_channel(todname,"Enc_Az_Deg",az,sizeof(float)*n);
+  write_bench_channel(todname,"Enc_El_Deg",el,sizeof(float)*n);
+  write_bench_channel(todname,"cpu_s",sec,sizeof(uint32_t)*n);
+  write_bench_channel(todname,"cpu_us",usec,sizeof(uint32_t)*n);
+
+  char fname[2*MAXLEN];
+  sprintf(fname,"%s/format",todname);
+  FILE *format=fopen(fname,"w");
+  assert(format);
+  fprintf(format,"Enc_Az_Deg RAW f 1\nEnc_El_Deg RAW f 1\ncpu_s RAW U 1\ncpu_us RAW U 1\n");
+  float *zeros=(float *)calloc(n,sizeof(float));
+  int ncol=bench_ncol(cfg);
+  for (int det=0;det<cfg->ndet;det++) {
+    char field[32];
+    sprintf(field,"tesdatar%02dc%02d",det/ncol,det%ncol);
+    fprintf(format,"%s RAW f 1\n",field);
+    write_bench_channel(todname,field,zeros,sizeof(float)*n);
+  }
+  fclose(format);
+
+  free(zeros);
+  free(az);
+  free(el);
+  free(sec);
+  free(usec);
+}
+/*--------------------------------------------------------------------------------*/
+static void get_bench_pointing_name(const BenchConfig *cfg, char *fname)
+//fname has MAXLEN bytes, like params.pointing_file.
+{
+  int n=snprintf(fname,MAXLEN,"%s/pointing_offsets.txt",cfg->dir);
+  assert((n>0)&&(n<MAXLEN));
+}
+/*--------------------------------------------------------------------------------*/
+static void write_bench_pointing(const BenchConfig *cfg)
+//a square grid of detectors centred on the boresight.
+{
+  char fname[MAXLEN];
+  get_bench_pointing_name(cfg,fname);
+  int ncol=bench_ncol(cfg);
+  int nrow=(cfg->ndet+ncol-1)/ncol;
+  FILE *outfile=fopen(fname,"w");
+  assert(outfile);
+  fprintf(outfile,"nrow = %d ncol = %d fitType = 0 0 0\n",nrow,ncol);
+  for (int row=0;row<nrow;row++)
+    for (int col=0;col<ncol;col++)
+      fprintf(outfile,"%14.6e %14.6e\n",(row-0.5*(nrow-1))*BENCH_DET_SPACING,(col-0.5*(ncol-1))*BENCH_DET_SPACING);
+  fclose(outfile);
+}
+/*--------------------------------------------------------------------------------*/
+static void fill_bench_noise(mbTOD *tod, const BenchConfig *cfg)
+//put 1/f noise into a TOD's (zeroed) channels and write it back out.  Each TOD belongs to
+//exactly one process, so nobody else is writing these files.
+{
+  read_tod_data(tod);
+  set_tod_noise(tod,cfg->white,cfg->knee,cfg->alpha);
+  add_noise_to_tod_new(tod);
+  destroy_tod_noise(tod);
+
+  float *chan=(float *)malloc(sizeof(float)*tod->ndata);
+  for (int det=0;det<tod->ndet;det++) {
+    char field[32];
+    sprintf(field,"tesdatar%02dc%02d",tod->rows[det],tod->cols[det]);
+    for (int i=0;i<tod->ndata;i++)
+      chan[i]=tod->data[det][i];
+    write_bench_channel(tod->dirfile,field,chan,sizeof(float)*tod->ndata);
+  }
+  free(chan);
+  free_tod_storage(tod);
+}
+/*--------------------------------------------------------------------------------*/
+static void add_bench_cuts(mbTOD *tod, const BenchConfig *cfg)
+//cut_frac of each detector's samples, in randomly placed chunks of cut_len.
+{
+  int ncut=(int)(cfg->cut_frac*tod->ndata/cfg->cut_len+0.5);
+  if ((ncut==0)||(cfg->cut_len>=tod->ndata))
+    return;
+  for (int det=0;det<tod->ndet;det++) {
+    uint32_t state=(uint32_t)(tod->seed+det+1);
+    for (int i=0;i<ncut;i++) {
+      int first=bench_rand(&state)%(tod->ndata-cfg->cut_len);
+      mbCutsExtend(tod->cuts,first,first+cfg->cut_len-1,tod->rows[det],tod->cols[det]);
+    }
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static void setup_bench_band_noise(mbTOD *tod, int eig_rank, actData eig_tol)
+//a three-band model: correlated low and mid bands with their own rotations, and an
+//uncorrelated top band.  eig_rank>0 only solves for that many modes of the rotations.
+{
+  actData nyquist=0.5/tod->deltat;
+  actData bands[4]={0,0.5,4.0,2*nyquist};
+  bool do_rots[3]={true,true,false};
+  mbNoiseType types[3]={MBNOISE_INTERP,MBNOISE_INTERP,MBNOISE_CONSTANT};
+  allocate_tod_noise_bands(tod,bands,3);
+  set_banded_noise_eig_rank(tod,eig_rank,eig_tol);
+  get_simple_banded_noise_model(tod,do_rots,types);
+}
+/*--------------------------------------------------------------------------------*/
+static void destroy_bench_band_noise(mbTOD *tod)
+{
+  mbNoiseVectorStructBands *noise=tod->band_noise;
+  if (!noise)
+    return;
+  for (int band=0;band<noise->nband;band++) {
+    for (int det=0;det<noise->ndet;det++)
+      if (noise->noise_params[band][det].noise_data)
+	free(noise->noise_params[band][det].noise_data);
+    free(noise->noise_params[band]);
+    if (noise->rot_mats[band])
+      free_matrix(noise->rot_mats[band]);  //inv_rot_mats_transpose points at the same matrix
+  }
+  free(noise->noise_params);
+  free(noise->rot_mats);
+  free(noise->inv_rot_mats_transpose);
+  free(noise->do_rotations);
+  free(noise->bands);
+  free(noise->ibands);
+  free(noise);
+  tod->band_noise=NULL;
+}
+/*--------------------------------------------------------------------------------*/
+static void time_bench_demod(mbTOD *tod, const BenchConfig *cfg, double *times)
+//a round trip through the HWP demodulation with a synthetic, constant-speed HWP angle.
+{
+#ifdef ACTPOL
+  bool own_hwp=(tod->hwp==NULL);
+  if (own_hwp) {
+    tod->hwp=vector(tod->ndata);
+    for (int i=0;i<tod->ndata;i++)
+      tod->hwp[i]=fmod(2*M_PI*cfg->hwp_freq*tod->deltat*i,2*M_PI);
+  }
+  DemodData *demod=init_demod_data(tod,cfg->hwp_freq,0,0,0,0);
+  if (cfg->nharm>0) {
+    actData *freqs=vector(cfg->nharm);
+    for (int i=0;i<cfg->nharm;i++)
+      freqs[i]=2*(i+1);
+    set_demod_freqs(demod,freqs,cfg->nharm);
+    free(freqs);
+  }
+
+  double t0=omp_get_wtime();
+  demodulate_data(tod,demod);
+  double t1=omp_get_wtime();
+  times[BENCH_DEMOD]+=t1-t0;
+
+  remodulate_data(tod,demod);
+  t0=omp_get_wtime();
+  times[BENCH_REMOD]+=t0-t1;
+
+  destroy_demod_data(demod);
+  if (own_hwp) {
+    free(tod->hwp);
+    tod->hwp=NULL;
+  }
+#endif
+}
+/*--------------------------------------------------------------------------------*/
+static void time_bench_polmap(MAP *map, mbTOD *tod, PARAMS *params, const BenchConfig *cfg)
+//benchmark_polmap_kernels on an IQU copy of the map.  The synthetic TODs have no polarization
+//angles, so each detector gets a fixed one plus a slow drift, and the pointing gets saved the
+//way the pol kernels need it.
+{
+#ifdef ACTPOL
+  if (cfg->polmap_nrep<=0)
+    return;
+  if (map->footprint) {
+    printf("skipping the polarized kernels, they need a whole map.\n");
+    return;
+  }
+  MAP *polmap=make_map_copy(map);
+  int iqu[MAX_NPOL]={1,1,1,0,0,0};
+  set_map_polstate(polmap,iqu);
+  long nelem=polmap->npix*get_npol_in_map(polmap);
+  for (long i=0;i<nelem;i++)
+    polmap->map[i]=sin(0.01*i);
+
+  read_tod_data(tod);
+  if (!tod->uncuts)
+    get_tod_uncut_regions(tod);
+  bool own_gamma=(tod->twogamma_saved==NULL);
+  if (own_gamma) {
+    tod->twogamma_saved=matrix(tod->ndet,tod->ndata);
+    for (int det=0;det<tod->ndet;det++)
+      for (int i=0;i<tod->ndata;i++)
+	tod->twogamma_saved[det][i]=2*(M_PI*det/tod->ndet+1e-4*i*tod->deltat);
+  }
+  bool own_pix=((tod->pixelization_saved==NULL)&&(tod->pixelization_packed==NULL));
+  if (own_pix)
+    save_tod_projection(polmap,tod,params);
+  benchmark_polmap_kernels(polmap,tod,cfg->polmap_nrep);
+
+  if (own_pix)
+    free_tod_pixelization_saved(tod);
+  if (own_gamma) {
+    free_tod_polangles(tod);  //save_tod_projection may have cached the synthetic angles
+    free_matrix(tod->twogamma_saved);
+    tod->twogamma_saved=NULL;
+  }
+  free_tod_storage(tod);
+  destroy_map(polmap);
+#endif
+}
+/*--------------------------------------------------------------------------------*/
+static void time_tod_stages(MAPvec *maps, MAPvec *scratch, TODvec *tods, PARAMS *params, const BenchConfig *cfg, double *times)
+//everything that happens to one TOD inside an iteration, plus the noise model setup.  Stages
+//that change the data run on whatever the previous stage left, as in the mapper.
+{
+  for (int i=0;i<tods->ntod;i++) {
+    mbTOD *tod=&(tods->tods[i]);
+    if (tod->noise)
+      destroy_tod_noise(tod);
+    double t0=omp_get_wtime();
+    read_tod_data(tod);
+    double t1=omp_get_wtime();
+    times[BENCH_READ]+=t1-t0;
+
+    remove_common_mode(tod,params);
+    t0=omp_get_wtime();
+    times[BENCH_COMMON]+=t0-t1;
+
+    tod->noise=nkFitTODNoise(tod,MBNOISE_LINEAR_POWLAW,0.5,80,-1.0);
+    t1=omp_get_wtime();
+    times[BENCH_FIT_POWLAW]+=t1-t0;
+
+    filter_data(tod);
+    t0=omp_get_wtime();
+    times[BENCH_FILTER]+=t0-t1;
+
+    apply_noise(tod);
+    t1=omp_get_wtime();
+    times[BENCH_APPLY_POWLAW]+=t1-t0;
+
+    setup_bench_band_noise(tod,0,0);
+    t0=omp_get_wtime();
+    times[BENCH_FIT_BANDED]+=t0-t1;
+
+    if (cfg->eig_rank>0) {
+      mbNoiseVectorStructBands *dense=tod->band_noise;
+      setup_bench_band_noise(tod,cfg->eig_rank,cfg->eig_tol);
+      t1=omp_get_wtime();
+      times[BENCH_FIT_BANDED_TOPK]+=t1-t0;
+      destroy_bench_band_noise(tod);
+      tod->band_noise=dense;
+      t0=omp_get_wtime();
+    }
+
+    apply_noise(tod);
+    t1=omp_get_wtime();
+    times[BENCH_APPLY_BANDED]+=t1-t0;
+    destroy_bench_band_noise(tod);
+
+    time_bench_demod(tod,cfg,times);
+
+    t0=omp_get_wtime();
+    mapset2tod(maps,tod,params);
+    t1=omp_get_wtime();
+    times[BENCH_MAP2TOD]+=t1-t0;
+
+    tod2mapset(scratch,tod,params);
+    t0=omp_get_wtime();
+    times[BENCH_TOD2MAP]+=t0-t1;
+
+    free_tod_storage(tod);
+    destroy_tod_noise(tod);
+  }
+}
+/*--------------------------------------------------------------------------------*/
+static double time_pcg_steps(MAPvec *maps, MAPvec *weights, TODvec *tods, PARAMS *params, int niter, double *resid)
+//niter iterations from the start of a solve, set up the way run_PCG does it.  resid, if not
+//NULL, gets the residual PCGstep reports after each one.
+{
+  MAPvec *r=make_mapset_copy(maps);
+  MAPvec *p=make_mapset_copy(maps);
+  MAPvec *x=make_mapset_copy(maps);
+  clear_mapset(x);
+  PCGWorkspace *ws=allocate_pcg_workspace(maps);
+  apply_preconditioner(p,weights,params);
+  if (params->mg_levels>0)
+    ws->coarse=setup_coarse_space(maps,weights,params);
+#ifdef HAVE_MPI
+  MPI_Barrier(MPI_COMM_WORLD);
+#endif
+  double t0=omp_get_wtime();
+  for (int iter=0;iter<niter;iter++) {
+    double residual=PCGstep(r,p,x,tods,weights,params,ws);
+    if (resid)
+      resid[iter]=residual;
+  }
+  double dt=omp_get_wtime()-t0;
+  destroy_pcg_workspace(ws);
+  destroy_mapset(r);
+  destroy_mapset(p);
+  destroy_mapset(x);
+  return dt;
+}
+/*--------------------------------------------------------------------------------*/
+static int read_bench_pcg_history(const char *fname, double *resid, int nmax, char *actdata)
+//returns how many iterations fname has, up to nmax, or -1 if it can't be read.  actdata gets the
+//build it came from.
+{
+  FILE *infile=fopen(fname,"r");
+  if (!infile) {
+    fprintf(stderr,"Unable to open %s for reading.\n",fname);
+    return -1;
+  }
+  char line[MAXLEN];
+  int n=0;
+  sprintf(actdata,"unknown");
+  while ((n<nmax)&&(fgets(line,MAXLEN,infile))) {
+    if (line[0]=='#') {
+      sscanf(line,"# actData %15s",actdata);
+      continue;
+    }
+    int iter;
+    double residual;
+    if (sscanf(line,"%d %lf",&iter,&residual)==2)
+      resid[n++]=residual;
+  }
+  fclose(infile);
+  return n;
+}
+/*--------------------------------------------------------------------------------*/
+static void write_bench_pcg_history(const BenchConfig *cfg, const double *resid, double dt)
+//each iteration's residual and its ratio to the first, plus the same for the reference run
+//next to it if there is one.
+{
+  FILE *outfile=fopen(cfg->pcg_history,"w");
+  if (!outfile)
+    fprintf(stderr,"Unable to open %s for writing, only printing the residual history.\n",cfg->pcg_history);
+  else {
+    fprintf(outfile,"# actData %s\n",BENCH_ACTDATA_NAME);
+    fprintf(outfile,"# ndet %d ndata %d ntod %d, %d iterations in %.5f seconds\n",cfg->ndet,cfg->ndata,cfg->ntod,cfg->pcg_niter,dt);
+    for (int i=0;i<cfg->pcg_niter;i++)
+      fprintf(outfile,"%d %.10e %.10e\n",i+1,resid[i],resid[i]/resid[0]);
+    fclose(outfile);
+    printf("wrote PCG residual history to %s\n",cfg->pcg_history);
+  }
+
+  double *ref=(double *)calloc(cfg->pcg_niter,sizeof(double));
+  char ref_actdata[16];
+  int nref=0;
+  if (strlen(cfg->pcg_reference)>0)
+    nref=read_bench_pcg_history(cfg->pcg_reference,ref,cfg->pcg_niter,ref_actdata);
+  printf("PCG residuals, %d iterations in %.5f seconds with actData %s\n",cfg->pcg_niter,dt,BENCH_ACTDATA_NAME);
+  if (nref>0) {
+    printf("%5s %16s %16s %16s %12s\n","iter","this |r|/|r0|","reference","reference build","ratio");
+    for (int i=0;i<cfg->pcg_niter;i++) {
+      if (i<nref)
+	printf("%5d %16.6e %16.6e %16s %12.5f\n",i+1,resid[i]/resid[0],ref[i]/ref[0],ref_actdata,(resid[i]/resid[0])/(ref[i]/ref[0]));
+      else
+	printf("%5d %16.6e\n",i+1,resid[i]/resid[0]);
+    }
+  }
+  else {
+    printf("%5s %16s %16s\n","iter","residual","|r|/|r0|");
+    for (int i=0;i<cfg->pcg_niter;i++)
+      printf("%5d %16.6e %16.6e\n",i+1,resid[i],resid[i]/resid[0]);
+  }
+  free(ref);
+}
+/*--------------------------------------------------------------------------------*/
+static int compare_bench_doubles(const void *a, const void *b)
+{
+  double aa=*(const double *)a;
+  double bb=*(const double *)b;
+  return (aa>bb)-(aa<bb);
+}
+/*--------------------------------------------------------------------------------*/
+static void write_bench_report(const BenchConfig *cfg, double **times, int nproc)
+//a table to stdout and the same numbers as JSON.  Throughput is detector-samples per second
+//over the whole run, using the best repetition.
+{
+  FILE *outfile=fopen(cfg->json,"w");
+  if (!outfile)
+    fprintf(stderr,"Unable to open %s for writing, only printing results.\n",cfg->json);
+  double nsamp=(double)cfg->ntod*cfg->ndet*cfg->ndata;
+  if (outfile) {
+    fprintf(outfile,"{\n  \"label\": \"%s\",\n  \"actdata\": \"%s\",\n",cfg->label,BENCH_ACTDATA_NAME);
+    fprintf(outfile,"  \"config\": {\"ndet\": %d, \"ndata\": %d, \"ntod\": %d, \"nrep\": %d, \"nproc\": %d, \"nthread\": %d, \"actdata_bytes\": %d,\n",
+	    cfg->ndet,cfg->ndata,cfg->ntod,cfg->nrep,nproc,omp_get_max_threads(),(int)sizeof(actData));
+    fprintf(outfile,"             \"srate\": %g, \"az_throw\": %g, \"az_speed\": %g, \"elev\": %g, \"cut_frac\": %g, \"cut_len\": %d, \"knee\": %g, \"alpha\": %g, \"white\": %g,\n",
+	    cfg->srate,cfg->az_throw,cfg->az_speed,cfg->elev,cfg->cut_frac,cfg->cut_len,cfg->knee,cfg->alpha,cfg->white);
+    fprintf(outfile,"             \"hwp_freq\": %g, \"nharm\": %d, \"eig_rank\": %d, \"eig_tol\": %g},\n",cfg->hwp_freq,cfg->nharm,cfg->eig_rank,cfg->eig_tol);
+    fprintf(outfile,"  \"stages\": [\n");
+  }
+  printf("%-22s %12s %12s %12s %14s\n","stage","min (s)","median (s)","max (s)","Msamples/s");
+  double *sorted=(double *)malloc(sizeof(double)*cfg->nrep);
+  for (int stage=0;stage<BENCH_NSTAGE;stage++) {
+    memcpy(sorted,times[stage],sizeof(double)*cfg->nrep);
+    qsort(sorted,cfg->nrep,sizeof(double),compare_bench_doubles);
+    double tmin=sorted[0];
+    double tmax=sorted[cfg->nrep-1];
+    double tmed=(cfg->nrep%2 ? sorted[cfg->nrep/2] : 0.5*(sorted[cfg->nrep/2-1]+sorted[cfg->nrep/2]));
+    double rate=(tmin>0 ? nsamp/tmin/1e6 : 0);
+    printf("%-22s %12.5f %12.5f %12.5f %14.3f\n",bench_stage_names[stage],tmin,tmed,tmax,rate);
+    if (outfile) {
+      fprintf(outfile,"    {\"name\": \"%s\", \"min\": %.6e, \"median\": %.6e, \"max\": %.6e, \"msamples_per_sec\": %.6e, \"times\": [",
+	      bench_stage_names[stage],tmin,tmed,tmax,rate);
+      for (int rep=0;rep<cfg->nrep;rep++)
+	fprintf(outfile,"%s%.6e",(rep ? ", " : ""),times[stage][rep]);
+      fprintf(outfile,"]}%s\n",(stage<BENCH_NSTAGE-1 ? "," : ""));
+    }
+  }
+  free(sorted);
+  if (outfile) {
+    fprintf(outfile,"  ]\n}\n");
+    fclose(outfile);
+    printf("wrote benchmark results to %s\n",cfg->json);
+  }
+}
+/*================================================================================*/
+
+int main(int argc, char *argv[])
+{
+  TODvec tods;
+  MAPvec maps;
+  PARAMS params;
+  BenchConfig cfg;
+  memset(&params,0,sizeof(PARAMS));
+  memset(&tods,0,sizeof(TODvec));
+  int myrank=0;
+  int nproc=1;
+
+#ifdef HAVE_MPI
+  MPI_Init(&argc,&argv);
+  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
+  MPI_Comm_rank(MPI_COMM_WORLD,&myrank);
+#endif
+  if (argc!=2) {
+    if (myrank==0)
+      fprintf(stderr,"usage: %s parameter_file\n",argv[0]);
+#ifdef HAVE_MPI
+    MPI_Finalize();
+#endif
+    exit(EXIT_FAILURE);
+  }
+
+  if (myrank==0) {
+    set_bench_defaults(&cfg);
+    parse_bench_params(argv[1],&cfg);
+  }
+#ifdef HAVE_MPI
+  MPI_Bcast(&cfg,sizeof(BenchConfig),MPI_CHAR,0,MPI_COMM_WORLD);
+#endif
+  get_parameters(argc,argv,&params);
+
+  //the master lays out the dirfiles, then each TOD's owner fills in its noise.
+  if (myrank==0) {
+    mkdir(cfg.dir,0755);
+    for (int i=0;i<cfg.ntod;i++)
+      write_bench_dirfile(&cfg,i);
+    write_bench_pointing(&cfg);
+  }
+#ifdef HAVE_MPI
+  MPI_Barrier(MPI_COMM_WORLD);
+#endif
+  params.ntod=cfg.ntod;
+  for (int i=0;i<cfg.ntod;i++)
+    get_bench_todname(&cfg,i,params.datanames[i]);
+  get_bench_pointing_name(&cfg,params.pointing_file);
+
+  tods.total_tod=how_many_tods(tods.froot,&params);
+  find_my_tods(&tods,&params);
+  read_all_tod_headers(&tods,&params);
+  set_global_radec_lims(&tods);
+  createFFTWplans(&tods);
+  for (int i=0;i<tods.ntod;i++) {
+    fill_bench_noise(&(tods.tods[i]),&cfg);
+    add_bench_cuts(&(tods.tods[i]),&cfg);
+  }
+#ifdef HAVE_MPI
+  MPI_Barrier(MPI_COMM_WORLD);
+#endif
+
+  //maps.maps points at mapvec, so it lives as long as main does.
+  maps.nmap=1;
+  MAP *mapvec=(MAP *)malloc(maps.nmap*sizeof(MAP));
+  for (int i=0;i<maps.nmap;i++) {
+    mapvec[i].projection=(nkProjection *)malloc(sizeof(nkProjection));
+    mapvec[i].projection->proj_type=NK_RECT;
+    mapvec[i].have_locks=0;
+    mapvec[i].footprint=NULL;
+  }
+  maps.maps=&mapvec;
+  maps.maps[0]->pixsize=params.pixsize;
+  maps.maps[0]->ramin=tods.ramin;
+  maps.maps[0]->ramax=tods.ramax;
+  maps.maps[0]->decmin=tods.decmin;
+  maps.maps[0]->decmax=tods.decmax;
+  setup_maps(&maps,&params);
+  clear_mapset(&maps);
+
+  double **times=(double **)malloc(sizeof(double *)*BENCH_NSTAGE);
+  times[0]=(double *)calloc(BENCH_NSTAGE*cfg.nrep,sizeof(double));
+  for (int i=1;i<BENCH_NSTAGE;i++)
+    times[i]=times[0]+i*cfg.nrep;
+
+  double t_run=omp_get_wtime();
+  nk_profile_reset(strlen(params.profile_file)>0);
+  MAPvec *scratch=make_mapset_copy(&maps);
+  MAPvec *weights=NULL;
+  double mytimes[BENCH_NSTAGE];
+  for (int rep=0;rep<cfg.nrep;rep++) {
+    memset(mytimes,0,sizeof(mytimes));
+    clear_mapset(scratch);
+    time_tod_stages(&maps,scratch,&tods,&params,&cfg,mytimes);
+
+#ifdef HAVE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    clear_mapset(&maps);
+    double t0=omp_get_wtime();
+    make_initial_mapset(&maps,&tods,&params);
+    mytimes[BENCH_INITIAL]=omp_get_wtime()-t0;
+
+    if (!weights) {
+      weights=make_mapset_copy(&maps);
+      get_weights(weights,&tods,&params);
+    }
+    mytimes[BENCH_PCG]=time_pcg_steps(&maps,weights,&tods,&params,1,NULL);
+
+    //the slowest process is what everyone ends up waiting for.
+#ifdef HAVE_MPI
+    double maxtimes[BENCH_NSTAGE];
+    MPI_Allreduce(mytimes,maxtimes,BENCH_NSTAGE,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+    memcpy(mytimes,maxtimes,sizeof(mytimes));
+#endif
+    for (int i=0;i<BENCH_NSTAGE;i++)
+      times[i][rep]=mytimes[i];
+    mprintf(stdout,"finished benchmark repetition %d of %d\n",rep+1,cfg.nrep);
+  }
+  if (strlen(params.profile_file)>0)
+    nk_profile_report(&params,omp_get_wtime()-t_run);
+
+  //maps still holds the last repetition's right hand side.
+  double *resid=NULL;
+  double dt_pcg=0;
+  if (cfg.pcg_niter>0) {
+    resid=(double *)calloc(cfg.pcg_niter,sizeof(double));
+    dt_pcg=time_pcg_steps(&maps,weights,&tods,&params,cfg.pcg_niter,resid);
+  }
+
+  if (myrank==0) {
+    write_bench_report(&cfg,times,nproc);
+    if (resid)
+      write_bench_pcg_history(&cfg,resid,dt_pcg);
+    if (tods.ntod>0)
+      time_bench_polmap(maps.maps[0],&(tods.tods[0]),&params,&cfg);
+  }
+
+  destroy_mapset(scratch);
+  destroy_mapset(weights);
+  if (resid)
+    free(resid);
+  free(times[0]);
+  free(times);
+#ifdef HAVE_MPI
+  MPI_Finalize();
+#endif
+  return 0;
+}
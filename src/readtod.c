@@ -11,9 +11,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <omp.h>
 
 #include "readtod.h"
 
@@ -22,6 +24,8 @@
 //#include "actpol/dirfile.h"
 //#include "actpol/getdata.h"
 
+#include "dirfile_batch.h"
+
 void *ACTpolDirfile_read_channel( char typechar, const ACTpolDirfile *dirfile,
 			    const char *channelname, int *nsamples_out );
 
@@ -453,8 +457,8 @@ void decimate_vector_in_place(actData *vec, int *nn) //shrink a vector by a fact
   int n=*nn;
   int n2=(n+1)/2;  //round up if we are odd
 
-  actData tmp0=0.25*(vec[0]+2*vec[1]*vec[2]);
-  actData tmp1=0.25*(vec[2]+2*vec[3]*vec[4]);
+  actData tmp0=0.25*(vec[0]+2*vec[1]+vec[2]);
+  actData tmp1=0.25*(vec[2]+2*vec[3]+vec[4]);
   for (int i=2;i<n2-1;i++) {
     int ii=2*i;
     vec[i]=0.25*(vec[ii]+2*vec[ii+1]+vec[ii+2]);
@@ -670,68 +674,348 @@ actData *many_dirfile_read_actData_channel(ManyFormatType *fmt, char *channame,
 
 // ----------------------------------------------------------------------------
 
-actData **read_dirfile_tod_data_from_rowcol_list (mbTOD *tod, int *row, int *col, int ndet, actData **data, int *nout)
-//if data is non-null, assume the space is allocated.
+typedef struct {
+  char name[64];
+  char type;
+  int spf;
+} RawFieldEntry;
+
+// ----------------------------------------------------------------------------
+
+static char raw_type_char(const char *s)
+//map a dirfile RAW type (old single-character or newer spelled-out form) onto the single-character code.
 {
-  
-  int status;
-  assert(tod!=NULL);
-  //printf("reading format from %s.\n",tod->dirfile);
-  ManyFormatType *format=GetManyFormat(tod->dirfile,NULL,&status);
-  
+  if (strlen(s)==1)
+    return s[0];
+  if (strcmp(s,"UINT8")==0)
+    return 'c';
+  if (strcmp(s,"INT16")==0)
+    return 's';
+  if (strcmp(s,"UINT16")==0)
+    return 'u';
+  if (strcmp(s,"INT32")==0)
+    return 'S';
+  if (strcmp(s,"UINT32")==0)
+    return 'U';
+  if ((strcmp(s,"FLOAT32")==0)||(strcmp(s,"FLOAT")==0))
+    return 'f';
+  if ((strcmp(s,"FLOAT64")==0)||(strcmp(s,"DOUBLE")==0))
+    return 'd';
+  return 0;
+}
 
-  //struct FormatType *format = GetFormat( tod->dirfile, NULL, &status );
-  //printf("got it.\n");
-  assert( format != NULL );
-  
+// ----------------------------------------------------------------------------
 
-  
-  if (data==NULL) {
-    actData *vec=(actData *)malloc(ndet*tod->ndata*sizeof(actData));
-    assert(vec!=NULL);
-    for (int i=0;i<ndet;i++)
-      data[i]=vec+i*tod->ndata;
+static size_t raw_type_size(char type)
+{
+  switch(type) {
+  case 'c':
+    return 1;
+  case 's':
+  case 'u':
+    return 2;
+  case 'S':
+  case 'U':
+  case 'i':
+  case 'f':
+    return 4;
+  case 'd':
+    return 8;
+  default:
+    return 0;
   }
-  
-  for (int idet=0;idet<ndet;idet++) {
-    assert(row[idet]<33);
-    assert(col[idet]<32);
-    char tesfield[]="tesdatar00c00";
-    sprintf(tesfield,"tesdatar%02dc%02d",row[idet],col[idet]);
-    int n;
+}
 
-    actData *chan=many_dirfile_read_actData_channel(format,tesfield,&n);
+// ----------------------------------------------------------------------------
 
-#ifndef ACTDATA_DOUBLE
-    //printf("reading float channel\n");
-    //actData *chan = dirfile_read_float_channel( format, tesfield, &n );
-#else
-    //printf("reading double channel\n");
-    //actData *chan = dirfile_read_double_channel( format, tesfield, &n );
-#endif
-    //printf("finished channel.\n");
-    for (int ii=0;ii<tod->decimate;ii++)
-      chan=decimate_vector(chan,&n);
-    if (n>tod->ndata) {
-#pragma omp critical 
-      {
-	static int firsttime=1;
-	if (firsttime) {
-	  firsttime=0;
-	  fprintf(stderr,"Warning - data is longer than the TOD.  You should be very nervous about this, unless you expected to see this message.\n");
+static bool is_unhandled_format_directive(const char *tok)
+//ENDIAN and FRAMEOFFSET change how the raw bytes map onto samples, and INCLUDE pulls in fields we
+//wouldn't see, so the mmap reader can't be trusted on format files with any of them.
+{
+  if (tok[0]=='/')
+    tok++;
+  return ((strcmp(tok,"ENDIAN")==0)||(strcmp(tok,"FRAMEOFFSET")==0)||(strcmp(tok,"INCLUDE")==0));
+}
+
+// ----------------------------------------------------------------------------
+
+static int read_dirfile_raw_format(const char *dirname, RawFieldEntry **entries_out)
+//Pull the RAW entries out of a plain (uncompressed) dirfile's format file.  Returns the number of
+//entries found, or 0 if there is no readable format file or it has a directive we don't handle,
+//in which case callers should use the library reader.
+{
+  *entries_out=NULL;
+  char fname[MAXLEN];
+  snprintf(fname,MAXLEN,"%s/format",dirname);
+  FILE *infile=fopen(fname,"r");
+  if (infile==NULL)
+    return 0;
+  int nalloc=1024,nentry=0;
+  RawFieldEntry *entries=(RawFieldEntry *)malloc(nalloc*sizeof(RawFieldEntry));
+  char line[MAXLEN];
+  while (fgets(line,MAXLEN,infile)) {
+    char name[MAXLEN],kind[MAXLEN],type[MAXLEN];
+    int spf;
+    if (line[0]=='#')
+      continue;
+    if ((sscanf(line,"%s",name)==1)&&(is_unhandled_format_directive(name))) {
+      nentry=0;
+      break;
+    }
+    if (sscanf(line,"%s %s %s %d",name,kind,type,&spf)!=4)
+      continue;
+    if (strcmp(kind,"RAW")!=0)
+      continue;
+    if (strlen(name)>=sizeof(entries[0].name))
+      continue;
+    if (raw_type_size(raw_type_char(type))==0)
+      continue;
+    if (nentry==nalloc) {
+      nalloc*=2;
+      entries=(RawFieldEntry *)realloc(entries,nalloc*sizeof(RawFieldEntry));
+    }
+    strcpy(entries[nentry].name,name);
+    entries[nentry].type=raw_type_char(type);
+    entries[nentry].spf=spf;
+    nentry++;
+  }
+  fclose(infile);
+  if (nentry==0) {
+    free(entries);
+    return 0;
+  }
+  *entries_out=entries;
+  return nentry;
+}
+
+// ----------------------------------------------------------------------------
+
+static void convert_raw_to_actdata(const void *raw, char type, long n, actData *dest)
+{
+  switch(type) {
+  case 'c':
+    for (long i=0;i<n;i++) dest[i]=((const uint8_t *)raw)[i];
+    break;
+  case 's':
+    for (long i=0;i<n;i++) dest[i]=((const int16_t *)raw)[i];
+    break;
+  case 'u':
+    for (long i=0;i<n;i++) dest[i]=((const uint16_t *)raw)[i];
+    break;
+  case 'S':
+  case 'i':
+    for (long i=0;i<n;i++) dest[i]=((const int32_t *)raw)[i];
+    break;
+  case 'U':
+    for (long i=0;i<n;i++) dest[i]=((const uint32_t *)raw)[i];
+    break;
+  case 'f':
+    for (long i=0;i<n;i++) dest[i]=((const float *)raw)[i];
+    break;
+  case 'd':
+    for (long i=0;i<n;i++) dest[i]=((const double *)raw)[i];
+    break;
+  default:
+    assert(1==0);  //read_dirfile_raw_format only lets through types we know.
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+static void *map_raw_channel(const char *dirname, const char *channame, size_t *nbyte)
+//mmap a raw channel file read-only.  Returns NULL if it isn't there as a plain file.
+{
+  char fname[MAXLEN];
+  snprintf(fname,MAXLEN,"%s/%s",dirname,channame);
+  int fd=open(fname,O_RDONLY);
+  if (fd<0)
+    return NULL;
+  struct stat st;
+  if ((fstat(fd,&st)!=0)||(st.st_size==0)) {
+    close(fd);
+    return NULL;
+  }
+  void *map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (map==MAP_FAILED)
+    return NULL;
+  madvise(map,st.st_size,MADV_SEQUENTIAL);
+  *nbyte=st.st_size;
+  return map;
+}
+
+// ----------------------------------------------------------------------------
+
+static void warn_data_longer_than_tod()
+{
+#pragma omp critical (readtod_warn)
+  {
+    static int firsttime=1;
+    if (firsttime) {
+      firsttime=0;
+      fprintf(stderr,"Warning - data is longer than the TOD.  You should be very nervous about this, unless you expected to see this message.\n");
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+static void finish_batched_channel(actData *chan, int n, int start_offset, int decimate, int ndata, actData *dest)
+//decimate a full-length channel in place and copy the part we keep into the TOD.
+{
+  for (int ii=0;ii<decimate;ii++)
+    decimate_vector_in_place(chan,&n);
+  if (n>ndata+start_offset)
+    warn_data_longer_than_tod();
+  else
+    assert(n==ndata+start_offset);
+  memcpy(dest,chan+start_offset,sizeof(actData)*ndata);
+}
+
+// ----------------------------------------------------------------------------
+
+size_t read_dirfile_channels_batched(const char *dirfile, char **channames, int nchan, int start_offset, int decimate, int ndata, actData **data, int *nout)
+//Read nchan channels straight into the rows of data, which must already be allocated to ndata each.
+//Plain dirfiles have their raw files mmapped and converted in parallel directly into data, with no
+//intermediate buffer unless we need to decimate.  Anything else (compressed dirfiles, derived
+//fields) is decoded in one batch with ACTpolDirfile_read_channels, which does the slim/zip
+//decompression of the channels in parallel.  Concatenated multi-file TODs still go one channel
+//at a time through the library.  Returns the number of bytes read off disk (or decoded).
+{
+  RawFieldEntry *entries=NULL;
+  int nentry=0;
+  bool multifile=(strchr(dirfile,'\n')!=NULL);
+  if (!multifile)
+    nentry=read_dirfile_raw_format(dirfile,&entries);
+  int *pending=(int *)malloc(nchan*sizeof(int));
+  int npending=0;
+  size_t nbyte_tot=0;
+
+#pragma omp parallel shared(dirfile,channames,nchan,start_offset,decimate,ndata,data,entries,nentry,pending,npending,nbyte_tot) default(none)
+  {
+    actData *scratch=NULL;
+    long nscratch=0;
+#pragma omp for schedule(dynamic,1) reduction(+:nbyte_tot)
+    for (int ichan=0;ichan<nchan;ichan++) {
+      const RawFieldEntry *entry=NULL;
+      for (int i=0;i<nentry;i++)
+	if (strcmp(entries[i].name,channames[ichan])==0) {
+	  entry=entries+i;
+	  break;
 	}
+      size_t nbyte=0;
+      void *map=NULL;
+      if (entry)
+	map=map_raw_channel(dirfile,channames[ichan],&nbyte);
+      if (map==NULL) {
+	int ii;
+#pragma omp atomic capture
+	ii=npending++;
+	pending[ii]=ichan;
+	continue;
+      }
+
+      size_t typesize=raw_type_size(entry->type);
+      int n=nbyte/typesize;
+      nbyte_tot+=nbyte;
+      if ((decimate==0)&&(start_offset+ndata<=n)) {
+	//common case - convert only the window we want, directly into the TOD.
+	convert_raw_to_actdata((const char *)map+start_offset*typesize,entry->type,ndata,data[ichan]);
+	if (n>start_offset+ndata)
+	  warn_data_longer_than_tod();
+	munmap(map,nbyte);
+	continue;
       }
+      if (n>nscratch) {
+	free(scratch);
+	nscratch=n;
+	scratch=(actData *)malloc(nscratch*sizeof(actData));
+	assert(scratch!=NULL);
+      }
+      convert_raw_to_actdata(map,entry->type,n,scratch);
+      munmap(map,nbyte);
+      finish_batched_channel(scratch,n,start_offset,decimate,ndata,data[ichan]);
+    }
+    free(scratch);
+  }
+
+  if (npending>0) {
+    actData **chans=(actData **)malloc(npending*sizeof(actData *));
+    int *nsamp=(int *)malloc(npending*sizeof(int));
+    if (!multifile) {
+      const char **names=(const char **)malloc(npending*sizeof(char *));
+      for (int i=0;i<npending;i++)
+	names[i]=channames[pending[i]];
+      ACTpolDirfile *format=ACTpolDirfile_open(dirfile);
+      assert(format!=NULL);
+#ifdef ACTDATA_DOUBLE
+      int nbad=ACTpolDirfile_read_channels('d',format,names,npending,(void **)chans,nsamp);
+#else
+      int nbad=ACTpolDirfile_read_channels('f',format,names,npending,(void **)chans,nsamp);
+#endif
+      assert(nbad==0);
+      ACTpolDirfile_close(format);
+      free(names);
     }
     else {
-      assert(n==tod->ndata);
-      *nout=n;
+      int status=0;
+      ManyFormatType *format=GetManyFormat((char *)dirfile,NULL,&status);
+      assert(format!=NULL);
+      for (int i=0;i<npending;i++) {
+	chans[i]=many_dirfile_read_actData_channel(format,channames[pending[i]],&nsamp[i]);
+	assert(chans[i]!=NULL);
+      }
+      FreeManyFormat(format);
     }
-    memcpy(data[idet],chan+tod->start_offset,sizeof(actData)*tod->ndata);
-    free(chan);
+    for (int i=0;i<npending;i++)
+      nbyte_tot+=nsamp[i]*sizeof(actData);
+#pragma omp parallel for schedule(dynamic,1) shared(chans,nsamp,npending,pending,start_offset,decimate,ndata,data) default(none)
+    for (int i=0;i<npending;i++) {
+      finish_batched_channel(chans[i],nsamp[i],start_offset,decimate,ndata,data[pending[i]]);
+      free(chans[i]);
+    }
+    free(chans);
+    free(nsamp);
+  }
+
+  free(pending);
+  if (entries)
+    free(entries);
+  *nout=ndata;
+  return nbyte_tot;
+}
+
+// ----------------------------------------------------------------------------
+
+actData **read_dirfile_tod_data_from_rowcol_list (mbTOD *tod, int *row, int *col, int ndet, actData **data, int *nout)
+//if data is non-null, assume the space is allocated.
+{
+  assert(tod!=NULL);
+  assert(ndet>=0);
+  if (data==NULL) {
+    data=(actData **)malloc(ndet*sizeof(actData *));
+    actData *vec=(actData *)malloc((size_t)ndet*tod->ndata*sizeof(actData));
+    assert((data!=NULL)&&(vec!=NULL));
+    for (int i=0;i<ndet;i++)
+      data[i]=vec+(size_t)i*tod->ndata;
+  }
+
+  char **channames=(char **)malloc(ndet*sizeof(char *));
+  char *namebuf=(char *)malloc(ndet*16);
+  for (int idet=0;idet<ndet;idet++) {
+    assert(row[idet]<33);
+    assert(col[idet]<32);
+    channames[idet]=namebuf+16*idet;
+    sprintf(channames[idet],"tesdatar%02dc%02d",row[idet],col[idet]);
   }
 
-  FreeManyFormat(format);
+  double t1=omp_get_wtime();
+  size_t nbyte=read_dirfile_channels_batched(tod->dirfile,channames,ndet,tod->start_offset,tod->decimate,tod->ndata,data,nout);
+  double dt=omp_get_wtime()-t1;
+  printf("read %d detectors (%.3f GB) in %.3f seconds, %.3f GB/s\n",ndet,nbyte/1e9,dt,(dt>0 ? nbyte/1e9/dt : 0.0));
 
+  free(namebuf);
+  free(channames);
   return data;
 }
 
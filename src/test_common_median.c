@@ -0,0 +1,142 @@
+//Check the tiled median common mode against the per-sample loop it replaced.  For each number of
+//detectors, the exact answer (sorting network up to MB_COMMON_NETWORK_MAX detectors, per-sample
+//selection above that) has to match mbCalculateCommonModeSlow exactly, and the approximate median
+//has to land close to the middle of each sample's values.  Build it against the ninkasi library
+//with something like
+//  mpicc -std=gnu99 -fopenmp -I../include test_common_median.c -L. -lninkasi ... -o test_common_median
+//and run as
+//  ./test_common_median [ndata]
+
+#ifndef MAKEFILE_HAND
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "ninkasi.h"
+#include "mbCommon.h"
+
+//the approximate median's rank, as a fraction of ndet, has to be this close to 0.5 on average...
+#define TEST_APPROX_MEAN_RANK_TOL 0.1
+//...and the worst sample can't fall into the outer fraction this big at either end.
+#define TEST_APPROX_WORST_RANK 0.15
+
+/*--------------------------------------------------------------------------------*/
+static mbNoiseCommonMode *make_test_fit(int ndet, int ndata, unsigned *seed)
+//just the parts of the common mode object mbCalculateCommonMode uses, filled with gaussian
+//noise plus a shared signal, and a few samples of ties.
+{
+  mbNoiseCommonMode *fit=(mbNoiseCommonMode *)calloc(1,sizeof(mbNoiseCommonMode));
+  fit->ndet=ndet;
+  fit->ndata=ndata;
+  fit->data=psAllocMatrix(ndet,ndata);
+  fit->common_mode=(actData *)psAlloc(ndata*sizeof(actData));
+  fit->have_data=true;
+  for (int j=0;j<ndet;j++)
+    for (int i=0;i<ndata;i++) {
+      actData u1=(rand_r(seed)+1.0)/(RAND_MAX+2.0);
+      actData u2=(rand_r(seed)+1.0)/(RAND_MAX+2.0);
+      fit->data[j][i]=sqrt(-2*log(u1))*cos(2*M_PI*u2)+sin(0.01*i);
+      if (i%97==0)
+	fit->data[j][i]=(actData)(j%3);
+    }
+  return fit;
+}
+/*--------------------------------------------------------------------------------*/
+static void free_test_fit(mbNoiseCommonMode *fit)
+{
+  psFree(fit->data[0]);
+  psFree(fit->data);
+  psFree(fit->common_mode);
+  free(fit);
+}
+/*--------------------------------------------------------------------------------*/
+static int check_ndet(int ndet, int ndata, unsigned *seed)
+//returns the number of problems found.
+{
+  int nbad=0;
+  mbNoiseCommonMode *fit=make_test_fit(ndet,ndata,seed);
+  actData *exact=(actData *)psAlloc(ndata*sizeof(actData));
+  actData *fast=(actData *)psAlloc(ndata*sizeof(actData));
+  actData *approx=(actData *)psAlloc(ndata*sizeof(actData));
+
+  //the per-sample loop reads off the front of the array for a single detector, whose median is just its data.
+  double t0=omp_get_wtime();
+  if (ndet>1)
+    mbCalculateCommonModeSlow(fit);
+  else
+    memcpy(fit->common_mode,fit->data[0],ndata*sizeof(actData));
+  double t1=omp_get_wtime();
+  memcpy(exact,fit->common_mode,ndata*sizeof(actData));
+  mbCalculateCommonMode(fit);
+  double t2=omp_get_wtime();
+  memcpy(fast,fit->common_mode,ndata*sizeof(actData));
+  fit->approx_median=true;
+  mbCalculateCommonMode(fit);
+  double t3=omp_get_wtime();
+  memcpy(approx,fit->common_mode,ndata*sizeof(actData));
+
+  int ndiff=0;
+  for (int i=0;i<ndata;i++)
+    if (fast[i]!=exact[i]) {
+      if (ndiff<5)
+	fprintf(stderr,"ndet %d sample %d: %s median %g but per-sample median %g.\n",ndet,i,
+		(ndet<=MB_COMMON_NETWORK_MAX ? "network" : "selection"),(double)fast[i],(double)exact[i]);
+      ndiff++;
+    }
+  nbad+=ndiff;
+
+  //where the approximate median falls among each sample's values.
+  double rank_sum=0,rank_worst=0.5,rms=0;
+  for (int i=0;i<ndata;i++) {
+    int nbelow=0,nabove=0;
+    for (int j=0;j<ndet;j++) {
+      if (fit->data[j][i]<approx[i])
+	nbelow++;
+      if (fit->data[j][i]>approx[i])
+	nabove++;
+    }
+    double lo=(double)nbelow/ndet;
+    double hi=1.0-(double)nabove/ndet;
+    double rank=(lo>0.5 ? lo : (hi<0.5 ? hi : 0.5));  //ties count as the middle if they straddle it
+    rank_sum+=fabs(rank-0.5);
+    if (fabs(rank-0.5)>fabs(rank_worst-0.5))
+      rank_worst=rank;
+    rms+=(approx[i]-exact[i])*(approx[i]-exact[i]);
+  }
+  double rank_mean=rank_sum/ndata;
+  rms=sqrt(rms/ndata);
+  if ((ndet>=3)&&((rank_mean>TEST_APPROX_MEAN_RANK_TOL)||(rank_worst<TEST_APPROX_WORST_RANK)||(rank_worst>1-TEST_APPROX_WORST_RANK))) {
+    fprintf(stderr,"ndet %d: approximate median is off by %.3f in rank on average, worst rank %.3f.\n",ndet,rank_mean,rank_worst);
+    nbad++;
+  }
+  printf("ndet %5d: slow %8.4f  exact %8.4f  approx %8.4f s, exact diffs %d, approx rms %.3e mean rank offset %.3f worst rank %.3f\n",
+	 ndet,t1-t0,t2-t1,t3-t2,ndiff,rms,rank_mean,rank_worst);
+
+  psFree(exact);
+  psFree(fast);
+  psFree(approx);
+  free_test_fit(fit);
+  return nbad;
+}
+/*================================================================================*/
+
+int main(int argc, char *argv[])
+{
+  int ndata=(argc>1 ? atoi(argv[1]) : 20000);
+  int ndets[]={1,2,3,5,17,32,63,64,65,200,1000};
+  int nbad=0;
+  unsigned seed=1;
+
+  for (int i=0;i<(int)(sizeof(ndets)/sizeof(ndets[0]));i++)
+    nbad+=check_ndet(ndets[i],ndata,&seed);
+
+  printf("%s: %d problems.\n",(nbad ? "FAILED" : "passed"),nbad);
+  return (nbad ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,164 @@
+//Check the range-array cuts against a plain per-sample mask: random global and detector cuts,
+//decimation, and more cuts on top of the decimated ones, with the ranges checked for being
+//sorted, disjoint and not touching after every step.  Build it against the ninkasi library
+//with something like
+//  mpicc -std=gnu99 -fopenmp -I../include test_cuts.c -L. -lninkasi ... -o test_cuts
+//and run as
+//  ./test_cuts [ndata] [ncut]
+
+#ifndef MAKEFILE_HAND
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ninkasi.h"
+#include "mbCuts.h"
+
+#define TEST_NROW 4
+#define TEST_NCOL 4
+
+/*--------------------------------------------------------------------------------*/
+static void mask_extend(char *mask, int ndata, int first, int last)
+{
+  if (first<0)
+    first=0;
+  for (int i=first;(i<=last)&&(i<ndata);i++)
+    mask[i]=1;
+}
+/*--------------------------------------------------------------------------------*/
+static void mask_decimate(char *mask, int ndata)
+//what mbCutsDecimate does to each range, [first,last] -> [first/2,(last+1)/2], done on the mask.
+{
+  char *half=(char *)calloc(ndata/2+1,1);
+  for (int i=0;i<ndata;i++)
+    if (mask[i]&&((i==0)||!mask[i-1])) {
+      int last=i;
+      while ((last+1<ndata)&&mask[last+1])
+	last++;
+      for (int j=i/2;j<=(last+1)/2;j++)
+	half[j]=1;
+    }
+  memcpy(mask,half,ndata/2+1);
+  memset(mask+ndata/2+1,0,ndata-ndata/2-1);
+  free(half);
+}
+/*--------------------------------------------------------------------------------*/
+static int check_cuts(const mbCuts *cuts, char **masks, const char *global, int ndata, const char *when)
+//ranges sorted and apart, and mbCutsIsCut/mbCutsGetRanges agree with the masks.
+{
+  int nbad=0;
+  mbCutRange *ranges=(mbCutRange *)malloc(sizeof(mbCutRange)*(ndata+1));
+  for (int row=0;row<TEST_NROW;row++)
+    for (int col=0;col<TEST_NCOL;col++) {
+      int slot=row*TEST_NCOL+col;
+      for (int pass=0;pass<2;pass++) {
+	int s=(pass ? MB_CUTS_GLOBAL_SLOT(cuts) : slot);
+	for (int i=1;i<cuts->ncut[s];i++)
+	  if ((long)cuts->ranges[s][i-1].indexLast+1>=cuts->ranges[s][i].indexFirst) {
+	    if (nbad<10)
+	      fprintf(stderr,"%s: slot %d ranges [%d,%d] and [%d,%d] meet.\n",when,s,cuts->ranges[s][i-1].indexFirst,cuts->ranges[s][i-1].indexLast,
+		      cuts->ranges[s][i].indexFirst,cuts->ranges[s][i].indexLast);
+	    nbad++;
+	  }
+      }
+      char *mask=(char *)calloc(ndata,1);
+      int n=mbCutsGetRanges(cuts,row,col,ranges);
+      assert(n==mbCutsGetNCut(cuts,row,col));
+      for (int i=0;i<n;i++)
+	mask_extend(mask,ndata,ranges[i].indexFirst,ranges[i].indexLast);
+      for (int i=0;i<ndata;i++) {
+	bool want=masks[slot][i]||global[i];
+	if ((mbCutsIsCut(cuts,row,col,i)!=want)||(mask[i]!=want)) {
+	  if (nbad<10)
+	    fprintf(stderr,"%s: detector %d %d sample %d should be %s.\n",when,row,col,i,(want ? "cut" : "uncut"));
+	  nbad++;
+	}
+      }
+      free(mask);
+    }
+  free(ranges);
+  return nbad;
+}
+/*--------------------------------------------------------------------------------*/
+static void add_random_cuts(mbCuts *cuts, char **masks, char *global, int ndata, int ncut, unsigned *seed)
+//mostly short cuts, close enough together that plenty of them touch.  They stay inside the
+//data so the masks can follow them through decimation.
+{
+  for (int i=0;i<ncut;i++) {
+    int first=rand_r(seed)%ndata-5;
+    int len=(rand_r(seed)%8==0 ? rand_r(seed)%200 : rand_r(seed)%4);
+    if (first+len>=ndata)
+      len=ndata-1-first;
+    if (rand_r(seed)%20==0) {
+      mbCutsExtendGlobal(cuts,first,first+len);
+      mask_extend(global,ndata,first,first+len);
+    }
+    else {
+      int slot=rand_r(seed)%(TEST_NROW*TEST_NCOL);
+      mbCutsExtend(cuts,first,first+len,slot/TEST_NCOL,slot%TEST_NCOL);
+      mask_extend(masks[slot],ndata,first,first+len);
+    }
+  }
+}
+/*================================================================================*/
+
+int main(int argc, char *argv[])
+{
+  int ndata=(argc>1 ? atoi(argv[1]) : 20000);
+  int ncut=(argc>2 ? atoi(argv[2]) : 5000);
+  int nbad=0;
+
+  //ranges that are apart before decimating and meet after: [0,1],[3,5] -> [0,1],[1,3].
+  mbCuts *cuts=mbCutsAlloc(1,1);
+  mbCutsExtend(cuts,0,1,0,0);
+  mbCutsExtend(cuts,3,5,0,0);
+  mbCutsExtend(cuts,11,11,0,0);
+  mbCutsDecimate(cuts);
+  mbCutRange ranges[4];
+  int n=mbCutsGetRanges(cuts,0,0,ranges);
+  if ((n!=2)||(ranges[0].indexFirst!=0)||(ranges[0].indexLast!=3)||(ranges[1].indexFirst!=5)||(ranges[1].indexLast!=6)) {
+    fprintf(stderr,"decimating [0,1],[3,5],[11,11] gave %d ranges, expected [0,3],[5,6].\n",n);
+    nbad++;
+  }
+  //and a cut that lands between them afterwards has to leave one range.
+  mbCutsExtend(cuts,4,4,0,0);
+  n=mbCutsGetRanges(cuts,0,0,ranges);
+  if ((n!=1)||(ranges[0].indexFirst!=0)||(ranges[0].indexLast!=6)) {
+    fprintf(stderr,"extending the decimated cuts by [4,4] gave %d ranges, expected [0,6].\n",n);
+    nbad++;
+  }
+  CutsFree(cuts);
+
+  //random cuts, checked against masks through two rounds of decimating and adding more.
+  cuts=mbCutsAlloc(TEST_NROW,TEST_NCOL);
+  char **masks=(char **)malloc(sizeof(char *)*TEST_NROW*TEST_NCOL);
+  for (int i=0;i<TEST_NROW*TEST_NCOL;i++)
+    masks[i]=(char *)calloc(ndata,1);
+  char *global=(char *)calloc(ndata,1);
+  unsigned seed=1;
+  for (int round=0;round<3;round++) {
+    char when[64];
+    add_random_cuts(cuts,masks,global,ndata,ncut,&seed);
+    sprintf(when,"round %d",round);
+    nbad+=check_cuts(cuts,masks,global,ndata,when);
+    mbCutsDecimate(cuts);
+    for (int i=0;i<TEST_NROW*TEST_NCOL;i++)
+      mask_decimate(masks[i],ndata);
+    mask_decimate(global,ndata);
+    sprintf(when,"round %d decimated",round);
+    nbad+=check_cuts(cuts,masks,global,ndata,when);
+  }
+  for (int i=0;i<TEST_NROW*TEST_NCOL;i++)
+    free(masks[i]);
+  free(masks);
+  free(global);
+  CutsFree(cuts);
+
+  printf("%s: %d problems.\n",(nbad ? "FAILED" : "passed"),nbad);
+  return (nbad ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,94 @@
+//Time reading every tesdata channel of a dirfile one at a time vs. in one batch through
+//ACTpolDirfile_read_channels, and check the two agree.  The batch is timed on 1,2,4.. threads
+//up to OMP_NUM_THREADS, so pointing it at a slim-compressed TOD or a zipped one (tod.zip)
+//gives the parallel decompression speedup, and a plain one gives the overhead of batching.
+//Build with something like
+//  gcc -std=gnu99 -fopenmp -I../include test_getdata_speed.c dirfile.c getdata.c -lslim -lzzip -o test_getdata_speed
+//and run as
+//  OMP_NUM_THREADS=8 ./test_getdata_speed /path/to/tod
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "actpol/dirfile.h"
+#include "actpol/getdata.h"
+#include "dirfile_batch.h"
+
+int main(int argc, char *argv[])
+{
+  if (argc<2) {
+    fprintf(stderr,"usage: %s dirfile\n",argv[0]);
+    return EXIT_FAILURE;
+  }
+  ACTpolDirfile *dirfile=ACTpolDirfile_open(argv[1]);
+  if (dirfile==NULL) {
+    fprintf(stderr,"unable to open %s\n",argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  int nmax=33*32;
+  char *namebuf=(char *)malloc(nmax*16);
+  const char **names=(const char **)malloc(nmax*sizeof(char *));
+  int nchan=0;
+  for (int row=0;row<33;row++)
+    for (int col=0;col<32;col++) {
+      char *name=namebuf+16*nchan;
+      sprintf(name,"tesdatar%02dc%02d",row,col);
+      if (ACTpolDirfile_has_channel(dirfile,name))
+	names[nchan++]=name;
+    }
+  printf("found %d tesdata channels.\n",nchan);
+  if (nchan==0)
+    return EXIT_FAILURE;
+
+  float **serial=(float **)malloc(nchan*sizeof(float *));
+  int *nserial=(int *)malloc(nchan*sizeof(int));
+  double t1=omp_get_wtime();
+  for (int i=0;i<nchan;i++)
+    serial[i]=ACTpolDirfile_read_float_channel(dirfile,names[i],&nserial[i]);
+  double t_serial=omp_get_wtime()-t1;
+
+  size_t nbyte=0;
+  for (int i=0;i<nchan;i++)
+    nbyte+=nserial[i]*sizeof(float);
+  printf("serial read took %8.3f seconds (%.3f GB/s)\n",t_serial,nbyte/1e9/t_serial);
+
+  float **batch=(float **)malloc(nchan*sizeof(float *));
+  int *nbatch=(int *)malloc(nchan*sizeof(int));
+  int nthread_max=omp_get_max_threads();
+  int nmismatch=0;
+  for (int nthread=1;;nthread*=2) {
+    if (nthread>nthread_max)
+      nthread=nthread_max;
+    omp_set_num_threads(nthread);
+    t1=omp_get_wtime();
+    int nbad=ACTpolDirfile_read_channels('f',dirfile,names,nchan,(void **)batch,nbatch);
+    double t_batch=omp_get_wtime()-t1;
+
+    int nwrong=0;
+    for (int i=0;i<nchan;i++) {
+      if ((nserial[i]!=nbatch[i])||(batch[i]==NULL)||(memcmp(serial[i],batch[i],nserial[i]*sizeof(float))!=0))
+	nwrong++;
+      free(batch[i]);
+    }
+    printf("batched read on %2d threads took %8.3f seconds (%.3f GB/s), speedup %.2f, %d channels failed, %d disagreed with the serial read.\n",
+	   nthread,t_batch,nbyte/1e9/t_batch,t_serial/t_batch,nbad,nwrong);
+    nmismatch+=nwrong;
+    if (nthread==nthread_max)
+      break;
+  }
+  for (int i=0;i<nchan;i++)
+    free(serial[i]);
+
+  ACTpolDirfile_close(dirfile);
+  free(serial);
+  free(nserial);
+  free(batch);
+  free(nbatch);
+  free(names);
+  free(namebuf);
+  return (nmismatch==0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
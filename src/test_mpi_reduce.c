@@ -0,0 +1,104 @@
+//Check the sparse map reduction (mpi_reduce_map) against a plain MPI_Allreduce over the whole
+//map (mpi_reduce_map_dense), and time both.  Each process fills its own patch of a big map,
+//like TODs that only see part of a wide survey.  Build it against the ninkasi library with
+//something like
+//  mpicc -std=gnu99 -fopenmp -I../include test_mpi_reduce.c -L. -lninkasi ... -o test_mpi_reduce
+//and run as
+//  mpirun -np 4 ./test_mpi_reduce [npix] [patch fraction] [nrep]
+
+#ifndef MAKEFILE_HAND
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <omp.h>
+
+#include "ninkasi.h"
+
+int mpi_reduce_map(MAP *map);
+int mpi_reduce_map_dense(MAP *map);
+int mpi_reduce_mapset(MAPvec *maps);
+
+static void fill_patch(MAP *map, int myid, int nproc, double frac)
+//each process gets a patch of frac*npix pixels, spread evenly along the map so neighbours
+//overlap a bit, with a few stray hits elsewhere.
+{
+  memset(map->map,0,sizeof(actData)*map->npix);
+  long len=frac*map->npix;
+  long start=(long)((map->npix-len)*(double)myid/(nproc>1 ? nproc-1 : 1));
+  for (long i=0;i<len;i++)
+    map->map[start+i]=sin(0.001*(start+i))+myid;
+  srand(myid+1);
+  for (int i=0;i<10;i++)
+    map->map[((long)rand()*7919)%map->npix]+=1.0;
+}
+
+int main(int argc, char *argv[])
+{
+  MPI_Init(&argc,&argv);
+  int myid,nproc;
+  MPI_Comm_rank(MPI_COMM_WORLD,&myid);
+  MPI_Comm_size(MPI_COMM_WORLD,&nproc);
+
+  long npix=(argc>1 ? atol(argv[1]) : 20000000);
+  double frac=(argc>2 ? atof(argv[2]) : 0.05);
+  int nrep=(argc>3 ? atoi(argv[3]) : 5);
+
+  MAP *sparse=(MAP *)calloc(1,sizeof(MAP));
+  MAP *dense=(MAP *)calloc(1,sizeof(MAP));
+  sparse->npix=dense->npix=npix;
+#ifdef ACTPOL
+  sparse->pol_state[0]=dense->pol_state[0]=1;
+#endif
+  sparse->map=vector(npix);
+  dense->map=vector(npix);
+
+  double t_sparse=0,t_dense=0;
+  for (int rep=0;rep<nrep;rep++) {
+    fill_patch(sparse,myid,nproc,frac);
+    fill_patch(dense,myid,nproc,frac);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t1=MPI_Wtime();
+    mpi_reduce_map_dense(dense);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double t2=MPI_Wtime();
+    mpi_reduce_map(sparse);
+    MPI_Barrier(MPI_COMM_WORLD);
+    t_sparse+=MPI_Wtime()-t2;
+    t_dense+=t2-t1;
+  }
+
+  double maxerr=0,maxval=0;
+  for (long i=0;i<npix;i++) {
+    if (fabs(sparse->map[i]-dense->map[i])>maxerr)
+      maxerr=fabs(sparse->map[i]-dense->map[i]);
+    if (fabs(dense->map[i])>maxval)
+      maxval=fabs(dense->map[i]);
+  }
+  double global_err;
+  MPI_Allreduce(&maxerr,&global_err,1,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+
+  MAPvec maps;
+  maps.nmap=1;
+  maps.maps=&sparse;
+  mpi_reduce_mapset(&maps);  //prints tile use and bytes moved for one more pass
+
+  if (myid==0) {
+    printf("%d processes, %ld pixels, patch fraction %.3f\n",nproc,npix,frac);
+    printf("dense allreduce  %8.4f seconds per map\n",t_dense/nrep);
+    printf("sparse reduction %8.4f seconds per map, speedup %.2f\n",t_sparse/nrep,t_dense/t_sparse);
+    printf("max difference %12.4e on values up to %12.4e\n",global_err,maxval);
+  }
+  int bad=(global_err>1e-5*(maxval+1));
+  free(sparse->map);
+  free(dense->map);
+  free(sparse);
+  free(dense);
+  MPI_Finalize();
+  return (bad ? EXIT_FAILURE : EXIT_SUCCESS);
+}
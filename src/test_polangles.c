@@ -0,0 +1,45 @@
+//Check the Q15 packing of the polarization angle cache: values in [-1,1] have to come back to
+//within half a step, and values a little past +-1, which the separate sin/cos polynomial fits on
+//the actpol_pointing path do produce, have to clamp instead of wrapping around to the other sign.
+//Build it against the ninkasi library with something like
+//  mpicc -std=gnu99 -fopenmp -DACTPOL -I../include test_polangles.c -L. -lninkasi ... -o test_polangles
+//and run as
+//  ./test_polangles
+
+#ifndef MAKEFILE_HAND
+#include "config.h"
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ninkasi.h"
+
+/*--------------------------------------------------------------------------------*/
+static int check_q15(actData x)
+//returns 1 if x doesn't survive the trip through Q15.
+{
+  short q=polangle_to_q15(x);
+  actData back=q/NK_POLANGLE_SCALE;
+  actData want=(x>1 ? 1 : (x<-1 ? -1 : x));
+  if (fabs(back-want)>0.5/NK_POLANGLE_SCALE+1e-7) {
+    fprintf(stderr,"%.7f went to Q15 as %d, which reads back as %.7f.\n",(double)x,q,(double)back);
+    return 1;
+  }
+  return 0;
+}
+/*================================================================================*/
+
+int main(int argc, char *argv[])
+{
+  int nbad=0;
+  actData edges[]={1.0005,-1.0005,1.00002,-1.00002,1.0,-1.0,0.99999,-0.99999,0.0,1.5,-2.0};
+  for (int i=0;i<(int)(sizeof(edges)/sizeof(edges[0]));i++)
+    nbad+=check_q15(edges[i]);
+  for (int i=-100000;i<=100000;i++)
+    nbad+=check_q15(i*1.0003e-5);
+
+  printf("%s: %d problems.\n",(nbad ? "FAILED" : "passed"),nbad);
+  return (nbad ? EXIT_FAILURE : EXIT_SUCCESS);
+}